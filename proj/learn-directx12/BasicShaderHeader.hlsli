@@ -35,3 +35,13 @@ cbuffer Material : register(b1)
     float4 specular; // スペキュラ
     float3 ambient; // アンビエント
 };
+
+// octahedral 表現 (R16G16_SNORM) の法線を単位ベクトルに戻す
+// 圧縮した頂点レイアウト (vertex_compression.h) で使う
+float3 OctDecode(float2 e)
+{
+    float3 n = float3(e, 1 - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += (n.xy >= 0) ? -t : t;
+    return normalize(n);
+}
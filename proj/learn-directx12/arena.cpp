@@ -0,0 +1,58 @@
+#include "arena.h"
+
+#include <algorithm>
+
+Arena::Arena(std::size_t block_size, std::pmr::memory_resource* upstream)
+    : block_size_(std::max<std::size_t>(block_size, 256)), upstream_(upstream) {}
+
+Arena::~Arena() { Release(); }
+
+void Arena::Reset() {
+  current_ = 0;
+  offset_ = 0;
+  stats_.allocations = 0;
+  stats_.used_bytes = 0;
+  ++stats_.resets;
+}
+
+void Arena::Release() {
+  for (const Block& block : blocks_) {
+    upstream_->deallocate(block.data, block.size, alignof(std::max_align_t));
+  }
+  blocks_.clear();
+  stats_.reserved_bytes = 0;
+  Reset();
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  // 今のブロック, 無ければ Reset() 前に使っていた後ろのブロックから順に入るところを探す
+  for (; current_ < blocks_.size(); ++current_, offset_ = 0) {
+    const Block& block = blocks_[current_];
+    const uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+    const std::size_t aligned = ((base + offset_ + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+    if (aligned <= block.size && block.size - aligned >= bytes) {
+      stats_.used_bytes += aligned + bytes - offset_;
+      offset_ = aligned + bytes;
+      ++stats_.allocations;
+      stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.used_bytes);
+      return block.data + aligned;
+    }
+    stats_.used_bytes += block.size - offset_;  // 入らなかった残りは使ったものとして数える
+  }
+
+  // 新しいブロックを足す (今より後ろのブロックには入らなかったので末尾に置く)
+  const std::size_t size = std::max(block_size_, bytes + alignment);
+  Block block = {static_cast<std::byte*>(upstream_->allocate(size, alignof(std::max_align_t))), size};
+  blocks_.push_back(block);
+  ++stats_.block_allocations;
+  stats_.reserved_bytes += size;
+  current_ = blocks_.size() - 1;
+  offset_ = 0;
+  return do_allocate(bytes, alignment);
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t) {
+  // 個別には解放しない (Reset() でまとめて解放する)
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept { return this == &other; }
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+/**
+ * @brief 確保するだけで個別には解放しないアロケーター (モノトニックアリーナ)
+ * @details 大きなブロックを上流 (既定は new / delete) から取り, その中を前から切り出して返す.
+ *          個々の deallocate は何もせず, Reset() でまとめて解放したことにする. ブロックは Reset() 後も残して使い回すので,
+ *          同じくらいの量を確保しては捨てる処理 (モデルの読み込みなど) を繰り返してもヒープには触れない.
+ *          std::pmr::memory_resource なので std::pmr::vector などにそのまま渡せる. スレッドセーフではない.
+ *
+ *   Arena arena;
+ *   std::pmr::vector<uint32_t> indices(&arena);
+ *   ...
+ *   arena.Reset();  // indices などアリーナから取ったものを全て使い終わってから呼ぶ
+ */
+class Arena : public std::pmr::memory_resource {
+ public:
+  struct Stats {
+    uint64_t allocations = 0;        // Reset() してから切り出した回数
+    uint64_t block_allocations = 0;  // 上流からブロックを確保した回数 (作ってから)
+    uint64_t resets = 0;
+    std::size_t used_bytes = 0;      // Reset() してから切り出したバイト数 (アライメントの詰め物を含む)
+    std::size_t peak_bytes = 0;      // used_bytes の最大値 (作ってから)
+    std::size_t reserved_bytes = 0;  // 持っているブロックの合計
+  };
+
+  /**
+   * @param block_size ブロックの大きさ. これより大きい要求にはその大きさのブロックを取る
+   * @param upstream ブロックの確保先
+   */
+  explicit Arena(std::size_t block_size = std::size_t(64) << 10,
+                 std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+  ~Arena() override;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  /**
+   * @brief 切り出したものを全て解放したことにする. ブロックは返さずに次の確保で使う
+   */
+  void Reset();
+
+  /**
+   * @brief ブロックを上流に返す (Reset() もする)
+   */
+  void Release();
+
+  const Stats& GetStats() const { return stats_; }
+
+ protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+ private:
+  struct Block {
+    std::byte* data;
+    std::size_t size;
+  };
+
+  std::size_t block_size_;
+  std::pmr::memory_resource* upstream_;
+  std::vector<Block> blocks_;
+  std::size_t current_ = 0;  // 切り出し中のブロック
+  std::size_t offset_ = 0;   // blocks_[current_] の使用済みバイト数
+  Stats stats_;
+};
@@ -0,0 +1,287 @@
+#include "baked_model.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <system_error>
+
+#include "material.h"
+#include "mesh_optimizer.h"
+#include "model_loader.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::size_t AlignSection(std::size_t offset) {
+  return (offset + kBakedSectionAlignment - 1) / kBakedSectionAlignment * kBakedSectionAlignment;
+}
+
+/**
+ * @brief 変換元ファイルのサイズと更新時刻 (ベイク済みファイルが古くなったかの判定に使う)
+ */
+bool GetSourceStamp(const fs::path& path, uint64_t* size, int64_t* write_time) {
+  std::error_code ec;
+  const auto file_size = fs::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  const auto time = fs::last_write_time(path, ec);
+  if (ec) {
+    return false;
+  }
+  *size = static_cast<uint64_t>(file_size);
+  *write_time = static_cast<int64_t>(time.time_since_epoch().count());
+  return true;
+}
+
+}  // namespace
+
+fs::path BakedModelPath(const fs::path& pmd_path) {
+  fs::path path = pmd_path;
+  path.replace_extension(kBakedModelExtension);
+  return path;
+}
+
+///////////////
+// BakeModel //
+///////////////
+
+bool BakeModel(const PmdFile& pmd, const fs::path& model_filepath, const BakeOptions& options,
+               std::vector<uint8_t>* out, std::string* error) {
+  auto vertices = pmd.Vertices();
+  auto indices = pmd.Indices();
+  auto materials = pmd.Materials();
+  auto bones = pmd.Bones();
+
+  BakedModelHeader header = {};
+  std::memcpy(header.magic, kBakedModelMagic, sizeof(header.magic));
+  header.version = kBakedModelVersion;
+  header.header_size = sizeof(BakedModelHeader);
+  header.vertex_stride = sizeof(PmdVertex);
+  header.vertex_count = static_cast<uint32_t>(vertices.size());
+  header.index_count = static_cast<uint32_t>(indices.size());
+  header.material_count = static_cast<uint32_t>(materials.size());
+  header.material_constant_stride = static_cast<uint32_t>(kMaterialConstantStride);
+  header.bone_count = static_cast<uint32_t>(bones.size());
+  if (!GetSourceStamp(model_filepath, &header.source_size, &header.source_write_time)) {
+    *error = model_filepath.u8string() + ": cannot stat source file";
+    return false;
+  }
+
+  // テクスチャパスは実行時に分割・文字コード変換しなくて済むよう, 解決済みの UTF-8 相対パスで持つ
+  const fs::path model_dir = model_filepath.parent_path();
+  std::string strings;
+  std::map<std::string, uint32_t> string_offsets;  // toon などの同じ名前は 1 回だけ格納する
+  auto intern = [&](const fs::path& path) -> uint32_t {
+    if (path.empty()) {
+      return kBakedNoString;
+    }
+    const std::string name = path.lexically_relative(model_dir).u8string();
+    auto it = string_offsets.find(name);
+    if (it != string_offsets.end()) {
+      return it->second;
+    }
+    const uint32_t offset = static_cast<uint32_t>(strings.size());
+    strings.append(name);
+    strings.push_back('\0');
+    string_offsets.emplace(name, offset);
+    return offset;
+  };
+
+  std::vector<BakedMaterial> baked_materials(materials.size());
+  uint64_t index_offset = 0;
+  for (std::size_t i = 0; i < materials.size(); ++i) {
+    auto& m = baked_materials[i];
+    m.index_offset = static_cast<uint32_t>(index_offset);
+    m.index_count = materials[i].indicesNum;
+    index_offset += m.index_count;
+    if (index_offset > indices.size()) {
+      *error = "material " + std::to_string(i) + " refers beyond the index buffer";
+      return false;
+    }
+    auto paths = ResolveMaterialTexturePaths(model_filepath, materials[i]);
+    m.texture_names[kBakedTextureTex] = intern(paths.tex);
+    m.texture_names[kBakedTextureSph] = intern(paths.sph);
+    m.texture_names[kBakedTextureSpa] = intern(paths.spa);
+    m.texture_names[kBakedTextureToon] = intern(paths.toon);
+  }
+  const std::vector<uint8_t> constants = PackMaterialConstants(materials);
+
+  // 三角形の並べ替えはマテリアルの範囲内で行うので, 上で求めた範囲はそのまま使える
+  OptimizedMesh optimized;
+  if (options.optimize_mesh) {
+    std::vector<uint32_t> index_counts(baked_materials.size());
+    for (std::size_t i = 0; i < baked_materials.size(); ++i) {
+      index_counts[i] = baked_materials[i].index_count;
+    }
+    optimized = OptimizeMesh(vertices, indices, index_counts);
+    vertices = PmdSpan<PmdVertex>(optimized.vertices.data(), optimized.vertices.size());
+    indices = PmdSpan<uint16_t>(optimized.indices.data(), optimized.indices.size());
+    header.flags |= kBakedFlagOptimizedMesh;
+  }
+
+  // セクションの配置 (どれも 256 の倍数から始める)
+  std::size_t offset = sizeof(BakedModelHeader);
+  auto place = [&offset](BakedSection& section, std::size_t size) {
+    offset = AlignSection(offset);
+    section.offset = offset;
+    section.size = size;
+    offset += size;
+  };
+  place(header.vertices, vertices.size_bytes());
+  place(header.indices, indices.size_bytes());
+  place(header.material_constants, constants.size());
+  place(header.materials, baked_materials.size() * sizeof(BakedMaterial));
+  place(header.bones, bones.size_bytes());
+  place(header.strings, strings.size());
+
+  out->assign(offset, 0);
+  std::memcpy(out->data(), &header, sizeof(header));
+  auto copy = [out](const BakedSection& section, const void* src) {
+    if (section.size != 0) {
+      std::memcpy(out->data() + section.offset, src, section.size);
+    }
+  };
+  copy(header.vertices, vertices.data());
+  copy(header.indices, indices.data());
+  copy(header.material_constants, constants.data());
+  copy(header.materials, baked_materials.data());
+  copy(header.bones, bones.data());
+  copy(header.strings, strings.data());
+  return true;
+}
+
+bool WriteBakedModel(const fs::path& path, const std::vector<uint8_t>& data, std::string* error) {
+  fs::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!ofs) {
+      *error = tmp_path.u8string() + ": write failed";
+      return false;
+    }
+  }
+  std::error_code ec;
+  fs::rename(tmp_path, path, ec);
+  if (ec) {
+    fs::remove(tmp_path, ec);
+    *error = path.u8string() + ": " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+////////////////
+// BakedModel //
+////////////////
+
+bool BakedModel::Open(const fs::path& path) {
+  path_ = path;
+  if (!file_.Open(path)) {
+    error_ = file_.Error();
+    return false;
+  }
+  return Parse(file_.data(), file_.size());
+}
+
+bool BakedModel::Parse(const void* data, std::size_t size) {
+  header_ = nullptr;
+  vertices_ = {};
+  indices_ = {};
+  material_constants_ = {};
+  materials_ = {};
+  bones_ = {};
+  strings_ = {};
+  error_.clear();
+
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  if (bytes == nullptr || size < sizeof(BakedModelHeader)) {
+    error_ = "Baked model is truncated in header";
+    return false;
+  }
+  if (reinterpret_cast<std::uintptr_t>(bytes) % alignof(BakedModelHeader) != 0) {
+    error_ = "Baked model data is not aligned";
+    return false;
+  }
+  const auto* header = reinterpret_cast<const BakedModelHeader*>(bytes);
+  if (std::memcmp(header->magic, kBakedModelMagic, sizeof(header->magic)) != 0) {
+    error_ = "Not a baked model (bad magic)";
+    return false;
+  }
+  if (header->version != kBakedModelVersion || header->header_size != sizeof(BakedModelHeader)) {
+    error_ = "Unsupported baked model version " + std::to_string(header->version);
+    return false;
+  }
+  if (header->vertex_stride != sizeof(PmdVertex) || header->material_constant_stride != kMaterialConstantStride) {
+    error_ = "Baked model layout does not match this build";
+    return false;
+  }
+
+  // 各セクションがファイル内に収まり, 要素数と大きさが一致することだけを確かめる
+  auto section = [&](const BakedSection& s, uint64_t expected_size, const char* name) {
+    if (s.offset % kBakedSectionAlignment != 0 || s.offset > size || s.size > size - s.offset ||
+        s.size != expected_size) {
+      error_ = std::string("Baked model has a broken ") + name + " section";
+      return false;
+    }
+    return true;
+  };
+  if (!section(header->vertices, uint64_t(header->vertex_count) * sizeof(PmdVertex), "vertex") ||
+      !section(header->indices, uint64_t(header->index_count) * sizeof(uint16_t), "index") ||
+      !section(header->material_constants, uint64_t(header->material_count) * kMaterialConstantStride,
+               "material constant") ||
+      !section(header->materials, uint64_t(header->material_count) * sizeof(BakedMaterial), "material") ||
+      !section(header->bones, uint64_t(header->bone_count) * sizeof(PmdBone), "bone") ||
+      !section(header->strings, header->strings.size, "string")) {
+    return false;
+  }
+
+  PmdSpan<char> strings(reinterpret_cast<const char*>(bytes + header->strings.offset), header->strings.size);
+  if (!strings.empty() && strings[strings.size() - 1] != '\0') {
+    error_ = "Baked model string table is not terminated";
+    return false;
+  }
+  PmdSpan<BakedMaterial> materials(reinterpret_cast<const BakedMaterial*>(bytes + header->materials.offset),
+                                   header->material_count);
+  for (auto& m : materials) {
+    if (uint64_t(m.index_offset) + m.index_count > header->index_count) {
+      error_ = "Baked model material refers beyond the index buffer";
+      return false;
+    }
+    for (auto name : m.texture_names) {
+      if (name != kBakedNoString && name >= strings.size()) {
+        error_ = "Baked model material refers beyond the string table";
+        return false;
+      }
+    }
+  }
+
+  header_ = header;
+  vertices_ = PmdSpan<PmdVertex>(reinterpret_cast<const PmdVertex*>(bytes + header->vertices.offset),
+                                 header->vertex_count);
+  indices_ = PmdSpan<uint16_t>(reinterpret_cast<const uint16_t*>(bytes + header->indices.offset), header->index_count);
+  material_constants_ = PmdSpan<uint8_t>(bytes + header->material_constants.offset, header->material_constants.size);
+  materials_ = materials;
+  bones_ = PmdSpan<PmdBone>(reinterpret_cast<const PmdBone*>(bytes + header->bones.offset), header->bone_count);
+  strings_ = strings;
+  return true;
+}
+
+bool BakedModel::IsUpToDate(const fs::path& source_path) const {
+  uint64_t size = 0;
+  int64_t write_time = 0;
+  if (header_ == nullptr || !GetSourceStamp(source_path, &size, &write_time)) {
+    return false;
+  }
+  return size == header_->source_size && write_time == header_->source_write_time;
+}
+
+fs::path BakedModel::TexturePath(std::size_t material_index, BakedTextureSlot slot) const {
+  const uint32_t name = materials_.at(material_index).texture_names[slot];
+  if (name == kBakedNoString) {
+    return {};
+  }
+  return path_.parent_path() / fs::u8path(strings_.data() + name);
+}
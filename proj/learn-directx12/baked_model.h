@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "pmd_file.h"
+
+/////////////////////////////
+// Baked model file format //
+/////////////////////////////
+
+// PMD をオフラインで変換した "ベイク済み" モデル (.pmdb)
+// 起動時はファイルをマップしてヘッダーと範囲を検証するだけで, 要素ごとのパースは行わない.
+//
+//  offset 0   : BakedModelHeader
+//  256 の倍数 : 頂点       (PmdVertex と同じ 38 bytes/頂点. 入力レイアウトそのまま)
+//  256 の倍数 : インデックス (uint16_t)
+//  256 の倍数 : マテリアル定数 (kMaterialConstantStride ごとの MaterialForHlsl. 定数バッファにそのままコピーできる)
+//  256 の倍数 : BakedMaterial
+//  256 の倍数 : ボーン (PmdBone と同じ 39 bytes/ボーン)
+//  256 の倍数 : 文字列テーブル (UTF-8, '\0' 終端. モデルのディレクトリからの相対パス)
+//
+// 数値はすべてリトルエンディアン.
+
+constexpr char kBakedModelMagic[4] = {'P', 'M', 'D', 'B'};
+constexpr uint32_t kBakedModelVersion = 2;
+constexpr std::size_t kBakedSectionAlignment = 256;
+constexpr uint32_t kBakedNoString = 0xffffffff;  // 文字列テーブルに該当なし
+constexpr const char* kBakedModelExtension = ".pmdb";
+constexpr uint32_t kBakedFlagOptimizedMesh = 1 << 0;  // 頂点とインデックスを OptimizeMesh で並べ替え済み
+
+struct BakedSection {
+  uint64_t offset;  // ファイル先頭からのバイト数
+  uint64_t size;    // バイト数
+};
+
+struct BakedModelHeader {
+  char magic[4];                      // "PMDB"
+  uint32_t version;                   // kBakedModelVersion
+  uint32_t header_size;               // sizeof(BakedModelHeader)
+  uint32_t vertex_stride;             // sizeof(PmdVertex)
+  uint32_t vertex_count;              //
+  uint32_t index_count;               //
+  uint32_t material_count;            //
+  uint32_t material_constant_stride;  // kMaterialConstantStride
+  uint32_t bone_count;                //
+  uint32_t flags;                     // kBakedFlag* の組み合わせ
+  uint64_t source_size;               // 変換元 PMD のファイルサイズ (更新検出用)
+  int64_t source_write_time;          // 変換元 PMD の更新時刻 (file_time_type の tick 数)
+  BakedSection vertices;
+  BakedSection indices;
+  BakedSection material_constants;
+  BakedSection materials;
+  BakedSection bones;
+  BakedSection strings;
+};
+
+/**
+ * @brief マテリアルが参照するテクスチャの種類 (BakedMaterial::texture_names の添字)
+ */
+enum BakedTextureSlot : uint32_t {
+  kBakedTextureTex = 0,   // register(t0)
+  kBakedTextureSph = 1,   // register(t1)
+  kBakedTextureSpa = 2,   // register(t2)
+  kBakedTextureToon = 3,  // register(t3)
+  kBakedTextureSlotCount = 4,
+};
+
+/**
+ * @brief 描画とテクスチャ読み込みに必要なマテリアル情報 (解決済み)
+ */
+struct BakedMaterial {
+  uint32_t index_offset;                           // インデックス列の先頭位置
+  uint32_t index_count;                            // インデックス数
+  uint32_t texture_names[kBakedTextureSlotCount];  // 文字列テーブルのオフセット (kBakedNoString: なし)
+};
+
+static_assert(sizeof(BakedModelHeader) == 152, "baked model header must be 152 bytes");
+static_assert(sizeof(BakedMaterial) == 24, "baked material must be 24 bytes");
+
+/**
+ * @brief PMD に対応するベイク済みファイルのパス (拡張子を .pmdb にしたもの)
+ */
+std::filesystem::path BakedModelPath(const std::filesystem::path& pmd_path);
+
+/**
+ * @brief ベイク時の変換オプション
+ */
+struct BakeOptions {
+  bool optimize_mesh = false;  // 頂点キャッシュ・オーバードロー・頂点フェッチの最適化 (mesh_optimizer.h)
+};
+
+/**
+ * @brief パース済みの PMD をベイク済みフォーマットのバイト列に変換する
+ * @param pmd 変換元
+ * @param model_filepath 変換元のパス. テクスチャパスの解決と更新検出に使う
+ * @param options 変換オプション
+ * @param out 出力先
+ * @param error 失敗した場合の理由
+ * @return 失敗したら false
+ */
+bool BakeModel(const PmdFile& pmd, const std::filesystem::path& model_filepath, const BakeOptions& options,
+               std::vector<uint8_t>* out, std::string* error);
+
+/**
+ * @brief ベイク済みのバイト列をファイルに書き出す
+ * @details 一時ファイルに書いてから置き換えるので, 途中で失敗しても壊れたファイルは残らない.
+ */
+bool WriteBakedModel(const std::filesystem::path& path, const std::vector<uint8_t>& data, std::string* error);
+
+/**
+ * @brief ベイク済みモデルのリーダー
+ * @details ファイルをマップし, ヘッダーと各セクションの範囲を検証するだけで読み込みを終える.
+ *          返したビューは BakedModel が生きている間だけ有効.
+ *
+ *   BakedModel baked;
+ *   if (!baked.Open(path) || !baked.IsUpToDate(pmd_path)) { ... PMD から読む ... }
+ */
+class BakedModel {
+ public:
+  BakedModel() = default;
+  BakedModel(const BakedModel&) = delete;
+  BakedModel& operator=(const BakedModel&) = delete;
+  BakedModel(BakedModel&&) noexcept = default;
+  BakedModel& operator=(BakedModel&&) noexcept = default;
+
+  /**
+   * @brief ファイルをマップして検証する
+   * @return 失敗したら false. 理由は Error() で取得できる
+   */
+  bool Open(const std::filesystem::path& path);
+
+  /**
+   * @brief メモリ上のデータを検証する (データは呼び出し側が保持し続けること)
+   */
+  bool Parse(const void* data, std::size_t size);
+
+  /**
+   * @brief 変換元の PMD が変換後に更新されていないか
+   */
+  bool IsUpToDate(const std::filesystem::path& source_path) const;
+
+  bool IsOpen() const { return header_ != nullptr; }
+  const BakedModelHeader& Header() const { return *header_; }
+  PmdSpan<PmdVertex> Vertices() const { return vertices_; }
+  PmdSpan<uint16_t> Indices() const { return indices_; }
+  PmdSpan<uint8_t> MaterialConstants() const { return material_constants_; }
+  PmdSpan<BakedMaterial> Materials() const { return materials_; }
+  PmdSpan<PmdBone> Bones() const { return bones_; }
+
+  /**
+   * @brief マテリアルのテクスチャのパス (無ければ空)
+   * @details 文字列テーブルの相対パスを Open() したファイルのディレクトリと結合する.
+   */
+  std::filesystem::path TexturePath(std::size_t material_index, BakedTextureSlot slot) const;
+
+  const std::filesystem::path& Path() const { return path_; }
+  const std::string& Error() const { return error_; }
+
+ private:
+  MappedFile file_;
+  std::filesystem::path path_;
+  const BakedModelHeader* header_ = nullptr;
+  PmdSpan<PmdVertex> vertices_;
+  PmdSpan<uint16_t> indices_;
+  PmdSpan<uint8_t> material_constants_;
+  PmdSpan<BakedMaterial> materials_;
+  PmdSpan<PmdBone> bones_;
+  PmdSpan<char> strings_;
+  std::string error_;
+};
@@ -0,0 +1,792 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BC_ENCODER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// これより小さい画像はスレッドに分けても得にならない
+constexpr std::size_t kParallelMinBlocks = 16 * 16;
+constexpr std::size_t kBlockRowsPerTask = 2;
+
+constexpr uint16_t kAllPixels = 0xFFFF;
+constexpr float kRgbWeights[4] = {1.0f, 1.0f, 1.0f, 0.0f};
+constexpr float kRgbaWeights[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+constexpr float kAlphaWeights[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+// BC7 の 4 bit インデックスの補間の重み (/64)
+constexpr int kBc7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+/**
+ * @brief 4x4 ブロックの画素 (チャンネルごとに並べる. SIMD で 4 画素ずつ読む)
+ */
+struct Block {
+  alignas(16) float channels[4][16];
+};
+
+Block LoadBlock(const uint8_t rgba[64]) {
+  Block block;
+  for (int i = 0; i < 16; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      block.channels[c][i] = rgba[i * 4 + c];
+    }
+  }
+  return block;
+}
+
+/**
+ * @brief mask の各画素に最も近いパレットの色を選ぶ
+ * @details 距離が同じなら小さいインデックスを選ぶ (SIMD でもスカラーでも同じ結果になる).
+ * @param weights チャンネルごとの誤差の重み (0 のチャンネルは見ない)
+ * @param mask 対象の画素 (ビット i が画素 i). 対象外の画素の indices は変えず, 誤差にも数えない
+ * @return 重み付き二乗誤差の合計
+ */
+float SelectIndices(const Block& block, const float (*palette)[4], int palette_size, const float weights[4],
+                    uint16_t mask, uint8_t indices[16], bool use_simd) {
+  alignas(16) float best_error[16];
+  alignas(16) int32_t best_index[16];
+  int c_begin = 0;
+  int c_end = 4;
+  while (c_begin < c_end && weights[c_begin] == 0.0f) {
+    ++c_begin;
+  }
+  while (c_end > c_begin && weights[c_end - 1] == 0.0f) {
+    --c_end;
+  }
+#ifdef BC_ENCODER_USE_SSE
+  if (use_simd) {
+    for (int group = 0; group < 4; ++group) {
+      __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+      __m128i best_i = _mm_setzero_si128();
+      for (int p = 0; p < palette_size; ++p) {
+        __m128 d = _mm_setzero_ps();
+        for (int c = c_begin; c < c_end; ++c) {
+          const __m128 diff = _mm_sub_ps(_mm_load_ps(&block.channels[c][group * 4]), _mm_set1_ps(palette[p][c]));
+          d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(weights[c]), _mm_mul_ps(diff, diff)));
+        }
+        const __m128i less = _mm_castps_si128(_mm_cmplt_ps(d, best));
+        best = _mm_min_ps(d, best);
+        best_i = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(p)), _mm_andnot_si128(less, best_i));
+      }
+      _mm_store_ps(best_error + group * 4, best);
+      _mm_store_si128(reinterpret_cast<__m128i*>(best_index + group * 4), best_i);
+    }
+  } else
+#endif
+  {
+    for (int i = 0; i < 16; ++i) {
+      best_error[i] = std::numeric_limits<float>::max();
+      best_index[i] = 0;
+      for (int p = 0; p < palette_size; ++p) {
+        float d = 0.0f;
+        for (int c = c_begin; c < c_end; ++c) {
+          const float diff = block.channels[c][i] - palette[p][c];
+          d = d + weights[c] * (diff * diff);
+        }
+        if (d < best_error[i]) {
+          best_error[i] = d;
+          best_index[i] = p;
+        }
+      }
+    }
+  }
+  float total = 0.0f;
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      indices[i] = static_cast<uint8_t>(best_index[i]);
+      total += best_error[i];
+    }
+  }
+  return total;
+}
+
+/**
+ * @brief mask の画素の平均と主成分の軸 (長さ 1. ばらつきが無ければ 0) を求める
+ */
+void PrincipalAxis(const Block& block, int channel_count, uint16_t mask, float mean[4], float axis[4]) {
+  int count = 0;
+  std::fill(mean, mean + 4, 0.0f);
+  std::fill(axis, axis + 4, 0.0f);
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      for (int c = 0; c < channel_count; ++c) {
+        mean[c] += block.channels[c][i];
+      }
+      ++count;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  for (int c = 0; c < channel_count; ++c) {
+    mean[c] /= count;
+  }
+  float covariance[4][4] = {};
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      for (int a = 0; a < channel_count; ++a) {
+        for (int b = 0; b < channel_count; ++b) {
+          covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+        }
+      }
+    }
+  }
+  // べき乗法. 分散の最も大きいチャンネルの列から始める
+  int start = 0;
+  for (int c = 1; c < channel_count; ++c) {
+    if (covariance[c][c] > covariance[start][start]) {
+      start = c;
+    }
+  }
+  if (covariance[start][start] <= 0.0f) {
+    return;
+  }
+  float v[4] = {};
+  for (int c = 0; c < channel_count; ++c) {
+    v[c] = covariance[c][start];
+  }
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[4] = {};
+    float length = 0.0f;
+    for (int a = 0; a < channel_count; ++a) {
+      for (int b = 0; b < channel_count; ++b) {
+        next[a] += covariance[a][b] * v[b];
+      }
+      length = std::max(length, std::abs(next[a]));
+    }
+    if (length <= 0.0f) {
+      return;
+    }
+    for (int c = 0; c < channel_count; ++c) {
+      v[c] = next[c] / length;
+    }
+  }
+  float length = 0.0f;
+  for (int c = 0; c < channel_count; ++c) {
+    length += v[c] * v[c];
+  }
+  length = std::sqrt(length);
+  for (int c = 0; c < channel_count; ++c) {
+    axis[c] = v[c] / length;
+  }
+}
+
+/**
+ * @brief mask の画素を主成分の軸に射影した両端 (e0 が軸の正の側)
+ */
+void AxisEndpoints(const Block& block, int channel_count, uint16_t mask, float e0[4], float e1[4]) {
+  float mean[4];
+  float axis[4];
+  PrincipalAxis(block, channel_count, mask, mean, axis);
+  float min_t = 0.0f;
+  float max_t = 0.0f;
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      float t = 0.0f;
+      for (int c = 0; c < channel_count; ++c) {
+        t += (block.channels[c][i] - mean[c]) * axis[c];
+      }
+      min_t = std::min(min_t, t);
+      max_t = std::max(max_t, t);
+    }
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = std::clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+    e1[c] = std::clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+  }
+}
+
+/**
+ * @brief インデックスを固定して, 2 つの端点を最小二乗法で求め直す
+ * @param weights インデックスごとの e1 側への補間の割合
+ * @return 解けなければ (全画素が同じ重みなど) false
+ */
+bool RefineEndpoints(const Block& block, int channel_count, uint16_t mask, const uint8_t indices[16],
+                     const float* weights, float e0[4], float e1[4]) {
+  float aa = 0.0f;
+  float ab = 0.0f;
+  float bb = 0.0f;
+  float ax[4] = {};
+  float bx[4] = {};
+  for (int i = 0; i < 16; ++i) {
+    if (mask & (1u << i)) {
+      const float t = weights[indices[i]];
+      const float s = 1.0f - t;
+      aa += s * s;
+      ab += s * t;
+      bb += t * t;
+      for (int c = 0; c < channel_count; ++c) {
+        ax[c] += s * block.channels[c][i];
+        bx[c] += t * block.channels[c][i];
+      }
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  for (int c = 0; c < channel_count; ++c) {
+    e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / det, 0.0f, 255.0f);
+    e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+/////////
+// BC1 //
+/////////
+
+uint16_t QuantizeRgb565(const float c[4]) {
+  const int r = static_cast<int>(std::clamp(c[0], 0.0f, 255.0f) * (31.0f / 255.0f) + 0.5f);
+  const int g = static_cast<int>(std::clamp(c[1], 0.0f, 255.0f) * (63.0f / 255.0f) + 0.5f);
+  const int b = static_cast<int>(std::clamp(c[2], 0.0f, 255.0f) * (31.0f / 255.0f) + 0.5f);
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void ExpandRgb565(uint16_t value, int out[3]) {
+  const int r = (value >> 11) & 31;
+  const int g = (value >> 5) & 63;
+  const int b = value & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * @brief BC1 の色ブロックのパレット (展開と同じ整数演算)
+ * @param four_color false なら 3 色 + 透明黒
+ */
+void Bc1Palette(uint16_t c0, uint16_t c1, bool four_color, uint8_t palette[4][4]) {
+  int e0[3];
+  int e1[3];
+  ExpandRgb565(c0, e0);
+  ExpandRgb565(c1, e1);
+  for (int c = 0; c < 3; ++c) {
+    palette[0][c] = static_cast<uint8_t>(e0[c]);
+    palette[1][c] = static_cast<uint8_t>(e1[c]);
+    if (four_color) {
+      palette[2][c] = static_cast<uint8_t>((2 * e0[c] + e1[c] + 1) / 3);
+      palette[3][c] = static_cast<uint8_t>((e0[c] + 2 * e1[c] + 1) / 3);
+    } else {
+      palette[2][c] = static_cast<uint8_t>((e0[c] + e1[c] + 1) / 2);
+      palette[3][c] = 0;
+    }
+  }
+  palette[0][3] = palette[1][3] = palette[2][3] = 255;
+  palette[3][3] = four_color ? 255 : 0;
+}
+
+// インデックスごとの e1 側への補間の割合
+constexpr float kBc1FourColorWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+constexpr float kBc1ThreeColorWeights[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+
+struct Bc1Candidate {
+  uint16_t c0 = 0;
+  uint16_t c1 = 0;
+  uint8_t indices[16] = {};
+  float error = std::numeric_limits<float>::max();
+  bool four_color = true;
+};
+
+/**
+ * @brief 量子化した端点でブロックを表したときのインデックスと誤差
+ * @param mode 0: BC1 の 4 色, 1: BC1 の 3 色 + 透明, 2: BC3 の色ブロック (常に 4 色)
+ */
+Bc1Candidate EvaluateBc1(const Block& block, uint16_t opaque_mask, uint16_t c0, uint16_t c1, int mode,
+                         bool use_simd) {
+  Bc1Candidate candidate;
+  // BC1 は c0 > c1 なら 4 色, c0 <= c1 なら 3 色 + 透明
+  if (mode == 0 && c0 < c1) {
+    std::swap(c0, c1);
+  } else if (mode == 1 && c0 > c1) {
+    std::swap(c0, c1);
+  }
+  candidate.c0 = c0;
+  candidate.c1 = c1;
+  candidate.four_color = mode == 2 || c0 > c1;
+  uint8_t palette[4][4];
+  Bc1Palette(c0, c1, candidate.four_color, palette);
+  float palette_f[4][4];
+  for (int p = 0; p < 4; ++p) {
+    for (int c = 0; c < 4; ++c) {
+      palette_f[p][c] = palette[p][c];
+    }
+  }
+  std::fill(candidate.indices, candidate.indices + 16, uint8_t(3));
+  candidate.error = SelectIndices(block, palette_f, candidate.four_color ? 4 : 3, kRgbWeights, opaque_mask,
+                                  candidate.indices, use_simd);
+  return candidate;
+}
+
+/**
+ * @brief BC1 / BC3 の色ブロック (8 bytes) を作る
+ * @param opaque_mask 色を持つ画素. BC1 ではそれ以外を 3 色モードの透明にする (BC3 は全画素を渡す)
+ */
+void EncodeColorBlock(const Block& block, uint16_t opaque_mask, bool bc3, const BcEncodeOptions& options,
+                      uint8_t out[8]) {
+  Bc1Candidate best;
+  if (opaque_mask == 0) {
+    // 全て透明. c0 == c1 の 3 色モードでインデックスを全て 3 にする
+    best.c0 = best.c1 = 0;
+    std::fill(best.indices, best.indices + 16, uint8_t(3));
+  } else {
+    const int mode = bc3 ? 2 : (opaque_mask != kAllPixels ? 1 : 0);
+    float e0[4];
+    float e1[4];
+    AxisEndpoints(block, 3, opaque_mask, e0, e1);
+    // 両端の画素は補間色で近似されやすいので, 少し内側に寄せる
+    for (int c = 0; c < 3; ++c) {
+      const float inset = (e0[c] - e1[c]) / 16.0f;
+      e0[c] -= inset;
+      e1[c] += inset;
+    }
+    best = EvaluateBc1(block, opaque_mask, QuantizeRgb565(e0), QuantizeRgb565(e1), mode, options.use_simd);
+    for (uint32_t i = 0; i < options.refine_iterations && best.error > 0.0f; ++i) {
+      const float* weights = best.four_color ? kBc1FourColorWeights : kBc1ThreeColorWeights;
+      if (!RefineEndpoints(block, 3, opaque_mask, best.indices, weights, e0, e1)) {
+        break;
+      }
+      Bc1Candidate refined =
+          EvaluateBc1(block, opaque_mask, QuantizeRgb565(e0), QuantizeRgb565(e1), mode, options.use_simd);
+      if (refined.error >= best.error) {
+        break;
+      }
+      best = refined;
+    }
+  }
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; ++i) {
+    bits |= uint32_t(best.indices[i]) << (i * 2);
+  }
+  out[0] = static_cast<uint8_t>(best.c0);
+  out[1] = static_cast<uint8_t>(best.c0 >> 8);
+  out[2] = static_cast<uint8_t>(best.c1);
+  out[3] = static_cast<uint8_t>(best.c1 >> 8);
+  std::memcpy(out + 4, &bits, 4);
+}
+
+void DecodeColorBlock(const uint8_t block[8], bool bc3, uint8_t rgba[64]) {
+  const uint16_t c0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+  const uint16_t c1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+  uint8_t palette[4][4];
+  Bc1Palette(c0, c1, bc3 || c0 > c1, palette);
+  uint32_t bits;
+  std::memcpy(&bits, block + 4, 4);
+  for (int i = 0; i < 16; ++i) {
+    std::memcpy(rgba + i * 4, palette[(bits >> (i * 2)) & 3], 4);
+  }
+}
+
+/////////
+// BC3 //
+/////////
+
+void AlphaPalette(int a0, int a1, float palette[8][4]) {
+  int values[8] = {a0, a1};
+  if (a0 > a1) {
+    for (int i = 2; i < 8; ++i) {
+      values[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+    }
+  } else {
+    for (int i = 2; i < 6; ++i) {
+      values[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+    }
+    values[6] = 0;
+    values[7] = 255;
+  }
+  for (int i = 0; i < 8; ++i) {
+    palette[i][0] = palette[i][1] = palette[i][2] = 0.0f;
+    palette[i][3] = static_cast<float>(values[i]);
+  }
+}
+
+/**
+ * @brief BC3 のアルファブロック (8 bytes, BC4 と同じ) を作る. 最小値と最大値を端点にした 8 段階
+ */
+void EncodeAlphaBlock(const Block& block, const BcEncodeOptions& options, uint8_t out[8]) {
+  const float* alpha = block.channels[3];
+  const int a_min = static_cast<int>(*std::min_element(alpha, alpha + 16));
+  const int a_max = static_cast<int>(*std::max_element(alpha, alpha + 16));
+  uint8_t indices[16] = {};
+  if (a_min != a_max) {
+    float palette[8][4];
+    AlphaPalette(a_max, a_min, palette);
+    SelectIndices(block, palette, 8, kAlphaWeights, kAllPixels, indices, options.use_simd);
+  }
+  uint64_t bits = 0;
+  for (int i = 0; i < 16; ++i) {
+    bits |= uint64_t(indices[i]) << (i * 3);
+  }
+  out[0] = static_cast<uint8_t>(a_max);
+  out[1] = static_cast<uint8_t>(a_min);
+  for (int i = 0; i < 6; ++i) {
+    out[2 + i] = static_cast<uint8_t>(bits >> (i * 8));
+  }
+}
+
+void DecodeAlphaBlock(const uint8_t block[8], uint8_t rgba[64]) {
+  float palette[8][4];
+  AlphaPalette(block[0], block[1], palette);
+  uint64_t bits = 0;
+  for (int i = 0; i < 6; ++i) {
+    bits |= uint64_t(block[2 + i]) << (i * 8);
+  }
+  for (int i = 0; i < 16; ++i) {
+    rgba[i * 4 + 3] = static_cast<uint8_t>(palette[(bits >> (i * 3)) & 7][3]);
+  }
+}
+
+/////////
+// BC7 //
+/////////
+
+/**
+ * @brief 128 bit のブロックに下位ビットから順に書く・読む
+ */
+class BitStream {
+ public:
+  explicit BitStream(uint8_t* bytes) : bytes_(bytes) {}
+
+  void Write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++position_) {
+      bytes_[position_ >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (position_ & 7));
+    }
+  }
+
+  uint32_t Read(int bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < bits; ++i, ++position_) {
+      value |= uint32_t((bytes_[position_ >> 3] >> (position_ & 7)) & 1) << i;
+    }
+    return value;
+  }
+
+ private:
+  uint8_t* bytes_;
+  int position_ = 0;
+};
+
+/**
+ * @brief モード 6 の端点 (7 bit x RGBA と p-bit. 8 bit の値は (q << 1) | p)
+ */
+struct Mode6Endpoint {
+  uint8_t q[4];
+  uint8_t p;
+
+  int Value(int c) const { return (q[c] << 1) | p; }
+};
+
+Mode6Endpoint QuantizeMode6(const float e[4]) {
+  Mode6Endpoint best = {};
+  float best_error = std::numeric_limits<float>::max();
+  for (uint8_t p = 0; p < 2; ++p) {
+    Mode6Endpoint candidate = {};
+    candidate.p = p;
+    float error = 0.0f;
+    for (int c = 0; c < 4; ++c) {
+      candidate.q[c] = static_cast<uint8_t>(std::clamp(static_cast<int>((e[c] - p) * 0.5f + 0.5f), 0, 127));
+      const float diff = candidate.Value(c) - e[c];
+      error += diff * diff;
+    }
+    if (error < best_error) {
+      best = candidate;
+      best_error = error;
+    }
+  }
+  return best;
+}
+
+void Mode6Palette(const Mode6Endpoint& e0, const Mode6Endpoint& e1, float palette[16][4]) {
+  for (int i = 0; i < 16; ++i) {
+    const int w = kBc7Weights4[i];
+    for (int c = 0; c < 4; ++c) {
+      palette[i][c] = static_cast<float>(((64 - w) * e0.Value(c) + w * e1.Value(c) + 32) >> 6);
+    }
+  }
+}
+
+struct Mode6Candidate {
+  Mode6Endpoint e0;
+  Mode6Endpoint e1;
+  uint8_t indices[16] = {};
+  float error = std::numeric_limits<float>::max();
+};
+
+Mode6Candidate EvaluateMode6(const Block& block, const float e0[4], const float e1[4], bool use_simd) {
+  Mode6Candidate candidate;
+  candidate.e0 = QuantizeMode6(e0);
+  candidate.e1 = QuantizeMode6(e1);
+  float palette[16][4];
+  Mode6Palette(candidate.e0, candidate.e1, palette);
+  candidate.error = SelectIndices(block, palette, 16, kRgbaWeights, kAllPixels, candidate.indices, use_simd);
+  return candidate;
+}
+
+}  // namespace
+
+void EncodeBC1Block(const uint8_t rgba[64], uint8_t out[8], const BcEncodeOptions& options) {
+  const Block block = LoadBlock(rgba);
+  uint16_t opaque_mask = 0;
+  for (int i = 0; i < 16; ++i) {
+    if (rgba[i * 4 + 3] >= 128) {
+      opaque_mask |= uint16_t(1u << i);
+    }
+  }
+  EncodeColorBlock(block, opaque_mask, false, options, out);
+}
+
+void EncodeBC3Block(const uint8_t rgba[64], uint8_t out[16], const BcEncodeOptions& options) {
+  const Block block = LoadBlock(rgba);
+  EncodeAlphaBlock(block, options, out);
+  EncodeColorBlock(block, kAllPixels, true, options, out + 8);
+}
+
+void EncodeBC7Block(const uint8_t rgba[64], uint8_t out[16], const BcEncodeOptions& options) {
+  static const float kWeights[16] = {0 / 64.0f,  4 / 64.0f,  9 / 64.0f,  13 / 64.0f, 17 / 64.0f, 21 / 64.0f,
+                                     26 / 64.0f, 30 / 64.0f, 34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f,
+                                     51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f};
+  const Block block = LoadBlock(rgba);
+  float e0[4];
+  float e1[4];
+  AxisEndpoints(block, 4, kAllPixels, e0, e1);
+  Mode6Candidate best = EvaluateMode6(block, e0, e1, options.use_simd);
+  for (uint32_t i = 0; i < options.refine_iterations && best.error > 0.0f; ++i) {
+    if (!RefineEndpoints(block, 4, kAllPixels, best.indices, kWeights, e0, e1)) {
+      break;
+    }
+    Mode6Candidate refined = EvaluateMode6(block, e0, e1, options.use_simd);
+    if (refined.error >= best.error) {
+      break;
+    }
+    best = refined;
+  }
+
+  // 画素 0 のインデックスは最上位ビットを省略する (0 - 7 に収まるよう端点を入れ替える)
+  if (best.indices[0] >= 8) {
+    std::swap(best.e0, best.e1);
+    for (auto& index : best.indices) {
+      index = static_cast<uint8_t>(15 - index);
+    }
+  }
+
+  std::memset(out, 0, 16);
+  BitStream stream(out);
+  stream.Write(1u << 6, 7);  // モード 6
+  for (int c = 0; c < 4; ++c) {
+    stream.Write(best.e0.q[c], 7);
+    stream.Write(best.e1.q[c], 7);
+  }
+  stream.Write(best.e0.p, 1);
+  stream.Write(best.e1.p, 1);
+  stream.Write(best.indices[0], 3);
+  for (int i = 1; i < 16; ++i) {
+    stream.Write(best.indices[i], 4);
+  }
+}
+
+void DecodeBC1Block(const uint8_t block[8], uint8_t rgba[64]) { DecodeColorBlock(block, false, rgba); }
+
+void DecodeBC3Block(const uint8_t block[16], uint8_t rgba[64]) {
+  DecodeColorBlock(block + 8, true, rgba);
+  DecodeAlphaBlock(block, rgba);
+}
+
+void DecodeBC7Block(const uint8_t block[16], uint8_t rgba[64]) {
+  if ((block[0] & 0x7F) != 0x40) {
+    std::memset(rgba, 0, 64);
+    return;
+  }
+  uint8_t bytes[16];
+  std::memcpy(bytes, block, 16);
+  BitStream stream(bytes);
+  stream.Read(7);
+  Mode6Endpoint e0 = {};
+  Mode6Endpoint e1 = {};
+  for (int c = 0; c < 4; ++c) {
+    e0.q[c] = static_cast<uint8_t>(stream.Read(7));
+    e1.q[c] = static_cast<uint8_t>(stream.Read(7));
+  }
+  e0.p = static_cast<uint8_t>(stream.Read(1));
+  e1.p = static_cast<uint8_t>(stream.Read(1));
+  float palette[16][4];
+  Mode6Palette(e0, e1, palette);
+  for (int i = 0; i < 16; ++i) {
+    const uint32_t index = stream.Read(i == 0 ? 3 : 4);
+    for (int c = 0; c < 4; ++c) {
+      rgba[i * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+    }
+  }
+}
+
+PixelFormat ChooseBlockFormat(const Image& image) {
+  if (BytesPerPixel(image.format) != 4) {
+    return PixelFormat::kUnknown;
+  }
+  for (uint32_t y = 0; y < image.height; ++y) {
+    const uint8_t* row = image.Row(y);
+    for (uint32_t x = 0; x < image.width; ++x) {
+      if (row[x * 4 + 3] != 255) {
+        return PixelFormat::kBC7;
+      }
+    }
+  }
+  return PixelFormat::kBC1;
+}
+
+Image CompressImage(const Image& image, PixelFormat format, const BcEncodeOptions& options, ThreadPool* pool) {
+  Image out;
+  if (BytesPerPixel(image.format) != 4 || image.width == 0 || image.height == 0 ||
+      image.pixels.size() < image.row_pitch * image.height) {
+    return out;
+  }
+  if (format == PixelFormat::kUnknown) {
+    format = ChooseBlockFormat(image);
+  }
+  if (!IsBlockCompressed(format)) {
+    return out;
+  }
+  out.format = format;
+  out.width = image.width;
+  out.height = image.height;
+  out.row_pitch = RowBytes(format, image.width);
+  out.pixels.resize(out.row_pitch * RowCount(format, image.height));
+
+  const uint32_t blocks_x = (image.width + 3) / 4;
+  const uint32_t blocks_y = (image.height + 3) / 4;
+  const std::size_t block_bytes = BytesPerBlock(format);
+  // BGRA8 は RGBA の並びにしてから圧縮する
+  const int red = image.format == PixelFormat::kBGRA8 ? 2 : 0;
+  auto rows = [&](std::size_t begin, std::size_t end) {
+    uint8_t rgba[64];
+    for (std::size_t by = begin; by < end; ++by) {
+      uint8_t* dst = out.Row(static_cast<uint32_t>(by));
+      for (uint32_t bx = 0; bx < blocks_x; ++bx) {
+        for (uint32_t i = 0; i < 16; ++i) {
+          const uint32_t x = std::min(bx * 4 + i % 4, image.width - 1);
+          const uint32_t y = std::min(static_cast<uint32_t>(by) * 4 + i / 4, image.height - 1);
+          const uint8_t* p = image.Row(y) + std::size_t(x) * 4;
+          rgba[i * 4 + 0] = p[red];
+          rgba[i * 4 + 1] = p[1];
+          rgba[i * 4 + 2] = p[2 - red];
+          rgba[i * 4 + 3] = p[3];
+        }
+        uint8_t* block = dst + bx * block_bytes;
+        switch (format) {
+          case PixelFormat::kBC1:
+            EncodeBC1Block(rgba, block, options);
+            break;
+          case PixelFormat::kBC3:
+            EncodeBC3Block(rgba, block, options);
+            break;
+          default:
+            EncodeBC7Block(rgba, block, options);
+            break;
+        }
+      }
+    }
+  };
+  if (pool != nullptr && std::size_t(blocks_x) * blocks_y >= kParallelMinBlocks) {
+    pool->ParallelFor(0, blocks_y, kBlockRowsPerTask, rows);
+  } else {
+    rows(0, blocks_y);
+  }
+  return out;
+}
+
+std::vector<Image> CompressMipChain(const std::vector<Image>& levels, PixelFormat format,
+                                    const BcEncodeOptions& options, ThreadPool* pool) {
+  std::vector<Image> compressed;
+  if (levels.empty()) {
+    return compressed;
+  }
+  if (format == PixelFormat::kUnknown) {
+    format = ChooseBlockFormat(levels.front());
+  }
+  for (const Image& level : levels) {
+    Image image = CompressImage(level, format, options, pool);
+    if (image.pixels.empty()) {
+      return {};
+    }
+    compressed.push_back(std::move(image));
+  }
+  return compressed;
+}
+
+Image DecompressImage(const Image& image) {
+  Image out;
+  if (!IsBlockCompressed(image.format) || image.width == 0 || image.height == 0 ||
+      image.pixels.size() < image.row_pitch * RowCount(image.format, image.height)) {
+    return out;
+  }
+  out.format = PixelFormat::kRGBA8;
+  out.width = image.width;
+  out.height = image.height;
+  out.row_pitch = std::size_t(image.width) * 4;
+  out.pixels.resize(out.row_pitch * image.height);
+
+  const std::size_t block_bytes = BytesPerBlock(image.format);
+  uint8_t rgba[64];
+  for (uint32_t by = 0; by < RowCount(image.format, image.height); ++by) {
+    const uint8_t* src = image.Row(by);
+    for (uint32_t bx = 0; bx < (image.width + 3) / 4; ++bx) {
+      const uint8_t* block = src + bx * block_bytes;
+      switch (image.format) {
+        case PixelFormat::kBC1:
+          DecodeBC1Block(block, rgba);
+          break;
+        case PixelFormat::kBC3:
+          DecodeBC3Block(block, rgba);
+          break;
+        default:
+          DecodeBC7Block(block, rgba);
+          break;
+      }
+      for (uint32_t i = 0; i < 16; ++i) {
+        const uint32_t x = bx * 4 + i % 4;
+        const uint32_t y = by * 4 + i / 4;
+        if (x < image.width && y < image.height) {
+          std::memcpy(out.Row(y) + std::size_t(x) * 4, rgba + i * 4, 4);
+        }
+      }
+    }
+  }
+  return out;
+}
+
+double ComputePsnr(const Image& reference, const Image& image, bool include_alpha) {
+  if (BytesPerPixel(reference.format) != 4 || BytesPerPixel(image.format) != 4 || reference.width != image.width ||
+      reference.height != image.height || reference.width == 0 || reference.height == 0) {
+    return 0.0;
+  }
+  // チャンネルを RGBA の順に読むためのオフセット
+  const int ref_red = reference.format == PixelFormat::kBGRA8 ? 2 : 0;
+  const int img_red = image.format == PixelFormat::kBGRA8 ? 2 : 0;
+  const int ref_order[4] = {ref_red, 1, 2 - ref_red, 3};
+  const int img_order[4] = {img_red, 1, 2 - img_red, 3};
+  const int channels = include_alpha ? 4 : 3;
+  double sum = 0.0;
+  for (uint32_t y = 0; y < reference.height; ++y) {
+    const uint8_t* a = reference.Row(y);
+    const uint8_t* b = image.Row(y);
+    for (uint32_t x = 0; x < reference.width; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        const double diff = double(a[x * 4 + ref_order[c]]) - double(b[x * 4 + img_order[c]]);
+        sum += diff * diff;
+      }
+    }
+  }
+  const double mse = sum / (double(reference.width) * reference.height * channels);
+  if (mse == 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
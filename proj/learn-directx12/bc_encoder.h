@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+class ThreadPool;
+
+struct BcEncodeOptions {
+  // 端点を最小二乗法で詰め直す回数 (0 なら主成分軸上の両端をそのまま使う)
+  uint32_t refine_iterations = 2;
+  // false ならスカラー実装だけを使う (SIMD 実装の検証用)
+  bool use_simd = true;
+};
+
+/**
+ * @brief 4x4 ブロックを圧縮・展開する
+ * @details rgba は RGBA8 の 16 画素 (64 bytes, 行優先).
+ *          BC1 はアルファが 128 未満の画素があれば 3 色 + 透明のモードにする.
+ *          BC7 はモード 6 (1 サブセット, RGBA 7 bit + p-bit の端点, 4 bit インデックス) だけを使う.
+ *          展開はこのエンコーダーの出力を検証するためのもので, BC7 はモード 6 以外を黒 (0) にする.
+ */
+void EncodeBC1Block(const uint8_t rgba[64], uint8_t out[8], const BcEncodeOptions& options = {});
+void EncodeBC3Block(const uint8_t rgba[64], uint8_t out[16], const BcEncodeOptions& options = {});
+void EncodeBC7Block(const uint8_t rgba[64], uint8_t out[16], const BcEncodeOptions& options = {});
+void DecodeBC1Block(const uint8_t block[8], uint8_t rgba[64]);
+void DecodeBC3Block(const uint8_t block[16], uint8_t rgba[64]);
+void DecodeBC7Block(const uint8_t block[16], uint8_t rgba[64]);
+
+/**
+ * @brief 画像に合うブロック圧縮のフォーマット (アルファが全て 255 なら BC1, それ以外は BC7)
+ */
+PixelFormat ChooseBlockFormat(const Image& image);
+
+/**
+ * @brief RGBA8 / BGRA8 の画像をブロック圧縮する
+ * @details 端の 4 画素に満たないブロックは端の画素を繰り返して埋める. ブロック列ごとに並列に処理する.
+ *          D3D12 のブロック圧縮テクスチャは最も細かいミップの幅・高さが 4 の倍数でなければならないので,
+ *          リソースにする場合は呼び出し側で確かめること (ミップの 2 段目以降は 4 未満でもよい).
+ * @param format kBC1 / kBC3 / kBC7. kUnknown なら ChooseBlockFormat で選ぶ
+ * @param pool nullptr でなければブロック列ごとに並列に処理する
+ * @return 対応していない画像なら空
+ */
+Image CompressImage(const Image& image, PixelFormat format, const BcEncodeOptions& options = {},
+                    ThreadPool* pool = nullptr);
+
+/**
+ * @brief ミップチェーンの全段を同じフォーマットで圧縮する
+ * @return どれか 1 段でも失敗したら空
+ */
+std::vector<Image> CompressMipChain(const std::vector<Image>& levels, PixelFormat format,
+                                    const BcEncodeOptions& options = {}, ThreadPool* pool = nullptr);
+
+/**
+ * @brief ブロック圧縮された画像を RGBA8 に展開する
+ * @return 対応していないフォーマットなら空
+ */
+Image DecompressImage(const Image& image);
+
+/**
+ * @brief 2 つの RGBA8 / BGRA8 の画像の PSNR (dB). 同じなら無限大, 比べられない場合は 0
+ * @param include_alpha false なら RGB だけで比べる
+ */
+double ComputePsnr(const Image& reference, const Image& image, bool include_alpha = true);
@@ -0,0 +1,68 @@
+#include "command_recording.h"
+
+#include <algorithm>
+
+std::vector<RecordRange> PartitionDrawCommands(const std::vector<DrawCommand>& commands, std::size_t max_ranges,
+                                               std::size_t min_draws_per_range) {
+  std::size_t total_draws = 0;
+  for (const auto& command : commands) {
+    total_draws += command.type == DrawCommandType::kDrawIndexed ? 1 : 0;
+  }
+
+  std::vector<RecordRange> ranges;
+  if (commands.empty()) {
+    return ranges;
+  }
+  const std::size_t range_count = std::clamp<std::size_t>(
+      total_draws / std::max<std::size_t>(min_draws_per_range, 1), 1, std::max<std::size_t>(max_ranges, 1));
+
+  RecordRange range;
+  DrawState state;
+  std::size_t draws_before = 0;  // range より前の区間の描画数
+  for (std::size_t i = 0; i < commands.size(); ++i) {
+    const DrawCommand& command = commands[i];
+    switch (command.type) {
+      case DrawCommandType::kSetPipeline:
+        state.pipeline = command.value;
+        break;
+      case DrawCommandType::kSetGeometry:
+        state.geometry = command.value;
+        break;
+      case DrawCommandType::kSetMaterial:
+        state.material = command.value;
+        break;
+      case DrawCommandType::kDrawIndexed:
+        ++range.draws;
+        break;
+    }
+    // 描画を (ranges.size() + 1) / range_count の割合まで記録したら区間を閉じる (最後の区間は末尾まで)
+    const bool last = ranges.size() + 1 == range_count;
+    if (!last && command.type == DrawCommandType::kDrawIndexed &&
+        (draws_before + range.draws) * range_count >= total_draws * (ranges.size() + 1)) {
+      range.end = i + 1;
+      ranges.push_back(range);
+      draws_before += range.draws;
+      range = {};
+      range.begin = i + 1;
+      range.state = state;
+    }
+  }
+  range.end = commands.size();
+  if (range.begin < range.end) {
+    ranges.push_back(range);
+  }
+  return ranges;
+}
+
+void RecordRangesParallel(ThreadPool& pool, const std::vector<RecordRange>& ranges,
+                          const std::function<void(std::size_t range_index, const RecordRange& range)>& record) {
+  if (ranges.size() == 1) {
+    record(0, ranges[0]);
+    return;
+  }
+  pool.ParallelFor(0, ranges.size(), 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      record(i, ranges[i]);
+    }
+  });
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "draw_list.h"
+#include "thread_pool.h"
+
+/**
+ * @brief コマンド列のある位置で有効な状態 (kNone はまだ設定されていない)
+ */
+struct DrawState {
+  static constexpr uint32_t kNone = 0xffffffff;
+  uint32_t pipeline = kNone;
+  uint32_t geometry = kNone;
+  uint32_t material = kNone;
+};
+
+/**
+ * @brief 1 つのコマンドリスト (コマンドバッファ) に記録するコマンドの区間
+ */
+struct RecordRange {
+  std::size_t begin = 0;  // DrawListBuilder::Commands() の [begin, end)
+  std::size_t end = 0;
+  DrawState state;        // begin の直前で有効な状態. 新しいコマンドリストには引き継がれないので記録の最初に設定し直す
+  std::size_t draws = 0;  // 区間の kDrawIndexed の数
+};
+
+/**
+ * @brief コマンド列を kDrawIndexed の数がほぼ均等になるように最大 max_ranges 個の区間に分ける
+ * @details 区間の境界は kDrawIndexed の直後にだけ置く (kSet* とそれに続く描画は同じ区間に入る).
+ *          1 区間の描画が min_draws_per_range 未満になるほど細かくは分けない (記録を始める手間の方が大きくなるので).
+ *          区間を順に実行すると元のコマンド列と同じ描画になる.
+ */
+std::vector<RecordRange> PartitionDrawCommands(const std::vector<DrawCommand>& commands, std::size_t max_ranges,
+                                               std::size_t min_draws_per_range);
+
+/**
+ * @brief range のコマンドを backend に記録する
+ * @details backend は SetPipeline(uint32_t) / SetGeometry(uint32_t) / SetMaterial(uint32_t) /
+ *          DrawIndexed(uint32_t index_count, uint32_t index_offset) を持つ型. 最初に range.state を設定し直す.
+ */
+template <typename Backend>
+void RecordDrawRange(const std::vector<DrawCommand>& commands, const RecordRange& range, Backend& backend) {
+  if (range.state.pipeline != DrawState::kNone) {
+    backend.SetPipeline(range.state.pipeline);
+  }
+  if (range.state.geometry != DrawState::kNone) {
+    backend.SetGeometry(range.state.geometry);
+  }
+  if (range.state.material != DrawState::kNone) {
+    backend.SetMaterial(range.state.material);
+  }
+  for (std::size_t i = range.begin; i < range.end; ++i) {
+    const DrawCommand& command = commands[i];
+    switch (command.type) {
+      case DrawCommandType::kSetPipeline:
+        backend.SetPipeline(command.value);
+        break;
+      case DrawCommandType::kSetGeometry:
+        backend.SetGeometry(command.value);
+        break;
+      case DrawCommandType::kSetMaterial:
+        backend.SetMaterial(command.value);
+        break;
+      case DrawCommandType::kDrawIndexed:
+        backend.DrawIndexed(command.value, command.offset);
+        break;
+    }
+  }
+}
+
+/**
+ * @brief 区間ごとに record(range_index, range) を並列に呼ぶ (呼び出しスレッドも参加する). 全て終わるまで待つ
+ * @details record は range_index 番目のコマンドリストに記録する. 投入は呼び出し側が range_index の順に行うこと.
+ */
+void RecordRangesParallel(ThreadPool& pool, const std::vector<RecordRange>& ranges,
+                          const std::function<void(std::size_t range_index, const RecordRange& range)>& record);
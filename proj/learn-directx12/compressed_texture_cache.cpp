@@ -0,0 +1,188 @@
+#include "compressed_texture_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+#include "hash.h"
+#include "mapped_file.h"
+#include "mip_generator.h"
+#include "texture_content_store.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[4] = {'B', 'C', 'T', 'X'};
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t format;  // PixelFormat
+  uint32_t level_count;
+};
+
+struct LevelHeader {
+  uint32_t width;
+  uint32_t height;
+  uint64_t size;  // 続くピクセルデータのバイト数 (ブロック列を詰めたもの)
+};
+
+}  // namespace
+
+CompressedTextureCache::CompressedTextureCache(fs::path directory) : directory_(std::move(directory)) {}
+
+uint64_t CompressedTextureCache::MakeKey(const Image& source, PixelFormat format, const BcEncodeOptions& options) {
+  uint64_t key = HashImagePixels(source);
+  key = HashCombine(key, (uint64_t(source.width) << 32) | source.height);
+  key = HashCombine(key, (uint64_t(format) << 40) | (uint64_t(source.format) << 32) | kEncoderVersion);
+  key = HashCombine(key, (uint64_t(options.use_simd) << 32) | options.refine_iterations);
+  return key;
+}
+
+fs::path CompressedTextureCache::EntryPath(uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bctex", static_cast<unsigned long long>(key));
+  return directory_ / name;
+}
+
+bool CompressedTextureCache::Load(uint64_t key, std::vector<Image>* levels) {
+  auto miss = [this]() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.misses;
+    return false;
+  };
+  std::error_code ec;
+  const fs::path path = EntryPath(key);
+  if (!fs::exists(path, ec)) {
+    return miss();
+  }
+  MappedFile file;
+  if (!file.Open(path) || file.size() < sizeof(FileHeader)) {
+    return miss();
+  }
+  FileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  const PixelFormat format = static_cast<PixelFormat>(header.format);
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kEncoderVersion ||
+      !IsBlockCompressed(format) || header.level_count == 0) {
+    return miss();
+  }
+
+  std::vector<Image> loaded;
+  std::size_t offset = sizeof(FileHeader);
+  for (uint32_t i = 0; i < header.level_count; ++i) {
+    LevelHeader level;
+    if (file.size() - offset < sizeof(level)) {
+      return miss();
+    }
+    std::memcpy(&level, file.data() + offset, sizeof(level));
+    offset += sizeof(level);
+    Image image;
+    image.format = format;
+    image.width = level.width;
+    image.height = level.height;
+    image.row_pitch = RowBytes(format, level.width);
+    if (level.width == 0 || level.height == 0 || level.size != image.row_pitch * RowCount(format, level.height) ||
+        file.size() - offset < level.size) {
+      return miss();
+    }
+    image.pixels.assign(file.data() + offset, file.data() + offset + level.size);
+    offset += level.size;
+    loaded.push_back(std::move(image));
+  }
+
+  *levels = std::move(loaded);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.hits;
+  stats_.bytes_read += file.size();
+  return true;
+}
+
+bool CompressedTextureCache::Store(uint64_t key, const std::vector<Image>& levels, std::string* error) {
+  if (levels.empty() || !IsBlockCompressed(levels.front().format)) {
+    *error = "not a block compressed mip chain";
+    return false;
+  }
+  std::vector<uint8_t> data(sizeof(FileHeader));
+  FileHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kEncoderVersion;
+  header.format = static_cast<uint32_t>(levels.front().format);
+  header.level_count = static_cast<uint32_t>(levels.size());
+  std::memcpy(data.data(), &header, sizeof(header));
+  for (const Image& image : levels) {
+    const std::size_t row_bytes = RowBytes(image.format, image.width);
+    const uint32_t rows = RowCount(image.format, image.height);
+    if (image.format != levels.front().format || image.pixels.size() < image.row_pitch * rows) {
+      *error = "invalid mip level";
+      return false;
+    }
+    LevelHeader level = {image.width, image.height, uint64_t(row_bytes) * rows};
+    const std::size_t offset = data.size();
+    data.resize(offset + sizeof(level) + level.size);
+    std::memcpy(data.data() + offset, &level, sizeof(level));
+    for (uint32_t y = 0; y < rows; ++y) {
+      std::memcpy(data.data() + offset + sizeof(level) + row_bytes * y, image.Row(y), row_bytes);
+    }
+  }
+
+  std::error_code ec;
+  fs::create_directories(directory_, ec);
+  const fs::path path = EntryPath(key);
+  // 同じキーを同時に書くスレッドと一時ファイルがぶつからないようにする
+  fs::path tmp_path = path;
+  tmp_path += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!ofs) {
+      *error = tmp_path.u8string() + ": write failed";
+      return false;
+    }
+  }
+  fs::rename(tmp_path, path, ec);
+  if (ec) {
+    fs::remove(tmp_path, ec);
+    *error = path.u8string() + ": " + ec.message();
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.stores;
+  stats_.bytes_written += data.size();
+  return true;
+}
+
+CompressedTextureCache::Stats CompressedTextureCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+std::vector<Image> LoadOrCompressTexture(const Image& image, PixelFormat format, const BcEncodeOptions& options,
+                                         CompressedTextureCache* cache, ThreadPool* pool, bool* cache_hit) {
+  if (cache_hit != nullptr) {
+    *cache_hit = false;
+  }
+  std::vector<Image> levels;
+  if (BytesPerPixel(image.format) != 4 || image.width == 0 || image.height == 0 || image.width % 4 != 0 ||
+      image.height % 4 != 0) {
+    return levels;
+  }
+  const uint64_t key = CompressedTextureCache::MakeKey(image, format, options);
+  if (cache != nullptr && cache->Load(key, &levels)) {
+    if (cache_hit != nullptr) {
+      *cache_hit = true;
+    }
+    return levels;
+  }
+  levels = CompressMipChain(GenerateMipChain(image, {}, pool), format, options, pool);
+  if (cache != nullptr && !levels.empty()) {
+    // 書けなくても次回またエンコードするだけなので, 結果はそのまま返す
+    std::string error;
+    cache->Store(key, levels, &error);
+  }
+  return levels;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bc_encoder.h"
+#include "image.h"
+
+class ThreadPool;
+
+/**
+ * @brief ブロック圧縮したミップチェーンをディスクに置いておくキャッシュ
+ * @details キーは元画像のピクセルのハッシュ (HashImagePixels) ・サイズ・要求したフォーマット・エンコーダーのバージョン.
+ *          同じ内容の画像は 2 回目以降エンコードせずにファイルから読む (ファイル名やディレクトリが違っても共有される).
+ *          ファイルは <directory>/<key 16 桁>.bctex. 書き込みは一時ファイルを rename するので,
+ *          複数のスレッド・プロセスから同じキーを同時に書いても壊れない. スレッドセーフ.
+ *
+ *   CompressedTextureCache cache(model_dir / "texture_cache");
+ *   bool hit = false;
+ *   auto levels = LoadOrCompressTexture(image, PixelFormat::kUnknown, {}, &cache, &pool, &hit);
+ */
+class CompressedTextureCache {
+ public:
+  // 出力が変わるエンコーダーの変更をしたら上げる (古いエントリは読まれなくなる)
+  static constexpr uint32_t kEncoderVersion = 1;
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+  };
+
+  explicit CompressedTextureCache(std::filesystem::path directory);
+
+  /**
+   * @param format 要求したフォーマット (kUnknown なら ChooseBlockFormat に任せたもの)
+   * @param options エンコードの設定 (設定が違えば別のエントリになる)
+   */
+  static uint64_t MakeKey(const Image& source, PixelFormat format, const BcEncodeOptions& options);
+
+  /**
+   * @brief キーのミップチェーンを読む
+   * @return 無い・壊れている・古いバージョンなら false (miss に数える)
+   */
+  bool Load(uint64_t key, std::vector<Image>* levels);
+
+  /**
+   * @return 失敗したら false. 理由は error に入れる
+   */
+  bool Store(uint64_t key, const std::vector<Image>& levels, std::string* error);
+
+  std::filesystem::path EntryPath(uint64_t key) const;
+  const std::filesystem::path& directory() const { return directory_; }
+  Stats GetStats() const;
+
+ private:
+  std::filesystem::path directory_;
+  mutable std::mutex mutex_;  // stats_ 用
+  Stats stats_;
+};
+
+/**
+ * @brief image のミップチェーンを作ってブロック圧縮する. cache にあればエンコードせずにそれを返す
+ * @details 画像の幅・高さが 4 の倍数でない場合は D3D12 のリソースにできないので空を返す.
+ * @param cache nullptr なら毎回エンコードする
+ * @param pool nullptr でなければミップの生成と圧縮を並列に行う
+ * @param cache_hit nullptr でなければキャッシュから読んだかどうかを入れる
+ * @return level 0 から順に並んだ圧縮済みのミップ. 圧縮できなければ空
+ */
+std::vector<Image> LoadOrCompressTexture(const Image& image, PixelFormat format, const BcEncodeOptions& options,
+                                         CompressedTextureCache* cache, ThreadPool* pool, bool* cache_hit = nullptr);
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cmath>
+
+// CPU 側の計算 (スキニング・モーション・カリングなど) で使う最小限のベクトル・行列
+// DirectXMath と同じく行ベクトル・行優先 (v' = v * M) で, 行列の積は左から順に適用される.
+// Windows 以外でもビルドできるよう DirectXMath には依存しない.
+
+struct Float3 {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+};
+
+struct Float4 {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+  float w = 0.0f;
+};
+
+/**
+ * @brief 回転を表す単位クォータニオン (x, y, z が虚部, w が実部)
+ */
+struct Quaternion {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+  float w = 1.0f;
+};
+
+/**
+ * @brief 4x4 行列 (m[row][column])
+ */
+struct Matrix4 {
+  float m[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+};
+
+inline Float3 operator+(const Float3& a, const Float3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Float3 operator-(const Float3& a, const Float3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Float3 operator-(const Float3& a) { return {-a.x, -a.y, -a.z}; }
+inline Float3 operator*(const Float3& a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Float3 Cross(const Float3& a, const Float3& b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline float Length(const Float3& a) { return std::sqrt(Dot(a, a)); }
+inline Float3 Normalize(const Float3& a) {
+  const float len = Length(a);
+  return len > 0.0f ? a * (1.0f / len) : a;
+}
+inline Float3 Lerp(const Float3& a, const Float3& b, float t) { return a + (b - a) * t; }
+
+inline Matrix4 MatrixIdentity() { return Matrix4(); }
+
+inline Matrix4 MatrixTranslation(const Float3& t) {
+  Matrix4 r;
+  r.m[3][0] = t.x;
+  r.m[3][1] = t.y;
+  r.m[3][2] = t.z;
+  return r;
+}
+
+inline Matrix4 MatrixScaling(const Float3& s) {
+  Matrix4 r;
+  r.m[0][0] = s.x;
+  r.m[1][1] = s.y;
+  r.m[2][2] = s.z;
+  return r;
+}
+
+/**
+ * @brief 行列の積 (a を適用してから b を適用する)
+ */
+inline Matrix4 operator*(const Matrix4& a, const Matrix4& b) {
+  Matrix4 r;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+    }
+  }
+  return r;
+}
+
+/**
+ * @brief 点を変換する (w = 1 として扱い, 射影はしない)
+ */
+inline Float3 TransformPoint(const Float3& v, const Matrix4& m) {
+  return {v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + m.m[3][0],
+          v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + m.m[3][1],
+          v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + m.m[3][2]};
+}
+
+/**
+ * @brief 方向ベクトルを変換する (平行移動成分は無視する)
+ */
+inline Float3 TransformNormal(const Float3& v, const Matrix4& m) {
+  return {v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0],
+          v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1],
+          v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2]};
+}
+
+/**
+ * @brief 同次座標で変換する (射影変換用)
+ */
+inline Float4 Transform(const Float4& v, const Matrix4& m) {
+  Float4 r;
+  r.x = v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0] + v.w * m.m[3][0];
+  r.y = v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1] + v.w * m.m[3][1];
+  r.z = v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2] + v.w * m.m[3][2];
+  r.w = v.x * m.m[0][3] + v.y * m.m[1][3] + v.z * m.m[2][3] + v.w * m.m[3][3];
+  return r;
+}
+
+inline Quaternion QuaternionRotationAxis(const Float3& axis, float angle) {
+  const Float3 n = Normalize(axis);
+  const float s = std::sin(angle * 0.5f);
+  return {n.x * s, n.y * s, n.z * s, std::cos(angle * 0.5f)};
+}
+
+/**
+ * @brief クォータニオンの積 (a の回転を適用してから b の回転を適用する. DirectXMath の XMQuaternionMultiply と同じ)
+ */
+inline Quaternion operator*(const Quaternion& a, const Quaternion& b) {
+  return {b.w * a.x + b.x * a.w + b.y * a.z - b.z * a.y, b.w * a.y - b.x * a.z + b.y * a.w + b.z * a.x,
+          b.w * a.z + b.x * a.y - b.y * a.x + b.z * a.w, b.w * a.w - b.x * a.x - b.y * a.y - b.z * a.z};
+}
+
+inline Quaternion Normalize(const Quaternion& q) {
+  const float len = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  if (len <= 0.0f) {
+    return Quaternion();
+  }
+  const float inv = 1.0f / len;
+  return {q.x * inv, q.y * inv, q.z * inv, q.w * inv};
+}
+
+/**
+ * @brief 球面線形補間 (最短経路側を通る)
+ */
+inline Quaternion Slerp(const Quaternion& a, Quaternion b, float t) {
+  float cos_theta = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+  if (cos_theta < 0.0f) {
+    b = {-b.x, -b.y, -b.z, -b.w};
+    cos_theta = -cos_theta;
+  }
+  float ka = 1.0f - t;
+  float kb = t;
+  // ほぼ同じ向きなら線形補間で十分 (0 除算も避ける)
+  if (cos_theta < 0.9995f) {
+    const float theta = std::acos(cos_theta);
+    const float inv_sin = 1.0f / std::sin(theta);
+    ka = std::sin((1.0f - t) * theta) * inv_sin;
+    kb = std::sin(t * theta) * inv_sin;
+  }
+  return Normalize(
+      Quaternion{a.x * ka + b.x * kb, a.y * ka + b.y * kb, a.z * ka + b.z * kb, a.w * ka + b.w * kb});
+}
+
+inline Matrix4 MatrixRotationQuaternion(const Quaternion& q) {
+  const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+  Matrix4 r;
+  r.m[0][0] = 1.0f - 2.0f * (yy + zz);
+  r.m[0][1] = 2.0f * (xy + wz);
+  r.m[0][2] = 2.0f * (xz - wy);
+  r.m[1][0] = 2.0f * (xy - wz);
+  r.m[1][1] = 1.0f - 2.0f * (xx + zz);
+  r.m[1][2] = 2.0f * (yz + wx);
+  r.m[2][0] = 2.0f * (xz + wy);
+  r.m[2][1] = 2.0f * (yz - wx);
+  r.m[2][2] = 1.0f - 2.0f * (xx + yy);
+  return r;
+}
+
+/**
+ * @brief 左手系のビュー行列 (XMMatrixLookAtLH と同じ)
+ */
+inline Matrix4 MatrixLookAtLH(const Float3& eye, const Float3& target, const Float3& up) {
+  const Float3 z = Normalize(target - eye);
+  const Float3 x = Normalize(Cross(up, z));
+  const Float3 y = Cross(z, x);
+  Matrix4 r;
+  const Float3 axes[3] = {x, y, z};
+  for (int i = 0; i < 3; ++i) {
+    r.m[0][i] = axes[i].x;
+    r.m[1][i] = axes[i].y;
+    r.m[2][i] = axes[i].z;
+    r.m[3][i] = -Dot(axes[i], eye);
+  }
+  return r;
+}
+
+/**
+ * @brief 左手系の透視投影行列 (XMMatrixPerspectiveFovLH と同じ. 深度は near で 0, far で 1)
+ */
+inline Matrix4 MatrixPerspectiveFovLH(float fov_y, float aspect, float near_z, float far_z) {
+  const float h = 1.0f / std::tan(fov_y * 0.5f);
+  const float range = far_z / (far_z - near_z);
+  Matrix4 r;
+  r.m[0][0] = h / aspect;
+  r.m[1][1] = h;
+  r.m[2][2] = range;
+  r.m[2][3] = 1.0f;
+  r.m[3][2] = -range * near_z;
+  r.m[3][3] = 0.0f;
+  return r;
+}
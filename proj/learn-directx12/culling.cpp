@@ -0,0 +1,386 @@
+#include "culling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "command_recording.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// メッシュの分からない描画の箱 (どの平面の外にもならない)
+constexpr float kUnboundedExtent = 1e30f;
+// これより w が小さい頂点はカメラの後ろかニアクリップ面の近くとみなす
+constexpr float kMinClipW = 1e-5f;
+
+double MicrosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+Float4 Column(const Matrix4& m, int c) { return {m.m[0][c], m.m[1][c], m.m[2][c], m.m[3][c]}; }
+
+Float4 NormalizePlane(const Float4& p) {
+  const float len = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+  return len > 0.0f ? Float4{p.x / len, p.y / len, p.z / len, p.w / len} : p;
+}
+
+}  // namespace
+
+BoundingBox ComputeIndexRangeBounds(const CullingMesh& mesh, uint32_t index_offset, uint32_t index_count) {
+  BoundingBox box;
+  if (mesh.indices == nullptr || index_offset >= mesh.index_count) {
+    return box;
+  }
+  const std::size_t end = std::min<std::size_t>(std::size_t(index_offset) + index_count, mesh.index_count);
+  float min_x = box.min.x, min_y = box.min.y, min_z = box.min.z;
+  float max_x = box.max.x, max_y = box.max.y, max_z = box.max.z;
+  bool any = false;
+  for (std::size_t i = index_offset; i < end; ++i) {
+    const uint16_t v = mesh.indices[i];
+    if (v >= mesh.vertex_count) {
+      continue;
+    }
+    if (!any) {
+      min_x = max_x = mesh.px[v];
+      min_y = max_y = mesh.py[v];
+      min_z = max_z = mesh.pz[v];
+      any = true;
+      continue;
+    }
+    min_x = std::min(min_x, mesh.px[v]);
+    min_y = std::min(min_y, mesh.py[v]);
+    min_z = std::min(min_z, mesh.pz[v]);
+    max_x = std::max(max_x, mesh.px[v]);
+    max_y = std::max(max_y, mesh.py[v]);
+    max_z = std::max(max_z, mesh.pz[v]);
+  }
+  if (any) {
+    box.min = {min_x, min_y, min_z};
+    box.max = {max_x, max_y, max_z};
+  }
+  return box;
+}
+
+Frustum ExtractFrustum(const Matrix4& world_view_proj) {
+  // clip = p * M なので, クリップ座標の各成分は M の列との内積. -w <= x <= w, -w <= y <= w, 0 <= z <= w が内側
+  const Float4 c0 = Column(world_view_proj, 0);
+  const Float4 c1 = Column(world_view_proj, 1);
+  const Float4 c2 = Column(world_view_proj, 2);
+  const Float4 c3 = Column(world_view_proj, 3);
+  auto add = [](const Float4& a, const Float4& b) { return Float4{a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w}; };
+  auto sub = [](const Float4& a, const Float4& b) { return Float4{a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w}; };
+  Frustum frustum;
+  frustum.planes[0] = NormalizePlane(add(c3, c0));
+  frustum.planes[1] = NormalizePlane(sub(c3, c0));
+  frustum.planes[2] = NormalizePlane(add(c3, c1));
+  frustum.planes[3] = NormalizePlane(sub(c3, c1));
+  frustum.planes[4] = NormalizePlane(c2);
+  frustum.planes[5] = NormalizePlane(sub(c3, c2));
+  return frustum;
+}
+
+////////////////
+// DrawCuller //
+////////////////
+
+DrawCuller::DrawCuller(const Options& options) : options_(options) {
+  options_.depth_width = std::max<uint32_t>(options_.depth_width, 1);
+  options_.depth_height = std::max<uint32_t>(options_.depth_height, 1);
+}
+
+void DrawCuller::SetCommands(const std::vector<DrawCommand>& commands,
+                             const std::function<bool(uint32_t material)>& is_occluder) {
+  commands_ = commands;
+  draws_.clear();
+  uint32_t geometry = DrawState::kNone;
+  uint32_t material = DrawState::kNone;
+  for (const DrawCommand& command : commands_) {
+    switch (command.type) {
+      case DrawCommandType::kSetGeometry:
+        geometry = command.value;
+        break;
+      case DrawCommandType::kSetMaterial:
+        material = command.value;
+        break;
+      case DrawCommandType::kDrawIndexed:
+        draws_.push_back({geometry, command.offset, command.value, !is_occluder || is_occluder(material)});
+        break;
+      default:
+        break;
+    }
+  }
+  meshes_.clear();
+  bounds_.assign(draws_.size(), BoundingBox());
+  visible_.assign(draws_.size(), 1);
+  UpdateBounds({});
+}
+
+void DrawCuller::UpdateBounds(const std::vector<CullingMesh>& meshes) {
+  const auto start = std::chrono::steady_clock::now();
+  meshes_ = meshes;
+  const std::size_t padded = (draws_.size() + 3) / 4 * 4;
+  for (auto* v : {&min_x_, &min_y_, &min_z_}) {
+    v->assign(padded, 1.0f);
+  }
+  for (auto* v : {&max_x_, &max_y_, &max_z_}) {
+    v->assign(padded, -1.0f);
+  }
+  for (std::size_t i = 0; i < draws_.size(); ++i) {
+    const Draw& draw = draws_[i];
+    BoundingBox& box = bounds_[i];
+    if (draw.geometry < meshes_.size()) {
+      box = ComputeIndexRangeBounds(meshes_[draw.geometry], draw.index_offset, draw.index_count);
+    } else {
+      box.min = {-kUnboundedExtent, -kUnboundedExtent, -kUnboundedExtent};
+      box.max = {kUnboundedExtent, kUnboundedExtent, kUnboundedExtent};
+    }
+    min_x_[i] = box.min.x;
+    min_y_[i] = box.min.y;
+    min_z_[i] = box.min.z;
+    max_x_[i] = box.max.x;
+    max_y_[i] = box.max.y;
+    max_z_[i] = box.max.z;
+  }
+  stats_.bounds_us = MicrosecondsSince(start);
+}
+
+const std::vector<DrawCommand>& DrawCuller::Cull(const Matrix4& world_view_proj) {
+  const auto start = std::chrono::steady_clock::now();
+  stats_.draws = draws_.size();
+  stats_.frustum_culled = 0;
+  stats_.occlusion_culled = 0;
+  stats_.occluder_triangles = 0;
+  stats_.occlusion_us = 0.0;
+
+  if (options_.frustum) {
+    CullFrustum(ExtractFrustum(world_view_proj));
+  } else {
+    std::fill(visible_.begin(), visible_.end(), uint8_t(1));
+  }
+  for (std::size_t i = 0; i < draws_.size(); ++i) {
+    if (bounds_[i].Empty()) {
+      visible_[i] = 0;  // 描く三角形が無い
+    }
+    stats_.frustum_culled += visible_[i] ? 0 : 1;
+  }
+  stats_.frustum_us = MicrosecondsSince(start);
+
+  if (options_.occlusion) {
+    const auto occlusion_start = std::chrono::steady_clock::now();
+    RasterizeOccluders(world_view_proj);
+    for (std::size_t i = 0; i < draws_.size(); ++i) {
+      if (visible_[i] && IsOccluded(bounds_[i], world_view_proj)) {
+        visible_[i] = 0;
+        ++stats_.occlusion_culled;
+      }
+    }
+    stats_.occlusion_us = MicrosecondsSince(occlusion_start);
+  }
+
+  BuildCommands();
+  stats_.cull_us = MicrosecondsSince(start);
+  return output_;
+}
+
+void DrawCuller::CullFrustum(const Frustum& frustum) {
+  // 平面ごとに, 法線方向に最も遠い箱の頂点が外側にあれば箱全体が外側
+  const float* corner[6][3];
+  for (int p = 0; p < 6; ++p) {
+    const Float4& plane = frustum.planes[p];
+    corner[p][0] = plane.x >= 0.0f ? max_x_.data() : min_x_.data();
+    corner[p][1] = plane.y >= 0.0f ? max_y_.data() : min_y_.data();
+    corner[p][2] = plane.z >= 0.0f ? max_z_.data() : min_z_.data();
+  }
+  const std::size_t count = draws_.size();
+  std::size_t i = 0;
+#ifdef CULLING_USE_SSE
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= min_x_.size(); i += 4) {
+    __m128 outside = _mm_setzero_ps();
+    for (int p = 0; p < 6; ++p) {
+      const Float4& plane = frustum.planes[p];
+      const __m128 d = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), _mm_loadu_ps(corner[p][0] + i)),
+                     _mm_mul_ps(_mm_set1_ps(plane.y), _mm_loadu_ps(corner[p][1] + i))),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), _mm_loadu_ps(corner[p][2] + i)), _mm_set1_ps(plane.w)));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(d, zero));
+    }
+    const int mask = _mm_movemask_ps(outside);
+    for (std::size_t lane = 0; lane < 4 && i + lane < count; ++lane) {
+      visible_[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; ++p) {
+      const Float4& plane = frustum.planes[p];
+      outside = plane.x * corner[p][0][i] + plane.y * corner[p][1][i] + plane.z * corner[p][2][i] + plane.w < 0.0f;
+    }
+    visible_[i] = outside ? 0 : 1;
+  }
+}
+
+void DrawCuller::RasterizeOccluders(const Matrix4& world_view_proj) {
+  const int width = static_cast<int>(options_.depth_width);
+  const int height = static_cast<int>(options_.depth_height);
+  depth_.assign(std::size_t(width) * height, 1.0f);
+
+  struct ScreenVertex {
+    float x, y, z;
+    bool valid;
+  };
+  auto project = [&](const CullingMesh& mesh, uint16_t v) {
+    ScreenVertex s = {0.0f, 0.0f, 0.0f, false};
+    if (v >= mesh.vertex_count) {
+      return s;
+    }
+    const Float4 clip = Transform({mesh.px[v], mesh.py[v], mesh.pz[v], 1.0f}, world_view_proj);
+    if (clip.w < kMinClipW || clip.z < 0.0f) {
+      return s;
+    }
+    const float inv_w = 1.0f / clip.w;
+    s.x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+    s.y = (0.5f - clip.y * inv_w * 0.5f) * height;
+    s.z = clip.z * inv_w;
+    s.valid = true;
+    return s;
+  };
+
+  for (std::size_t d = 0; d < draws_.size(); ++d) {
+    const Draw& draw = draws_[d];
+    if (!visible_[d] || !draw.occluder || draw.geometry >= meshes_.size()) {
+      continue;
+    }
+    const CullingMesh& mesh = meshes_[draw.geometry];
+    const std::size_t end = std::min<std::size_t>(std::size_t(draw.index_offset) + draw.index_count, mesh.index_count);
+    for (std::size_t i = draw.index_offset; i + 3 <= end; i += 3) {
+      ScreenVertex a = project(mesh, mesh.indices[i]);
+      ScreenVertex b = project(mesh, mesh.indices[i + 1]);
+      const ScreenVertex c = project(mesh, mesh.indices[i + 2]);
+      if (!a.valid || !b.valid || !c.valid) {
+        continue;  // ニアクリップ面にかかる三角形は遮蔽物にしない
+      }
+      float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+      if (area == 0.0f) {
+        continue;
+      }
+      if (area < 0.0f) {  // 両面を描くので向きを揃える
+        std::swap(a, b);
+        area = -area;
+      }
+      const int x0 = std::max(0, static_cast<int>(std::floor(std::min({a.x, b.x, c.x}))));
+      const int x1 = std::min(width - 1, static_cast<int>(std::ceil(std::max({a.x, b.x, c.x}))));
+      const int y0 = std::max(0, static_cast<int>(std::floor(std::min({a.y, b.y, c.y}))));
+      const int y1 = std::min(height - 1, static_cast<int>(std::ceil(std::max({a.y, b.y, c.y}))));
+      if (x0 > x1 || y0 > y1) {
+        continue;
+      }
+      ++stats_.occluder_triangles;
+      const float inv_area = 1.0f / area;
+      for (int y = y0; y <= y1; ++y) {
+        const float py = y + 0.5f;
+        float* row = depth_.data() + std::size_t(y) * width;
+        for (int x = x0; x <= x1; ++x) {
+          const float px = x + 0.5f;
+          // 画素の中心が三角形の内側か (辺の上も含む)
+          const float w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+          const float w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+          const float w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+          if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+            continue;
+          }
+          const float z = (w0 * a.z + w1 * b.z + w2 * c.z) * inv_area;
+          row[x] = std::min(row[x], z);
+        }
+      }
+    }
+  }
+}
+
+bool DrawCuller::IsOccluded(const BoundingBox& box, const Matrix4& world_view_proj) const {
+  const int width = static_cast<int>(options_.depth_width);
+  const int height = static_cast<int>(options_.depth_height);
+  float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+  float nearest = 1.0f;
+  for (int corner = 0; corner < 8; ++corner) {
+    const Float4 p = {corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y,
+                      corner & 4 ? box.max.z : box.min.z, 1.0f};
+    const Float4 clip = Transform(p, world_view_proj);
+    if (clip.w < kMinClipW || clip.z < 0.0f) {
+      return false;  // カメラの後ろやニアクリップ面にかかる箱は判定しない
+    }
+    const float inv_w = 1.0f / clip.w;
+    const float x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+    const float y = (0.5f - clip.y * inv_w * 0.5f) * height;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+    nearest = std::min(nearest, clip.z * inv_w);
+  }
+  // 矩形に重なる画素と, その周囲 1 画素 (遮蔽物の縁からはみ出す部分を必ず画素の中心で拾うため)
+  const int x0 = std::max(0, static_cast<int>(std::floor(min_x)) - 1);
+  const int x1 = std::min(width - 1, static_cast<int>(std::ceil(max_x)) + 1);
+  const int y0 = std::max(0, static_cast<int>(std::floor(min_y)) - 1);
+  const int y1 = std::min(height - 1, static_cast<int>(std::ceil(max_y)) + 1);
+  if (x0 > x1 || y0 > y1) {
+    return false;
+  }
+  for (int y = y0; y <= y1; ++y) {
+    const float* row = depth_.data() + std::size_t(y) * width;
+    for (int x = x0; x <= x1; ++x) {
+      if (row[x] >= nearest) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void DrawCuller::BuildCommands() {
+  output_.clear();
+  DrawState current;
+  DrawState emitted;
+  std::size_t draw = 0;
+  stats_.visible = 0;
+  stats_.visible_indices = 0;
+  stats_.culled_indices = 0;
+  for (const DrawCommand& command : commands_) {
+    switch (command.type) {
+      case DrawCommandType::kSetPipeline:
+        current.pipeline = command.value;
+        break;
+      case DrawCommandType::kSetGeometry:
+        current.geometry = command.value;
+        break;
+      case DrawCommandType::kSetMaterial:
+        current.material = command.value;
+        break;
+      case DrawCommandType::kDrawIndexed:
+        if (!visible_[draw++]) {
+          stats_.culled_indices += command.value;
+          break;
+        }
+        if (current.pipeline != emitted.pipeline) {
+          output_.push_back({DrawCommandType::kSetPipeline, current.pipeline, 0, 0});
+        }
+        if (current.geometry != emitted.geometry) {
+          output_.push_back({DrawCommandType::kSetGeometry, current.geometry, 0, 0});
+        }
+        if (current.material != emitted.material) {
+          output_.push_back({DrawCommandType::kSetMaterial, current.material, 0, 0});
+        }
+        emitted = current;
+        output_.push_back(command);
+        ++stats_.visible;
+        stats_.visible_indices += command.value;
+        break;
+    }
+  }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "cpu_math.h"
+#include "draw_list.h"
+
+/**
+ * @brief 軸に平行な境界ボックス. min が max より大きければ空 (何も描かない)
+ */
+struct BoundingBox {
+  Float3 min = {1.0f, 1.0f, 1.0f};
+  Float3 max = {-1.0f, -1.0f, -1.0f};
+
+  bool Empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+};
+
+/**
+ * @brief カリングに使うメッシュ (位置は structure of arrays)
+ * @details SkinningStreams (バインドポーズ) や SkinnedVertices (スキニング後) の配列をそのまま指せる.
+ */
+struct CullingMesh {
+  const float* px = nullptr;
+  const float* py = nullptr;
+  const float* pz = nullptr;
+  std::size_t vertex_count = 0;
+  const uint16_t* indices = nullptr;
+  std::size_t index_count = 0;
+};
+
+/**
+ * @brief mesh のインデックス [index_offset, index_offset + index_count) が参照する頂点の境界ボックス
+ * @details 範囲外のインデックス・頂点は無視する.
+ */
+BoundingBox ComputeIndexRangeBounds(const CullingMesh& mesh, uint32_t index_offset, uint32_t index_count);
+
+/**
+ * @brief 視錐台の 6 平面 (左, 右, 下, 上, 手前, 奥)
+ * @details 平面 (x, y, z, w) は x * p.x + y * p.y + z * p.z + w >= 0 が内側. (x, y, z) は正規化してある.
+ */
+struct Frustum {
+  Float4 planes[6];
+};
+
+/**
+ * @brief world * view * proj (行ベクトルの規約, D3D の深度範囲 0 - 1) から視錐台を取り出す
+ * @details 平面はこの行列を掛ける前の空間 (world を含めればモデル空間) のもの.
+ */
+Frustum ExtractFrustum(const Matrix4& world_view_proj);
+
+/**
+ * @brief 描画コマンドごとに見えるかを判定し, 見える描画だけのコマンド列を作る
+ * @details
+ *  - 境界ボックスは kDrawIndexed のインデックス範囲が参照する頂点から作る. DrawListBuilder が結合した描画
+ *    (状態が同じで範囲が連続するマテリアル) は 1 つの箱になる
+ *  - 視錐台カリングは箱を 4 つずつ SSE で判定する (全ての頂点が 1 つの平面の外にある箱だけを除く)
+ *  - Options::occlusion なら, 視錐台に残った遮蔽物 (不透明) の三角形を粗い深度バッファに描き,
+ *    箱を画面に投影した矩形 (周囲 1 画素を含む) の全ての画素で箱の最も手前の深度より手前に遮蔽物がある描画を除く.
+ *    ニアクリップ面にかかる三角形は遮蔽物にしない (隠れるものが減るだけで, 見えるものは消さない)
+ *  GPU には依存しない.
+ *
+ *   DrawCuller culler;
+ *   culler.SetCommands(draw_list.Commands());
+ *   culler.UpdateBounds({mesh});                  // 頂点が変わったら (スキニングなど)
+ *   const auto& commands = culler.Cull(world_view_proj);  // 毎フレーム
+ */
+class DrawCuller {
+ public:
+  struct Options {
+    bool frustum = true;
+    bool occlusion = false;
+    uint32_t depth_width = 256;  // 遮蔽判定の深度バッファの大きさ
+    uint32_t depth_height = 128;
+  };
+
+  struct Stats {
+    std::size_t draws = 0;  // kDrawIndexed の数
+    std::size_t visible = 0;
+    std::size_t frustum_culled = 0;
+    std::size_t occlusion_culled = 0;
+    uint64_t visible_indices = 0;
+    uint64_t culled_indices = 0;
+    std::size_t occluder_triangles = 0;  // 深度バッファに描いた三角形
+    double bounds_us = 0.0;              // 最後の UpdateBounds() にかかった時間
+    double frustum_us = 0.0;             // 最後の Cull() の視錐台カリング
+    double occlusion_us = 0.0;           // 最後の Cull() の遮蔽物の描画と判定
+    double cull_us = 0.0;                // 最後の Cull() 全体 (コマンド列の作成を含む)
+  };
+
+  DrawCuller() : DrawCuller(Options()) {}
+  explicit DrawCuller(const Options& options);
+
+  /**
+   * @brief 判定するコマンド列を設定する (DrawListBuilder::Build() の後に 1 回)
+   * @param is_occluder マテリアルが深度を書くか (半透明なら false). 空なら全ての描画を遮蔽物にする
+   */
+  void SetCommands(const std::vector<DrawCommand>& commands,
+                   const std::function<bool(uint32_t material)>& is_occluder = {});
+
+  /**
+   * @brief 境界ボックスを作り直す
+   * @param meshes ジオメトリ番号 (kSetGeometry) ごとのメッシュ. 遮蔽物を描くのにも使うので,
+   *               次に UpdateBounds() を呼ぶまで指している配列を保つこと. メッシュの無い描画は常に見えるものとする
+   */
+  void UpdateBounds(const std::vector<CullingMesh>& meshes);
+
+  /**
+   * @brief world_view_proj で見える描画だけのコマンド列を返す
+   * @details kSet* は状態の変わる描画の直前にだけ出す. 返した参照は次の Cull() まで有効.
+   */
+  const std::vector<DrawCommand>& Cull(const Matrix4& world_view_proj);
+
+  // kDrawIndexed の順
+  const std::vector<BoundingBox>& Bounds() const { return bounds_; }
+  // kDrawIndexed の順. 1 なら最後の Cull() で見えると判定した
+  const std::vector<uint8_t>& Visibility() const { return visible_; }
+  // 最後の Cull() で遮蔽物を描いた深度バッファ (depth_width * depth_height, 1.0 が最も奥)
+  const std::vector<float>& DepthBuffer() const { return depth_; }
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct Draw {
+    uint32_t geometry;
+    uint32_t index_offset;
+    uint32_t index_count;
+    bool occluder;
+  };
+
+  void CullFrustum(const Frustum& frustum);
+  void RasterizeOccluders(const Matrix4& world_view_proj);
+  bool IsOccluded(const BoundingBox& box, const Matrix4& world_view_proj) const;
+  void BuildCommands();
+
+  Options options_;
+  std::vector<DrawCommand> commands_;
+  std::vector<Draw> draws_;
+  std::vector<CullingMesh> meshes_;
+  std::vector<BoundingBox> bounds_;
+  // 視錐台カリング用に成分ごとに並べた箱 (4 の倍数に切り上げ, 余りは空の箱)
+  std::vector<float> min_x_, min_y_, min_z_, max_x_, max_y_, max_z_;
+  std::vector<uint8_t> visible_;
+  std::vector<float> depth_;
+  std::vector<DrawCommand> output_;
+  Stats stats_;
+};
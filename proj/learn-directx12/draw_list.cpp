@@ -0,0 +1,143 @@
+#include "draw_list.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace {
+
+/**
+ * @brief 値を bits ビットに収める (収まらなければ最大値にする)
+ */
+uint64_t Field(uint32_t value, int bits) { return std::min<uint64_t>(value, (uint64_t(1) << bits) - 1); }
+
+/**
+ * @brief 0.0 - 1.0 の深度を bits ビットの整数にする
+ */
+uint64_t QuantizeDepth(float depth, int bits) {
+  const float clamped = std::clamp(depth, 0.0f, 1.0f);  // NaN は 0 になる
+  const uint64_t max = (uint64_t(1) << bits) - 1;
+  return static_cast<uint64_t>(clamped * static_cast<float>(max) + 0.5f) & max;
+}
+
+}  // namespace
+
+uint32_t DrawListBuilder::AddMaterial(const MaterialForHlsl& constants, const TextureSet& textures) {
+  auto texture_set = texture_set_ids_.emplace(textures, static_cast<uint32_t>(texture_sets_.size()));
+  if (texture_set.second) {
+    texture_sets_.push_back(textures);
+  }
+  auto constant = constants_ids_.emplace(constants, static_cast<uint32_t>(constants_.size()));
+  if (constant.second) {
+    constants_.push_back(constants);
+  }
+  const uint64_t key = (uint64_t(texture_set.first->second) << 32) | constant.first->second;
+  auto material = material_ids_.emplace(key, static_cast<uint32_t>(materials_.size()));
+  if (material.second) {
+    materials_.push_back({texture_set.first->second, constant.first->second});
+  }
+  return material.first->second;
+}
+
+void DrawListBuilder::AddDraw(const DrawItem& item) {
+  assert(item.material < materials_.size());
+  assert(item.pipeline < kMaxPipelines);
+  if (item.index_count > 0) {
+    items_.push_back(item);
+  }
+}
+
+uint64_t DrawListBuilder::MakeSortKey(const DrawItem& item) const {
+  const MaterialEntry& material = materials_[item.material];
+  uint64_t key = (item.translucent ? uint64_t(1) : 0) << 63;
+  if (item.translucent) {
+    // 奥から手前へ描かないと合成結果が変わるので, 深度をパイプラインより優先し, 状態ではまとめない.
+    // 同じ深度なら登録順 (MMD と同じ) になる
+    key |= QuantizeDepth(1.0f - item.depth, 24) << 39;
+    key |= Field(item.pipeline, 7) << 32;
+  } else {
+    key |= Field(item.pipeline, 7) << 56;
+    key |= Field(material.texture_set, 16) << 40;
+    key |= Field(material.constants, 16) << 24;
+    key |= Field(item.geometry, 12) << 12;
+    key |= QuantizeDepth(item.depth, 12);
+  }
+  return key;
+}
+
+void DrawListBuilder::Build() {
+  commands_.clear();
+  stats_ = {};
+  stats_.draws = items_.size();
+  stats_.unique_materials = materials_.size();
+
+  // キーが同じ描画は登録順を保つ (同じモデルのマテリアルはインデックス順に並び, 結合できる)
+  std::vector<std::pair<uint64_t, uint32_t>> order(items_.size());
+  for (std::size_t i = 0; i < items_.size(); ++i) {
+    order[i] = {MakeSortKey(items_[i]), static_cast<uint32_t>(i)};
+  }
+  std::sort(order.begin(), order.end());
+
+  commands_.reserve(items_.size() * 2);
+  const DrawItem* current = nullptr;  // 直前の描画 (状態の比較用)
+  std::size_t pending_draw = 0;       // 結合先の kDrawIndexed の位置
+  for (auto& entry : order) {
+    const DrawItem& item = items_[entry.second];
+    const bool pipeline_changed = current == nullptr || item.pipeline != current->pipeline;
+    const bool geometry_changed = current == nullptr || item.geometry != current->geometry;
+    const bool material_changed = current == nullptr || item.material != current->material;
+    if (pipeline_changed) {
+      commands_.push_back({DrawCommandType::kSetPipeline, item.pipeline, 0, 0});
+      ++stats_.pipeline_changes;
+    }
+    if (geometry_changed) {
+      commands_.push_back({DrawCommandType::kSetGeometry, item.geometry, 0, 0});
+      ++stats_.geometry_changes;
+    }
+    if (material_changed) {
+      commands_.push_back({DrawCommandType::kSetMaterial, item.material, 0, 0});
+      ++stats_.material_changes;
+    }
+
+    const bool state_changed = pipeline_changed || geometry_changed || material_changed;
+    if (!state_changed) {
+      DrawCommand& draw = commands_[pending_draw];
+      if (draw.offset + draw.value == item.index_offset) {
+        draw.value += item.index_count;
+        current = &item;
+        continue;
+      }
+    }
+    pending_draw = commands_.size();
+    commands_.push_back({DrawCommandType::kDrawIndexed, item.index_count, item.index_offset, 0});
+    ++stats_.draw_commands;
+    current = &item;
+  }
+  items_.clear();
+}
+
+void DrawListBuilder::Clear() {
+  texture_sets_.clear();
+  constants_.clear();
+  materials_.clear();
+  texture_set_ids_.clear();
+  constants_ids_.clear();
+  material_ids_.clear();
+  items_.clear();
+  commands_.clear();
+  stats_ = {};
+}
+
+DrawListBuilder::Stats DrawListBuilder::CountUnsortedStateChanges(const std::vector<DrawItem>& items) {
+  Stats stats;
+  stats.draws = items.size();
+  stats.draw_commands = items.size();
+  const DrawItem* current = nullptr;
+  for (auto& item : items) {
+    stats.pipeline_changes += current == nullptr || item.pipeline != current->pipeline ? 1 : 0;
+    stats.geometry_changes += current == nullptr || item.geometry != current->geometry ? 1 : 0;
+    stats.material_changes += current == nullptr || item.material != current->material ? 1 : 0;
+    current = &item;
+  }
+  return stats;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "material.h"
+
+/**
+ * @brief マテリアルが参照するテクスチャの組 (t0 - t3)
+ * @details 値はバックエンドが決める識別子 (リソースのアドレスや TextureContentStore で共有した Image のアドレスなど).
+ *          0 は「テクスチャなし」(既定の白・黒・グラデーションのテクスチャ) を表す.
+ */
+struct TextureSet {
+  uint64_t tex = 0;
+  uint64_t sph = 0;
+  uint64_t spa = 0;
+  uint64_t toon = 0;
+
+  bool operator==(const TextureSet& other) const {
+    return tex == other.tex && sph == other.sph && spa == other.spa && toon == other.toon;
+  }
+};
+
+/**
+ * @brief 描画 1 回分の要求
+ */
+struct DrawItem {
+  uint32_t pipeline = 0;     // パイプラインステート (DrawListBuilder::kMaxPipelines 未満)
+  bool translucent = false;  // 半透明なら不透明の後に奥から手前の順で描く
+  uint32_t geometry = 0;     // 頂点・インデックスバッファ (モデル) の番号
+  uint32_t material = 0;     // DrawListBuilder::AddMaterial の戻り値
+  uint32_t index_offset = 0;
+  uint32_t index_count = 0;
+  float depth = 0.0f;  // 正規化したカメラからの距離 (0.0 - 1.0)
+};
+
+enum class DrawCommandType : uint32_t {
+  kSetPipeline,  // value: パイプライン
+  kSetGeometry,  // value: ジオメトリ
+  kSetMaterial,  // value: マテリアル (重複を除いた番号)
+  kDrawIndexed,  // value: インデックス数, offset: 開始インデックス
+};
+
+/**
+ * @brief バックエンドが先頭から順に実行するコマンド (16 bytes)
+ */
+struct DrawCommand {
+  DrawCommandType type;
+  uint32_t value;
+  uint32_t offset;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(DrawCommand) == 16, "draw command must be 16 bytes");
+
+/**
+ * @brief 描画要求をソート・結合してコマンド列にする (グラフィックス API には依存しない)
+ * @details
+ *  - マテリアルは MaterialForHlsl とテクスチャの組が同じなら 1 つにまとめる
+ *  - 描画はソートキー (64 bit) の順に並べ, 状態が変わるところでだけ kSet* を出す
+ *  - 同じ状態で インデックス範囲が連続する描画は 1 回の kDrawIndexed にする
+ *
+ * ソートキーの並び (上位ビットから)
+ *  不透明: translucent(1) | pipeline(7) | texture set(16) | constants(16) | geometry(12) | depth(12, 手前から)
+ *  半透明: translucent(1) | depth(24, 奥から) | pipeline(7) | 0(32)
+ *  キーが同じ描画は登録順に並ぶ.
+ *  番号が各フィールドに収まらない場合はキーの上での並びが崩れるだけで, 出力するコマンドは正しい.
+ *
+ *   DrawListBuilder builder;
+ *   uint32_t m = builder.AddMaterial(constants, textures);
+ *   builder.AddDraw({pipeline, false, model, m, offset, count, depth});
+ *   builder.Build();
+ *   for (auto& c : builder.Commands()) { ... }
+ */
+class DrawListBuilder {
+ public:
+  static constexpr uint32_t kMaxPipelines = 128;
+
+  struct Stats {
+    std::size_t draws = 0;             // AddDraw した数
+    std::size_t draw_commands = 0;     // 結合後の kDrawIndexed の数
+    std::size_t pipeline_changes = 0;  // kSetPipeline の数
+    std::size_t geometry_changes = 0;  // kSetGeometry の数
+    std::size_t material_changes = 0;  // kSetMaterial の数
+    std::size_t unique_materials = 0;  // 重複を除いたマテリアル数
+  };
+
+  /**
+   * @brief マテリアルを登録し, 重複を除いた番号を返す
+   */
+  uint32_t AddMaterial(const MaterialForHlsl& constants, const TextureSet& textures);
+
+  void AddDraw(const DrawItem& item);
+
+  /**
+   * @brief 描画要求をソートしてコマンド列を作る. 描画要求は消える (マテリアルは残る)
+   */
+  void Build();
+
+  /**
+   * @brief 登録されたマテリアルを全て消す
+   */
+  void Clear();
+
+  const std::vector<DrawCommand>& Commands() const { return commands_; }
+  const Stats& GetStats() const { return stats_; }
+
+  std::size_t MaterialCount() const { return materials_.size(); }
+  const MaterialForHlsl& MaterialConstants(uint32_t material) const {
+    return constants_[materials_[material].constants];
+  }
+  const TextureSet& MaterialTextures(uint32_t material) const {
+    return texture_sets_[materials_[material].texture_set];
+  }
+
+  /**
+   * @brief ソートキーを作る
+   */
+  uint64_t MakeSortKey(const DrawItem& item) const;
+
+  /**
+   * @brief ソートせず登録順に 1 回ずつ描いた場合の状態変更の数 (比較用)
+   */
+  static Stats CountUnsortedStateChanges(const std::vector<DrawItem>& items);
+
+ private:
+  struct MaterialEntry {
+    uint32_t texture_set;
+    uint32_t constants;
+  };
+  // TextureSet と MaterialForHlsl はパディングが無いので, バイト列として比較する
+  struct BytesHash {
+    template <typename T>
+    std::size_t operator()(const T& value) const {
+      return static_cast<std::size_t>(HashBytes(&value, sizeof(value)));
+    }
+  };
+  struct BytesEqual {
+    template <typename T>
+    bool operator()(const T& a, const T& b) const {
+      return std::memcmp(&a, &b, sizeof(T)) == 0;
+    }
+  };
+
+  std::vector<TextureSet> texture_sets_;
+  std::vector<MaterialForHlsl> constants_;
+  std::vector<MaterialEntry> materials_;
+  std::unordered_map<TextureSet, uint32_t, BytesHash, BytesEqual> texture_set_ids_;
+  std::unordered_map<MaterialForHlsl, uint32_t, BytesHash, BytesEqual> constants_ids_;
+  std::unordered_map<uint64_t, uint32_t> material_ids_;  // (texture set << 32 | constants) -> マテリアル
+
+  std::vector<DrawItem> items_;
+  std::vector<DrawCommand> commands_;
+  Stats stats_;
+};
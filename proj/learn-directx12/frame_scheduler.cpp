@@ -0,0 +1,47 @@
+#include "frame_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+#include "profiler.h"
+
+FrameScheduler::FrameScheduler(uint32_t frames_in_flight, GpuTimeline timeline)
+    : timeline_(std::move(timeline)), slot_values_(std::max<uint32_t>(frames_in_flight, 1), 0) {
+  if (!timeline_.signal || !timeline_.completed_value || !timeline_.wait) {
+    throw std::invalid_argument("FrameScheduler: incomplete GpuTimeline");
+  }
+}
+
+uint32_t FrameScheduler::BeginFrame() {
+  const uint64_t completed = timeline_.completed_value();
+  stats_.max_frames_ahead = std::max(stats_.max_frames_ahead, last_value_ - std::min(completed, last_value_));
+  const uint64_t value = slot_values_[slot_];
+  if (value > completed) {
+    Wait(value);
+  }
+  return slot_;
+}
+
+void FrameScheduler::EndFrame() {
+  ++last_value_;
+  timeline_.signal(last_value_);
+  slot_values_[slot_] = last_value_;
+  slot_ = (slot_ + 1) % FramesInFlight();
+  ++stats_.frames;
+}
+
+void FrameScheduler::WaitIdle() {
+  if (last_value_ > timeline_.completed_value()) {
+    Wait(last_value_);
+  }
+}
+
+void FrameScheduler::Wait(uint64_t value) {
+  ProfileScope profile("fence wait");
+  const auto start = std::chrono::steady_clock::now();
+  timeline_.wait(value);
+  stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  ++stats_.waits;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief GPU のタイムライン (単調増加するフェンス値) を操作する関数の組
+ * @details D3D12 なら ID3D12CommandQueue::Signal / ID3D12Fence::GetCompletedValue / SetEventOnCompletion に対応する.
+ *          テストや計測では GPU の無い実装を渡せる.
+ */
+struct GpuTimeline {
+  // これまでに積んだコマンドが全て終わったら value を書き込む命令をキューに積む
+  std::function<void(uint64_t value)> signal;
+  // GPU が書き込み済みの最大の値
+  std::function<uint64_t()> completed_value;
+  // completed_value() >= value になるまで待つ
+  std::function<void(uint64_t value)> wait;
+};
+
+/**
+ * @brief 複数フレームを GPU に投げたままにして CPU の記録と GPU の実行を重ねる (GPU の API には依存しない)
+ * @details フレームごとのリソース (コマンドアロケーター・定数バッファなど) は frames_in_flight 個ずつ用意し,
+ *          BeginFrame() が返すスロットのものを使う. BeginFrame() はそのスロットを前回使ったフレームの完了だけを待つので,
+ *          GPU がフレーム N を実行している間に CPU はフレーム N + 1 を記録できる.
+ *          frames_in_flight = 1 なら毎フレーム GPU の完了を待つ (以前の動作と同じ). スレッドセーフではない.
+ *
+ *   FrameScheduler scheduler(2, timeline);
+ *   // フレームごと
+ *   auto slot = scheduler.BeginFrame();
+ *   allocators[slot]->Reset();  // slot の前回のフレームは終わっている
+ *   ... 記録して ExecuteCommandLists ...
+ *   scheduler.EndFrame();
+ *   // 終了時やフレームをまたぐリソースを作り直す前
+ *   scheduler.WaitIdle();
+ */
+class FrameScheduler {
+ public:
+  struct Stats {
+    uint64_t frames = 0;           // EndFrame() の回数
+    uint64_t waits = 0;            // BeginFrame() / WaitIdle() で GPU を待った回数 (終わっていたものは数えない)
+    double wait_seconds = 0.0;     // 待った時間の合計
+    uint64_t max_frames_ahead = 0; // GPU が終えていないフレーム数の最大値 (BeginFrame() の時点)
+  };
+
+  /**
+   * @param frames_in_flight 同時に GPU に投げておくフレーム数 (1 以上)
+   * @param timeline フェンスの操作
+   */
+  FrameScheduler(uint32_t frames_in_flight, GpuTimeline timeline);
+  FrameScheduler(const FrameScheduler&) = delete;
+  FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+  /**
+   * @brief フレームの記録を始める. スロットを前回使ったフレームが GPU で終わるまで待つ
+   * @return このフレームのリソースのスロット ([0, FramesInFlight()))
+   */
+  uint32_t BeginFrame();
+
+  /**
+   * @brief フレームのコマンドを全て投げた後に呼ぶ. フレームの終わりをタイムラインに積む
+   */
+  void EndFrame();
+
+  /**
+   * @brief 投げたフレームが全て GPU で終わるまで待つ
+   */
+  void WaitIdle();
+
+  uint32_t FramesInFlight() const { return static_cast<uint32_t>(slot_values_.size()); }
+  uint32_t CurrentSlot() const { return slot_; }
+  // 最後に EndFrame() したフレームのフェンス値
+  uint64_t LastSubmittedValue() const { return last_value_; }
+  // GPU が終えたフレームのフェンス値
+  uint64_t CompletedValue() const { return timeline_.completed_value(); }
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  void Wait(uint64_t value);
+
+  GpuTimeline timeline_;
+  std::vector<uint64_t> slot_values_;  // スロットを最後に使ったフレームのフェンス値 (0 は未使用)
+  uint32_t slot_ = 0;
+  uint64_t last_value_ = 0;
+  Stats stats_;
+};
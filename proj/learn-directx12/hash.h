@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 64 bit の非暗号学的ハッシュ (xxHash64 と同じアルゴリズム)
+ * @details テクスチャなどの内容比較用. 数 GB/s で処理できる.
+ */
+uint64_t HashBytes(const void* data, std::size_t size, uint64_t seed = 0);
+
+/**
+ * @brief 2 つのハッシュ値を合成する
+ */
+inline uint64_t HashCombine(uint64_t a, uint64_t b) {
+  return a ^ (b + 0x9e3779b97f4a7c15ull + (a << 6) + (a >> 2));
+}
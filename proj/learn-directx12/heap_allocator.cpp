@@ -0,0 +1,429 @@
+#include "heap_allocator.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+// 最上位ビットの位置 (value != 0)
+int Log2(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+// 最下位ビットの位置 (value != 0)
+int LowestBit(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+uint64_t AlignUp(uint64_t value, uint64_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+constexpr uint32_t kNoHeap = 0xffffffff;
+
+}  // namespace
+
+////////////////////
+// TLSF allocator //
+////////////////////
+
+TlsfAllocator::TlsfAllocator(uint64_t capacity, uint64_t granularity)
+    : capacity_(0), granularity_(std::max<uint64_t>(granularity, 1)) {
+  capacity_ = capacity & ~(granularity_ - 1);
+  for (auto& heads : free_heads_) {
+    std::fill(std::begin(heads), std::end(heads), kNull);
+  }
+  if (capacity_ != 0) {
+    const uint32_t block = NewBlock();
+    blocks_[block].offset = 0;
+    blocks_[block].size = capacity_;
+    InsertFree(block);
+  }
+}
+
+void TlsfAllocator::Mapping(uint64_t size, int* fl, int* sl) {
+  if (size < kSlCount) {
+    *fl = 0;
+    *sl = static_cast<int>(size);
+    return;
+  }
+  const int f = Log2(size);
+  *fl = f - kSlBits + 1;
+  *sl = static_cast<int>(size >> (f - kSlBits)) - kSlCount;
+}
+
+uint32_t TlsfAllocator::FindFree(uint64_t size) const {
+  // 区分の中の全てのブロックが size 以上になるように, 次の区分の先頭まで切り上げてから探す
+  uint64_t rounded = size;
+  if (size >= kSlCount) {
+    const uint64_t round = (uint64_t(1) << (Log2(size) - kSlBits)) - 1;
+    rounded = size <= ~uint64_t(0) - round ? size + round : ~uint64_t(0);
+  }
+  int fl, sl;
+  Mapping(rounded, &fl, &sl);
+  uint32_t sl_map = sl_bitmap_[fl] & (~0u << sl);
+  if (sl_map == 0) {
+    const uint64_t fl_map = fl + 1 < 64 ? fl_bitmap_ & (~uint64_t(0) << (fl + 1)) : 0;
+    if (fl_map != 0) {
+      fl = LowestBit(fl_map);
+      sl_map = sl_bitmap_[fl];
+    }
+  }
+  if (sl_map != 0) {
+    return free_heads_[fl][LowestBit(sl_map)];
+  }
+  // 大きい区分に空きが無ければ, size が属する区分のリストから入るものを探す (ヒープの残りが少ない時に取りこぼさない)
+  Mapping(size, &fl, &sl);
+  for (uint32_t block = free_heads_[fl][sl]; block != kNull; block = blocks_[block].next_free) {
+    if (blocks_[block].size >= size) {
+      return block;
+    }
+  }
+  return kNull;
+}
+
+void TlsfAllocator::InsertFree(uint32_t block) {
+  Block& b = blocks_[block];
+  int fl, sl;
+  Mapping(b.size, &fl, &sl);
+  b.free = true;
+  b.prev_free = kNull;
+  b.next_free = free_heads_[fl][sl];
+  if (b.next_free != kNull) {
+    blocks_[b.next_free].prev_free = block;
+  }
+  free_heads_[fl][sl] = block;
+  fl_bitmap_ |= uint64_t(1) << fl;
+  sl_bitmap_[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::RemoveFree(uint32_t block) {
+  Block& b = blocks_[block];
+  int fl, sl;
+  Mapping(b.size, &fl, &sl);
+  if (b.prev_free != kNull) {
+    blocks_[b.prev_free].next_free = b.next_free;
+  } else {
+    free_heads_[fl][sl] = b.next_free;
+    if (b.next_free == kNull) {
+      sl_bitmap_[fl] &= ~(1u << sl);
+      if (sl_bitmap_[fl] == 0) {
+        fl_bitmap_ &= ~(uint64_t(1) << fl);
+      }
+    }
+  }
+  if (b.next_free != kNull) {
+    blocks_[b.next_free].prev_free = b.prev_free;
+  }
+  b.free = false;
+  b.prev_free = kNull;
+  b.next_free = kNull;
+}
+
+uint32_t TlsfAllocator::NewBlock() {
+  if (!unused_blocks_.empty()) {
+    const uint32_t block = unused_blocks_.back();
+    unused_blocks_.pop_back();
+    blocks_[block] = {};
+    return block;
+  }
+  blocks_.emplace_back();
+  return static_cast<uint32_t>(blocks_.size() - 1);
+}
+
+void TlsfAllocator::DeleteBlock(uint32_t block) { unused_blocks_.push_back(block); }
+
+uint32_t TlsfAllocator::Split(uint32_t block, uint64_t size) {
+  const uint32_t rest = NewBlock();  // blocks_ が伸びるので参照はこの後で取る
+  Block& b = blocks_[block];
+  Block& r = blocks_[rest];
+  r.offset = b.offset + size;
+  r.size = b.size - size;
+  r.prev_physical = block;
+  r.next_physical = b.next_physical;
+  if (r.next_physical != kNull) {
+    blocks_[r.next_physical].prev_physical = rest;
+  }
+  b.size = size;
+  b.next_physical = rest;
+  return rest;
+}
+
+uint64_t TlsfAllocator::Allocate(uint64_t size, uint64_t alignment) {
+  size = AlignUp(std::max<uint64_t>(size, 1), granularity_);
+  alignment = std::max(alignment, granularity_);
+  // 空きブロックの先頭は granularity にしか揃っていないので, それより大きいアライメントは詰め物の分を足して探す
+  const uint64_t padding = alignment - granularity_;
+  if (size > capacity_ || padding > capacity_ - size) {
+    return kInvalidOffset;
+  }
+  uint32_t block = FindFree(size + padding);
+  if (block == kNull) {
+    return kInvalidOffset;
+  }
+  RemoveFree(block);
+
+  const uint64_t aligned = AlignUp(blocks_[block].offset, alignment);
+  if (aligned != blocks_[block].offset) {
+    // 前の詰め物を空きブロックとして残す (前のブロックは割り当て済みなので結合するものは無い)
+    const uint32_t front = block;
+    block = Split(front, aligned - blocks_[front].offset);
+    InsertFree(front);
+  }
+  if (blocks_[block].size > size) {
+    InsertFree(Split(block, size));
+  }
+
+  Block& b = blocks_[block];
+  b.alignment = alignment;
+  allocated_[b.offset] = block;
+  used_bytes_ += b.size;
+  return b.offset;
+}
+
+void TlsfAllocator::Free(uint64_t offset) {
+  auto it = allocated_.find(offset);
+  if (it == allocated_.end()) {
+    return;
+  }
+  uint32_t block = it->second;
+  allocated_.erase(it);
+  used_bytes_ -= blocks_[block].size;
+
+  // 前後の空きブロックと結合する
+  const uint32_t prev = blocks_[block].prev_physical;
+  if (prev != kNull && blocks_[prev].free) {
+    RemoveFree(prev);
+    blocks_[prev].size += blocks_[block].size;
+    blocks_[prev].next_physical = blocks_[block].next_physical;
+    if (blocks_[block].next_physical != kNull) {
+      blocks_[blocks_[block].next_physical].prev_physical = prev;
+    }
+    DeleteBlock(block);
+    block = prev;
+  }
+  const uint32_t next = blocks_[block].next_physical;
+  if (next != kNull && blocks_[next].free) {
+    RemoveFree(next);
+    blocks_[block].size += blocks_[next].size;
+    blocks_[block].next_physical = blocks_[next].next_physical;
+    if (blocks_[next].next_physical != kNull) {
+      blocks_[blocks_[next].next_physical].prev_physical = block;
+    }
+    DeleteBlock(next);
+  }
+  blocks_[block].alignment = 0;
+  InsertFree(block);
+}
+
+void TlsfAllocator::ForEachAllocation(
+    const std::function<void(uint64_t offset, uint64_t size, uint64_t alignment)>& f) const {
+  for (const auto& [offset, block] : allocated_) {
+    f(offset, blocks_[block].size, blocks_[block].alignment);
+  }
+}
+
+TlsfAllocator::Stats TlsfAllocator::GetStats() const {
+  Stats stats;
+  stats.capacity = capacity_;
+  stats.used_bytes = used_bytes_;
+  stats.free_bytes = capacity_ - used_bytes_;
+  stats.allocations = allocated_.size();
+  for (int fl = 0; fl < kFlCount; ++fl) {
+    if ((fl_bitmap_ >> fl & 1) == 0) {
+      continue;
+    }
+    for (int sl = 0; sl < kSlCount; ++sl) {
+      for (uint32_t block = free_heads_[fl][sl]; block != kNull; block = blocks_[block].next_free) {
+        ++stats.free_blocks;
+        stats.largest_free_block = std::max(stats.largest_free_block, blocks_[block].size);
+      }
+    }
+  }
+  return stats;
+}
+
+///////////////////////
+// heap suballocator //
+///////////////////////
+
+HeapSuballocator::HeapSuballocator(const Options& options, CreateHeap create_heap, DestroyHeap destroy_heap)
+    : options_(options), create_heap_(std::move(create_heap)), destroy_heap_(std::move(destroy_heap)) {
+  options_.granularity = std::max<uint64_t>(options_.granularity, 1);
+  options_.heap_size = std::max(AlignUp(options_.heap_size, options_.granularity), options_.granularity);
+}
+
+HeapSuballocator::~HeapSuballocator() {
+  for (auto& heap : heaps_) {
+    if (heap.handle != nullptr) {
+      destroy_heap_(heap.handle);
+    }
+  }
+}
+
+uint32_t HeapSuballocator::AddHeap(uint64_t size, bool dedicated) {
+  void* handle = create_heap_(size);
+  if (handle == nullptr) {
+    return kNoHeap;
+  }
+  ++heap_creations_;
+  Heap heap = {handle, std::make_unique<TlsfAllocator>(size, options_.granularity), dedicated};
+  for (uint32_t i = 0; i < heaps_.size(); ++i) {
+    if (heaps_[i].handle == nullptr) {
+      heaps_[i] = std::move(heap);
+      return i;
+    }
+  }
+  heaps_.push_back(std::move(heap));
+  return static_cast<uint32_t>(heaps_.size() - 1);
+}
+
+HeapAllocation HeapSuballocator::Allocate(uint64_t size, uint64_t alignment) {
+  const uint64_t padded = AlignUp(std::max<uint64_t>(size, 1), options_.granularity) +
+                          (std::max(alignment, options_.granularity) - options_.granularity);
+  // 専用のヒープにするほど大きくなければ, 先に作ったヒープから順に探す (前に詰めておくと後ろのヒープが空きやすい)
+  if (padded <= options_.heap_size) {
+    for (uint32_t i = 0; i < heaps_.size(); ++i) {
+      Heap& heap = heaps_[i];
+      if (heap.handle == nullptr || heap.dedicated) {
+        continue;
+      }
+      const uint64_t offset = heap.allocator->Allocate(size, alignment);
+      if (offset != TlsfAllocator::kInvalidOffset) {
+        return {heap.handle, i, offset, AlignUp(std::max<uint64_t>(size, 1), options_.granularity)};
+      }
+    }
+  }
+  const bool dedicated = padded > options_.heap_size;
+  const uint32_t index = AddHeap(dedicated ? AlignUp(padded, options_.granularity) : options_.heap_size, dedicated);
+  if (index == kNoHeap) {
+    return {};
+  }
+  Heap& heap = heaps_[index];
+  const uint64_t offset = heap.allocator->Allocate(size, alignment);
+  if (offset == TlsfAllocator::kInvalidOffset) {
+    ReleaseIfEmpty(index);
+    return {};
+  }
+  return {heap.handle, index, offset, AlignUp(std::max<uint64_t>(size, 1), options_.granularity)};
+}
+
+void HeapSuballocator::Free(const HeapAllocation& allocation) {
+  if (!allocation || allocation.heap_index >= heaps_.size() ||
+      heaps_[allocation.heap_index].handle != allocation.heap) {
+    return;
+  }
+  heaps_[allocation.heap_index].allocator->Free(allocation.offset);
+  ReleaseIfEmpty(allocation.heap_index);
+}
+
+void HeapSuballocator::ReleaseIfEmpty(uint32_t heap_index) {
+  Heap& heap = heaps_[heap_index];
+  if (!heap.allocator->Empty()) {
+    return;
+  }
+  if (!heap.dedicated) {
+    // 空いた通常のヒープは 1 つだけ予備に残す (割り当てと解放を繰り返すたびにヒープを作らないように)
+    const bool has_spare = std::any_of(heaps_.begin(), heaps_.end(), [&](const Heap& other) {
+      return &other != &heap && other.handle != nullptr && !other.dedicated && other.allocator->Empty();
+    });
+    if (!has_spare) {
+      return;
+    }
+  }
+  destroy_heap_(heap.handle);
+  heap.handle = nullptr;
+  heap.allocator.reset();
+}
+
+std::size_t HeapSuballocator::Defragment(uint64_t max_bytes, const MoveAllocation& move) {
+  struct Entry {
+    uint32_t heap_index;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t alignment;
+  };
+  // 後ろのヒープ・後ろのオフセットから順に, それより前に入る場所があれば移す
+  std::vector<Entry> entries;
+  for (uint32_t i = 0; i < heaps_.size(); ++i) {
+    if (heaps_[i].handle == nullptr || heaps_[i].dedicated) {
+      continue;
+    }
+    heaps_[i].allocator->ForEachAllocation([&](uint64_t offset, uint64_t size, uint64_t alignment) {
+      entries.push_back({i, offset, size, alignment});
+    });
+  }
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    return a.heap_index != b.heap_index ? a.heap_index > b.heap_index : a.offset > b.offset;
+  });
+
+  std::size_t moved = 0;
+  uint64_t moved_bytes = 0;
+  for (const Entry& entry : entries) {
+    if (moved_bytes + entry.size > max_bytes) {
+      break;
+    }
+    HeapAllocation to;
+    for (uint32_t i = 0; i <= entry.heap_index && !to; ++i) {
+      Heap& heap = heaps_[i];
+      if (heap.handle == nullptr || heap.dedicated) {
+        continue;
+      }
+      const uint64_t offset = heap.allocator->Allocate(entry.size, entry.alignment);
+      if (offset == TlsfAllocator::kInvalidOffset) {
+        continue;
+      }
+      if (i == entry.heap_index && offset >= entry.offset) {
+        heap.allocator->Free(offset);  // 前に詰められない
+        continue;
+      }
+      to = {heap.handle, i, offset, entry.size};
+    }
+    if (!to) {
+      continue;
+    }
+    const HeapAllocation from = {heaps_[entry.heap_index].handle, entry.heap_index, entry.offset, entry.size};
+    if (!move(from, to)) {
+      heaps_[to.heap_index].allocator->Free(to.offset);
+      break;
+    }
+    Free(from);
+    ++moved;
+    moved_bytes += entry.size;
+  }
+  return moved;
+}
+
+HeapSuballocator::Stats HeapSuballocator::GetStats() const {
+  Stats stats;
+  stats.heap_creations = heap_creations_;
+  for (const auto& heap : heaps_) {
+    if (heap.handle == nullptr) {
+      continue;
+    }
+    const auto heap_stats = heap.allocator->GetStats();
+    ++stats.heaps;
+    stats.dedicated_heaps += heap.dedicated ? 1 : 0;
+    stats.heap_bytes += heap_stats.capacity;
+    stats.used_bytes += heap_stats.used_bytes;
+    stats.free_bytes += heap_stats.free_bytes;
+    stats.largest_free_block = std::max(stats.largest_free_block, heap_stats.largest_free_block);
+    stats.allocations += heap_stats.allocations;
+    stats.free_blocks += heap_stats.free_blocks;
+  }
+  return stats;
+}
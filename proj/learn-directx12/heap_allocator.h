@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 範囲 [0, capacity) をオフセットで切り分ける TLSF (Two-Level Segregated Fit) アロケーター
+ * @details 空きブロックをサイズの 2 段階の区分 (2 のべき乗 x 32 分割) ごとのリストに持ち, ビットマップで O(1) で探す.
+ *          解放したブロックは隣の空きブロックとすぐに結合する. メモリ自体には触れない (GPU のヒープの管理用).
+ *          サイズとオフセットは granularity の倍数に切り上げる. granularity 以下のアライメントは追加の手間なしで満たす.
+ *          スレッドセーフではない.
+ */
+class TlsfAllocator {
+ public:
+  static constexpr uint64_t kInvalidOffset = ~uint64_t(0);
+
+  struct Stats {
+    uint64_t capacity = 0;
+    uint64_t used_bytes = 0;          // 割り当て済みのブロックの合計 (granularity への切り上げを含む)
+    uint64_t free_bytes = 0;
+    uint64_t largest_free_block = 0;  // これより大きい割り当ては (アライメントによらず) 失敗する
+    std::size_t allocations = 0;
+    std::size_t free_blocks = 0;
+
+    /**
+     * @brief 空きが細切れになっている度合い (0: 空きが 1 つの塊, 1 に近いほど細切れ)
+     */
+    double Fragmentation() const {
+      return free_bytes == 0 ? 0.0 : 1.0 - static_cast<double>(largest_free_block) / static_cast<double>(free_bytes);
+    }
+  };
+
+  /**
+   * @param capacity 管理する範囲の大きさ (granularity の倍数に切り捨てる)
+   * @param granularity サイズとオフセットの単位 (2 のべき乗)
+   */
+  explicit TlsfAllocator(uint64_t capacity, uint64_t granularity = 1);
+
+  /**
+   * @param alignment 2 のべき乗
+   * @return 割り当てた範囲の先頭. 空きが無ければ kInvalidOffset
+   */
+  uint64_t Allocate(uint64_t size, uint64_t alignment = 1);
+
+  /**
+   * @param offset Allocate() が返したもの
+   */
+  void Free(uint64_t offset);
+
+  /**
+   * @brief 割り当て済みのブロックを f(offset, size, alignment) に渡す (オフセットの順とは限らない)
+   */
+  void ForEachAllocation(const std::function<void(uint64_t offset, uint64_t size, uint64_t alignment)>& f) const;
+
+  bool Empty() const { return allocated_.empty(); }
+  uint64_t Capacity() const { return capacity_; }
+  uint64_t Granularity() const { return granularity_; }
+  Stats GetStats() const;
+
+ private:
+  static constexpr uint32_t kNull = 0xffffffff;
+  static constexpr int kSlBits = 5;
+  static constexpr int kSlCount = 1 << kSlBits;  // 2 段目の区分の数
+  static constexpr int kFlCount = 64 - kSlBits + 1;
+
+  struct Block {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint64_t alignment = 0;  // 割り当て済みなら要求されたアライメント
+    uint32_t prev_physical = kNull;
+    uint32_t next_physical = kNull;
+    uint32_t prev_free = kNull;
+    uint32_t next_free = kNull;
+    bool free = false;
+  };
+
+  static void Mapping(uint64_t size, int* fl, int* sl);
+  uint32_t FindFree(uint64_t size) const;
+  void InsertFree(uint32_t block);
+  void RemoveFree(uint32_t block);
+  uint32_t NewBlock();
+  void DeleteBlock(uint32_t block);
+  // block の先頭 size バイトを残し, 後ろを新しいブロックにして返す
+  uint32_t Split(uint32_t block, uint64_t size);
+
+  uint64_t capacity_;
+  uint64_t granularity_;
+  std::vector<Block> blocks_;
+  std::vector<uint32_t> unused_blocks_;
+  uint64_t fl_bitmap_ = 0;
+  uint32_t sl_bitmap_[kFlCount] = {};
+  uint32_t free_heads_[kFlCount][kSlCount];
+  std::unordered_map<uint64_t, uint32_t> allocated_;  // オフセット -> ブロック
+  uint64_t used_bytes_ = 0;
+};
+
+/**
+ * @brief ヒープ内の割り当て
+ */
+struct HeapAllocation {
+  void* heap = nullptr;  // バックエンドのヒープ (ID3D12Heap* など). 失敗したら nullptr
+  uint32_t heap_index = 0;
+  uint64_t offset = 0;
+  uint64_t size = 0;
+
+  explicit operator bool() const { return heap != nullptr; }
+};
+
+/**
+ * @brief 大きなヒープを TlsfAllocator で切り分けてリソースを置く (GPU の API には依存しない)
+ * @details
+ *  - ヒープは同じ種類 (D3D12 ならヒープの種類とフラグ, 配置のアライメントの区分) ごとに 1 つの HeapSuballocator で管理する
+ *  - 入らなければ heap_size のヒープを足す. heap_size より大きい要求にはその大きさの専用のヒープを作る
+ *  - 空になったヒープは, 専用のものと予備の 1 つを超えるものを破棄する
+ *  - Defragment() は後ろのヒープ・後ろのオフセットの割り当てを前の空きに移す (中身の移動は呼び出し側が行う)
+ *  ヒープの作成と破棄は呼び出し側の関数で行う. スレッドセーフではない.
+ *
+ *   HeapSuballocator heaps({}, create_heap, destroy_heap);
+ *   auto allocation = heaps.Allocate(info.SizeInBytes, info.Alignment);
+ *   device->CreatePlacedResource(static_cast<ID3D12Heap*>(allocation.heap), allocation.offset, ...);
+ *   ...
+ *   heaps.Free(allocation);  // リソースを破棄した後
+ */
+class HeapSuballocator {
+ public:
+  struct Options {
+    uint64_t heap_size = uint64_t(64) << 20;
+    uint64_t granularity = uint64_t(64) << 10;  // 配置のアライメントの区分 (D3D12 の既定は 64 KiB, 小さいテクスチャは 4 KiB)
+  };
+
+  struct Stats {
+    std::size_t heaps = 0;
+    std::size_t dedicated_heaps = 0;
+    uint64_t heap_creations = 0;
+    uint64_t heap_bytes = 0;          // 持っているヒープの合計
+    uint64_t used_bytes = 0;
+    uint64_t free_bytes = 0;
+    uint64_t largest_free_block = 0;  // 1 つのヒープの中の最大の空き
+    std::size_t allocations = 0;
+    std::size_t free_blocks = 0;
+
+    double Fragmentation() const {
+      return free_bytes == 0 ? 0.0 : 1.0 - static_cast<double>(largest_free_block) / static_cast<double>(free_bytes);
+    }
+  };
+
+  // size バイトのヒープを作る. 失敗したら nullptr
+  using CreateHeap = std::function<void*(uint64_t size)>;
+  using DestroyHeap = std::function<void(void* heap)>;
+  // from の中身を to にコピーして参照を付け替える. false なら移動しない (to は解放される)
+  using MoveAllocation = std::function<bool(const HeapAllocation& from, const HeapAllocation& to)>;
+
+  HeapSuballocator(const Options& options, CreateHeap create_heap, DestroyHeap destroy_heap);
+  /**
+   * @brief 全てのヒープを破棄する. 置いたリソースを全て破棄してから破棄すること
+   */
+  ~HeapSuballocator();
+  HeapSuballocator(const HeapSuballocator&) = delete;
+  HeapSuballocator& operator=(const HeapSuballocator&) = delete;
+
+  HeapAllocation Allocate(uint64_t size, uint64_t alignment);
+  void Free(const HeapAllocation& allocation);
+
+  /**
+   * @brief 割り当てを前のヒープ・前のオフセットの空きに移して詰める. 空になったヒープは破棄する
+   * @param max_bytes 1 回で移す量の上限 (フレームごとに少しずつ進める場合など)
+   * @return 移した割り当ての数
+   */
+  std::size_t Defragment(uint64_t max_bytes, const MoveAllocation& move);
+
+  Stats GetStats() const;
+
+ private:
+  struct Heap {
+    void* handle;
+    std::unique_ptr<TlsfAllocator> allocator;
+    bool dedicated;
+  };
+
+  uint32_t AddHeap(uint64_t size, bool dedicated);
+  void ReleaseIfEmpty(uint32_t heap_index);
+
+  Options options_;
+  CreateHeap create_heap_;
+  DestroyHeap destroy_heap_;
+  std::vector<Heap> heaps_;  // 破棄したヒープは handle を nullptr にして番号を残す
+  uint64_t heap_creations_ = 0;
+};
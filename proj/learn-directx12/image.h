@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief CPU 側で扱う画像のピクセルフォーマット
+ *
+ */
+enum class PixelFormat {
+  kUnknown,
+  kRGBA8,  // DXGI_FORMAT_R8G8B8A8_UNORM
+  kBGRA8,  // DXGI_FORMAT_B8G8R8A8_UNORM
+  kBC1,    // DXGI_FORMAT_BC1_UNORM (4x4 ブロックあたり 8 bytes)
+  kBC3,    // DXGI_FORMAT_BC3_UNORM (4x4 ブロックあたり 16 bytes)
+  kBC7,    // DXGI_FORMAT_BC7_UNORM (4x4 ブロックあたり 16 bytes)
+};
+
+inline std::size_t BytesPerPixel(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kRGBA8:
+    case PixelFormat::kBGRA8:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+inline bool IsBlockCompressed(PixelFormat format) {
+  return format == PixelFormat::kBC1 || format == PixelFormat::kBC3 || format == PixelFormat::kBC7;
+}
+
+inline std::size_t BytesPerBlock(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kBC1:
+      return 8;
+    case PixelFormat::kBC3:
+    case PixelFormat::kBC7:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @brief 1 ライン (ブロック圧縮なら 4 画素の高さのブロック 1 列) の詰めたバイト数
+ */
+inline std::size_t RowBytes(PixelFormat format, uint32_t width) {
+  return IsBlockCompressed(format) ? std::size_t((width + 3) / 4) * BytesPerBlock(format)
+                                   : std::size_t(width) * BytesPerPixel(format);
+}
+
+/**
+ * @brief ライン (ブロック圧縮ならブロック列) の数
+ */
+inline uint32_t RowCount(PixelFormat format, uint32_t height) {
+  return IsBlockCompressed(format) ? (height + 3) / 4 : height;
+}
+
+/**
+ * @brief デコード済みの 2D 画像 (GPU に依存しない)
+ * @details ブロック圧縮のフォーマットでは width / height は画素数のまま, ラインは 4x4 ブロックの列になる
+ *          (row_pitch はブロック 1 列のバイト数, Row(y) は y 番目のブロック列).
+ */
+struct Image {
+  PixelFormat format = PixelFormat::kUnknown;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::size_t row_pitch = 0;  // 1 ラインのバイト数
+  std::vector<uint8_t> pixels;
+
+  std::size_t SizeInBytes() const { return pixels.size(); }
+  const uint8_t* Row(uint32_t y) const { return pixels.data() + row_pitch * y; }
+  uint8_t* Row(uint32_t y) { return pixels.data() + row_pitch * y; }
+};
@@ -0,0 +1,1162 @@
+#include "image_decoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "inflate.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_DECODER_SSE2 1
+#endif
+
+namespace {
+
+// D3D12 の 2D テクスチャの最大サイズ. これより大きい画像はヘッダーが壊れているものとして扱う
+constexpr uint32_t kMaxDimension = 16384;
+
+uint16_t ReadLE16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+uint32_t ReadLE32(const uint8_t* p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+uint32_t ReadBE32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]); }
+
+bool Fail(std::string* error, const char* message) {
+  if (error != nullptr) {
+    *error = message;
+  }
+  return false;
+}
+
+bool ValidDimensions(int64_t width, int64_t height) {
+  return width > 0 && height > 0 && width <= kMaxDimension && height <= kMaxDimension;
+}
+
+void StoreBGRA(uint8_t* dst, uint8_t b, uint8_t g, uint8_t r, uint8_t a) {
+  dst[0] = b;
+  dst[1] = g;
+  dst[2] = r;
+  dst[3] = a;
+}
+
+/**
+ * @brief アルファが全て 0 の画像を不透明にする (アルファを使っていない 32 bit の BMP / TGA 向け)
+ */
+void ForceOpaqueIfAlphaUnused(uint8_t* dst, std::size_t row_pitch, uint32_t width, uint32_t height) {
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint8_t* row = dst + row_pitch * y;
+    for (uint32_t x = 0; x < width; ++x) {
+      if (row[x * 4 + 3] != 0) {
+        return;
+      }
+    }
+  }
+  for (uint32_t y = 0; y < height; ++y) {
+    uint8_t* row = dst + row_pitch * y;
+    for (uint32_t x = 0; x < width; ++x) {
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+//////////
+// BMP  //
+//////////
+
+// BITMAPINFOHEADER の biCompression
+constexpr uint32_t kBmpRgb = 0;
+constexpr uint32_t kBmpRle8 = 1;
+constexpr uint32_t kBmpRle4 = 2;
+constexpr uint32_t kBmpBitFields = 3;
+constexpr uint32_t kBmpAlphaBitFields = 6;
+
+/**
+ * @brief BITFIELDS のマスク 1 つ分. 取り出した値を 8 bit に広げる
+ */
+struct BitMask {
+  uint32_t mask = 0;
+  int shift = 0;
+  int bits = 0;
+
+  explicit BitMask(uint32_t m = 0) : mask(m) {
+    if (mask == 0) {
+      return;
+    }
+    while (((mask >> shift) & 1) == 0) {
+      ++shift;
+    }
+    while (bits < 32 - shift && ((mask >> (shift + bits)) & 1) != 0) {
+      ++bits;
+    }
+  }
+
+  uint8_t Extract(uint32_t pixel, uint8_t fallback) const {
+    if (bits == 0) {
+      return fallback;
+    }
+    const uint32_t v = (pixel & mask) >> shift;
+    if (bits >= 8) {
+      return static_cast<uint8_t>(v >> (bits - 8));
+    }
+    const uint32_t max = (1u << bits) - 1;
+    return static_cast<uint8_t>((v * 255 + max / 2) / max);
+  }
+};
+
+struct BmpHeader {
+  uint32_t pixel_offset = 0;
+  uint32_t header_size = 0;
+  int32_t width = 0;
+  int32_t height = 0;  // 負なら上から下
+  uint16_t bit_count = 0;
+  uint32_t compression = kBmpRgb;
+  uint32_t colors_used = 0;
+  uint32_t masks[4] = {};  // R, G, B, A
+  bool has_alpha_mask = false;
+  std::size_t palette_offset = 0;
+  std::size_t palette_entry_size = 4;
+};
+
+bool MatchBmp(const uint8_t* data, std::size_t size) { return size >= 26 && data[0] == 'B' && data[1] == 'M'; }
+
+bool ParseBmpHeader(const uint8_t* data, std::size_t size, BmpHeader* header, std::string* error) {
+  if (!MatchBmp(data, size)) {
+    return Fail(error, "bmp: not a bitmap");
+  }
+  BmpHeader h;
+  h.pixel_offset = ReadLE32(data + 10);
+  h.header_size = ReadLE32(data + 14);
+  if (h.header_size == 12) {  // BITMAPCOREHEADER
+    h.width = ReadLE16(data + 18);
+    h.height = ReadLE16(data + 20);
+    h.bit_count = ReadLE16(data + 24);
+    h.palette_entry_size = 3;
+  } else if (h.header_size >= 40 && size >= 14 + std::size_t(40)) {
+    h.width = static_cast<int32_t>(ReadLE32(data + 18));
+    h.height = static_cast<int32_t>(ReadLE32(data + 22));
+    h.bit_count = ReadLE16(data + 28);
+    h.compression = ReadLE32(data + 30);
+    h.colors_used = ReadLE32(data + 46);
+  } else {
+    return Fail(error, "bmp: unsupported header");
+  }
+  h.palette_offset = 14 + std::size_t(h.header_size);
+
+  if (h.compression == kBmpBitFields || h.compression == kBmpAlphaBitFields) {
+    const int mask_count = (h.compression == kBmpAlphaBitFields || h.header_size >= 56) ? 4 : 3;
+    // BITMAPINFOHEADER (40) の場合はマスクがヘッダーの後ろに付く
+    const std::size_t mask_offset = 14 + 40;
+    if (size < mask_offset + 4 * mask_count) {
+      return Fail(error, "bmp: truncated header");
+    }
+    for (int i = 0; i < mask_count; ++i) {
+      h.masks[i] = ReadLE32(data + mask_offset + 4 * i);
+    }
+    if (h.header_size == 40) {
+      h.palette_offset += 4 * mask_count;
+    }
+    h.has_alpha_mask = h.masks[3] != 0;
+    if (h.bit_count != 16 && h.bit_count != 32) {
+      return Fail(error, "bmp: bitfields require 16 or 32 bpp");
+    }
+  } else if (h.compression == kBmpRgb) {
+    if (h.bit_count == 16) {
+      h.masks[0] = 0x7C00;
+      h.masks[1] = 0x03E0;
+      h.masks[2] = 0x001F;
+    }
+    // 32 bit の BI_RGB は 4 バイト目を使わない (Windows と同じく不透明として読む)
+  } else if (!(h.compression == kBmpRle8 && h.bit_count == 8) && !(h.compression == kBmpRle4 && h.bit_count == 4)) {
+    return Fail(error, "bmp: unsupported compression");
+  }
+
+  switch (h.bit_count) {
+    case 1:
+    case 4:
+    case 8:
+    case 16:
+    case 24:
+    case 32:
+      break;
+    default:
+      return Fail(error, "bmp: unsupported bit count");
+  }
+  if (!ValidDimensions(h.width, h.height < 0 ? -int64_t(h.height) : h.height)) {
+    return Fail(error, "bmp: invalid size");
+  }
+  if (h.pixel_offset >= size) {
+    return Fail(error, "bmp: truncated file");
+  }
+  // 壊れたヘッダーで巨大なバッファを確保しないように, 非圧縮ならピクセルデータが足りているかを先に見る
+  const uint64_t stride = ((uint64_t(h.width) * h.bit_count + 31) / 32) * 4;
+  const uint64_t rows = h.height < 0 ? -int64_t(h.height) : h.height;
+  if (h.compression != kBmpRle8 && h.compression != kBmpRle4 && (size - h.pixel_offset) / stride < rows) {
+    return Fail(error, "bmp: truncated pixel data");
+  }
+  *header = h;
+  return true;
+}
+
+bool ReadBmpInfo(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error) {
+  BmpHeader h;
+  if (!ParseBmpHeader(data, size, &h, error)) {
+    return false;
+  }
+  info->width = static_cast<uint32_t>(h.width);
+  info->height = static_cast<uint32_t>(h.height < 0 ? -int64_t(h.height) : h.height);
+  info->format = PixelFormat::kBGRA8;
+  return true;
+}
+
+/**
+ * @brief RLE8 / RLE4 を展開してパレットのインデックスの列にする (下から上の順)
+ */
+bool DecodeBmpRle(const uint8_t* src, const uint8_t* end, bool rle4, uint32_t width, uint32_t height,
+                  uint8_t* indices, std::string* error) {
+  uint32_t x = 0;
+  uint32_t y = 0;
+  auto put = [&](uint8_t index) {
+    if (x < width && y < height) {
+      indices[std::size_t(y) * width + x] = index;
+    }
+    ++x;
+  };
+  while (y < height) {
+    if (end - src < 2) {
+      return Fail(error, "bmp: truncated rle data");
+    }
+    const uint8_t count = src[0];
+    const uint8_t value = src[1];
+    src += 2;
+    if (count > 0) {
+      for (uint32_t i = 0; i < count; ++i) {
+        put(rle4 ? ((i & 1) ? (value & 0x0F) : (value >> 4)) : value);
+      }
+    } else if (value == 0) {  // 行末
+      x = 0;
+      ++y;
+    } else if (value == 1) {  // 画像の終わり
+      break;
+    } else if (value == 2) {  // 移動
+      if (end - src < 2) {
+        return Fail(error, "bmp: truncated rle data");
+      }
+      x += src[0];
+      y += src[1];
+      src += 2;
+    } else {  // 非圧縮の並び (2 バイト境界に揃える)
+      const std::size_t bytes = rle4 ? (value + 1) / 2 : value;
+      if (std::size_t(end - src) < bytes) {
+        return Fail(error, "bmp: truncated rle data");
+      }
+      for (uint32_t i = 0; i < value; ++i) {
+        put(rle4 ? ((i & 1) ? (src[i / 2] & 0x0F) : (src[i / 2] >> 4)) : src[i]);
+      }
+      src += (bytes + 1) & ~std::size_t(1);
+    }
+  }
+  return true;
+}
+
+bool DecodeBmp(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst, std::size_t row_pitch,
+               std::string* error) {
+  BmpHeader h;
+  if (!ParseBmpHeader(data, size, &h, error)) {
+    return false;
+  }
+  const uint32_t width = info.width;
+  const uint32_t height = info.height;
+  const bool top_down = h.height < 0;
+  auto dst_row = [&](uint32_t file_row) { return dst + row_pitch * (top_down ? file_row : height - 1 - file_row); };
+
+  // パレット (BGRA にしておく)
+  uint8_t palette[256][4] = {};
+  if (h.bit_count <= 8) {
+    const uint32_t max_colors = 1u << h.bit_count;
+    uint32_t colors = (h.colors_used == 0 || h.colors_used > max_colors) ? max_colors : h.colors_used;
+    if (h.palette_offset > size) {
+      return Fail(error, "bmp: truncated palette");
+    }
+    colors = static_cast<uint32_t>(std::min<std::size_t>(colors, (size - h.palette_offset) / h.palette_entry_size));
+    for (uint32_t i = 0; i < colors; ++i) {
+      const uint8_t* entry = data + h.palette_offset + i * h.palette_entry_size;
+      StoreBGRA(palette[i], entry[0], entry[1], entry[2], 255);
+    }
+  }
+
+  const uint8_t* pixels = data + h.pixel_offset;
+  if (h.compression == kBmpRle8 || h.compression == kBmpRle4) {
+    // 飛ばされた画素はパレットの 0 番
+    std::vector<uint8_t> indices(std::size_t(width) * height, 0);
+    if (!DecodeBmpRle(pixels, data + size, h.compression == kBmpRle4, width, height, indices.data(), error)) {
+      return false;
+    }
+    for (uint32_t y = 0; y < height; ++y) {
+      const uint8_t* src = indices.data() + std::size_t(y) * width;
+      uint8_t* out = dst_row(y);
+      for (uint32_t x = 0; x < width; ++x) {
+        std::memcpy(out + x * 4, palette[src[x]], 4);
+      }
+    }
+    return true;
+  }
+
+  const std::size_t stride = ((std::size_t(width) * h.bit_count + 31) / 32) * 4;
+  const BitMask r_mask(h.masks[0]), g_mask(h.masks[1]), b_mask(h.masks[2]), a_mask(h.masks[3]);
+  const bool use_masks = h.compression != kBmpRgb || h.bit_count == 16;
+
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint8_t* src = pixels + stride * y;
+    uint8_t* out = dst_row(y);
+    switch (h.bit_count) {
+      case 8:
+        for (uint32_t x = 0; x < width; ++x) {
+          std::memcpy(out + x * 4, palette[src[x]], 4);
+        }
+        break;
+      case 1:
+      case 4: {
+        const int bits = h.bit_count;
+        const int per_byte = 8 / bits;
+        const uint8_t mask = static_cast<uint8_t>((1 << bits) - 1);
+        for (uint32_t x = 0; x < width; ++x) {
+          const int shift = 8 - bits * (1 + int(x % per_byte));
+          const uint8_t index = (src[x / per_byte] >> shift) & mask;
+          std::memcpy(out + x * 4, palette[index], 4);
+        }
+        break;
+      }
+      case 16:
+        for (uint32_t x = 0; x < width; ++x) {
+          const uint32_t p = ReadLE16(src + x * 2);
+          StoreBGRA(out + x * 4, b_mask.Extract(p, 0), g_mask.Extract(p, 0), r_mask.Extract(p, 0), a_mask.Extract(p, 255));
+        }
+        break;
+      case 24:
+        for (uint32_t x = 0; x < width; ++x) {
+          StoreBGRA(out + x * 4, src[x * 3], src[x * 3 + 1], src[x * 3 + 2], 255);
+        }
+        break;
+      case 32:
+        if (!use_masks) {
+          for (uint32_t x = 0; x < width; ++x) {
+            StoreBGRA(out + x * 4, src[x * 4], src[x * 4 + 1], src[x * 4 + 2], 255);
+          }
+        } else if (h.masks[0] == 0x00FF0000 && h.masks[1] == 0x0000FF00 && h.masks[2] == 0x000000FF &&
+                   (h.masks[3] == 0xFF000000 || h.masks[3] == 0)) {
+          // よくある BGRA の並びはそのままコピーする
+          std::memcpy(out, src, std::size_t(width) * 4);
+          if (h.masks[3] == 0) {
+            for (uint32_t x = 0; x < width; ++x) {
+              out[x * 4 + 3] = 255;
+            }
+          }
+        } else {
+          for (uint32_t x = 0; x < width; ++x) {
+            const uint32_t p = ReadLE32(src + x * 4);
+            StoreBGRA(out + x * 4, b_mask.Extract(p, 0), g_mask.Extract(p, 0), r_mask.Extract(p, 0),
+                      a_mask.Extract(p, 255));
+          }
+        }
+        break;
+    }
+  }
+  if (h.has_alpha_mask) {
+    ForceOpaqueIfAlphaUnused(dst, row_pitch, width, height);
+  }
+  return true;
+}
+
+//////////
+// TGA  //
+//////////
+
+struct TgaHeader {
+  uint8_t id_length = 0;
+  uint8_t color_map_type = 0;
+  uint8_t image_type = 0;
+  uint16_t color_map_first = 0;
+  uint16_t color_map_length = 0;
+  uint8_t color_map_bits = 0;
+  uint16_t width = 0;
+  uint16_t height = 0;
+  uint8_t pixel_bits = 0;
+  uint8_t descriptor = 0;
+
+  bool rle() const { return image_type >= 9; }
+  uint8_t base_type() const { return image_type & 7; }  // 1: カラーマップ, 2: トゥルーカラー, 3: グレー
+};
+
+bool ParseTgaHeader(const uint8_t* data, std::size_t size, TgaHeader* header) {
+  if (size < 18) {
+    return false;
+  }
+  TgaHeader h;
+  h.id_length = data[0];
+  h.color_map_type = data[1];
+  h.image_type = data[2];
+  h.color_map_first = ReadLE16(data + 3);
+  h.color_map_length = ReadLE16(data + 5);
+  h.color_map_bits = data[7];
+  h.width = ReadLE16(data + 12);
+  h.height = ReadLE16(data + 14);
+  h.pixel_bits = data[16];
+  h.descriptor = data[17];
+
+  const uint8_t type = h.base_type();
+  if ((h.image_type != 1 && h.image_type != 2 && h.image_type != 3 && h.image_type != 9 && h.image_type != 10 &&
+       h.image_type != 11) ||
+      h.color_map_type > 1 || (h.descriptor & 0xC0) != 0 || !ValidDimensions(h.width, h.height)) {
+    return false;
+  }
+  if (type == 1) {
+    if (h.color_map_type != 1 || h.pixel_bits != 8 || h.color_map_length == 0 ||
+        (h.color_map_bits != 15 && h.color_map_bits != 16 && h.color_map_bits != 24 && h.color_map_bits != 32)) {
+      return false;
+    }
+  } else if (type == 2) {
+    if (h.pixel_bits != 15 && h.pixel_bits != 16 && h.pixel_bits != 24 && h.pixel_bits != 32) {
+      return false;
+    }
+  } else if (h.pixel_bits != 8 && h.pixel_bits != 16) {  // グレー (+ アルファ)
+    return false;
+  }
+  if (!h.rle()) {
+    const uint64_t map_bytes = h.color_map_type == 1 ? uint64_t(h.color_map_bits + 7) / 8 * h.color_map_length : 0;
+    const uint64_t pixel_bytes = uint64_t(h.width) * h.height * ((h.pixel_bits + 7) / 8);
+    if (18 + h.id_length + map_bytes + pixel_bytes > size) {
+      return false;
+    }
+  }
+  *header = h;
+  return true;
+}
+
+// TGA にはマジックナンバーが無いので, ヘッダーの値が全て妥当なものを TGA とみなす
+bool MatchTga(const uint8_t* data, std::size_t size) {
+  TgaHeader h;
+  return ParseTgaHeader(data, size, &h);
+}
+
+bool ReadTgaInfo(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error) {
+  TgaHeader h;
+  if (!ParseTgaHeader(data, size, &h)) {
+    return Fail(error, "tga: invalid header");
+  }
+  info->width = h.width;
+  info->height = h.height;
+  info->format = PixelFormat::kBGRA8;
+  return true;
+}
+
+/**
+ * @brief TGA の 1 画素 (bits ビット) を BGRA にする
+ */
+void TgaPixelToBGRA(const uint8_t* src, int bits, bool gray, bool has_alpha, uint8_t* out) {
+  if (gray) {
+    StoreBGRA(out, src[0], src[0], src[0], bits == 16 ? src[1] : 255);
+    return;
+  }
+  switch (bits) {
+    case 15:
+    case 16: {
+      const uint32_t p = ReadLE16(src);
+      const uint8_t r = static_cast<uint8_t>(((p >> 10) & 31) * 255 / 31);
+      const uint8_t g = static_cast<uint8_t>(((p >> 5) & 31) * 255 / 31);
+      const uint8_t b = static_cast<uint8_t>((p & 31) * 255 / 31);
+      StoreBGRA(out, b, g, r, (bits == 16 && has_alpha) ? ((p & 0x8000) ? 255 : 0) : 255);
+      break;
+    }
+    case 24:
+      StoreBGRA(out, src[0], src[1], src[2], 255);
+      break;
+    default:
+      StoreBGRA(out, src[0], src[1], src[2], has_alpha ? src[3] : 255);
+      break;
+  }
+}
+
+bool DecodeTga(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst, std::size_t row_pitch,
+               std::string* error) {
+  TgaHeader h;
+  if (!ParseTgaHeader(data, size, &h)) {
+    return Fail(error, "tga: invalid header");
+  }
+  const uint32_t width = info.width;
+  const uint32_t height = info.height;
+  const bool top_down = (h.descriptor & 0x20) != 0;
+  const bool right_to_left = (h.descriptor & 0x10) != 0;
+  const int alpha_bits = h.descriptor & 0x0F;
+  const uint8_t type = h.base_type();
+  const bool gray = type == 3;
+
+  const uint8_t* p = data + 18 + h.id_length;
+  const uint8_t* end = data + size;
+  if (p > end) {
+    return Fail(error, "tga: truncated header");
+  }
+
+  // カラーマップ (BGRA にしておく)
+  std::vector<uint8_t> palette;
+  bool has_alpha = false;
+  if (h.color_map_type == 1) {
+    const std::size_t entry_bytes = (h.color_map_bits + 7) / 8;
+    const std::size_t map_bytes = entry_bytes * h.color_map_length;
+    if (std::size_t(end - p) < map_bytes) {
+      return Fail(error, "tga: truncated color map");
+    }
+    if (type == 1) {
+      has_alpha = h.color_map_bits == 32 || (h.color_map_bits == 16 && alpha_bits > 0);
+      palette.assign(std::size_t(h.color_map_first + h.color_map_length) * 4, 0);
+      for (uint32_t i = 0; i < h.color_map_length; ++i) {
+        TgaPixelToBGRA(p + i * entry_bytes, h.color_map_bits, false, has_alpha,
+                       palette.data() + (h.color_map_first + i) * std::size_t(4));
+      }
+    }
+    p += map_bytes;
+  }
+  if (type == 2) {
+    has_alpha = h.pixel_bits == 32 || (h.pixel_bits == 16 && alpha_bits > 0);
+  } else if (gray) {
+    has_alpha = h.pixel_bits == 16;
+  }
+
+  const int pixel_bytes = (h.pixel_bits + 7) / 8;
+  auto to_bgra = [&](const uint8_t* src, uint8_t* out) {
+    if (type == 1) {
+      const std::size_t index = src[0];
+      if (index * 4 < palette.size()) {
+        std::memcpy(out, palette.data() + index * 4, 4);
+      } else {
+        StoreBGRA(out, 0, 0, 0, 255);
+      }
+    } else {
+      TgaPixelToBGRA(src, h.pixel_bits, gray, has_alpha, out);
+    }
+  };
+
+  // RLE のパケットは行をまたげるので, 状態を行の外に持つ
+  uint32_t packet_left = 0;
+  bool packet_repeat = false;
+  uint8_t repeat_pixel[4] = {};
+  for (uint32_t row = 0; row < height; ++row) {
+    uint8_t* out = dst + row_pitch * (top_down ? row : height - 1 - row);
+    if (!h.rle()) {
+      const std::size_t row_bytes = std::size_t(width) * pixel_bytes;
+      if (std::size_t(end - p) < row_bytes) {
+        return Fail(error, "tga: truncated pixel data");
+      }
+      if (h.pixel_bits == 32 && !right_to_left) {
+        std::memcpy(out, p, row_bytes);
+      } else if (h.pixel_bits == 24 && !right_to_left) {
+        for (uint32_t x = 0; x < width; ++x) {
+          StoreBGRA(out + x * 4, p[x * 3], p[x * 3 + 1], p[x * 3 + 2], 255);
+        }
+      } else {
+        for (uint32_t x = 0; x < width; ++x) {
+          to_bgra(p + std::size_t(x) * pixel_bytes, out + (right_to_left ? width - 1 - x : x) * 4);
+        }
+      }
+      p += row_bytes;
+      continue;
+    }
+    for (uint32_t x = 0; x < width; ++x) {
+      if (packet_left == 0) {
+        if (p >= end) {
+          return Fail(error, "tga: truncated rle data");
+        }
+        packet_repeat = (*p & 0x80) != 0;
+        packet_left = (*p & 0x7F) + 1u;
+        ++p;
+        if (packet_repeat) {
+          if (end - p < pixel_bytes) {
+            return Fail(error, "tga: truncated rle data");
+          }
+          to_bgra(p, repeat_pixel);
+          p += pixel_bytes;
+        }
+      }
+      uint8_t* pixel = out + (right_to_left ? width - 1 - x : x) * 4;
+      if (packet_repeat) {
+        std::memcpy(pixel, repeat_pixel, 4);
+      } else {
+        if (end - p < pixel_bytes) {
+          return Fail(error, "tga: truncated rle data");
+        }
+        to_bgra(p, pixel);
+        p += pixel_bytes;
+      }
+      --packet_left;
+    }
+  }
+  if (has_alpha) {
+    // アルファのビット数を書かないまま 0 で埋めるツールが多いので, 全て 0 なら不透明にする (DirectXTex と同じ)
+    ForceOpaqueIfAlphaUnused(dst, row_pitch, width, height);
+  }
+  return true;
+}
+
+//////////
+// PNG  //
+//////////
+
+constexpr uint8_t kPngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+struct PngHeader {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint8_t bit_depth = 0;
+  uint8_t color_type = 0;
+  uint8_t interlace = 0;
+
+  int channels() const {
+    switch (color_type) {
+      case 0:
+      case 3:
+        return 1;
+      case 2:
+        return 3;
+      case 4:
+        return 2;
+      default:
+        return 4;
+    }
+  }
+  // フィルターで参照する左隣までのバイト数
+  int filter_bytes() const { return std::max(1, channels() * bit_depth / 8); }
+  std::size_t RowBytes(uint32_t w) const { return (std::size_t(w) * channels() * bit_depth + 7) / 8; }
+};
+
+bool MatchPng(const uint8_t* data, std::size_t size) {
+  return size >= 8 && std::memcmp(data, kPngSignature, 8) == 0;
+}
+
+bool ParsePngHeader(const uint8_t* data, std::size_t size, PngHeader* header, std::string* error) {
+  if (!MatchPng(data, size)) {
+    return Fail(error, "png: bad signature");
+  }
+  if (size < 8 + 8 + 13 || ReadBE32(data + 8) != 13 || std::memcmp(data + 12, "IHDR", 4) != 0) {
+    return Fail(error, "png: missing IHDR");
+  }
+  const uint8_t* ihdr = data + 16;
+  PngHeader h;
+  h.width = ReadBE32(ihdr);
+  h.height = ReadBE32(ihdr + 4);
+  h.bit_depth = ihdr[8];
+  h.color_type = ihdr[9];
+  h.interlace = ihdr[12];
+  if (ihdr[10] != 0 || ihdr[11] != 0 || h.interlace > 1) {
+    return Fail(error, "png: unsupported compression, filter or interlace method");
+  }
+  bool valid_depth = false;
+  switch (h.color_type) {
+    case 0:
+      valid_depth = h.bit_depth == 1 || h.bit_depth == 2 || h.bit_depth == 4 || h.bit_depth == 8 || h.bit_depth == 16;
+      break;
+    case 3:
+      valid_depth = h.bit_depth == 1 || h.bit_depth == 2 || h.bit_depth == 4 || h.bit_depth == 8;
+      break;
+    case 2:
+    case 4:
+    case 6:
+      valid_depth = h.bit_depth == 8 || h.bit_depth == 16;
+      break;
+  }
+  if (!valid_depth) {
+    return Fail(error, "png: invalid color type / bit depth");
+  }
+  if (!ValidDimensions(h.width, h.height)) {
+    return Fail(error, "png: invalid size");
+  }
+  *header = h;
+  return true;
+}
+
+bool ReadPngInfo(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error) {
+  PngHeader h;
+  if (!ParsePngHeader(data, size, &h, error)) {
+    return false;
+  }
+  info->width = h.width;
+  info->height = h.height;
+  info->format = PixelFormat::kRGBA8;
+  return true;
+}
+
+uint8_t Paeth(int a, int b, int c) {
+  const int pa = std::abs(b - c);
+  const int pb = std::abs(a - c);
+  const int pc = std::abs(a + b - 2 * c);
+  return static_cast<uint8_t>((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c));
+}
+
+#ifdef IMAGE_DECODER_SSE2
+__m128i Load4(const uint8_t* p) {
+  int32_t v;
+  std::memcpy(&v, p, 4);
+  return _mm_cvtsi32_si128(v);
+}
+void Store4(uint8_t* p, __m128i v) {
+  const int32_t x = _mm_cvtsi128_si32(v);
+  std::memcpy(p, &x, 4);
+}
+__m128i Abs16(__m128i x) { return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x)); }
+__m128i Select(__m128i mask, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+/**
+ * @brief 4 バイト/画素 (8 bit RGBA) のフィルターを 1 画素ずつ SSE2 で戻す
+ * @details 左隣に依存するので画素の間は逐次だが, 4 チャンネルをまとめて計算する.
+ */
+bool UnfilterRow4(uint8_t filter, uint8_t* row, const uint8_t* prev, std::size_t bytes) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero;  // 左 (戻した値)
+  switch (filter) {
+    case 1:
+      for (std::size_t i = 0; i < bytes; i += 4) {
+        a = _mm_add_epi8(Load4(row + i), a);
+        Store4(row + i, a);
+      }
+      return true;
+    case 3:
+      for (std::size_t i = 0; i < bytes; i += 4) {
+        const __m128i b = Load4(prev + i);
+        // avg_epu8 は切り上げなので, (a ^ b) & 1 を引いて切り捨てにする
+        const __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+        a = _mm_add_epi8(Load4(row + i), avg);
+        Store4(row + i, a);
+      }
+      return true;
+    case 4: {
+      __m128i c = zero;  // 左上
+      for (std::size_t i = 0; i < bytes; i += 4) {
+        const __m128i b = _mm_unpacklo_epi8(Load4(prev + i), zero);
+        const __m128i a16 = _mm_unpacklo_epi8(a, zero);
+        const __m128i pa = Abs16(_mm_sub_epi16(b, c));
+        const __m128i pb = Abs16(_mm_sub_epi16(a16, c));
+        const __m128i pc = Abs16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a16, c)));
+        const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        // 同点なら a, b, c の順に優先する
+        const __m128i nearest =
+            Select(_mm_cmpeq_epi16(smallest, pa), a16, Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+        a = _mm_add_epi8(Load4(row + i), _mm_packus_epi16(nearest, nearest));
+        Store4(row + i, a);
+        c = b;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+#endif
+
+/**
+ * @brief 1 行のフィルターを戻す
+ * @param prev 上の行 (戻した後). 最初の行では 0 で埋めた行
+ */
+bool UnfilterRow(uint8_t filter, uint8_t* row, const uint8_t* prev, std::size_t bytes, int bpp) {
+  switch (filter) {
+    case 0:
+      return true;
+    case 2:
+      for (std::size_t i = 0; i < bytes; ++i) {
+        row[i] = static_cast<uint8_t>(row[i] + prev[i]);
+      }
+      return true;
+    case 1:
+    case 3:
+    case 4:
+      break;
+    default:
+      return false;
+  }
+#ifdef IMAGE_DECODER_SSE2
+  if (bpp == 4) {
+    return UnfilterRow4(filter, row, prev, bytes);
+  }
+#endif
+  const std::size_t left = std::min<std::size_t>(bpp, bytes);
+  if (filter == 1) {
+    for (std::size_t i = left; i < bytes; ++i) {
+      row[i] = static_cast<uint8_t>(row[i] + row[i - bpp]);
+    }
+  } else if (filter == 3) {
+    for (std::size_t i = 0; i < left; ++i) {
+      row[i] = static_cast<uint8_t>(row[i] + (prev[i] >> 1));
+    }
+    for (std::size_t i = left; i < bytes; ++i) {
+      row[i] = static_cast<uint8_t>(row[i] + ((row[i - bpp] + prev[i]) >> 1));
+    }
+  } else {
+    for (std::size_t i = 0; i < left; ++i) {
+      row[i] = static_cast<uint8_t>(row[i] + prev[i]);
+    }
+    for (std::size_t i = left; i < bytes; ++i) {
+      row[i] = static_cast<uint8_t>(row[i] + Paeth(row[i - bpp], prev[i], prev[i - bpp]));
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief PLTE / tRNS の内容 (RGBA に変換するときに使う)
+ */
+struct PngColorInfo {
+  uint8_t palette[256][4] = {};
+  uint32_t palette_size = 0;
+  bool has_key = false;    // tRNS によるカラーキー (グレー / RGB)
+  uint16_t key[3] = {};
+};
+
+/**
+ * @brief フィルターを戻した 1 行 (count 画素) を RGBA8 にする
+ */
+void ConvertPngRow(const PngHeader& h, const PngColorInfo& color, const uint8_t* src, uint32_t count, uint8_t* out) {
+  const int depth = h.bit_depth;
+  switch (h.color_type) {
+    case 6:
+      if (depth == 8) {
+        std::memcpy(out, src, std::size_t(count) * 4);
+      } else {
+        for (uint32_t x = 0; x < count; ++x) {
+          out[x * 4 + 0] = src[x * 8 + 0];
+          out[x * 4 + 1] = src[x * 8 + 2];
+          out[x * 4 + 2] = src[x * 8 + 4];
+          out[x * 4 + 3] = src[x * 8 + 6];
+        }
+      }
+      break;
+    case 2:
+      for (uint32_t x = 0; x < count; ++x) {
+        uint8_t r, g, b, a = 255;
+        if (depth == 8) {
+          r = src[x * 3];
+          g = src[x * 3 + 1];
+          b = src[x * 3 + 2];
+          if (color.has_key && r == color.key[0] && g == color.key[1] && b == color.key[2]) {
+            a = 0;
+          }
+        } else {
+          const uint8_t* s = src + x * 6;
+          r = s[0];
+          g = s[2];
+          b = s[4];
+          if (color.has_key && ((s[0] << 8) | s[1]) == color.key[0] && ((s[2] << 8) | s[3]) == color.key[1] &&
+              ((s[4] << 8) | s[5]) == color.key[2]) {
+            a = 0;
+          }
+        }
+        out[x * 4 + 0] = r;
+        out[x * 4 + 1] = g;
+        out[x * 4 + 2] = b;
+        out[x * 4 + 3] = a;
+      }
+      break;
+    case 4:
+      for (uint32_t x = 0; x < count; ++x) {
+        const uint8_t g = depth == 8 ? src[x * 2] : src[x * 4];
+        const uint8_t a = depth == 8 ? src[x * 2 + 1] : src[x * 4 + 2];
+        out[x * 4 + 0] = out[x * 4 + 1] = out[x * 4 + 2] = g;
+        out[x * 4 + 3] = a;
+      }
+      break;
+    case 0:
+    case 3: {
+      const uint32_t max = (1u << std::min(depth, 8)) - 1;
+      const uint32_t scale = h.color_type == 0 && depth < 8 ? 255 / max : 1;
+      for (uint32_t x = 0; x < count; ++x) {
+        uint32_t v;
+        if (depth == 16) {
+          v = (uint32_t(src[x * 2]) << 8) | src[x * 2 + 1];
+        } else if (depth == 8) {
+          v = src[x];
+        } else {
+          const std::size_t bit = std::size_t(x) * depth;
+          v = (src[bit / 8] >> (8 - depth - bit % 8)) & max;
+        }
+        if (h.color_type == 3) {
+          std::memcpy(out + x * 4, color.palette[v], 4);  // 範囲外の番号は 0 (透明な黒)
+        } else {
+          const uint8_t g = static_cast<uint8_t>(depth == 16 ? (v >> 8) : v * scale);
+          out[x * 4 + 0] = out[x * 4 + 1] = out[x * 4 + 2] = g;
+          out[x * 4 + 3] = (color.has_key && v == color.key[0]) ? 0 : 255;
+        }
+      }
+      break;
+    }
+  }
+}
+
+bool DecodePng(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst, std::size_t row_pitch,
+               std::string* error) {
+  PngHeader h;
+  if (!ParsePngHeader(data, size, &h, error)) {
+    return false;
+  }
+
+  // チャンクを読む. IDAT が 1 つならコピーせずにそのまま展開する
+  thread_local std::vector<uint8_t> idat_buffer;
+  PngColorInfo color;
+  const uint8_t* idat = nullptr;
+  std::size_t idat_size = 0;
+  int idat_chunks = 0;
+  bool has_palette = false;
+  std::size_t offset = 8;
+  while (true) {
+    if (size - offset < 12) {
+      return Fail(error, "png: truncated chunk");
+    }
+    const uint32_t length = ReadBE32(data + offset);
+    const uint8_t* type = data + offset + 4;
+    const uint8_t* body = data + offset + 8;
+    if (length > size - offset - 12) {
+      return Fail(error, "png: truncated chunk");
+    }
+    if (std::memcmp(type, "IDAT", 4) == 0) {
+      if (idat_chunks == 0) {
+        idat = body;
+        idat_size = length;
+      } else {
+        if (idat_chunks == 1) {
+          idat_buffer.assign(idat, idat + idat_size);
+        }
+        idat_buffer.insert(idat_buffer.end(), body, body + length);
+        idat = idat_buffer.data();
+        idat_size = idat_buffer.size();
+      }
+      ++idat_chunks;
+    } else if (std::memcmp(type, "PLTE", 4) == 0) {
+      if (length % 3 != 0 || length > 256 * 3) {
+        return Fail(error, "png: invalid PLTE");
+      }
+      color.palette_size = length / 3;
+      for (uint32_t i = 0; i < color.palette_size; ++i) {
+        color.palette[i][0] = body[i * 3];
+        color.palette[i][1] = body[i * 3 + 1];
+        color.palette[i][2] = body[i * 3 + 2];
+        color.palette[i][3] = 255;
+      }
+      has_palette = true;
+    } else if (std::memcmp(type, "tRNS", 4) == 0) {
+      if (h.color_type == 3) {
+        for (uint32_t i = 0; i < std::min<uint32_t>(length, 256); ++i) {
+          color.palette[i][3] = body[i];
+        }
+      } else if (h.color_type == 0 && length >= 2) {
+        color.has_key = true;
+        color.key[0] = static_cast<uint16_t>((body[0] << 8) | body[1]);
+      } else if (h.color_type == 2 && length >= 6) {
+        color.has_key = true;
+        for (int i = 0; i < 3; ++i) {
+          color.key[i] = static_cast<uint16_t>((body[i * 2] << 8) | body[i * 2 + 1]);
+        }
+      }
+    } else if (std::memcmp(type, "IEND", 4) == 0) {
+      break;
+    }
+    offset += 12 + std::size_t(length);
+  }
+  if (idat_chunks == 0) {
+    return Fail(error, "png: missing IDAT");
+  }
+  if (h.color_type == 3 && !has_palette) {
+    return Fail(error, "png: missing PLTE");
+  }
+
+  // Adam7 の各パス (x0, y0, dx, dy). インターレースでなければ全体を 1 パスとして扱う
+  static constexpr uint32_t kAdam7[7][4] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+                                            {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+  static constexpr uint32_t kWhole[1][4] = {{0, 0, 1, 1}};
+  const uint32_t(*passes)[4] = h.interlace ? kAdam7 : kWhole;
+  const int pass_count = h.interlace ? 7 : 1;
+  auto pass_size = [&](int pass, uint32_t* w, uint32_t* hh) {
+    const uint32_t* p = passes[pass];
+    *w = info.width > p[0] ? (info.width - p[0] + p[2] - 1) / p[2] : 0;
+    *hh = info.height > p[1] ? (info.height - p[1] + p[3] - 1) / p[3] : 0;
+  };
+  std::size_t raw_size = 0;
+  for (int pass = 0; pass < pass_count; ++pass) {
+    uint32_t w, hh;
+    pass_size(pass, &w, &hh);
+    if (w > 0 && hh > 0) {
+      raw_size += (1 + h.RowBytes(w)) * hh;
+    }
+  }
+
+  thread_local std::vector<uint8_t> raw;
+  if (raw.size() < raw_size) {
+    raw.resize(raw_size);
+  }
+  if (!InflateZlib(idat, idat_size, raw.data(), raw_size, error)) {
+    return false;
+  }
+
+  thread_local std::vector<uint8_t> zero_row;
+  thread_local std::vector<uint8_t> converted;
+  const int bpp = h.filter_bytes();
+  uint8_t* src = raw.data();
+  for (int pass = 0; pass < pass_count; ++pass) {
+    uint32_t w, hh;
+    pass_size(pass, &w, &hh);
+    if (w == 0 || hh == 0) {
+      continue;
+    }
+    const std::size_t row_bytes = h.RowBytes(w);
+    zero_row.assign(row_bytes, 0);
+    const uint8_t* prev = zero_row.data();
+    const uint32_t* p = passes[pass];
+    for (uint32_t y = 0; y < hh; ++y) {
+      uint8_t* row = src + 1;
+      if (!UnfilterRow(src[0], row, prev, row_bytes, bpp)) {
+        return Fail(error, "png: invalid filter type");
+      }
+      uint8_t* out = dst + row_pitch * (p[1] + y * p[3]);
+      if (!h.interlace) {
+        ConvertPngRow(h, color, row, w, out);
+      } else {
+        converted.resize(std::size_t(w) * 4);
+        ConvertPngRow(h, color, row, w, converted.data());
+        for (uint32_t x = 0; x < w; ++x) {
+          std::memcpy(out + (p[0] + x * p[2]) * 4, converted.data() + x * 4, 4);
+        }
+      }
+      prev = row;
+      src += 1 + row_bytes;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+//////////////////////
+// PixelBufferPool  //
+//////////////////////
+
+PixelBufferPool::PixelBufferPool(std::size_t max_pooled_bytes) : max_pooled_bytes_(max_pooled_bytes) {}
+
+std::vector<uint8_t> PixelBufferPool::Acquire(std::size_t size) {
+  std::vector<uint8_t> buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.acquired;
+    // 要求の 2 倍までの容量で一番小さいものを使う (大きすぎるバッファで小さい画像を受けない)
+    auto it = buffers_.lower_bound(size);
+    if (it != buffers_.end() && it->first <= size * 2) {
+      buffer = std::move(it->second);
+      stats_.pooled_bytes -= it->first;
+      buffers_.erase(it);
+      ++stats_.reused;
+    }
+  }
+  // 取っておいたバッファは容量いっぱいまで resize してあるので, 縮めるだけで 0 埋めは起きない
+  buffer.resize(size);
+  return buffer;
+}
+
+void PixelBufferPool::Release(std::vector<uint8_t> buffer) {
+  const std::size_t capacity = buffer.capacity();
+  if (capacity == 0 || capacity > max_pooled_bytes_) {
+    return;
+  }
+  buffer.resize(capacity);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // 上限を超えるなら小さいものから捨てる
+  while (!buffers_.empty() && stats_.pooled_bytes + capacity > max_pooled_bytes_) {
+    stats_.pooled_bytes -= buffers_.begin()->first;
+    buffers_.erase(buffers_.begin());
+  }
+  stats_.pooled_bytes += capacity;
+  buffers_.emplace(capacity, std::move(buffer));
+}
+
+PixelBufferPool::Stats PixelBufferPool::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+///////////////////////////
+// ImageDecoderRegistry  //
+///////////////////////////
+
+ImageCodec MakeBmpCodec() { return {"bmp", MatchBmp, ReadBmpInfo, DecodeBmp}; }
+ImageCodec MakeTgaCodec() { return {"tga", MatchTga, ReadTgaInfo, DecodeTga}; }
+ImageCodec MakePngCodec() { return {"png", MatchPng, ReadPngInfo, DecodePng}; }
+
+ImageDecoderRegistry::ImageDecoderRegistry() : codecs_{MakePngCodec(), MakeBmpCodec()}, tga_(MakeTgaCodec()) {}
+
+void ImageDecoderRegistry::Register(ImageCodec codec) { codecs_.push_back(std::move(codec)); }
+
+const ImageCodec* ImageDecoderRegistry::Find(const uint8_t* data, std::size_t size) const {
+  for (const ImageCodec& codec : codecs_) {
+    if (codec.match(data, size)) {
+      return &codec;
+    }
+  }
+  return tga_.match(data, size) ? &tga_ : nullptr;
+}
+
+bool ImageDecoderRegistry::ReadInfo(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error) const {
+  const ImageCodec* codec = Find(data, size);
+  if (codec == nullptr) {
+    return Fail(error, "unknown image format");
+  }
+  return codec->read_info(data, size, info, error);
+}
+
+bool ImageDecoderRegistry::DecodeInto(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst,
+                                      std::size_t row_pitch, std::string* error) const {
+  const ImageCodec* codec = Find(data, size);
+  if (codec == nullptr) {
+    return Fail(error, "unknown image format");
+  }
+  if (row_pitch < std::size_t(info.width) * BytesPerPixel(info.format)) {
+    return Fail(error, "row pitch is too small");
+  }
+  return codec->decode(data, size, info, dst, row_pitch, error);
+}
+
+bool ImageDecoderRegistry::Decode(const uint8_t* data, std::size_t size, Image* out, std::string* error) const {
+  ImageInfo info;
+  if (!ReadInfo(data, size, &info, error)) {
+    return false;
+  }
+  out->format = info.format;
+  out->width = info.width;
+  out->height = info.height;
+  out->row_pitch = std::size_t(info.width) * BytesPerPixel(info.format);
+  out->pixels.resize(out->row_pitch * info.height);
+  return DecodeInto(data, size, info, out->pixels.data(), out->row_pitch, error);
+}
+
+std::shared_ptr<const Image> ImageDecoderRegistry::Decode(const uint8_t* data, std::size_t size,
+                                                          const std::shared_ptr<PixelBufferPool>& pool,
+                                                          std::string* error) const {
+  ImageInfo info;
+  if (!ReadInfo(data, size, &info, error)) {
+    return nullptr;
+  }
+  std::shared_ptr<Image> image;
+  if (pool == nullptr) {
+    image = std::make_shared<Image>();
+  } else {
+    // 破棄されたらピクセルのバッファを pool に戻す (pool は画像が全て破棄されるまで生きている)
+    image = std::shared_ptr<Image>(new Image, [pool](Image* p) {
+      pool->Release(std::move(p->pixels));
+      delete p;
+    });
+  }
+  image->format = info.format;
+  image->width = info.width;
+  image->height = info.height;
+  image->row_pitch = std::size_t(info.width) * BytesPerPixel(info.format);
+  const std::size_t bytes = image->row_pitch * info.height;
+  if (pool != nullptr) {
+    image->pixels = pool->Acquire(bytes);
+  } else {
+    image->pixels.resize(bytes);
+  }
+  if (!DecodeInto(data, size, info, image->pixels.data(), image->row_pitch, error)) {
+    return nullptr;
+  }
+  return image;
+}
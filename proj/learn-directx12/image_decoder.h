@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+/**
+ * @brief デコードする前に分かる画像の情報
+ */
+struct ImageInfo {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  PixelFormat format = PixelFormat::kUnknown;  // デコード結果のフォーマット (RGBA8 / BGRA8)
+};
+
+/**
+ * @brief 1 つの画像フォーマットのデコーダー
+ * @details 全ての関数は複数スレッドから同時に呼ばれる.
+ */
+struct ImageCodec {
+  std::string name;
+  // 先頭のバイト列がこのフォーマットなら true (拡張子は見ない)
+  std::function<bool(const uint8_t* data, std::size_t size)> match;
+  // ヘッダーだけを読む
+  std::function<bool(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error)> read_info;
+  // dst から row_pitch 間隔で info.height 行に info.format で書き出す
+  std::function<bool(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst,
+                     std::size_t row_pitch, std::string* error)>
+      decode;
+};
+
+/**
+ * @brief デコード先のピクセルバッファを使い回す
+ * @details 解放されたバッファを取っておき, 次に同じくらいのサイズを要求されたらそれを返す. スレッドセーフ.
+ */
+class PixelBufferPool {
+ public:
+  struct Stats {
+    uint64_t acquired = 0;
+    uint64_t reused = 0;            // 取っておいたバッファを返した回数
+    std::size_t pooled_bytes = 0;   // 取っておいているバッファの合計容量
+  };
+
+  /**
+   * @param max_pooled_bytes 取っておくバッファの合計容量の上限
+   */
+  explicit PixelBufferPool(std::size_t max_pooled_bytes = std::size_t(64) << 20);
+  PixelBufferPool(const PixelBufferPool&) = delete;
+  PixelBufferPool& operator=(const PixelBufferPool&) = delete;
+
+  /**
+   * @brief size バイトのバッファを返す (中身は不定)
+   */
+  std::vector<uint8_t> Acquire(std::size_t size);
+
+  /**
+   * @brief 使い終わったバッファを返す. 上限を超える場合は捨てる
+   */
+  void Release(std::vector<uint8_t> buffer);
+
+  Stats GetStats() const;
+
+ private:
+  std::size_t max_pooled_bytes_;
+  mutable std::mutex mutex_;
+  std::multimap<std::size_t, std::vector<uint8_t>> buffers_;  // 容量順
+  Stats stats_;
+};
+
+/**
+ * @brief 先頭のバイト列 (マジックナンバー) でフォーマットを判定してデコーダーを選ぶ
+ * @details 組み込みで BMP / TGA / PNG に対応する (Windows の API や DirectXTex には依存しない).
+ *          BMP と TGA は BGRA8, PNG は RGBA8 で出力する (GPU はどちらも読めるので並べ替えない).
+ *          TGA にはマジックナンバーが無いので, ヘッダーの値が妥当かどうかで判定し, 他の全てのフォーマットの後に試す.
+ *
+ *   ImageDecoderRegistry decoders;
+ *   std::string error;
+ *   auto image = decoders.Decode(data, size, pool, &error);  // pool は std::shared_ptr<PixelBufferPool> (nullptr 可)
+ */
+class ImageDecoderRegistry {
+ public:
+  ImageDecoderRegistry();
+
+  /**
+   * @brief デコーダーを追加する (組み込みのもの・先に登録したものが優先される)
+   */
+  void Register(ImageCodec codec);
+
+  /**
+   * @return 対応するデコーダーが無ければ nullptr
+   */
+  const ImageCodec* Find(const uint8_t* data, std::size_t size) const;
+
+  bool ReadInfo(const uint8_t* data, std::size_t size, ImageInfo* info, std::string* error) const;
+
+  /**
+   * @brief 呼び出し側が用意したメモリ (アップロードバッファなど) に直接デコードする
+   * @param info ReadInfo() で読んだもの
+   */
+  bool DecodeInto(const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst, std::size_t row_pitch,
+                  std::string* error) const;
+
+  /**
+   * @brief out にデコードする. out->pixels の容量が足りていれば確保し直さない
+   */
+  bool Decode(const uint8_t* data, std::size_t size, Image* out, std::string* error) const;
+
+  /**
+   * @brief pool から取ったバッファにデコードする. 返した画像が破棄されるとバッファは pool に戻る
+   * @return 失敗したら nullptr
+   */
+  std::shared_ptr<const Image> Decode(const uint8_t* data, std::size_t size,
+                                      const std::shared_ptr<PixelBufferPool>& pool, std::string* error) const;
+
+ private:
+  std::vector<ImageCodec> codecs_;
+  ImageCodec tga_;  // 判定が曖昧なので最後に試す
+};
+
+// 組み込みのデコーダー (ImageDecoderRegistry を通さずに使う場合や, 順番を変えて登録し直す場合に)
+ImageCodec MakeBmpCodec();
+ImageCodec MakeTgaCodec();
+ImageCodec MakePngCodec();
@@ -0,0 +1,430 @@
+#include "inflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr int kFastBits = 10;  // これ以下の長さの符号は表を 1 回引くだけで読む
+constexpr int kMaxBits = 15;
+
+constexpr uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                      31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr uint16_t kDistanceBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                        193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                        6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/**
+ * @brief 下位ビットから順に読むビットストリーム
+ * @details 入力の終わりを越えて読んだ分は 0 で埋め, 埋めたバイト数を数える (越えて使っていたら Overrun()).
+ *          バッファの count_ より上のビットは 0 か, 次に読むバイトと同じ値になっている.
+ */
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, std::size_t size) : p_(data), end_(data + size) {}
+
+  /**
+   * @brief バッファに 56 bit 以上入れる
+   */
+  void Refill() {
+    if (end_ - p_ >= 8) {
+      uint64_t v;
+      std::memcpy(&v, p_, 8);  // リトルエンディアン前提
+      buffer_ |= v << count_;
+      p_ += (63 - count_) >> 3;
+      count_ |= 56;
+      return;
+    }
+    while (count_ <= 56) {
+      if (p_ < end_) {
+        buffer_ |= uint64_t(*p_++) << count_;
+      } else {
+        ++overrun_;
+      }
+      count_ += 8;
+    }
+  }
+
+  uint32_t Peek(int bits) const { return static_cast<uint32_t>(buffer_ & ((uint64_t(1) << bits) - 1)); }
+  void Consume(int bits) {
+    buffer_ >>= bits;
+    count_ -= bits;
+  }
+  uint32_t Read(int bits) {
+    const uint32_t value = Peek(bits);
+    Consume(bits);
+    return value;
+  }
+
+  bool Overrun() const { return overrun_ * 8 > count_; }
+
+  /**
+   * @brief バイト境界まで読み飛ばし, 次に読むバイトの位置を返す (入力を越えていたら nullptr)
+   * @details 以降は Reset() するまでビットとしては読まない
+   */
+  const uint8_t* AlignedPosition() {
+    Consume(count_ & 7);
+    if (Overrun()) {
+      return nullptr;
+    }
+    return p_ - (count_ / 8 - overrun_);
+  }
+
+  void Reset(const uint8_t* p) {
+    p_ = p;
+    buffer_ = 0;
+    count_ = 0;
+    overrun_ = 0;
+  }
+
+  const uint8_t* end() const { return end_; }
+
+ private:
+  const uint8_t* p_;
+  const uint8_t* end_;
+  uint64_t buffer_ = 0;
+  int count_ = 0;
+  int overrun_ = 0;
+};
+
+/**
+ * @brief 正準ハフマン符号の復号表
+ */
+struct Huffman {
+  uint16_t fast[1 << kFastBits];  // (符号長 << 9) | シンボル. 0 なら kFastBits より長い符号 (または無効)
+  uint16_t count[kMaxBits + 1];   // 符号長ごとのシンボル数
+  uint16_t symbols[288];          // 符号長, シンボルの順に並べたもの
+
+  /**
+   * @return 符号長が多すぎる (符号が重なる) 場合は false. 足りない (不完全な) 符号は許す
+   */
+  bool Build(const uint8_t* lengths, int n) {
+    std::fill(std::begin(count), std::end(count), uint16_t(0));
+    for (int i = 0; i < n; ++i) {
+      ++count[lengths[i]];
+    }
+    count[0] = 0;
+    int left = 1;
+    for (int len = 1; len <= kMaxBits; ++len) {
+      left = (left << 1) - count[len];
+      if (left < 0) {
+        return false;
+      }
+    }
+    uint16_t offsets[kMaxBits + 2] = {};
+    for (int len = 1; len <= kMaxBits; ++len) {
+      offsets[len + 1] = static_cast<uint16_t>(offsets[len] + count[len]);
+    }
+    for (int i = 0; i < n; ++i) {
+      if (lengths[i] != 0) {
+        symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+      }
+    }
+
+    // 符号はビットの並びが逆順でストリームに入っているので, 反転した値で表を引く
+    std::fill(std::begin(fast), std::end(fast), uint16_t(0));
+    uint32_t code = 0;
+    int index = 0;
+    for (int len = 1; len <= kFastBits; ++len) {
+      for (int k = 0; k < count[len]; ++k, ++code) {
+        uint32_t reversed = 0;
+        for (int b = 0; b < len; ++b) {
+          reversed |= ((code >> b) & 1) << (len - 1 - b);
+        }
+        const uint16_t entry = static_cast<uint16_t>((len << 9) | symbols[index++]);
+        for (uint32_t j = reversed; j < (1u << kFastBits); j += 1u << len) {
+          fast[j] = entry;
+        }
+      }
+      code <<= 1;
+    }
+    return true;
+  }
+
+  /**
+   * @brief 1 シンボル読む (呼び出し側で Refill() しておく)
+   * @return 無効な符号なら -1
+   */
+  int Decode(BitReader& bits) const {
+    const uint16_t entry = fast[bits.Peek(kFastBits)];
+    if (entry != 0) {
+      bits.Consume(entry >> 9);
+      return entry & 511;
+    }
+    // 長い符号は 1 bit ずつ, 符号長ごとの範囲に入るかで探す
+    const uint32_t buffer = bits.Peek(kMaxBits);
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= kMaxBits; ++len) {
+      code |= (buffer >> (len - 1)) & 1;
+      if (code - count[len] < first) {
+        bits.Consume(len);
+        return symbols[index + (code - first)];
+      }
+      index += count[len];
+      first = (first + count[len]) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+};
+
+struct FixedTables {
+  Huffman literal;
+  Huffman distance;
+
+  FixedTables() {
+    uint8_t lengths[288];
+    std::fill(lengths, lengths + 144, uint8_t(8));
+    std::fill(lengths + 144, lengths + 256, uint8_t(9));
+    std::fill(lengths + 256, lengths + 280, uint8_t(7));
+    std::fill(lengths + 280, lengths + 288, uint8_t(8));
+    literal.Build(lengths, 288);
+    std::fill(lengths, lengths + 30, uint8_t(5));
+    distance.Build(lengths, 30);
+  }
+};
+
+bool ReadDynamicTables(BitReader& bits, Huffman* literal, Huffman* distance, std::string* error) {
+  static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+  bits.Refill();
+  const int literal_count = static_cast<int>(bits.Read(5)) + 257;
+  const int distance_count = static_cast<int>(bits.Read(5)) + 1;
+  const int code_length_count = static_cast<int>(bits.Read(4)) + 4;
+  if (literal_count > 286 || distance_count > 30) {
+    *error = "zlib: too many codes";
+    return false;
+  }
+  uint8_t code_lengths[19] = {};
+  for (int i = 0; i < code_length_count; ++i) {
+    bits.Refill();
+    code_lengths[kOrder[i]] = static_cast<uint8_t>(bits.Read(3));
+  }
+  Huffman code_length_table;
+  if (!code_length_table.Build(code_lengths, 19)) {
+    *error = "zlib: invalid code length codes";
+    return false;
+  }
+
+  uint8_t lengths[286 + 30] = {};
+  const int total = literal_count + distance_count;
+  for (int n = 0; n < total;) {
+    bits.Refill();
+    const int symbol = code_length_table.Decode(bits);
+    if (symbol < 0) {
+      *error = "zlib: invalid code length";
+      return false;
+    }
+    if (symbol < 16) {
+      lengths[n++] = static_cast<uint8_t>(symbol);
+      continue;
+    }
+    uint8_t value = 0;
+    int repeat = 0;
+    if (symbol == 16) {
+      if (n == 0) {
+        *error = "zlib: repeat without a previous length";
+        return false;
+      }
+      value = lengths[n - 1];
+      repeat = 3 + static_cast<int>(bits.Read(2));
+    } else if (symbol == 17) {
+      repeat = 3 + static_cast<int>(bits.Read(3));
+    } else {
+      repeat = 11 + static_cast<int>(bits.Read(7));
+    }
+    if (n + repeat > total) {
+      *error = "zlib: code lengths overflow";
+      return false;
+    }
+    std::fill(lengths + n, lengths + n + repeat, value);
+    n += repeat;
+  }
+  if (bits.Overrun()) {
+    *error = "zlib: truncated stream";
+    return false;
+  }
+  if (lengths[256] == 0) {
+    *error = "zlib: missing end-of-block code";
+    return false;
+  }
+  if (!literal->Build(lengths, literal_count) || !distance->Build(lengths + literal_count, distance_count)) {
+    *error = "zlib: invalid code lengths";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief ハフマン符号化されたブロックの中身を展開する
+ */
+bool InflateBlock(BitReader& bits, const Huffman& literal, const Huffman& distance, uint8_t* out,
+                  std::size_t out_size, std::size_t* position, std::string* error) {
+  // 入力が途中で切れている場合は, 0 で埋めたビットを読んだことによる他のエラーより先にそちらを報告する
+  auto fail = [&](const char* message) {
+    *error = bits.Overrun() ? "zlib: truncated stream" : message;
+    return false;
+  };
+  std::size_t pos = *position;
+  for (;;) {
+    // 1 シンボルで読むのは最大 15 + 5 + 15 + 13 = 48 bit
+    bits.Refill();
+    const int symbol = literal.Decode(bits);
+    if (symbol < 256) {
+      if (symbol < 0) {
+        return fail("zlib: invalid literal/length code");
+      }
+      if (pos >= out_size) {
+        return fail("zlib: output is larger than expected");
+      }
+      out[pos++] = static_cast<uint8_t>(symbol);
+      continue;
+    }
+    if (symbol == 256) {
+      break;
+    }
+    if (symbol > 285) {
+      return fail("zlib: invalid length code");
+    }
+    const std::size_t length = kLengthBase[symbol - 257] + bits.Read(kLengthExtra[symbol - 257]);
+    const int distance_symbol = distance.Decode(bits);
+    if (distance_symbol < 0 || distance_symbol >= 30) {
+      return fail("zlib: invalid distance code");
+    }
+    const std::size_t dist = kDistanceBase[distance_symbol] + bits.Read(kDistanceExtra[distance_symbol]);
+    if (dist > pos) {
+      return fail("zlib: distance is too far back");
+    }
+    if (length > out_size - pos) {
+      return fail("zlib: output is larger than expected");
+    }
+    uint8_t* dst = out + pos;
+    const uint8_t* src = dst - dist;
+    if (dist >= 8 && out_size - pos >= length + 8) {
+      // 8 bytes ずつ (末尾で最大 7 bytes 余分に書くが, その位置は後で上書きされる)
+      for (std::size_t i = 0; i < length; i += 8) {
+        std::memcpy(dst + i, src + i, 8);
+      }
+    } else if (dist == 1) {
+      std::memset(dst, *src, length);
+    } else {
+      for (std::size_t i = 0; i < length; ++i) {
+        dst[i] = src[i];
+      }
+    }
+    pos += length;
+  }
+  *position = pos;
+  if (bits.Overrun()) {
+    return fail("zlib: truncated stream");
+  }
+  return true;
+}
+
+}  // namespace
+
+uint32_t Adler32(const uint8_t* data, std::size_t size, uint32_t adler) {
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (size > 0) {
+    // 5552 bytes までなら 32 bit で溢れない
+    const std::size_t n = std::min<std::size_t>(size, 5552);
+    size -= n;
+    for (std::size_t i = 0; i < n; ++i) {
+      a += data[i];
+      b += a;
+    }
+    data += n;
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+bool InflateZlib(const uint8_t* data, std::size_t size, uint8_t* out, std::size_t out_size, std::string* error) {
+  if (size < 6) {
+    *error = "zlib: truncated stream";
+    return false;
+  }
+  const int cmf = data[0];
+  const int flg = data[1];
+  if ((cmf & 15) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0) {
+    *error = "zlib: invalid header";
+    return false;
+  }
+  if (flg & 0x20) {
+    *error = "zlib: preset dictionary is not supported";
+    return false;
+  }
+
+  static const FixedTables fixed;
+  Huffman literal;
+  Huffman distance;
+  BitReader bits(data + 2, size - 2);
+  std::size_t pos = 0;
+  bool final_block = false;
+  while (!final_block) {
+    bits.Refill();
+    final_block = bits.Read(1) != 0;
+    const uint32_t type = bits.Read(2);
+    if (type == 0) {
+      // 無圧縮ブロック: バイト境界から LEN, NLEN, データ
+      const uint8_t* p = bits.AlignedPosition();
+      if (p == nullptr || bits.end() - p < 4) {
+        *error = "zlib: truncated stream";
+        return false;
+      }
+      const std::size_t len = p[0] | (p[1] << 8);
+      const std::size_t nlen = p[2] | (p[3] << 8);
+      p += 4;
+      if (len != (~nlen & 0xffff)) {
+        *error = "zlib: corrupt stored block";
+        return false;
+      }
+      if (static_cast<std::size_t>(bits.end() - p) < len) {
+        *error = "zlib: truncated stream";
+        return false;
+      }
+      if (len > out_size - pos) {
+        *error = "zlib: output is larger than expected";
+        return false;
+      }
+      std::memcpy(out + pos, p, len);
+      pos += len;
+      bits.Reset(p + len);
+      continue;
+    }
+    if (type == 1) {
+      if (!InflateBlock(bits, fixed.literal, fixed.distance, out, out_size, &pos, error)) {
+        return false;
+      }
+    } else if (type == 2) {
+      if (!ReadDynamicTables(bits, &literal, &distance, error) ||
+          !InflateBlock(bits, literal, distance, out, out_size, &pos, error)) {
+        return false;
+      }
+    } else {
+      *error = "zlib: invalid block type";
+      return false;
+    }
+  }
+
+  const uint8_t* p = bits.AlignedPosition();
+  if (p == nullptr || bits.end() - p < 4) {
+    *error = "zlib: missing checksum";
+    return false;
+  }
+  if (pos != out_size) {
+    *error = "zlib: output is smaller than expected";
+    return false;
+  }
+  const uint32_t expected = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+  if (Adler32(out, out_size) != expected) {
+    *error = "zlib: checksum mismatch";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief zlib (RFC 1950 / RFC 1951) のストリームを展開する
+ * @details 展開後のサイズが分かっている用途 (PNG の IDAT など) 向けに, 呼び出し側の out にそのまま書き出す.
+ *          Adler-32 も確かめる. プリセット辞書 (FDICT) には対応しない.
+ * @param out 展開先
+ * @param out_size out のバイト数. 展開結果がちょうどこのサイズでなければ失敗にする
+ * @return 失敗したら false. 理由は error に入れる
+ */
+bool InflateZlib(const uint8_t* data, std::size_t size, uint8_t* out, std::size_t out_size, std::string* error);
+
+/**
+ * @brief Adler-32 (zlib のチェックサム)
+ */
+uint32_t Adler32(const uint8_t* data, std::size_t size, uint32_t adler = 1);
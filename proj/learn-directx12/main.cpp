@@ -7,19 +7,51 @@
 #include <dxgi1_6.h>
 #include <tchar.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <istream>
-#include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _DEBUG
 #include <iostream>
 #endif
 
+#include "bc_encoder.h"
+#include "command_recording.h"
+#include "compressed_texture_cache.h"
+#include "culling.h"
+#include "draw_list.h"
+#include "frame_scheduler.h"
+#include "heap_allocator.h"
+#include "image.h"
+#include "image_decoder.h"
+#include "material.h"
+#include "mesh_lod.h"
+#include "mip_generator.h"
+#include "mip_streamer.h"
+#include "model_loader.h"
+#include "null_render_backend.h"
+#include "pmd_file.h"
+#include "profiler.h"
+#include "render_backend.h"
+#include "skinning.h"
+#include "string_util.h"
+#include "texture_cache.h"
+#include "texture_content_store.h"
+#include "thread_pool.h"
+#include "upload_allocator.h"
+#include "vmd_motion.h"
+
 #pragma comment(lib, "d3d12.lib")
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3dcompiler.lib")
@@ -29,95 +61,121 @@ namespace fs = std::filesystem;
 const unsigned int window_width = 1280;
 const unsigned int window_height = 720;
 
-std::map<std::string, std::function<HRESULT(const std::wstring&, DirectX::TexMetadata*, DirectX::ScratchImage&)>>
-    loadLambdaTable;
-
-/**
- * @brief
- * @param str マルチバイト文字列
- * @return 変換されたワイド文字列
- */
-std::wstring GetWideStringFromString(const std::string& str, UINT code_page = CP_ACP) {
-  // 文字列数
-  auto num1 = MultiByteToWideChar(code_page, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.c_str(), -1, nullptr, 0);
-  wchar_t* buf = new wchar_t[num1 + 1];
-  auto num2 = MultiByteToWideChar(code_page, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.c_str(), -1, buf, num1);
-  assert(num1 == num2);
-  std::wstring ret_wstr(buf);
-  delete buf;
-  return ret_wstr;
-}
-
-#pragma pack(push, 1)
-struct PMD_VERTEX {
-  DirectX::XMFLOAT3 pos;
-  DirectX::XMFLOAT3 normal;
-  DirectX::XMFLOAT2 uv;
-  uint16_t bone_no[2];
-  uint8_t weight;
-  uint8_t EdgeFlag;
-  uint16_t dummy;
-};
+// テクスチャのデコーダー. 形式はファイルの先頭のバイト列で判定する (BMP / TGA / PNG は組み込み, それ以外は DirectXTex)
+ImageDecoderRegistry image_decoders;
+// デコード先のバッファ. TextureContentStore で重複として捨てられた画像などのバッファを次のデコードで使い回す
+std::shared_ptr<PixelBufferPool> pixel_buffer_pool = std::make_shared<PixelBufferPool>();
 
 /**
- * @brief PMD マテリアル構造体 ( fread 用)
+ * @brief シェーダー側に渡すための基本的な行列データ
  *
  */
-struct PMDMaterial {
-  DirectX::XMFLOAT3 diffuse;   // 4 bytes * 3 ディフューズ色
-  float alpha;                 // 4 bytes      ディフューズα
-  float specularity;           // 4 bytes      スペキュラの強さ (乗算値)
-  DirectX::XMFLOAT3 specular;  // 4 bytes * 3 スペキュラ色
-  DirectX::XMFLOAT3 ambient;   // 4 bytes * 3 アンビエント色
-  unsigned char toonIdx;       // 1 byte      トゥーン番号 (後述)
-  unsigned char edgeFlg;       // 1 byte      マテリアルごとの輪郭線フラグ
-  unsigned int indicesNum;     // 4 bytes     このマテリアルが割り当てられる
-                               // インデックス数
-  char texFilePath[20];        // 1 byte * 20 テクスチャファイルパス + alpha
+struct SceneMatrices {
+  DirectX::XMMATRIX world;  // World Matrix
+  DirectX::XMMATRIX view;   // View Transformation Matrix
+  DirectX::XMMATRIX proj;   // Projection Matrix
+  DirectX::XMFLOAT3 eye;    // Eye Position
 };
-#pragma pack(pop)
 
 /**
- * @brief シェーダー側に投げられるマテリアルデータ
- *
+ * @brief フレームごとに持つリソース
+ * @details GPU が実行中のフレームのものは書き換えられないので, FrameScheduler のスロットの数だけ用意する.
  */
-struct MaterialForHlsl {
-  DirectX::XMFLOAT3 diffuse;   // 4 bytes * 3 ディフューズ色
-  float alpha;                 // 4 bytes     ディフューズα
-  DirectX::XMFLOAT3 specular;  // 4 bytes * 3 スペキュラ色
-  float specularity;           // 4 bytes     スペキュラの強さ（乗算値）
-  DirectX::XMFLOAT3 ambient;   // 4 bytes * 3 アンビエント色
+struct FrameContext {
+  ID3D12CommandAllocator* command_allocator = nullptr;
+  BufferView vertex_view;                        // 頂点バッファのこのフレームの区画
+  unsigned char* vertex_map = nullptr;           // その Map 先
+  uint64_t vertex_version = 0;                   // vertex_map に書いてあるスキニング結果の世代
+  // 描画コマンドを区間ごとに並列に記録するコマンドリスト (メインのコマンドリストの後に順に実行する)
+  std::vector<ID3D12CommandAllocator*> recording_allocators;
+  std::vector<ID3D12GraphicsCommandList*> recording_lists;
 };
 
-/**
- * @brief それ以外のマテリアルデータ
- *
- */
-struct AdditionalMaterial {
-  std::string texPath;  // テクスチャファイルパス
-  int toonIdx;          // トゥーン番号
-  bool edgeFlg;         // マテリアルごとの輪郭線フラグ
-};
+// RenderBackend のハンドルは ID3D12Resource* の値
+ID3D12Resource* ToResource(ResourceHandle handle) {
+  return reinterpret_cast<ID3D12Resource*>(static_cast<uintptr_t>(handle));
+}
+ResourceHandle ToHandle(ID3D12Resource* resource) {
+  return static_cast<ResourceHandle>(reinterpret_cast<uintptr_t>(resource));
+}
 
 /**
- * @brief 全体をまとめるデータ
- *
+ * @brief RenderCommandList の D3D12 の実装 (コマンドリスト 1 つに記録する)
+ * @details パイプラインは 1 つだけなので, コマンドリストを Reset した時に設定してある.
  */
-struct Material {
-  unsigned int indicesNum;  // インデックス数
-  MaterialForHlsl material;
-  AdditionalMaterial additional;
-};
+class D3D12CommandList : public RenderCommandList {
+ public:
+  /**
+   * @param material_table_size 1 マテリアルのディスクリプタテーブルのバイト数
+   * @param material_descriptor_index 重複を除いたマテリアル -> ディスクリプタテーブルの番号
+   */
+  D3D12CommandList(ID3D12GraphicsCommandList* list, D3D12_CPU_DESCRIPTOR_HANDLE rtv, D3D12_CPU_DESCRIPTOR_HANDLE dsv,
+                   ID3D12RootSignature* root_signature, ID3D12DescriptorHeap* material_heap,
+                   UINT64 material_table_size, const std::vector<unsigned int>* material_descriptor_index)
+      : list_(list),
+        rtv_(rtv),
+        dsv_(dsv),
+        root_signature_(root_signature),
+        material_heap_(material_heap),
+        material_table_size_(material_table_size),
+        material_descriptor_index_(material_descriptor_index) {}
+
+  void BeginPass(const PassDesc& pass) override {
+    list_->OMSetRenderTargets(1, &rtv_, false, &dsv_);
+    if (pass.clear_depth) {
+      list_->ClearDepthStencilView(dsv_, D3D12_CLEAR_FLAG_DEPTH, pass.depth, 0, 0, nullptr);
+    }
+    if (pass.clear_color) {
+      list_->ClearRenderTargetView(rtv_, pass.color, 0, nullptr);
+    }
+    // ビューポートとシザー矩形は出力先全体
+    D3D12_VIEWPORT viewport = {};
+    viewport.Width = static_cast<FLOAT>(pass.width);    // 出力先の幅(ピクセル数)
+    viewport.Height = static_cast<FLOAT>(pass.height);  // 出力先の高さ(ピクセル数)
+    viewport.MaxDepth = 1.0f;                           // 深度最大値
+    D3D12_RECT scissor_rect = {0, 0, static_cast<LONG>(pass.width), static_cast<LONG>(pass.height)};
+    list_->RSSetViewports(1, &viewport);
+    list_->RSSetScissorRects(1, &scissor_rect);
+    list_->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    list_->SetGraphicsRootSignature(root_signature_);
+    list_->SetDescriptorHeaps(1, &material_heap_);
+  }
+  void SetVertexBuffer(const BufferView& view) override {
+    D3D12_VERTEX_BUFFER_VIEW vertex_view = {};
+    vertex_view.BufferLocation = ToResource(view.buffer)->GetGPUVirtualAddress() + view.offset;
+    vertex_view.SizeInBytes = view.size;
+    vertex_view.StrideInBytes = view.stride;
+    list_->IASetVertexBuffers(0, 1, &vertex_view);
+  }
+  void SetIndexBuffer(const BufferView& view) override {
+    D3D12_INDEX_BUFFER_VIEW index_view = {};
+    index_view.BufferLocation = ToResource(view.buffer)->GetGPUVirtualAddress() + view.offset;
+    index_view.SizeInBytes = view.size;
+    index_view.Format = view.stride == 4 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+    list_->IASetIndexBuffer(&index_view);
+  }
+  void SetConstantBuffer(uint64_t gpu_address) override {
+    list_->SetGraphicsRootConstantBufferView(0, gpu_address);  // WVP matrix (World View Projection Matrix)
+  }
+  void SetPipeline(uint32_t) override {}
+  void SetGeometry(uint32_t) override {}
+  void SetMaterial(uint32_t material) override {
+    auto handle = material_heap_->GetGPUDescriptorHandleForHeapStart();
+    handle.ptr += static_cast<UINT64>((*material_descriptor_index_)[material]) * material_table_size_;
+    list_->SetGraphicsRootDescriptorTable(1, handle);
+  }
+  void DrawIndexed(uint32_t index_count, uint32_t index_offset) override {
+    list_->DrawIndexedInstanced(index_count, 1, index_offset, 0, 0);
+  }
 
-/**
- * @brief シェーダー側に渡すための基本的な行列データ
- *
- */
-struct SceneMatrices {
-  DirectX::XMMATRIX world;  // World Matrix
-  DirectX::XMMATRIX view;   // View Transformation Matrix
-  DirectX::XMMATRIX proj;   // Projection Matrix
-  DirectX::XMFLOAT3 eye;    // Eye Position
+ private:
+  ID3D12GraphicsCommandList* list_;
+  D3D12_CPU_DESCRIPTOR_HANDLE rtv_;
+  D3D12_CPU_DESCRIPTOR_HANDLE dsv_;
+  ID3D12RootSignature* root_signature_;
+  ID3D12DescriptorHeap* material_heap_;
+  UINT64 material_table_size_;
+  const std::vector<unsigned int>* material_descriptor_index_;
 };
 
 /**
@@ -126,7 +184,7 @@ struct SceneMatrices {
  * @param alignment アライメントサイズ
  * @return アライメントをそろえたサイズ
  */
-size_t AlignmentedSize(size_t size, size_t alignment) { return size + alignment - size % alignment; }
+size_t AlignmentedSize(size_t size, size_t alignment) { return (size + alignment - 1) / alignment * alignment; }
 
 /**
  * @brief コンソール画面にフォーマット付き文字列を表示
@@ -158,106 +216,348 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam) {
 
 IDXGIFactory6* _dxgiFactory = nullptr;
 ID3D12Device* _dev = nullptr;
-ID3D12CommandAllocator* _cmdAllocator = nullptr;
 ID3D12GraphicsCommandList* _cmdList = nullptr;
 ID3D12CommandQueue* _cmdQueue = nullptr;
 IDXGISwapChain4* _swapchain = nullptr;
 
-// ファイル名パスとリソースのマップテーブル
-std::map<std::wstring, ID3D12Resource*> resource_table;
+// デコード済み画像とリソースのマップテーブル
+// (同じテクスチャは TextureCache が同じ Image を返すので, 画像単位で 1 つだけリソースを作る)
+std::unordered_map<std::shared_ptr<const Image>, ID3D12Resource*> image_resource_table;
+// 画像ごとのミップチェーン (CPU 側. level 0 は元の画像の複製)
+std::unordered_map<const Image*, std::vector<Image>> image_mip_table;
+
+// true なら小さいミップだけを先に GPU に置き, 描画で要求されたミップを MipStreamer の予算の範囲で後から読み込む
+constexpr bool kStreamTextureMips = true;
+constexpr std::size_t kTextureMipBudget = std::size_t(256) << 20;
+// true ならテクスチャを BC1 / BC7 に圧縮して GPU に置く (RGBA8 の 1/8 - 1/4).
+// 圧縮済みのミップチェーンはモデルのディレクトリの texture_cache に残し, 2 回目以降はエンコードしない.
+// 圧縮したテクスチャは全ミップを常駐させる (ストリーミングしない)
+constexpr bool kCompressTextures = true;
+// GPU に投げたままにするフレーム数. CPU はフレーム N + 1 を記録しながら GPU のフレーム N の完了を待たない (1 なら毎フレーム待つ)
+constexpr uint32_t kFramesInFlight = 2;
+// 描画コマンドを並列に記録するコマンドリストの数の上限と, 1 つのコマンドリストに記録する描画の数の下限
+// (描画が少ない場合は分けずに 1 つに記録する)
+constexpr std::size_t kMaxRecordingRanges = 4;
+constexpr std::size_t kMinDrawsPerRecordingRange = 64;
+// true なら描画ごとの境界ボックスを視錐台で判定し, 画面に映らない描画を記録しない
+constexpr bool kCullDraws = true;
+// true なら不透明な描画を CPU で粗い深度バッファに描き, それに隠れる描画も記録しない
+// (モデル 1 体ではほとんど隠れないので既定は無効)
+constexpr bool kOcclusionCulling = false;
+// マテリアルごとに三角形を減らした LOD の段数 (元のメッシュを含む. 1 なら作らない) と,
+// 画面上の大きさで LOD を選ぶときに許容する誤差 (画素)
+constexpr std::size_t kLodLevels = 4;
+constexpr float kLodPixelError = 1.0f;
+// 0 以外なら, そのフレームで記録したコマンドを kCapturePath に書き出す (perf-bench render-backend --capture で再生・解析する)
+constexpr unsigned int kCaptureFrame = 0;
+constexpr const char* kCapturePath = "frame_capture.rcap";
+// フレーム時間 (p50 / p99) と段階ごとの CPU 時間を出力する間隔 (フレーム数). 0 なら出力しない
+constexpr unsigned int kProfileSummaryInterval = 600;
+// 空でなければ, 終了時に直近の区間を Chrome trace の JSON で書き出す (chrome://tracing や Perfetto で開く)
+constexpr const char* kProfileTracePath = "frame_trace.json";
 
 /**
- * @brief
- * @details upload buffer (中間バッファ) を挟んで read only な texture buffer にしないのはなぜか？
+ * @brief DirectXTex の読み込み関数を ImageCodec にする (組み込みのデコーダーが対応していない JPEG / DDS など用)
+ * @details RGBA8 / BGRA8 以外は RGBA8 に変換してから dst に書き出す.
  *
- * @param tex_path_wstr
- * @return ID3D12Resource*
- *         If tex_path_wstr is empty wstring (""), return nullptr.
- *         If failed to load, return nullptr.
+ * @param get_metadata ヘッダーだけを読む関数 (GetMetadataFrom*Memory)
+ * @param load 読み込む関数 (LoadFrom*Memory)
  */
-ID3D12Resource* LoadTextureFromFile(const std::wstring& tex_path_wstr) {
-  auto it = resource_table.find(tex_path_wstr);
-  if (it != resource_table.end()) {
-    return it->second;
-  }
-
-  // WIC テクスチャのロード
-  DirectX::TexMetadata metadata = {};
-  DirectX::ScratchImage scratchImg = {};
-  if (tex_path_wstr == L"") {
-#ifdef _DEBUG
-    {  // debug
-      std::wstringstream ss;
-      ss << L"LoadTextureFromFile's argument tex_path_wstr is invalid: \"" << tex_path_wstr.c_str() << L"\""
-         << std::endl;
-      OutputDebugStringW(ss.str().c_str());
+ImageCodec MakeDirectXTexCodec(
+    std::string name, std::function<bool(const uint8_t*, std::size_t)> match,
+    std::function<HRESULT(const uint8_t*, std::size_t, DirectX::TexMetadata*)> get_metadata,
+    std::function<HRESULT(const uint8_t*, std::size_t, DirectX::TexMetadata*, DirectX::ScratchImage&)> load) {
+  auto to_pixel_format = [](DXGI_FORMAT format) {
+    return format == DXGI_FORMAT_B8G8R8A8_UNORM ? PixelFormat::kBGRA8 : PixelFormat::kRGBA8;
+  };
+  ImageCodec codec;
+  codec.name = std::move(name);
+  codec.match = std::move(match);
+  codec.read_info = [get_metadata, to_pixel_format](const uint8_t* data, std::size_t size, ImageInfo* info,
+                                                    std::string* error) {
+    DirectX::TexMetadata metadata = {};
+    if (FAILED(get_metadata(data, size, &metadata))) {
+      *error = "failed to read the image header";
+      return false;
     }
-#endif
-    return nullptr;
-  }
-  fs::path tex_path(tex_path_wstr);
-  auto result = loadLambdaTable[tex_path.extension().string()](tex_path_wstr, &metadata, scratchImg);
-  if (FAILED(result)) {
-#ifdef _DEBUG
-    {  // debug
-      std::wstringstream ss;
-      ss << L"Failed to load a file: \"" << tex_path_wstr.c_str() << L"\"" << std::endl;
-      OutputDebugStringW(ss.str().c_str());
+    info->width = static_cast<uint32_t>(metadata.width);
+    info->height = static_cast<uint32_t>(metadata.height);
+    info->format = to_pixel_format(metadata.format);
+    return true;
+  };
+  codec.decode = [load, to_pixel_format](const uint8_t* data, std::size_t size, const ImageInfo& info, uint8_t* dst,
+                                         std::size_t row_pitch, std::string* error) {
+    DirectX::TexMetadata metadata = {};
+    DirectX::ScratchImage scratchImg = {};
+    if (FAILED(load(data, size, &metadata, scratchImg))) {
+      *error = "failed to decode the image";
+      return false;
     }
-#endif
-    return nullptr;
-  }
+    auto img = scratchImg.GetImage(0, 0, 0);  // 生データ抽出
+
+    // RGBA8 / BGRA8 以外は RGBA8 に揃える
+    DirectX::ScratchImage convertedImg = {};
+    if (img->format != DXGI_FORMAT_R8G8B8A8_UNORM && img->format != DXGI_FORMAT_B8G8R8A8_UNORM) {
+      HRESULT result = S_OK;
+      if (DirectX::IsCompressed(img->format)) {
+        result = DirectX::Decompress(*img, DXGI_FORMAT_R8G8B8A8_UNORM, convertedImg);
+      } else {
+        result = DirectX::Convert(*img, DXGI_FORMAT_R8G8B8A8_UNORM, DirectX::TEX_FILTER_DEFAULT,
+                                  DirectX::TEX_THRESHOLD_DEFAULT, convertedImg);
+      }
+      if (FAILED(result)) {
+        *error = "failed to convert the image to RGBA8";
+        return false;
+      }
+      img = convertedImg.GetImage(0, 0, 0);
+    }
+    if (img->width != info.width || img->height != info.height || to_pixel_format(img->format) != info.format) {
+      *error = "decoded image does not match the header";
+      return false;
+    }
+    const std::size_t row_bytes = std::size_t(img->width) * 4;
+    for (std::size_t y = 0; y < img->height; ++y) {
+      std::memcpy(dst + row_pitch * y, img->pixels + img->rowPitch * y, row_bytes);
+    }
+    return true;
+  };
+  return codec;
+}
+
+/**
+ * @brief 画像ファイルの中身を CPU 側の Image にデコードする
+ * @details TextureCache から (ModelLoader のワーカースレッドで) 並列に呼ばれる. GPU には触れない.
+ *          形式は拡張子ではなく中身で判定するので, 拡張子が .sph / .spa でも BMP ならそのまま読める.
+ *
+ * @param tex_path ログ用
+ * @param data ファイルの中身
+ * @param size data のバイト数
+ * @return std::shared_ptr<const Image>
+ *         If failed to load, return nullptr.
+ */
+std::shared_ptr<const Image> DecodeTextureData(const fs::path& tex_path, const uint8_t* data, std::size_t size) {
+  std::string error;
+  auto image = image_decoders.Decode(data, size, pixel_buffer_pool, &error);
 #ifdef _DEBUG
   {  // debug
     std::wstringstream ss;
-    ss << L"Load a file: \"" << tex_path_wstr.c_str() << L"\"" << std::endl;
+    if (image == nullptr) {
+      ss << L"Failed to load a file: \"" << tex_path.wstring().c_str() << L"\" (" << GetWideStringFromString(error).c_str()
+         << L")" << std::endl;
+    } else {
+      ss << L"Load a file: \"" << tex_path.wstring().c_str() << L"\"" << std::endl;
+    }
     OutputDebugStringW(ss.str().c_str());
   }
 #endif
+  return image;
+}
+
+/**
+ * @brief PixelFormat に対応する DXGI_FORMAT を返す
+ */
+DXGI_FORMAT ToDxgiFormat(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::kRGBA8:
+      return DXGI_FORMAT_R8G8B8A8_UNORM;
+    case PixelFormat::kBGRA8:
+      return DXGI_FORMAT_B8G8R8A8_UNORM;
+    case PixelFormat::kBC1:
+      return DXGI_FORMAT_BC1_UNORM;
+    case PixelFormat::kBC3:
+      return DXGI_FORMAT_BC3_UNORM;
+    case PixelFormat::kBC7:
+      return DXGI_FORMAT_BC7_UNORM;
+    default:
+      return DXGI_FORMAT_UNKNOWN;
+  }
+}
+
+/////////////////////
+// placed resource //
+/////////////////////
+
+/**
+ * @brief heap_properties と heap_flags の ID3D12Heap を作る HeapSuballocator
+ * @details D3D12 のヒープの大きさは 64 KiB の倍数にする (granularity が小さい専用のヒープの場合も)
+ */
+std::unique_ptr<HeapSuballocator> CreateHeapSuballocator(const HeapSuballocator::Options& options,
+                                                         D3D12_HEAP_PROPERTIES heap_properties,
+                                                         D3D12_HEAP_FLAGS heap_flags) {
+  return std::make_unique<HeapSuballocator>(
+      options,
+      [heap_properties, heap_flags](uint64_t size) -> void* {
+        D3D12_HEAP_DESC heap_desc = {};
+        heap_desc.SizeInBytes = AlignmentedSize(size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+        heap_desc.Properties = heap_properties;
+        heap_desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+        heap_desc.Flags = heap_flags;
+        ID3D12Heap* heap = nullptr;
+        if (FAILED(_dev->CreateHeap(&heap_desc, IID_PPV_ARGS(&heap)))) {
+          return nullptr;
+        }
+        return heap;
+      },
+      [](void* heap) { static_cast<ID3D12Heap*>(heap)->Release(); });
+}
+
+// テクスチャ (WriteToSubresource で書くので CPU から書ける L0 のヒープ) とアップロードヒープのバッファは,
+// リソースごとにヒープを作らず (CreateCommittedResource), 大きなヒープに CreatePlacedResource で詰めて置く.
+// 小さいテクスチャは 4 KiB 境界に置けるので, テクスチャのヒープは 4 KiB 単位で切り分ける
+std::unique_ptr<HeapSuballocator> texture_heaps;
+std::unique_ptr<HeapSuballocator> buffer_heaps;
+// 置いたリソースと, その割り当て (ReleaseResource() で返す)
+std::unordered_map<ID3D12Resource*, std::pair<HeapSuballocator*, HeapAllocation>> placed_resources;
+
+/**
+ * @brief texture_heaps / buffer_heaps を作る (デバイスを作った後に 1 回だけ呼ぶ)
+ */
+void CreateResourceHeaps() {
+  D3D12_HEAP_PROPERTIES texture_heap_properties = {};
+  texture_heap_properties.Type = D3D12_HEAP_TYPE_CUSTOM;
+  texture_heap_properties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
+  texture_heap_properties.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
+  HeapSuballocator::Options texture_options;
+  texture_options.granularity = D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT;
+  texture_heaps = CreateHeapSuballocator(texture_options, texture_heap_properties,
+                                         D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES);
+
+  HeapSuballocator::Options buffer_options;
+  buffer_options.heap_size = uint64_t(16) << 20;
+  buffer_heaps = CreateHeapSuballocator(buffer_options, CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+                                        D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS);
+}
 
-  auto img = scratchImg.GetImage(0, 0, 0);  // 生データ抽出
+/**
+ * @brief heaps から切り出した領域にリソースを置く
+ * @details テクスチャはまず 4 KiB 境界 (small resource) で置けるか問い合わせ, 置けなければ既定の 64 KiB 境界にする
+ *
+ * @return ID3D12Resource*
+ *         If failed to create, return nullptr.
+ */
+ID3D12Resource* CreatePlacedResource(HeapSuballocator& heaps, D3D12_RESOURCE_DESC desc,
+                                     D3D12_RESOURCE_STATES initial_state) {
+  if (desc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER) {
+    desc.Alignment = D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT;
+  }
+  auto info = _dev->GetResourceAllocationInfo(0, 1, &desc);
+  if (info.Alignment != desc.Alignment) {
+    desc.Alignment = 0;
+    info = _dev->GetResourceAllocationInfo(0, 1, &desc);
+  }
+  if (info.SizeInBytes == UINT64_MAX) {
+    return nullptr;
+  }
+  const auto allocation = heaps.Allocate(info.SizeInBytes, info.Alignment);
+  if (!allocation) {
+    return nullptr;
+  }
+  ID3D12Resource* resource = nullptr;
+  if (FAILED(_dev->CreatePlacedResource(static_cast<ID3D12Heap*>(allocation.heap), allocation.offset, &desc,
+                                        initial_state, nullptr, IID_PPV_ARGS(&resource)))) {
+    heaps.Free(allocation);
+    return nullptr;
+  }
+  placed_resources[resource] = {&heaps, allocation};
+  return resource;
+}
 
-  // Create Texture Buffer
-  ID3D12Resource* texbuff = nullptr;
-  {
-    // WriteToSubresource で転送する用のヒープ設定
-    D3D12_HEAP_PROPERTIES texHeapProp = {};
-    texHeapProp.Type = D3D12_HEAP_TYPE_CUSTOM;
-    texHeapProp.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
-    texHeapProp.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
-    texHeapProp.CreationNodeMask = 0;  // 単一アダプタのため0
-    texHeapProp.VisibleNodeMask = 0;   // 単一アダプタのため0
+/**
+ * @brief リソースを破棄する. CreatePlacedResource() で作ったものならヒープの領域も返す
+ */
+void ReleaseResource(ID3D12Resource* resource) {
+  resource->Release();
+  auto it = placed_resources.find(resource);
+  if (it != placed_resources.end()) {
+    it->second.first->Free(it->second.second);
+    placed_resources.erase(it);
+  }
+}
 
+/**
+ * @brief RenderBackend の D3D12 の実装
+ * @details バッファはアップロードヒープ, テクスチャは WriteToSubresource で書けるヒープに CreatePlacedResource で置く.
+ */
+class D3D12RenderBackend : public RenderBackend {
+ public:
+  ResourceHandle CreateBuffer(uint64_t size) override {
+    return ToHandle(
+        CreatePlacedResource(*buffer_heaps, CD3DX12_RESOURCE_DESC::Buffer(size), D3D12_RESOURCE_STATE_GENERIC_READ));
+  }
+  ResourceHandle CreateTexture(const TextureDesc& desc) override {
     D3D12_RESOURCE_DESC resDesc = {};
-    resDesc.Format = metadata.format;
-    resDesc.Width = metadata.width;    // 幅
-    resDesc.Height = metadata.height;  // 高さ
-    resDesc.DepthOrArraySize = metadata.arraySize;
+    resDesc.Format = ToDxgiFormat(desc.format);
+    resDesc.Width = desc.width;    // 幅
+    resDesc.Height = desc.height;  // 高さ
+    resDesc.DepthOrArraySize = 1;
     resDesc.SampleDesc.Count = 1;    // 通常テクスチャなのでアンチエイリアシングしない
     resDesc.SampleDesc.Quality = 0;  // クオリティは最低
-    resDesc.MipLevels = metadata.mipLevels;
-    resDesc.Dimension = static_cast<D3D12_RESOURCE_DIMENSION>(metadata.dimension);
+    resDesc.MipLevels = static_cast<UINT16>(desc.mip_levels);
+    resDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
     resDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;  // レイアウトは決定しない
     resDesc.Flags = D3D12_RESOURCE_FLAG_NONE;       // 特にフラグなし
-
-    result = _dev->CreateCommittedResource(&texHeapProp,
-                                           D3D12_HEAP_FLAG_NONE,  // 特に指定なし
-                                           &resDesc, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr,
-                                           IID_PPV_ARGS(&texbuff));
-    if (FAILED(result)) {
-      return nullptr;
-    }
-    result = texbuff->WriteToSubresource(0,
-                                         nullptr,         // 全領域へコピー
-                                         img->pixels,     // 元データアドレス
-                                         img->rowPitch,   // 1 ラインサイズ
-                                         img->slicePitch  // 全サイズ
-    );
-    if (FAILED(result)) {
+    return ToHandle(CreatePlacedResource(*texture_heaps, resDesc, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+  }
+  uint8_t* MapBuffer(ResourceHandle buffer) override {
+    // アップロードヒープは Map したままでよいので, 破棄するまで Unmap しない
+    uint8_t* mapped = nullptr;
+    if (FAILED(ToResource(buffer)->Map(0, nullptr, reinterpret_cast<void**>(&mapped)))) {
       return nullptr;
     }
+    return mapped;
+  }
+  bool WriteTexture(ResourceHandle texture, uint32_t level, const Image& image) override {
+    return SUCCEEDED(ToResource(texture)->WriteToSubresource(level,
+                                                             nullptr,                                // 全領域へコピー
+                                                             image.pixels.data(),                    // 元データアドレス
+                                                             static_cast<UINT>(image.row_pitch),     // 1 ラインサイズ
+                                                             static_cast<UINT>(image.SizeInBytes())  // 全サイズ
+                                                             ));
   }
-  resource_table[tex_path_wstr] = texbuff;
+  void ReleaseResource(ResourceHandle resource) override { ::ReleaseResource(ToResource(resource)); }
+};
+
+D3D12RenderBackend render_backend;
+
+/**
+ * @brief ミップチェーンの first_level 以降を持つテクスチャリソースを作る
+ * @details upload buffer (中間バッファ) を挟んで read only な texture buffer にしないのはなぜか？
+ *
+ * @param levels level 0 から順に並んだミップ
+ * @param first_level リソースの最も細かいミップにする段 (ストリーミングで細かいミップがまだ無い場合は 0 以外)
+ * @return ID3D12Resource*
+ *         If failed to create, return nullptr.
+ */
+ID3D12Resource* CreateTextureResource(const std::vector<Image>& levels, uint32_t first_level) {
+  return ToResource(CreateTextureFromLevels(render_backend, levels, first_level));
+}
+
+/**
+ * @brief 画像のテクスチャリソースを作る (画像ごとに 1 つだけ)
+ * @details image_mip_table にミップチェーンがあれば全ミップを持つリソースにする.
+ *
+ * @param image デコード済みの画像 (image_resource_table のキー)
+ * @param first_level GPU に置く最も細かいミップ
+ * @return ID3D12Resource*
+ *         If image is nullptr, return nullptr.
+ *         If failed to create, return nullptr.
+ */
+ID3D12Resource* CreateTextureFromImage(const std::shared_ptr<const Image>& image, uint32_t first_level = 0) {
+  if (image == nullptr) {
+    return nullptr;
+  }
+  auto it = image_resource_table.find(image);
+  if (it != image_resource_table.end()) {
+    return it->second;
+  }
+
+  auto mips = image_mip_table.find(image.get());
+  auto texbuff = mips != image_mip_table.end() ? CreateTextureResource(mips->second, first_level)
+                                               : CreateTextureResource({*image}, 0);
+  if (texbuff == nullptr) {
+    return nullptr;
+  }
+  image_resource_table[image] = texbuff;
   return texbuff;
 }
 
@@ -267,108 +567,39 @@ ID3D12Resource* LoadTextureFromFile(const std::wstring& tex_path_wstr) {
  * @return ID3D12Resource*
  */
 ID3D12Resource* CreateOneValueTexture(unsigned int fill_value) {
-  D3D12_HEAP_PROPERTIES texHeapProp = {};
-  texHeapProp.Type = D3D12_HEAP_TYPE_CUSTOM;
-  texHeapProp.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
-  texHeapProp.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
-  texHeapProp.CreationNodeMask = 0;
-  texHeapProp.VisibleNodeMask = 0;
-
   // texture's minimum size is 4x4
-  int width = 4;
-  int height = 4;
-
-  D3D12_RESOURCE_DESC resDesc = {};
-  resDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-  resDesc.Width = width;    // 幅
-  resDesc.Height = height;  // 高さ
-  resDesc.DepthOrArraySize = 1;
-  resDesc.SampleDesc.Count = 1;
-  resDesc.SampleDesc.Quality = 0;
-  resDesc.MipLevels = 1;
-  resDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-  resDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-  resDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-  ID3D12Resource* whiteBuff = nullptr;
-  auto result = _dev->CreateCommittedResource(&texHeapProp,
-                                              D3D12_HEAP_FLAG_NONE,  // 特に指定なし
-                                              &resDesc, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr,
-                                              IID_PPV_ARGS(&whiteBuff));
-  if (FAILED(result)) {
-    return nullptr;
-  }
-  std::vector<unsigned char> data(width * height * 4);  // 4: RGBA
-  std::fill(data.begin(), data.end(), fill_value);      // 全部 255 で埋める
-  // データ転送
-  result = whiteBuff->WriteToSubresource(0, nullptr, data.data(), width * height, data.size());
-  return whiteBuff;
+  Image image;
+  image.format = PixelFormat::kRGBA8;
+  image.width = 4;
+  image.height = 4;
+  image.row_pitch = image.width * 4;                                                      // 4: RGBA
+  image.pixels.assign(image.row_pitch * image.height, static_cast<uint8_t>(fill_value));  // 全部 fill_value で埋める
+  return CreateTextureResource({image}, 0);
 }
 
 // デフォルトグラデーションテクスチャ
 ID3D12Resource* CreateGrayGradationTexture() {
-  D3D12_HEAP_PROPERTIES texHeapProp = {};
-  texHeapProp.Type = D3D12_HEAP_TYPE_CUSTOM;
-  texHeapProp.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
-  texHeapProp.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
-  texHeapProp.CreationNodeMask = 0;
-  texHeapProp.VisibleNodeMask = 0;
-
-  int width = 4;  // 4: RGBA
-  int height = 256;
-
-  D3D12_RESOURCE_DESC resDesc = {};
-  resDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-  resDesc.Width = width;    // 幅
-  resDesc.Height = height;  // 高さ
-  resDesc.DepthOrArraySize = 1;
-  resDesc.SampleDesc.Count = 1;
-  resDesc.SampleDesc.Quality = 0;
-  resDesc.MipLevels = 1;
-  resDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-  resDesc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-  resDesc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-  ID3D12Resource* gradation_buffer = nullptr;
-  auto result = _dev->CreateCommittedResource(&texHeapProp,
-                                              D3D12_HEAP_FLAG_NONE,  // 特に指定なし
-                                              &resDesc, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, nullptr,
-                                              IID_PPV_ARGS(&gradation_buffer));
+  Image image;
+  image.format = PixelFormat::kRGBA8;
+  image.width = 4;
+  image.height = 256;
+  image.row_pitch = image.width * sizeof(unsigned int);
+  image.pixels.resize(image.row_pitch * image.height);
 
   // 上が白くて下が黒いテクスチャデータを作成
-  std::vector<unsigned int> data(width * height);
-  auto it = data.begin();
   unsigned int c = 0xff;  // 4 bytes (8*4=32 bits) : 0x000000ff
-  for (; it != data.end(); it += width) {
+  for (uint32_t y = 0; y < image.height; ++y) {
     // RGBAが逆並びしているためRGBマクロと0xff<<24を用いて表す
     // A : 0xff
     // B : c
     // G : c
     // R : c
-    auto col = (0xff << 24) | RGB(c, c, c);
-    std::fill(it, it + width, col);
+    const unsigned int col = (0xff << 24) | RGB(c, c, c);
+    auto row = reinterpret_cast<unsigned int*>(image.Row(y));
+    std::fill(row, row + image.width, col);
     --c;
   }
-  result = gradation_buffer->WriteToSubresource(0, nullptr, data.data(), width * sizeof(unsigned int),
-                                                sizeof(unsigned int) * data.size());
-  return gradation_buffer;
-}
-
-/**
- * @brief split string by delimiter
- *
- * @param text_str
- * @param splitter
- * @return std::vector<std::string>
- */
-std::vector<std::string> SplitString(const std::string& text_str, const char splitter = '*') {
-  std::vector<std::string> v;
-  std::stringstream ss{text_str};
-  std::string buf;
-  while (std::getline(ss, buf, splitter)) {
-    v.push_back(buf);
-  }
-  return v;
+  return CreateTextureResource({image}, 0);
 }
 
 void EnableDebugLayer() {
@@ -391,6 +622,11 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
   // result = CoInitializeEx(0, COINIT_MULTITHREADED);
 
   try {
+    // 段階ごとの CPU 時間を記録する (ワーカーからも記録するので thread_pool より先に作り, 後に破棄する)
+    Profiler profiler;
+    Profiler::SetCurrent(&profiler);
+    profiler.SetThreadName("main");
+
     DebugOutputFormatString("Show window test.");
     // ウィンドウクラス生成＆登録
     WNDCLASSEX w = {};
@@ -421,35 +657,34 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
 
     // Init Utils
 
-    loadLambdaTable[".sph"] = loadLambdaTable[".spa"] = loadLambdaTable[".bmp"] = loadLambdaTable[".png"] =
-        loadLambdaTable[".jpg"] =
-            [](const std::wstring& path, DirectX::TexMetadata* meta, DirectX::ScratchImage& img) -> HRESULT {
-      return DirectX::LoadFromWICFile(path.c_str(), DirectX::WIC_FLAGS_NONE, meta, img);
-    };
-    loadLambdaTable[".tga"] = [](const std::wstring& path, DirectX::TexMetadata* meta,
-                                 DirectX::ScratchImage& img) -> HRESULT {
-      return DirectX::LoadFromTGAFile(path.c_str(), meta, img);
-    };
-    loadLambdaTable[".dds"] = [](const std::wstring& path, DirectX::TexMetadata* meta,
-                                 DirectX::ScratchImage& img) -> HRESULT {
-      return DirectX::LoadFromDDSFile(path.c_str(), DirectX::DDS_FLAGS_NONE, meta, img);
-    };
+    // ファイルの読み込みは TextureCache が行うので, ここではメモリ上のデータからデコードする
+    // BMP / TGA / PNG は image_decoders に組み込まれているので, それ以外 (JPEG / GIF / TIFF / DDS) を DirectXTex に任せる
+    image_decoders.Register(MakeDirectXTexCodec(
+        "wic",
+        [](const uint8_t* data, std::size_t size) {
+          return size >= 4 && ((data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) ||  // JPEG
+                               std::memcmp(data, "GIF8", 4) == 0 || std::memcmp(data, "II*\0", 4) == 0 ||
+                               std::memcmp(data, "MM\0*", 4) == 0);
+        },
+        [](const uint8_t* data, std::size_t size, DirectX::TexMetadata* meta) {
+          return DirectX::GetMetadataFromWICMemory(data, size, DirectX::WIC_FLAGS_NONE, *meta);
+        },
+        [](const uint8_t* data, std::size_t size, DirectX::TexMetadata* meta, DirectX::ScratchImage& img) {
+          return DirectX::LoadFromWICMemory(data, size, DirectX::WIC_FLAGS_NONE, meta, img);
+        }));
+    image_decoders.Register(MakeDirectXTexCodec(
+        "dds", [](const uint8_t* data, std::size_t size) { return size >= 4 && std::memcmp(data, "DDS ", 4) == 0; },
+        [](const uint8_t* data, std::size_t size, DirectX::TexMetadata* meta) {
+          return DirectX::GetMetadataFromDDSMemory(data, size, DirectX::DDS_FLAGS_NONE, *meta);
+        },
+        [](const uint8_t* data, std::size_t size, DirectX::TexMetadata* meta, DirectX::ScratchImage& img) {
+          return DirectX::LoadFromDDSMemory(data, size, DirectX::DDS_FLAGS_NONE, meta, img);
+        }));
 
     //////////////
     // load pmd //
     //////////////
 
-    /**
-     * @brief PMD ヘッダー構造体
-     *
-     */
-    struct PMDHeader {
-      float version;        // 例：00 00 80 3F == 1.00
-      char model_name[20];  // モデル名
-      char comment[256];    // モデルコメント
-    };
-
-    FILE* fp;
     // const fs::path model_filepath = fs::absolute(L"Model/初音ミク.pmd");
     // const fs::path model_filepath = fs::absolute(L"Model/巡音ルカ.pmd");
     const fs::path model_filepath = fs::absolute(L"Model/初音ミクmetal.pmd");
@@ -458,90 +693,23 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       ss << L"Model filepath is \"" << model_filepath.wstring() << L"\"" << std::endl;
       OutputDebugStringW(ss.str().c_str());
     }
-    {
-      auto err = _wfopen_s(&fp, model_filepath.wstring().c_str(), L"rb");
-      if (fp == nullptr) {
-        wchar_t strerr[256];
-        _wcserror_s(strerr, 256, err);
-        LPCWSTR ptr = strerr;
-        MessageBox(hwnd, ptr, L"Open Error", MB_ICONERROR);
-        return -1;
-      }
-    }
-
-    char signature[3];  // 先頭 Pmd (3 bytes)
-    PMDHeader pmdheader = {};
-    fread(signature, sizeof(signature), 1, fp);
-    fread(&pmdheader, sizeof(pmdheader), 1, fp);
-
-    // header の直後に頂点数
-    unsigned int vertex_num(0);  // 頂点数
-    fread(&vertex_num, sizeof(vertex_num), 1, fp);
-    {  // debug
-      std::wstringstream ss;
-      ss << L"vertex num is " << vertex_num << std::endl;
-      OutputDebugStringW(ss.str().c_str());
-    }
-
-    constexpr size_t pmdvertex_size(38);           // 頂点 1 つあたりのサイズ
-    std::vector<PMD_VERTEX> vertices(vertex_num);  // バッファーの確保
-    for (auto i = 0; i < vertex_num; i++) {
-      fread(&vertices[i], pmdvertex_size, 1, fp);
-    }
-
-    // indices
-    unsigned int indices_num;  // インデックス数
-    fread(&indices_num, sizeof(indices_num), 1, fp);
-
-    std::vector<unsigned short> indices(indices_num);
-    fread(indices.data(), indices_num * sizeof(unsigned short), 1, fp);
-
-    // texture
-    unsigned int num_material;  // マテリアル数
-    fread(&num_material, sizeof(num_material), 1, fp);
-    {  // debug
-      std::wstringstream ss;
-      ss << L"material num is " << num_material << std::endl;
-      OutputDebugStringW(ss.str().c_str());
-    }
-    std::vector<PMDMaterial> pmd_materials(num_material);
-    std::vector<ID3D12Resource*> texture_resources(num_material);
-    std::vector<ID3D12Resource*> sph_resources(num_material);
-    std::vector<ID3D12Resource*> spa_resources(num_material);
-    std::vector<ID3D12Resource*> toon_resources(num_material);
-    fread(pmd_materials.data(), pmd_materials.size() * sizeof(PMDMaterial), 1, fp);
-#ifdef _DEBUG
-    {  // debug
-      for (unsigned int i = 0; i < pmd_materials.size(); i++) {
-        std::string tmp_str(pmd_materials[i].texFilePath);
-        auto tmp_tex_fpath_relative = fs::path(GetWideStringFromString(tmp_str, CP_ACP));
-        auto tmp_filepath = model_filepath.parent_path() / tmp_tex_fpath_relative;
-        std::wstringstream ss;
-        ss << L"idx " << i << L" : texture file path: \"" << tmp_filepath.wstring().c_str() << L"\"" << std::endl;
-        OutputDebugStringW(ss.str().c_str());
-      }
-#endif
-    }
-
-    std::vector<Material> materials(pmd_materials.size());
-    for (int i = 0; i < pmd_materials.size(); ++i) {
-      materials[i].indicesNum = pmd_materials[i].indicesNum;
-      materials[i].material.diffuse = pmd_materials[i].diffuse;
-      materials[i].material.alpha = pmd_materials[i].alpha;
-      materials[i].material.specular = pmd_materials[i].specular;
-      materials[i].material.specularity = pmd_materials[i].specularity;
-      materials[i].material.ambient = pmd_materials[i].ambient;
-#ifdef _DEBUG
-      {  // debug
-        std::wstringstream ss;
-        ss << L"idx " << i << L" : ambient: (" << pmd_materials[i].ambient.x << ", " << pmd_materials[i].ambient.y
-           << ", " << pmd_materials[i].ambient.z << L")" << std::endl;
-        OutputDebugStringW(ss.str().c_str());
-      }
-#endif
-    }
 
-    fclose(fp);
+    // 同じテクスチャ (toon など) を複数マテリアル・複数モデルから要求されてもデコードは 1 回だけ
+    // 別ディレクトリの同じ内容のファイルも texture_content_store で 1 つの Image (= 1 つの GPU リソース) にまとまる
+    // (ワーカーから参照されるので thread_pool より先に作り, 後に破棄する)
+    TextureContentStore texture_content_store;
+    TextureCache texture_cache(DecodeTextureData, std::size_t(512) << 20, &texture_content_store);
+    // PMD のパースとテクスチャのデコードはワーカースレッドで行い, その間にデバイスを初期化する
+    // WIC を使うので各ワーカーで COM を初期化しておく
+    ThreadPool thread_pool(
+        0,
+        [&profiler]() {
+          CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+          profiler.SetThreadName("worker");
+        },
+        []() { CoUninitialize(); });
+    ModelLoader model_loader(thread_pool, [&texture_cache](const fs::path& path) { return texture_cache.Get(path); });
+    auto model_futures = model_loader.LoadAsync({model_filepath});
 
     //////////////////////////
     // Initialize DirectX12 //
@@ -606,14 +774,38 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
     if (_dev == nullptr) {
       return EXIT_FAILURE;
     }
+    CreateResourceHeaps();
 
     // Create command list and command allocator
-    result = _dev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&_cmdAllocator));
+    // アロケーターは GPU が使い終わるまでリセットできないのでフレームごとに作る
+    std::vector<FrameContext> frame_contexts(kFramesInFlight);
+    for (auto& frame_context : frame_contexts) {
+      result = _dev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+                                            IID_PPV_ARGS(&frame_context.command_allocator));
+      if (FAILED(result)) {
+        throw std::runtime_error("Failed to create command allocator");
+      }
+      frame_context.recording_allocators.resize(kMaxRecordingRanges);
+      frame_context.recording_lists.resize(kMaxRecordingRanges);
+      for (std::size_t i = 0; i < kMaxRecordingRanges; ++i) {
+        result = _dev->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+                                              IID_PPV_ARGS(&frame_context.recording_allocators[i]));
+        if (SUCCEEDED(result)) {
+          result = _dev->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, frame_context.recording_allocators[i],
+                                           nullptr, IID_PPV_ARGS(&frame_context.recording_lists[i]));
+        }
+        if (FAILED(result)) {
+          throw std::runtime_error("Failed to create command list for parallel recording");
+        }
+        frame_context.recording_lists[i]->Close();
+      }
+    }
     result = _dev->CreateCommandList(0,  // 0 is single-GPU operation
                                      D3D12_COMMAND_LIST_TYPE_DIRECT,
-                                     _cmdAllocator,  // この Command Allocator に対応する
-                                     nullptr,        //  nulltpr : dummy initial pipeline state
+                                     frame_contexts[0].command_allocator,  // この Command Allocator に対応する
+                                     nullptr,  //  nulltpr : dummy initial pipeline state
                                      IID_PPV_ARGS(&_cmdList));
+    _cmdList->Close();  // 記録はフレームの先頭で Reset してから始める
 
     {
       // command queue
@@ -690,11 +882,23 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
     ///////////
 
     ID3D12Fence* _fence = nullptr;
-    UINT64 _fenceVal = 0;
-    result = _dev->CreateFence(_fenceVal, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&_fence));
+    result = _dev->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&_fence));
     if (result != S_OK) {
       throw std::runtime_error("Failed to create fence");
     }
+    auto fence_event = CreateEvent(nullptr, false, false, nullptr);
+    if (fence_event == nullptr) {
+      throw std::runtime_error("Failed to create fence event");
+    }
+    FrameScheduler frame_scheduler(kFramesInFlight,
+                                   GpuTimeline{
+                                       [&](uint64_t value) { _cmdQueue->Signal(_fence, value); },
+                                       [&]() { return _fence->GetCompletedValue(); },
+                                       [&](uint64_t value) {
+                                         _fence->SetEventOnCompletion(value, fence_event);
+                                         WaitForSingleObject(fence_event, INFINITE);
+                                       },
+                                   });
 
     /////////////////
     // Show Window //
@@ -706,55 +910,183 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
     // Shader //
     ////////////
 
+    ////////////////////////
+    // wait for the model //
+    ////////////////////////
+
+    std::shared_ptr<LoadedModel> model;
+    try {
+      model = model_futures[0].get();
+    } catch (const std::exception& e) {
+      MessageBox(hwnd, GetWideStringFromString(e.what()).c_str(), L"Open Error", MB_ICONERROR);
+      return -1;
+    }
+
+#ifdef _DEBUG
+    {  // debug
+      auto stats = texture_cache.GetStats();
+      std::wstringstream ss;
+      ss << L"texture cache: hits " << stats.hits << L", content hits " << stats.content_hits << L", coalesced "
+         << stats.coalesced << L", misses " << stats.misses << L", failures " << stats.failures << L", resident "
+         << stats.resident_bytes << L" bytes" << std::endl;
+      auto loader_stats = model_loader.GetStats();
+      ss << L"model loader: " << loader_stats.models << L" models, " << loader_stats.arena_allocations
+         << L" arena allocations in " << loader_stats.arena_blocks << L" blocks, scratch peak "
+         << loader_stats.peak_scratch_bytes << L" bytes" << std::endl;
+      auto content_stats = texture_content_store.GetStats();
+      ss << L"texture dedup: unique " << content_stats.unique_images << L" (" << content_stats.unique_bytes
+         << L" bytes), duplicates " << content_stats.duplicate_images << L", saved "
+         << (stats.bytes_deduplicated + content_stats.bytes_saved) << L" bytes" << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+#endif
+
+    // マップしたファイルの各セクションをそのまま参照する (要素ごとの fread やコピーはしない)
+    auto& vertices = model->vertices;
+    {  // debug
+      std::wstringstream ss;
+      ss << L"vertex num is " << vertices.size() << (model->baked.IsOpen() ? L" (baked)" : L"") << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+
+    auto& indices = model->indices;
+
+    // LOD: マテリアルの範囲ごとに三角形を減らしたインデックス列を作り, 全ての段を 1 つのインデックスバッファに置く.
+    // 頂点は元のものを使うので, スキニングと頂点バッファは段によらず共通
+    MeshLods mesh_lods;
+    {
+      ProfileScope profile("lod generation");
+      LodOptions lod_options;
+      lod_options.max_levels = kLodLevels;
+      mesh_lods = GenerateMeshLods(
+          vertices, indices,
+          std::vector<uint32_t>(model->material_index_counts.begin(), model->material_index_counts.end()),
+          lod_options);
+    }
+    {  // debug
+      std::wstringstream ss;
+      ss << L"lod levels:";
+      for (const auto& level : mesh_lods.levels) {
+        ss << L" " << level.triangles;
+      }
+      ss << L" triangles" << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+
+    // texture
+    unsigned int num_material = static_cast<unsigned int>(model->material_index_counts.size());  // マテリアル数
+    {  // debug
+      std::wstringstream ss;
+      ss << L"material num is " << num_material << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+    // マテリアルごとの t0 - t3 のリソース (無いものは nullptr)
+    struct MaterialTextureResources {
+      ID3D12Resource* tex = nullptr;
+      ID3D12Resource* sph = nullptr;
+      ID3D12Resource* spa = nullptr;
+      ID3D12Resource* toon = nullptr;
+    };
+    std::vector<MaterialTextureResources> material_textures(num_material);
+
+    // ミップのストリーミング. テクスチャの識別子は画像のアドレス
+    MipStreamer::Options streamer_options;
+    streamer_options.budget_bytes = kTextureMipBudget;
+    MipStreamer texture_streamer(streamer_options);
+    std::unordered_map<uint64_t, std::shared_ptr<const Image>> streamed_images;
+    auto texture_id = [](const std::shared_ptr<const Image>& image) {
+      return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(image.get()));
+    };
+    // ブロック圧縮済みのミップチェーンのキャッシュ (内容のハッシュがキーなので, 別モデルと同じディレクトリでもよい)
+    CompressedTextureCache compressed_textures(model_filepath.parent_path() / "texture_cache");
+    auto is_compressed = [](const std::shared_ptr<const Image>& image) {
+      auto mips = image_mip_table.find(image.get());
+      return mips != image_mip_table.end() && IsBlockCompressed(mips->second.front().format);
+    };
+
+    // skinning
+    // ボーンの姿勢が変わったフレームだけ CPU でスキニングして頂点バッファを書き換える
+    Skeleton skeleton;
+    skeleton.Build(model->bones);
+    SkinningStreams skinning_streams = MakeSkinningStreams(vertices, skeleton.BoneCount());
+    SkinnedVertices skinned_vertices;
+    std::vector<BonePose> bone_poses(skeleton.BoneCount());
+    std::vector<Matrix4> skinning_matrices;
+    std::vector<PmdVertex> skinned_vertex_data(vertices.begin(), vertices.end());  // uv などはそのまま使う
+    bool bone_poses_dirty = false;
+    {  // debug
+      std::wstringstream ss;
+      ss << L"bone num is " << skeleton.BoneCount() << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+
+    // motion
+    // 無ければバインドポーズのまま表示する
+    const fs::path motion_filepath = fs::absolute(L"Motion/motion.vmd");
+    VmdFile vmd;
+    MotionClip motion_clip;
+    if (vmd.Open(motion_filepath)) {
+      motion_clip.Build(vmd, skeleton);
+    } else {
+      std::wstringstream ss;
+      ss << L"Failed to load motion \"" << motion_filepath.wstring() << L"\": " << GetWideStringFromString(vmd.Error())
+         << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+    MotionPlayer motion_player(motion_clip);
+
     ////////////////////////////////////////
     // vertex buffer / vertex buffer view //
     ////////////////////////////////////////
 
-    D3D12_VERTEX_BUFFER_VIEW vbView = {};
+    // スキニング結果を毎フレーム書き込むので, GPU が前のフレームで読んでいる区画を避けてフレームごとに区画を分ける
+    uint64_t skinned_version = 0;  // skinned_vertex_data の世代
     {
-      ID3D12Resource* vertBuff = nullptr;
-      auto heapprop = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-      auto resdesc = CD3DX12_RESOURCE_DESC::Buffer(vertices.size() * sizeof(vertices[0]));
-      result = _dev->CreateCommittedResource(&heapprop, D3D12_HEAP_FLAG_NONE, &resdesc,
-                                             D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&vertBuff));
+      const size_t slice_size = AlignmentedSize(vertices.size_bytes(), 256);
+      const ResourceHandle vertBuff = render_backend.CreateBuffer(slice_size * kFramesInFlight);
+      if (vertBuff == 0) {
+        throw std::runtime_error("Failed to create vertex buffer");
+      }
 
       // copy vertices data to vertex buffer
-      PMD_VERTEX* vertMap = nullptr;
-      result = vertBuff->Map(0, nullptr, (void**)&vertMap);
-      if (FAILED(result)) {
+      // マップしたファイルの頂点セクションをそのまま転送する (38 bytes/頂点)
+      unsigned char* vertMap = render_backend.MapBuffer(vertBuff);  // スキニング結果を書き込むため Map したままにする
+      if (vertMap == nullptr) {
         throw std::runtime_error("Failed to map vertex buffer");
       }
-      std::copy(std::begin(vertices), std::end(vertices), vertMap);
-      vertBuff->Unmap(0, nullptr);
-
-      // create vertex buffer view
-      vbView.BufferLocation = vertBuff->GetGPUVirtualAddress();
-      vbView.SizeInBytes = static_cast<UINT>(vertices.size() * sizeof(vertices[0]));  // 全バイト数
-      vbView.StrideInBytes = sizeof(PMD_VERTEX);                                      // 1頂点あたりのバイト数
+      for (uint32_t i = 0; i < kFramesInFlight; ++i) {
+        auto& frame_context = frame_contexts[i];
+        frame_context.vertex_map = vertMap + slice_size * i;
+        std::memcpy(frame_context.vertex_map, vertices.data(), vertices.size_bytes());
+
+        // create vertex buffer view
+        frame_context.vertex_view.buffer = vertBuff;
+        frame_context.vertex_view.offset = slice_size * i;
+        frame_context.vertex_view.size = static_cast<uint32_t>(vertices.size_bytes());  // 全バイト数
+        frame_context.vertex_view.stride = sizeof(PmdVertex);                           // 1頂点あたりのバイト数
+      }
     }
 
     //////////////////////////////////////
     // index buffer / index buffer view //
     //////////////////////////////////////
 
-    D3D12_INDEX_BUFFER_VIEW ibView = {};
+    BufferView ibView;
     {
-      ID3D12Resource* idxBuff = nullptr;
-      auto heapprop = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-      auto resdesc = CD3DX12_RESOURCE_DESC::Buffer(indices.size() * sizeof(indices[0]));
-      result = _dev->CreateCommittedResource(&heapprop, D3D12_HEAP_FLAG_NONE, &resdesc,
-                                             D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&idxBuff));
-
-      // 作ったバッファにインデックスデータをコピー
-      unsigned short* mappedIdx = nullptr;
-      idxBuff->Map(0, nullptr, (void**)&mappedIdx);
-      std::copy(indices.begin(), indices.end(), mappedIdx);
-      idxBuff->Unmap(0, nullptr);
+      const std::size_t index_bytes = mesh_lods.indices.size() * sizeof(uint16_t);
+      const ResourceHandle idxBuff = render_backend.CreateBuffer(index_bytes);
+      unsigned char* mappedIdx = idxBuff != 0 ? render_backend.MapBuffer(idxBuff) : nullptr;
+      if (mappedIdx == nullptr) {
+        throw std::runtime_error("Failed to create index buffer");
+      }
+
+      // 作ったバッファに全ての LOD の段のインデックスデータをコピー
+      std::memcpy(mappedIdx, mesh_lods.indices.data(), index_bytes);
 
       // インデックスバッファビューを作成
-      ibView.BufferLocation = idxBuff->GetGPUVirtualAddress();
-      ibView.Format = DXGI_FORMAT_R16_UINT;
-      ibView.SizeInBytes = indices.size() * sizeof(indices[0]);
+      ibView.buffer = idxBuff;
+      ibView.size = static_cast<uint32_t>(index_bytes);
+      ibView.stride = sizeof(uint16_t);
     }
 
     // Depth buffer / Depth buffer view //
@@ -1002,11 +1334,7 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       // descriptor range
       D3D12_DESCRIPTOR_RANGE descriptor_range[4] = {};  // テクスチャと定数の２つ
 
-      // CBV 1st (transform matrix) : register(b0)
-      descriptor_range[0].NumDescriptors = 1;                           // 定数ひとつ
-      descriptor_range[0].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_CBV;  // 種別は定数
-      descriptor_range[0].BaseShaderRegister = 0;                       // 0番スロットから
-      descriptor_range[0].OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+      // CBV 1st (transform matrix) : register(b0) はルート CBV (下の rootparam[0])
 
       // CBV 2nd (material) : register(b1)
       descriptor_range[1].NumDescriptors = 1;  // ディスクリプタヒープは複数だが一度に使うのは1 つ
@@ -1029,9 +1357,10 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       ////////////////////
 
       // CBV (transform matrix)
-      rootparam[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-      rootparam[0].DescriptorTable.pDescriptorRanges = &descriptor_range[0];
-      rootparam[0].DescriptorTable.NumDescriptorRanges = 1;
+      // フレームごとに LinearUploadAllocator から切り出すので, ディスクリプタを作らずアドレスを直接渡す
+      rootparam[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+      rootparam[0].Descriptor.ShaderRegister = 0;  // register(b0)
+      rootparam[0].Descriptor.RegisterSpace = 0;
       rootparam[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 
       // CBV (material) + textures
@@ -1085,28 +1414,6 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
     ID3D12PipelineState* _pipelinestate = nullptr;
     result = _dev->CreateGraphicsPipelineState(&gpipeline, IID_PPV_ARGS(&_pipelinestate));
 
-    //////////////
-    // Viewport //
-    //////////////
-
-    D3D12_VIEWPORT viewport = {};
-    viewport.Width = window_width;    // 出力先の幅(ピクセル数)
-    viewport.Height = window_height;  // 出力先の高さ(ピクセル数)
-    viewport.TopLeftX = 0;            // 出力先の左上座標X
-    viewport.TopLeftY = 0;            // 出力先の左上座標Y
-    viewport.MaxDepth = 1.0f;         // 深度最大値
-    viewport.MinDepth = 0.0f;         // 深度最小値
-
-    ///////////////////////
-    // Scissor Rectangle //
-    ///////////////////////
-
-    D3D12_RECT scissorrect = {};
-    scissorrect.top = 0;                                   // 切り抜き上座標
-    scissorrect.left = 0;                                  // 切り抜き左座標
-    scissorrect.right = scissorrect.left + window_width;   // 切り抜き右座標
-    scissorrect.bottom = scissorrect.top + window_height;  // 切り抜き下座標
-
     ////////////////////////////////////////////
     // Material buffer / Material Buffer View //
     ////////////////////////////////////////////
@@ -1120,26 +1427,22 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
 
     ID3D12DescriptorHeap* materialDescHeap = nullptr;
     D3D12_CONSTANT_BUFFER_VIEW_DESC matCBVDesc = {};
+    std::function<void()> create_material_views;  // マテリアルごとの CBV と SRV をディスクリプタヒープに書く
     std::size_t material_buff_size;
     {
-      ID3D12Resource* material_buffer = nullptr;
-      material_buff_size = sizeof(MaterialForHlsl);
-      material_buff_size = (material_buff_size + 0xff) & ~0xff;
-      auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+      ProfileScope profile("material setup");
+      material_buff_size = kMaterialConstantStride;  // MaterialForHlsl を 256 アライメントに揃えたもの
       // TODO: 勿体ないけど仕方ないですね
-      auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(material_buff_size * num_material);
-      result =
-          _dev->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc, D3D12_RESOURCE_STATE_GENERIC_READ,
-                                        nullptr, IID_PPV_ARGS(&material_buffer));
+      const ResourceHandle material_handle = render_backend.CreateBuffer(material_buff_size * num_material);
+      uint8_t* map_material = material_handle != 0 ? render_backend.MapBuffer(material_handle) : nullptr;
+      if (map_material == nullptr) {
+        throw std::runtime_error("Failed to create material buffer");
+      }
+      ID3D12Resource* material_buffer = ToResource(material_handle);
 
       // マップマテリアルにコピー
-      char* map_material = nullptr;
-      result = material_buffer->Map(0, nullptr, (void**)&map_material);
-      for (auto& m : materials) {
-        *((MaterialForHlsl*)map_material) = m.material;  // データコピー
-        map_material += material_buff_size;  // 次のアライメント位置まで進める (256 の倍数)
-      }
-      material_buffer->Unmap(0, nullptr);
+      // 定数は 256 bytes ごとに詰めた状態で用意されている (ベイク済みならファイルの内容そのまま) のでまとめてコピーする
+      std::memcpy(map_material, model->material_constants.data(), model->material_constants.size_bytes());
 
       //////////////////////////
       // material buffer view //
@@ -1159,92 +1462,79 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       // Texture Buffer //
       ////////////////////
 
-      for (int i = 0; i < pmd_materials.size(); ++i) {
-        // トゥーン番号とトゥーンテクスチャのファイル名との関係
-        //  _________________________
-        // | toon index | filename   |
-        // |        255 | toon00.bmp |
-        // |          0 | toon01.bmp |
-        // |          1 | toon02.bmp |
-        // |          2 | toon03.bmp |
-        //  _________________________
-
-        // トゥーンリソースの読み込み
-        std::wstringstream ss;
-        ss << L"toon" << std::setw(2) << std::setfill(L'0') << ((pmd_materials[i].toonIdx + 1) & 0xff) << L".bmp";
-        fs::path toon_filepath = model_filepath.parent_path() / fs::path("toon") / fs::path(ss.str());
-#ifdef _DEBUG
-        {
-          std::wstringstream ss;
-          ss << L"Toon file : \"" << toon_filepath.wstring() << L"\" (" << (pmd_materials[i].toonIdx + 1) << L")"
-             << std::endl;
-          OutputDebugStringW(ss.str().c_str());
+      // テクスチャは ModelLoader がデコード済みなので, ミップチェーンを作って GPU リソースを作るだけ
+      // ミップチェーンはテクスチャごとにワーカーで並列に作る (MMD のテクスチャは UNORM で読むので格納値のまま平均する)
+      // 圧縮できるもの (幅・高さが 4 の倍数) はキャッシュから読むか, 無ければ圧縮してキャッシュに書く
+      {
+        std::vector<std::shared_ptr<const Image>> images;
+        for (const auto& textures : model->textures) {
+          for (const auto& image : {textures.tex, textures.sph, textures.spa, textures.toon}) {
+            if (image != nullptr && image_mip_table.count(image.get()) == 0 &&
+                std::find(images.begin(), images.end(), image) == images.end()) {
+              images.push_back(image);
+            }
+          }
         }
-#endif
-        toon_resources[i] = LoadTextureFromFile(toon_filepath.wstring());
-
-        if (strlen(pmd_materials[i].texFilePath) == 0) {
-          texture_resources[i] = nullptr;
+        std::vector<std::future<std::vector<Image>>> mip_futures;
+        for (const auto& image : images) {
+          mip_futures.push_back(thread_pool.Submit([image, &compressed_textures]() {
+            if (kCompressTextures) {
+              auto levels = LoadOrCompressTexture(*image, PixelFormat::kUnknown, {}, &compressed_textures, nullptr);
+              if (!levels.empty()) {
+                return levels;
+              }
+            }
+            return GenerateMipChain(*image);
+          }));
         }
-        // モデルとテクスチャパスからアプリケーションからのテクスチャパスを得る
-        fs::path tex_filepath;
-        fs::path sph_filepath;
-        fs::path spa_filepath;
-        char splitter('*');
-        // split して std::vector に格納
-        auto file_list = SplitString(pmd_materials[i].texFilePath, splitter);
-        for (auto& filename_str : file_list) {
-          fs::path filepath = model_filepath.parent_path() / fs::path(GetWideStringFromString(filename_str, CP_ACP));
-#ifdef _DEBUG
-          {  // debug
-            std::wstringstream ss;
-            ss << L"Try to load a file: \"" << filepath.wstring().c_str() << L"\"" << std::endl;
-            OutputDebugStringW(ss.str().c_str());
+        for (std::size_t i = 0; i < images.size(); ++i) {
+          auto levels = mip_futures[i].get();
+          if (!levels.empty()) {
+            image_mip_table[images[i].get()] = std::move(levels);
           }
-          {
-            std::wstringstream ss;
-            for (std::size_t i = 0; i < filepath.extension().wstring().size(); i++) {
-              ss << std::hex << (unsigned short)filepath.extension().wstring()[i] << " : " << std::endl;
-            }
-            std::wstring tmp_wstr(L".sph");
-            for (std::size_t i = 0; i < tmp_wstr.size(); i++) {
-              ss << std::hex << (unsigned short)tmp_wstr[i] << " : " << tmp_wstr[i] << std::endl;
-            }
-            OutputDebugStringW(ss.str().c_str());
+          if (kStreamTextureMips && !is_compressed(images[i])) {
+            streamed_images[texture_id(images[i])] = images[i];
           }
+        }
+#ifdef _DEBUG
+        auto stats = compressed_textures.GetStats();
+        std::wstringstream ss;
+        ss << L"compressed textures: " << stats.hits << L" cache hits, " << stats.stores << L" encoded" << std::endl;
+        OutputDebugStringW(ss.str().c_str());
 #endif
-
-          if (filepath.extension().wstring() == L".sph") {
-            if (sph_filepath.wstring() != L"") {
-              std::wcerr << "Error: multiple sph filepath : " << filepath.wstring() << std::endl;
-            }
-            sph_filepath = filepath;
-          } else if (filepath.extension().wstring() == L".spa") {
-            if (spa_filepath.wstring() != L"") {
-              std::wcerr << "Error: multiple spa filepath : " << filepath.wstring() << std::endl;
-            }
-            spa_filepath = filepath;
-          } else {
-            if (tex_filepath.wstring() != L"") {
-              std::wcerr << L"Error: multiple tex filepath : " << filepath.wstring() << std::endl;
-            }
-            tex_filepath = filepath;
-          }
+      }
+      // ストリーミングする場合は登録時に MipStreamer が決めた小さいミップだけでリソースを作る
+      auto create_texture = [&](const std::shared_ptr<const Image>& image) {
+        if (!kStreamTextureMips || image == nullptr || image_resource_table.count(image) != 0 ||
+            is_compressed(image)) {
+          return CreateTextureFromImage(image);
         }
-
+        auto mips = image_mip_table.find(image.get());
+        const uint32_t level_count = mips != image_mip_table.end() ? static_cast<uint32_t>(mips->second.size()) : 1;
+        return CreateTextureFromImage(
+            image, texture_streamer.Register(texture_id(image), image->width, image->height, level_count, 4));
+      };
+      for (int i = 0; i < num_material; ++i) {
+        auto& textures = model->textures[i];
 #ifdef _DEBUG
         {  // debug
+          const auto& indices = model->texture_indices[i];
+          auto file = [&](uint32_t index) {
+            return index == MaterialTextureIndices::kNoTexture ? std::wstring() : model->texture_files[index].wstring();
+          };
           std::wstringstream ss;
-          ss << L"tex_filepath : \"" << tex_filepath.wstring().c_str() << L"\"" << std::endl
-             << L"sph_filepath : \"" << sph_filepath.wstring().c_str() << L"\"" << std::endl
-             << L"spa_filepath : \"" << spa_filepath.wstring().c_str() << L"\"" << std::endl;
+          ss << L"tex_filepath : \"" << file(indices.tex) << L"\"" << std::endl
+             << L"sph_filepath : \"" << file(indices.sph) << L"\"" << std::endl
+             << L"spa_filepath : \"" << file(indices.spa) << L"\"" << std::endl
+             << L"toon_filepath : \"" << file(indices.toon) << L"\"" << std::endl;
           OutputDebugStringW(ss.str().c_str());
         }
 #endif
-
-        texture_resources[i] = LoadTextureFromFile(tex_filepath.wstring());
-        sph_resources[i] = LoadTextureFromFile(sph_filepath.wstring());
-        spa_resources[i] = LoadTextureFromFile(spa_filepath.wstring());
+        auto& resources = material_textures[i];
+        resources.tex = create_texture(textures.tex);
+        resources.sph = create_texture(textures.sph);
+        resources.spa = create_texture(textures.spa);
+        resources.toon = create_texture(textures.toon);
       }
 
       ///////////////////////////////////////
@@ -1252,64 +1542,121 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       ///////////////////////////////////////
 
       // 通常テクスチャビュー作成
-      {
+      // ストリーミングでテクスチャリソースが作り直されたら描画ループから作り直す
+      auto white_tex = CreateOneValueTexture(0xff);
+      auto black_tex = CreateOneValueTexture(0x00);
+      auto gradation_tex = CreateGrayGradationTexture();
+      create_material_views = [&, white_tex, black_tex, gradation_tex]() {
         D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
         srvDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;  // デフォルト
         srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
         srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;  // 2D テクスチャ
-        srvDesc.Texture2D.MipLevels = 1;                        // ミップマップは使用しないので1
+        srvDesc.Texture2D.MipLevels = static_cast<UINT>(-1);    // リソースにある全てのミップ
 
-        auto white_tex = CreateOneValueTexture(0xff);
-        auto black_tex = CreateOneValueTexture(0x00);
-        auto gradation_tex = CreateGrayGradationTexture();
+        auto cbvDesc = matCBVDesc;
         auto matDescHeapH = materialDescHeap->GetCPUDescriptorHandleForHeapStart();
         auto inc_size = _dev->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
         for (int i = 0; i < num_material; ++i) {
           // マテリアル固定バッファービュー
           // register(b1)
-          _dev->CreateConstantBufferView(&matCBVDesc, matDescHeapH);
+          _dev->CreateConstantBufferView(&cbvDesc, matDescHeapH);
           matDescHeapH.ptr += inc_size;
-          matCBVDesc.BufferLocation += material_buff_size;
+          cbvDesc.BufferLocation += material_buff_size;
 
           // register(t0)
-          if (texture_resources[i] == nullptr) {
+          if (material_textures[i].tex == nullptr) {
             srvDesc.Format = white_tex->GetDesc().Format;
             _dev->CreateShaderResourceView(white_tex, &srvDesc, matDescHeapH);
           } else {
-            srvDesc.Format = texture_resources[i]->GetDesc().Format;
-            _dev->CreateShaderResourceView(texture_resources[i], &srvDesc, matDescHeapH);
+            srvDesc.Format = material_textures[i].tex->GetDesc().Format;
+            _dev->CreateShaderResourceView(material_textures[i].tex, &srvDesc, matDescHeapH);
           }
           matDescHeapH.ptr += inc_size;
 
           // register(t1)
-          if (sph_resources[i] == nullptr) {
+          if (material_textures[i].sph == nullptr) {
             srvDesc.Format = white_tex->GetDesc().Format;
             _dev->CreateShaderResourceView(white_tex, &srvDesc, matDescHeapH);
           } else {
-            srvDesc.Format = sph_resources[i]->GetDesc().Format;
-            _dev->CreateShaderResourceView(sph_resources[i], &srvDesc, matDescHeapH);
+            srvDesc.Format = material_textures[i].sph->GetDesc().Format;
+            _dev->CreateShaderResourceView(material_textures[i].sph, &srvDesc, matDescHeapH);
           }
           matDescHeapH.ptr += inc_size;
 
           // register(t2)
-          if (spa_resources[i] == nullptr) {
+          if (material_textures[i].spa == nullptr) {
             srvDesc.Format = black_tex->GetDesc().Format;
             _dev->CreateShaderResourceView(black_tex, &srvDesc, matDescHeapH);
           } else {
-            srvDesc.Format = spa_resources[i]->GetDesc().Format;
-            _dev->CreateShaderResourceView(spa_resources[i], &srvDesc, matDescHeapH);
+            srvDesc.Format = material_textures[i].spa->GetDesc().Format;
+            _dev->CreateShaderResourceView(material_textures[i].spa, &srvDesc, matDescHeapH);
           }
           matDescHeapH.ptr += inc_size;
 
-          if (toon_resources[i] == nullptr) {
+          if (material_textures[i].toon == nullptr) {
             srvDesc.Format = gradation_tex->GetDesc().Format;
             _dev->CreateShaderResourceView(gradation_tex, &srvDesc, matDescHeapH);
           } else {
-            srvDesc.Format = toon_resources[i]->GetDesc().Format;
-            _dev->CreateShaderResourceView(toon_resources[i], &srvDesc, matDescHeapH);
+            srvDesc.Format = material_textures[i].toon->GetDesc().Format;
+            _dev->CreateShaderResourceView(material_textures[i].toon, &srvDesc, matDescHeapH);
           }
           matDescHeapH.ptr += inc_size;
         }
+      };
+      create_material_views();
+    }
+
+    ///////////////
+    // draw list //
+    ///////////////
+
+    // 定数とテクスチャが同じマテリアルは同じディスクリプタテーブルを使い, 連続していれば 1 回の描画にまとめる
+    // モデルは 1 体で描画順は毎フレーム同じなので, コマンド列は LOD の段ごとに 1 回だけ作る.
+    // マテリアルは全ての段で同じ順に追加するので, 重複を除いた番号は段によらず同じになる
+    std::vector<DrawListBuilder> draw_lists(mesh_lods.levels.size());
+    DrawListBuilder& draw_list = draw_lists[0];
+    std::vector<unsigned int> material_descriptor_index;  // 重複を除いたマテリアル -> ディスクリプタテーブルの番号
+    {
+      for (std::size_t level = 0; level < draw_lists.size(); ++level) {
+        const MeshLodLevel& lod = mesh_lods.levels[level];
+        unsigned int idxOffset = lod.index_offset;
+        for (unsigned int i = 0; i < num_material; ++i) {
+          MaterialForHlsl constants;
+          std::memcpy(&constants, model->material_constants.data() + i * kMaterialConstantStride, sizeof(constants));
+          const auto& textures = model->textures[i];
+          DrawItem item;
+          item.material = draw_lists[level].AddMaterial(
+              constants, {texture_id(textures.tex), texture_id(textures.sph), texture_id(textures.spa),
+                          texture_id(textures.toon)});
+          if (level == 0 && item.material == material_descriptor_index.size()) {
+            material_descriptor_index.push_back(i);
+          }
+          item.translucent = constants.alpha < 1.0f;
+          item.index_offset = idxOffset;
+          item.index_count = lod.index_counts[i];
+          draw_lists[level].AddDraw(item);
+          idxOffset += item.index_count;
+        }
+        draw_lists[level].Build();
+      }
+
+      const auto& stats = draw_list.GetStats();
+      std::wstringstream ss;
+      ss << L"draw list: " << stats.draws << L" materials -> " << stats.unique_materials << L" unique, "
+         << stats.draw_commands << L" draws, " << stats.material_changes << L" material changes" << std::endl;
+      OutputDebugStringW(ss.str().c_str());
+    }
+
+    // 描画ごとの境界ボックスは LOD の段ごとに持ち, その段を選んだフレームで頂点 (スキニング結果) が変わっていれば作り直す
+    DrawCuller::Options culler_options;
+    culler_options.occlusion = kOcclusionCulling;
+    std::vector<DrawCuller> draw_cullers(draw_lists.size(), DrawCuller(culler_options));
+    std::vector<uint64_t> culler_vertex_versions(draw_lists.size(), ~uint64_t(0));  // 境界ボックスを作った skinned_version
+    if (kCullDraws) {
+      for (std::size_t level = 0; level < draw_lists.size(); ++level) {
+        draw_cullers[level].SetCommands(draw_lists[level].Commands(), [&](uint32_t material) {
+          return draw_list.MaterialConstants(material).alpha >= 1.0f;
+        });
       }
     }
 
@@ -1317,13 +1664,10 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
     // Transform Matrix //
     //////////////////////
 
-    SceneMatrices* mapMatrix;  // マップ先を示すポインター
-    ID3D12Resource* constBuff = nullptr;
     DirectX::XMFLOAT3 eye(0, 17, -5);
     DirectX::XMMATRIX worldMat;  // 4x4
     DirectX::XMMATRIX viewMat;   // 4x4
     DirectX::XMMATRIX projMat;   // 4x4
-    ID3D12DescriptorHeap* basic_descriptor_heap = nullptr;
     {
       // Homography
 
@@ -1339,42 +1683,41 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
           1.0f,                                                                  // 近いほう
           100.0f                                                                 // 遠いほう
       );
-
-      auto heap_propertiy = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-      auto resource_description = CD3DX12_RESOURCE_DESC::Buffer((sizeof(SceneMatrices) + 0xff) & ~0xff);
-      result = _dev->CreateCommittedResource(&heap_propertiy, D3D12_HEAP_FLAG_NONE, &resource_description,
-                                             D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&constBuff));
-      result = constBuff->Map(0, nullptr, (void**)&mapMatrix);  // constant buffer に mapMatrix の Map
-
-      D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
-      descHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;  // シェーダーから見えるように
-      descHeapDesc.NodeMask = 0;                                       // マスクは 0
-      descHeapDesc.NumDescriptors = 1;                                 // CBV (transforrm matrix)
-      // SRV (Shader Resouce View), CBV (Constant Buffer View), UAV (Unordered Access View)
-      descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-
-      result = _dev->CreateDescriptorHeap(&descHeapDesc, IID_PPV_ARGS(&basic_descriptor_heap));
-
-      // デスクリプタの先頭ハンドルを取得しておく
-      auto basicHeapHandle = basic_descriptor_heap->GetCPUDescriptorHandleForHeapStart();
-      {
-        D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-        cbvDesc.BufferLocation = constBuff->GetGPUVirtualAddress();
-        cbvDesc.SizeInBytes = static_cast<UINT>(constBuff->GetDesc().Width);
-        // 定数バッファビューの作成
-        // register(b0)
-        _dev->CreateConstantBufferView(&cbvDesc, basicHeapHandle);
-      }
     }
 
+    // フレームごとの定数は 1 MiB のアップロードバッファから 256 バイト境界で切り出す.
+    // GPU がそのフレームを終えたらバッファを次のフレームで使い回すので, 定数を書くたびにリソースを作ることはない
+    LinearUploadAllocator upload_allocator(
+        {},
+        [&](std::size_t size, UploadPage* page) {
+          ID3D12Resource* buffer = nullptr;
+          auto heap_propertiy = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+          auto resource_description = CD3DX12_RESOURCE_DESC::Buffer(size);
+          if (FAILED(_dev->CreateCommittedResource(&heap_propertiy, D3D12_HEAP_FLAG_NONE, &resource_description,
+                                                   D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
+                                                   IID_PPV_ARGS(&buffer)))) {
+            return false;
+          }
+          if (FAILED(buffer->Map(0, nullptr, (void**)&page->cpu))) {  // 破棄するまで Map したままにする
+            buffer->Release();
+            return false;
+          }
+          page->gpu_address = buffer->GetGPUVirtualAddress();
+          page->handle = buffer;
+          return true;
+        },
+        [](const UploadPage& page) { static_cast<ID3D12Resource*>(page.handle)->Release(); });
+
     //////////////////
     // message loop //
     //////////////////
 
     MSG msg = {};
     unsigned int frame = 0;
+    uint32_t lod_level = 0;  // 最後に選んだ LOD の段
     float angle(0.0f);
     float angle_radian(0.0f);
+    const auto motion_start = std::chrono::steady_clock::now();
     while (true) {
       if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
         TranslateMessage(&msg);
@@ -1385,14 +1728,142 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
         break;
       }
 
+      profiler.MarkFrame();
+      if (kProfileSummaryInterval != 0 && frame != 0 && frame % kProfileSummaryInterval == 0) {
+        OutputDebugStringA(profiler.FormatSummary().c_str());
+        char line[256];
+        std::snprintf(line, sizeof(line), "lod: level %u, %zu / %zu triangles\n", lod_level,
+                      mesh_lods.levels[lod_level].triangles, mesh_lods.levels[0].triangles);
+        OutputDebugStringA(line);
+        if (kCullDraws) {
+          const auto& stats = draw_cullers[lod_level].GetStats();
+          std::snprintf(line, sizeof(line),
+                        "culling: %zu / %zu draws visible (frustum %zu, occlusion %zu culled), %.1f us, bounds %.1f us\n",
+                        stats.visible, stats.draws, stats.frustum_culled, stats.occlusion_culled, stats.cull_us,
+                        stats.bounds_us);
+          OutputDebugStringA(line);
+        }
+      }
+
+      // このフレームのリソースを GPU が使い終わるまで待つ (kFramesInFlight 前のフレームの完了を待つ)
+      auto& frame_context = frame_contexts[frame_scheduler.BeginFrame()];
+      frame_context.command_allocator->Reset();                          //キューをクリア
+      _cmdList->Reset(frame_context.command_allocator, _pipelinestate);  //コマンドをためる準備
+      upload_allocator.BeginFrame(frame_scheduler.CompletedValue());
+
       angle += 2.0f;
       angle = std::fmodf(angle, 360.0f);
       angle_radian = angle * DirectX::XM_PI / 180.0f;
-      // mapMatrix->world = DirectX::XMMatrixRotationY(angle_radian) * worldMat;
-      mapMatrix->world = worldMat;
-      mapMatrix->view = DirectX::XMMatrixRotationY(angle_radian) * viewMat;
-      mapMatrix->proj = projMat;
-      mapMatrix->eye = eye;
+      SceneMatrices scene;
+      // scene.world = DirectX::XMMatrixRotationY(angle_radian) * worldMat;
+      scene.world = worldMat;
+      scene.view = DirectX::XMMatrixRotationY(angle_radian) * viewMat;
+      scene.proj = projMat;
+      scene.eye = eye;
+      const UploadAllocation scene_constants = upload_allocator.Upload(scene);
+      if (!scene_constants) {
+        throw std::runtime_error("Failed to allocate scene constants");
+      }
+
+      if (!vmd.Motions().empty()) {
+        // 30 fps のモーションを経過時間に合わせてループ再生する
+        const std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - motion_start;
+        const float motion_frame = std::fmod(elapsed.count() * 30.0f, motion_clip.FrameCount() + 1.0f);
+        motion_player.Sample(motion_frame, &bone_poses);
+        bone_poses_dirty = true;
+      }
+
+      if (bone_poses_dirty) {
+        ProfileScope profile("skinning");
+        skeleton.ComputeSkinningMatrices(bone_poses, &skinning_matrices);
+        if (!skinning_matrices.empty()) {
+          SkinVerticesParallel(thread_pool, skinning_streams, skinning_matrices, &skinned_vertices);
+          WriteSkinnedVertices(skinned_vertices, 0, skinned_vertex_data.size(), skinned_vertex_data.data());
+          ++skinned_version;
+        }
+        bone_poses_dirty = false;
+      }
+      // このフレームの区画は GPU が使い終わっているので書き換えてよい (最新の結果が書いてあれば何もしない)
+      if (frame_context.vertex_version != skinned_version) {
+        std::memcpy(frame_context.vertex_map, skinned_vertex_data.data(), vertices.size_bytes());
+        frame_context.vertex_version = skinned_version;
+      }
+
+      // 画面上の大きさで LOD の段を選び, 画面に映る描画だけのコマンド列を作って記録する区間に分ける
+      const auto to_matrix4 = [](DirectX::FXMMATRIX m) {
+        DirectX::XMFLOAT4X4 stored;
+        DirectX::XMStoreFloat4x4(&stored, m);
+        Matrix4 matrix;
+        std::memcpy(matrix.m, stored.m, sizeof(matrix.m));
+        return matrix;
+      };
+      lod_level = SelectLodLevel(mesh_lods, to_matrix4(scene.world * scene.view), to_matrix4(scene.proj),
+                                 static_cast<float>(window_height), kLodPixelError);
+      const std::vector<DrawCommand>* frame_commands = &draw_lists[lod_level].Commands();
+      if (kCullDraws) {
+        ProfileScope profile("culling");
+        DrawCuller& draw_culler = draw_cullers[lod_level];
+        if (culler_vertex_versions[lod_level] != skinned_version) {
+          // スキニングする前はバインドポーズ
+          const bool skinned = skinned_version != 0;
+          CullingMesh mesh;
+          mesh.px = skinned ? skinned_vertices.px.data() : skinning_streams.px.data();
+          mesh.py = skinned ? skinned_vertices.py.data() : skinning_streams.py.data();
+          mesh.pz = skinned ? skinned_vertices.pz.data() : skinning_streams.pz.data();
+          mesh.vertex_count = vertices.size();
+          mesh.indices = mesh_lods.indices.data();
+          mesh.index_count = mesh_lods.indices.size();
+          draw_culler.UpdateBounds({mesh});
+          culler_vertex_versions[lod_level] = skinned_version;
+        }
+        frame_commands = &draw_culler.Cull(to_matrix4(scene.world * scene.view * scene.proj));
+      }
+      const auto recording_ranges =
+          PartitionDrawCommands(*frame_commands, kMaxRecordingRanges, kMinDrawsPerRecordingRange);
+
+      // ミップのストリーミング
+      // カメラは固定なので使っているテクスチャは毎フレーム最も細かいミップまで要求し, 1 フレームの転送量の範囲で読み込む.
+      // リソースとディスクリプタは GPU に投げたフレームからも参照されているので, 差し替えるフレームだけは全ての完了を待つ
+      if (kStreamTextureMips) {
+        ProfileScope profile("mip streaming");
+        for (const auto& [id, image] : streamed_images) {
+          texture_streamer.Request(id, 0.0f);
+        }
+        bool views_dirty = false;
+        const auto changes = texture_streamer.Update();
+        if (!changes.empty()) {
+          frame_scheduler.WaitIdle();
+        }
+        for (const auto& change : changes) {
+          const auto& image = streamed_images[change.texture];
+          auto& resource = image_resource_table[image];
+          auto replaced = CreateTextureResource(image_mip_table[image.get()], change.first_level);
+          if (replaced != nullptr) {
+            render_backend.ReleaseResource(ToHandle(resource));
+            resource = replaced;
+            views_dirty = true;
+          }
+        }
+        if (views_dirty) {
+          for (unsigned int i = 0; i < num_material; ++i) {
+            const auto& textures = model->textures[i];
+            auto& resources = material_textures[i];
+            resources.tex = CreateTextureFromImage(textures.tex);
+            resources.sph = CreateTextureFromImage(textures.sph);
+            resources.spa = CreateTextureFromImage(textures.spa);
+            resources.toon = CreateTextureFromImage(textures.toon);
+          }
+          create_material_views();
+#ifdef _DEBUG
+          auto stats = texture_streamer.GetStats();
+          std::wstringstream ss;
+          ss << L"mip streaming: resident " << stats.resident_bytes << L" / " << stats.full_bytes << L" bytes, "
+             << stats.levels_streamed_in << L" levels in, " << stats.levels_streamed_out << L" out, "
+             << stats.waiting_textures << L" waiting" << std::endl;
+          OutputDebugStringW(ss.str().c_str());
+#endif
+        }
+      }
 
       // DirectX処理
       //バックバッファのインデックスを取得
@@ -1407,80 +1878,117 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int) {
       BarrierDesc.Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
       _cmdList->ResourceBarrier(1, &BarrierDesc);
 
-      if (_pipelinestate != nullptr) {
-        _cmdList->SetPipelineState(_pipelinestate);
-      }
-
       //レンダーターゲットを指定
       auto rtvH = rtvHeaps->GetCPUDescriptorHandleForHeapStart();
       rtvH.ptr +=
           static_cast<ULONG_PTR>(bbIdx * _dev->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV));
       auto dsvH = dsvHeap->GetCPUDescriptorHandleForHeapStart();
-      _cmdList->OMSetRenderTargets(1, &rtvH, false, &dsvH);
-      _cmdList->ClearDepthStencilView(dsvH, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
-
-      // 画面クリア
-      constexpr float clearColor[] = {1.0f, 1.0f, 1.0f, 1.0f};  // while
-      _cmdList->ClearRenderTargetView(rtvH, clearColor, 0, nullptr);
-
-      _cmdList->RSSetViewports(1, &viewport);
-      _cmdList->RSSetScissorRects(1, &scissorrect);
-
-      _cmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-      _cmdList->IASetVertexBuffers(0, 1, &vbView);
-      _cmdList->IASetIndexBuffer(&ibView);
-
-      _cmdList->SetGraphicsRootSignature(rootsignature);
-
-      // WVP matrix (World View Projection Matrix)
-      _cmdList->SetDescriptorHeaps(1, &basic_descriptor_heap);
-      _cmdList->SetGraphicsRootDescriptorTable(
-          0,                                                             // root parameter index for SRV
-          basic_descriptor_heap->GetGPUDescriptorHandleForHeapStart());  // ヒープアドレス
-
-      _cmdList->SetDescriptorHeaps(1, &materialDescHeap);  // material
-
-      auto material_descriptor_handle = materialDescHeap->GetGPUDescriptorHandleForHeapStart();
-      unsigned int idxOffset = 0;
       auto cbvsrvIncSize =
           _dev->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV) * cbv_rsv_count_per_material;
-      for (auto& m : materials) {
-        _cmdList->SetGraphicsRootDescriptorTable(1, material_descriptor_handle);
-        _cmdList->DrawIndexedInstanced(m.indicesNum, 1, idxOffset, 0, 0);
-        material_descriptor_handle.ptr += cbvsrvIncSize;
-        idxOffset += m.indicesNum;
+      auto make_command_list = [&](ID3D12GraphicsCommandList* list) {
+        return D3D12CommandList(list, rtvH, dsvH, rootsignature, materialDescHeap, cbvsrvIncSize,
+                                &material_descriptor_index);
+      };
+
+      // 画面クリア
+      PassDesc clear_pass;
+      clear_pass.width = window_width;
+      clear_pass.height = window_height;
+      clear_pass.clear_color = true;
+      clear_pass.clear_depth = true;
+      std::fill(clear_pass.color, clear_pass.color + 4, 1.0f);  // while
+      make_command_list(_cmdList).BeginPass(clear_pass);
+
+      // 描画は区間ごとのコマンドリストに並列に記録する.
+      // コマンドリストは状態を引き継がないので, 区間ごとにレンダーターゲットなどを設定し直す
+      PassDesc draw_pass = clear_pass;
+      draw_pass.clear_color = false;
+      draw_pass.clear_depth = false;
+      const SceneBindings bindings = {frame_context.vertex_view, ibView, scene_constants.gpu_address};
+      RecordRangesParallel(thread_pool, recording_ranges, [&](std::size_t range_index, const RecordRange& range) {
+        ProfileScope profile("record commands");
+        auto allocator = frame_context.recording_allocators[range_index];
+        auto list = frame_context.recording_lists[range_index];
+        allocator->Reset();
+        list->Reset(allocator, _pipelinestate);
+        auto command_list = make_command_list(list);
+        RecordSceneRange(*frame_commands, range, draw_pass, bindings, command_list);
+      });
+
+      // 同じコマンドをメモリ上にも記録してファイルに書き出す (GPU の無い環境で再生・解析する用)
+      if (kCaptureFrame != 0 && frame == kCaptureFrame) {
+        RecordingCommandList capture;
+        capture.BeginPass(clear_pass);
+        for (const auto& range : recording_ranges) {
+          RecordSceneRange(*frame_commands, range, draw_pass, bindings, capture);
+        }
+        std::string error;
+        if (!SaveFrameCapture(kCapturePath, capture.Frame(), &error)) {
+          OutputDebugStringA(("Failed to save frame capture: " + error + "\n").c_str());
+        }
       }
+      ++frame;
 
+      // 最後に実行するコマンドリストでバックバッファを戻す
+      const std::size_t range_count = recording_ranges.size();
+      auto last_list = range_count == 0 ? _cmdList : frame_context.recording_lists[range_count - 1];
       BarrierDesc.Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
       BarrierDesc.Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
-      _cmdList->ResourceBarrier(1, &BarrierDesc);
+      last_list->ResourceBarrier(1, &BarrierDesc);
+
+      // ここからフレームの終わりまで (コマンドリストのクローズ・実行・フリップ)
+      ProfileScope submit_profile("submit");
 
       //命令のクローズ
       _cmdList->Close();
-
-      //コマンドリストの実行
-      ID3D12CommandList* cmdlists[] = {_cmdList};
-      _cmdQueue->ExecuteCommandLists(1, cmdlists);
-
-      ////待ち
-      _cmdQueue->Signal(_fence, ++_fenceVal);
-
-      if (_fence->GetCompletedValue() != _fenceVal) {
-        auto event = CreateEvent(nullptr, false, false, nullptr);
-        _fence->SetEventOnCompletion(_fenceVal, event);
-        if (event != 0) {
-          WaitForSingleObject(event, INFINITE);
-          CloseHandle(event);
-        }
+      for (std::size_t i = 0; i < range_count; ++i) {
+        frame_context.recording_lists[i]->Close();
       }
 
-      _cmdAllocator->Reset();                          //キューをクリア
-      _cmdList->Reset(_cmdAllocator, _pipelinestate);  //再びコマンドリストをためる準備
+      //コマンドリストの実行 (記録した区間の順に)
+      ID3D12CommandList* cmdlists[1 + kMaxRecordingRanges] = {_cmdList};
+      std::copy_n(frame_context.recording_lists.begin(), range_count, cmdlists + 1);
+      _cmdQueue->ExecuteCommandLists(static_cast<UINT>(1 + range_count), cmdlists);
 
       //フリップ
       _swapchain->Present(1, 0);
+
+      // 完了は待たずに次のフレームの記録に進む (待つのは次にこのスロットを使う BeginFrame())
+      frame_scheduler.EndFrame();
+      upload_allocator.EndFrame(frame_scheduler.LastSubmittedValue());
     }
 
+    // 終了する前に GPU に投げたフレームを全て終わらせる
+    frame_scheduler.WaitIdle();
+    CloseHandle(fence_event);
+    if (kProfileTracePath[0] != '\0') {
+      std::string error;
+      if (!profiler.WriteChromeTrace(kProfileTracePath, &error)) {
+        OutputDebugStringA(("Failed to write profile trace: " + error + "\n").c_str());
+      }
+    }
+#ifdef _DEBUG
+    {
+      const auto& stats = frame_scheduler.GetStats();
+      std::wstringstream ss;
+      ss << L"frames: " << stats.frames << L", " << kFramesInFlight << L" in flight, waited " << stats.waits
+         << L" times (" << stats.wait_seconds << L" s), max " << stats.max_frames_ahead << L" frames ahead"
+         << std::endl;
+      const auto& upload_stats = upload_allocator.GetStats();
+      ss << L"upload: " << upload_stats.allocations << L" allocations, " << upload_stats.page_creations
+         << L" pages created, " << upload_stats.page_reuses << L" reused, peak " << upload_stats.peak_frame_bytes
+         << L" bytes/frame" << std::endl;
+      for (const auto& [name, heaps] : {std::make_pair(L"texture", texture_heaps.get()),
+                                        std::make_pair(L"buffer", buffer_heaps.get())}) {
+        const auto heap_stats = heaps->GetStats();
+        ss << name << L" heaps: " << heap_stats.heaps << L" heaps (" << heap_stats.dedicated_heaps
+           << L" dedicated), " << heap_stats.allocations << L" resources, " << heap_stats.used_bytes << L" / "
+           << heap_stats.heap_bytes << L" bytes used, fragmentation " << heap_stats.Fragmentation() << std::endl;
+      }
+      OutputDebugStringW(ss.str().c_str());
+    }
+#endif
+
     // もうクラス使わんから登録解除してや
     UnregisterClass(w.lpszClassName, w.hInstance);
 
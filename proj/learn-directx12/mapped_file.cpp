@@ -0,0 +1,138 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#include <cstring>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+////////////////
+// MappedFile //
+////////////////
+
+MappedFile::~MappedFile() { Close(); }
+
+MappedFile::MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    opened_empty_ = std::exchange(other.opened_empty_, false);
+#ifdef _WIN32
+    file_handle_ = std::exchange(other.file_handle_, nullptr);
+    mapping_handle_ = std::exchange(other.mapping_handle_, nullptr);
+#endif
+    error_ = std::move(other.error_);
+  }
+  return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const fs::path& path) {
+  Close();
+  HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    error_ = "Failed to open file (CreateFileW error " + std::to_string(GetLastError()) + ")";
+    return false;
+  }
+  LARGE_INTEGER file_size = {};
+  if (!GetFileSizeEx(file, &file_size)) {
+    error_ = "Failed to get file size (error " + std::to_string(GetLastError()) + ")";
+    CloseHandle(file);
+    return false;
+  }
+  if (file_size.QuadPart == 0) {
+    // 空ファイルはマップできない
+    CloseHandle(file);
+    opened_empty_ = true;
+    return true;
+  }
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    error_ = "Failed to create file mapping (error " + std::to_string(GetLastError()) + ")";
+    CloseHandle(file);
+    return false;
+  }
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr) {
+    error_ = "Failed to map view of file (error " + std::to_string(GetLastError()) + ")";
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  file_handle_ = file;
+  mapping_handle_ = mapping;
+  data_ = static_cast<const std::uint8_t*>(view);
+  size_ = static_cast<std::size_t>(file_size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_ != nullptr) {
+    CloseHandle(mapping_handle_);
+  }
+  if (file_handle_ != nullptr) {
+    CloseHandle(file_handle_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  opened_empty_ = false;
+  file_handle_ = nullptr;
+  mapping_handle_ = nullptr;
+}
+#else
+bool MappedFile::Open(const fs::path& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error_ = std::string("Failed to open file: ") + std::strerror(errno);
+    return false;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0) {
+    error_ = std::string("Failed to stat file: ") + std::strerror(errno);
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    opened_empty_ = true;
+    return true;
+  }
+  void* view = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // マップはファイルディスクリプタを閉じても有効
+  if (view == MAP_FAILED) {
+    error_ = std::string("Failed to mmap file: ") + std::strerror(errno);
+    return false;
+  }
+  madvise(view, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+  data_ = static_cast<const std::uint8_t*>(view);
+  size_ = static_cast<std::size_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<std::uint8_t*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  opened_empty_ = false;
+}
+#endif
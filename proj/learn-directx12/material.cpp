@@ -0,0 +1,28 @@
+#include "material.h"
+
+#include <cstring>
+
+MaterialForHlsl MakeMaterialForHlsl(const PmdMaterial& material) {
+  MaterialForHlsl m;
+  m.diffuse = material.diffuse;
+  m.alpha = material.alpha;
+  m.specular = material.specular;
+  m.specularity = material.specularity;
+  m.ambient = material.ambient;
+  return m;
+}
+
+std::vector<uint8_t> PackMaterialConstants(PmdSpan<PmdMaterial> materials) {
+  std::vector<uint8_t> constants(materials.size() * kMaterialConstantStride);
+  PackMaterialConstants(materials, constants.data());
+  return constants;
+}
+
+void PackMaterialConstants(PmdSpan<PmdMaterial> materials, uint8_t* out) {
+  for (std::size_t i = 0; i < materials.size(); ++i) {
+    const MaterialForHlsl m = MakeMaterialForHlsl(materials[i]);
+    uint8_t* slot = out + i * kMaterialConstantStride;
+    std::memcpy(slot, &m, sizeof(m));
+    std::memset(slot + sizeof(m), 0, kMaterialConstantStride - sizeof(m));
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pmd_file.h"
+
+/**
+ * @brief シェーダー側に投げられるマテリアルデータ
+ * @details HLSL の cbuffer のパッキング規則 (float3 + float で 16 bytes) と同じ並びにしてある.
+ */
+struct MaterialForHlsl {
+  PmdFloat3 diffuse;   // 4 bytes * 3 ディフューズ色
+  float alpha;         // 4 bytes     ディフューズα
+  PmdFloat3 specular;  // 4 bytes * 3 スペキュラ色
+  float specularity;   // 4 bytes     スペキュラの強さ（乗算値）
+  PmdFloat3 ambient;   // 4 bytes * 3 アンビエント色
+};
+
+static_assert(sizeof(MaterialForHlsl) == 44, "MaterialForHlsl must match the HLSL cbuffer layout");
+
+/**
+ * @brief 定数バッファビューのアライメント (D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT)
+ */
+constexpr std::size_t kMaterialConstantStride = 256;
+
+/**
+ * @brief PMD のマテリアルからシェーダーに渡す値を取り出す
+ */
+MaterialForHlsl MakeMaterialForHlsl(const PmdMaterial& material);
+
+/**
+ * @brief 全マテリアルの定数を kMaterialConstantStride ごとに詰めたバイト列を作る
+ * @details そのまま定数バッファにコピーできる. 各スロットの余りは 0 で埋める.
+ */
+std::vector<uint8_t> PackMaterialConstants(PmdSpan<PmdMaterial> materials);
+
+/**
+ * @brief PackMaterialConstants と同じものを呼び出し側のバッファに書く
+ * @param out materials.size() * kMaterialConstantStride バイト
+ */
+void PackMaterialConstants(PmdSpan<PmdMaterial> materials, uint8_t* out);
@@ -0,0 +1,617 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <tuple>
+
+#include "mesh_optimizer.h"
+
+namespace {
+
+// 開いた辺 (縁と UV の継ぎ目) を保つために加える, 辺に垂直な平面の重み
+constexpr double kEdgeWeight = 10.0;
+// 1 回の走査で縮約を試す候補の割合 (残りは誤差を更新した次の走査で選び直す)
+constexpr std::size_t kCandidateFractionDenominator = 2;
+// 縮約の前後で三角形の法線がなす角の余弦の下限 (これより向きが変わる縮約はしない. 0.25 は約 75 度)
+constexpr float kMinNormalCosine = 0.25f;
+// LOD の段が前の段からこの比より減らなければ打ち切る
+constexpr float kMinLevelReduction = 0.9f;
+
+/**
+ * @brief 平面までの距離の二乗和 (対称行列 A, ベクトル b, 定数 c で p^T A p + 2 b.p + c)
+ */
+struct Quadric {
+  double a00 = 0.0, a11 = 0.0, a22 = 0.0, a01 = 0.0, a02 = 0.0, a12 = 0.0;
+  double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+  double c = 0.0;
+  double weight = 0.0;  // 重みの合計 (誤差を距離に戻すため)
+
+  void AddPlane(const Float3& n, float d, double w) {
+    a00 += w * n.x * n.x;
+    a11 += w * n.y * n.y;
+    a22 += w * n.z * n.z;
+    a01 += w * n.x * n.y;
+    a02 += w * n.x * n.z;
+    a12 += w * n.y * n.z;
+    b0 += w * n.x * d;
+    b1 += w * n.y * d;
+    b2 += w * n.z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void Add(const Quadric& q) {
+    a00 += q.a00;
+    a11 += q.a11;
+    a22 += q.a22;
+    a01 += q.a01;
+    a02 += q.a02;
+    a12 += q.a12;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  /**
+   * @return p に置いたときの平面までの距離の重み付き平均 (二乗)
+   */
+  double Evaluate(const Float3& p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                     2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+enum class VertexKind : uint8_t {
+  kManifold,  // 閉じた面の内側. どの隣にも寄せられる
+  kBorder,    // 開いた縁. 縁に沿って縁の頂点にだけ寄せられる
+  kSeam,      // UV の継ぎ目 (位置が同じ頂点が 2 つ). 継ぎ目に沿って組の両方を寄せる
+  kLocked,    // 動かさない (3 つ以上が同じ位置, 縁と継ぎ目が交わる点など)
+};
+
+/**
+ * @brief ボーンの影響度の差 (0: 同じ, 1: 共通のボーンが無い)
+ */
+float SkinDistance(const PmdVertex& a, const PmdVertex& b) {
+  const auto influence = [](const PmdVertex& v, uint16_t bone) {
+    const float w0 = std::min<uint8_t>(v.weight, 100) / 100.0f;
+    return (v.bone_no[0] == bone ? w0 : 0.0f) + (v.bone_no[1] == bone ? 1.0f - w0 : 0.0f);
+  };
+  const uint16_t bones[4] = {a.bone_no[0], a.bone_no[1], b.bone_no[0], b.bone_no[1]};
+  float difference = 0.0f;
+  for (int i = 0; i < 4; ++i) {
+    if (std::find(bones, bones + i, bones[i]) == bones + i) {
+      difference += std::fabs(influence(a, bones[i]) - influence(b, bones[i]));
+    }
+  }
+  return difference * 0.5f;
+}
+
+// PmdVertex は 1 byte アライメントなので, 参照を取らずに値で読む
+Float3 Position(const PmdVertex& v) { return {v.pos.x, v.pos.y, v.pos.z}; }
+
+uint64_t EdgeKey(uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | b; }
+
+/**
+ * @brief 有向辺の集合 (ソートした配列を二分探索する)
+ */
+class EdgeSet {
+ public:
+  template <typename Map>
+  void Build(const std::vector<uint32_t>& triangles, const Map& map) {
+    keys_.clear();
+    keys_.reserve(triangles.size());
+    for (std::size_t i = 0; i < triangles.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        keys_.push_back(EdgeKey(map(triangles[i + e]), map(triangles[i + (e + 1) % 3])));
+      }
+    }
+    std::sort(keys_.begin(), keys_.end());
+  }
+
+  bool Has(uint32_t a, uint32_t b) const { return std::binary_search(keys_.begin(), keys_.end(), EdgeKey(a, b)); }
+  // a - b が片方の三角形にだけ使われている (縁か継ぎ目)
+  bool IsOpen(uint32_t a, uint32_t b) const { return Has(a, b) != Has(b, a); }
+
+ private:
+  std::vector<uint64_t> keys_;
+};
+
+/**
+ * @brief 1 つのインデックス列の簡略化 (頂点はインデックス列が参照するものだけに詰めた番号で扱う)
+ */
+class Simplifier {
+ public:
+  Simplifier(PmdSpan<PmdVertex> vertices, const uint16_t* indices, std::size_t index_count,
+             const SimplifyOptions& options)
+      : vertices_(vertices), options_(options) {
+    local_to_vertex_.assign(indices, indices + index_count);
+    std::sort(local_to_vertex_.begin(), local_to_vertex_.end());
+    local_to_vertex_.erase(std::unique(local_to_vertex_.begin(), local_to_vertex_.end()), local_to_vertex_.end());
+    triangles_.resize(index_count / 3 * 3);
+    for (std::size_t i = 0; i < triangles_.size(); ++i) {
+      triangles_[i] = static_cast<uint32_t>(
+          std::lower_bound(local_to_vertex_.begin(), local_to_vertex_.end(), indices[i]) - local_to_vertex_.begin());
+    }
+    NormalizePositions();
+    BuildWedges();
+    ClassifyVertices();
+    ComputeQuadrics();
+  }
+
+  void Run(std::size_t target_triangles) {
+    while (triangles_.size() / 3 > target_triangles) {
+      if (!RunPass(triangles_.size() / 3 - target_triangles)) {
+        break;
+      }
+    }
+  }
+
+  std::vector<uint16_t> Result() const {
+    std::vector<uint16_t> result(triangles_.size());
+    for (std::size_t i = 0; i < triangles_.size(); ++i) {
+      result[i] = local_to_vertex_[triangles_[i]];
+    }
+    return result;
+  }
+
+  // 元の座標の単位での誤差
+  float Error() const { return static_cast<float>(std::sqrt(max_error_) / scale_); }
+
+ private:
+  struct Collapse {
+    uint32_t v;  // 寄せる頂点
+    uint32_t t;  // 寄せる先
+    double cost;
+  };
+
+  const PmdVertex& Vertex(uint32_t local) const { return vertices_[local_to_vertex_[local]]; }
+
+  // 大きさの違うモデルでも誤差の精度が同じになるよう, 境界ボックスの最大辺を 1 にする
+  void NormalizePositions() {
+    Float3 lo = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                 std::numeric_limits<float>::max()};
+    Float3 hi = -lo;
+    for (const uint16_t v : local_to_vertex_) {
+      const Float3 p = Position(vertices_[v]);
+      lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+      hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+    }
+    const float extent = std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+    scale_ = extent > 0.0f ? 1.0 / extent : 1.0;
+    positions_.resize(local_to_vertex_.size());
+    for (std::size_t i = 0; i < positions_.size(); ++i) {
+      const Float3 p = Position(vertices_[local_to_vertex_[i]]);
+      positions_[i] = {static_cast<float>((p.x - lo.x) * scale_), static_cast<float>((p.y - lo.y) * scale_),
+                       static_cast<float>((p.z - lo.z) * scale_)};
+    }
+  }
+
+  // 位置が同じ頂点に同じ番号 (wedge) を振り, 同じ wedge の頂点を輪でつなぐ
+  void BuildWedges() {
+    const std::size_t count = local_to_vertex_.size();
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      order[i] = i;
+    }
+    const auto bits = [this](uint32_t v) {
+      const PmdFloat3& p = Vertex(v).pos;
+      uint32_t x, y, z;
+      std::memcpy(&x, &p.x, sizeof(x));
+      std::memcpy(&y, &p.y, sizeof(y));
+      std::memcpy(&z, &p.z, sizeof(z));
+      return std::make_tuple(x, y, z, v);
+    };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return bits(a) < bits(b); });
+    wedge_.resize(count);
+    wedge_next_.resize(count);
+    wedge_size_.clear();
+    for (std::size_t i = 0; i < count;) {
+      std::size_t end = i + 1;
+      while (end < count && std::memcmp(&Vertex(order[end]).pos, &Vertex(order[i]).pos, sizeof(PmdFloat3)) == 0) {
+        ++end;
+      }
+      const auto wedge = static_cast<uint32_t>(wedge_size_.size());
+      for (std::size_t j = i; j < end; ++j) {
+        wedge_[order[j]] = wedge;
+        wedge_next_[order[j]] = order[j + 1 < end ? j + 1 : i];
+      }
+      wedge_size_.push_back(static_cast<uint32_t>(end - i));
+      i = end;
+    }
+  }
+
+  void BuildEdges() {
+    position_edges_.Build(triangles_, [this](uint32_t v) { return wedge_[v]; });
+    attribute_edges_.Build(triangles_, [](uint32_t v) { return v; });
+  }
+
+  void ClassifyVertices() {
+    BuildEdges();
+    std::vector<uint8_t> position_open(wedge_size_.size(), 0);
+    std::vector<uint8_t> attribute_open(local_to_vertex_.size(), 0);
+    for (std::size_t i = 0; i < triangles_.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        const uint32_t a = triangles_[i + e];
+        const uint32_t b = triangles_[i + (e + 1) % 3];
+        if (!position_edges_.Has(wedge_[b], wedge_[a])) {
+          position_open[wedge_[a]] = position_open[wedge_[b]] = 1;
+        }
+        if (!attribute_edges_.Has(b, a)) {
+          attribute_open[a] = attribute_open[b] = 1;
+        }
+      }
+    }
+    kinds_.resize(local_to_vertex_.size());
+    for (std::size_t v = 0; v < kinds_.size(); ++v) {
+      const uint32_t wedge = wedge_[v];
+      VertexKind kind = VertexKind::kLocked;
+      if (wedge_size_[wedge] == 1) {
+        kind = position_open[wedge] ? VertexKind::kBorder : VertexKind::kManifold;
+      } else if (wedge_size_[wedge] == 2 && !position_open[wedge] && attribute_open[v]) {
+        kind = VertexKind::kSeam;
+      }
+      if (kind == VertexKind::kBorder && options_.lock_borders) {
+        kind = VertexKind::kLocked;
+      }
+      kinds_[v] = kind;
+    }
+  }
+
+  // 三角形の平面と, 開いた辺に垂直な平面を wedge ごとに足す
+  void ComputeQuadrics() {
+    quadrics_.assign(wedge_size_.size(), Quadric());
+    for (std::size_t i = 0; i < triangles_.size(); i += 3) {
+      const uint32_t tri[3] = {triangles_[i], triangles_[i + 1], triangles_[i + 2]};
+      const Float3& p0 = positions_[tri[0]];
+      const Float3 cross = Cross(positions_[tri[1]] - p0, positions_[tri[2]] - p0);
+      const float length = Length(cross);
+      if (length == 0.0f) {
+        continue;
+      }
+      const Float3 normal = cross * (1.0f / length);
+      for (const uint32_t v : tri) {
+        quadrics_[wedge_[v]].AddPlane(normal, -Dot(normal, p0), length * 0.5);
+      }
+      for (int e = 0; e < 3; ++e) {
+        const uint32_t a = tri[e];
+        const uint32_t b = tri[(e + 1) % 3];
+        if (position_edges_.Has(wedge_[b], wedge_[a]) && attribute_edges_.Has(b, a)) {
+          continue;
+        }
+        const Float3 edge = positions_[b] - positions_[a];
+        const float edge_length = Length(edge);
+        if (edge_length == 0.0f) {
+          continue;
+        }
+        const Float3 edge_normal = Normalize(Cross(edge, normal));
+        const double w = kEdgeWeight * edge_length * edge_length;
+        quadrics_[wedge_[a]].AddPlane(edge_normal, -Dot(edge_normal, positions_[a]), w);
+        quadrics_[wedge_[b]].AddPlane(edge_normal, -Dot(edge_normal, positions_[a]), w);
+      }
+    }
+  }
+
+  bool CanCollapse(uint32_t v, uint32_t t) const {
+    if (wedge_[v] == wedge_[t] || SkinDistance(Vertex(v), Vertex(t)) > options_.max_skin_delta) {
+      return false;
+    }
+    const VertexKind target = kinds_[t];
+    switch (kinds_[v]) {
+      case VertexKind::kManifold:
+        return true;
+      case VertexKind::kBorder:
+        return (target == VertexKind::kBorder || target == VertexKind::kLocked) &&
+               position_edges_.IsOpen(wedge_[v], wedge_[t]);
+      case VertexKind::kSeam:
+        return (target == VertexKind::kSeam || target == VertexKind::kLocked) && attribute_edges_.IsOpen(v, t);
+      case VertexKind::kLocked:
+        break;
+    }
+    return false;
+  }
+
+  // v を t に寄せたときに裏返る (向きが大きく変わる) 三角形があるか
+  bool HasTriangleFlips(uint32_t v, uint32_t t) const {
+    for (uint32_t k = adjacency_offsets_[v]; k < adjacency_offsets_[v + 1]; ++k) {
+      const uint32_t triangle = adjacency_[k];
+      uint32_t tri[3];
+      for (int i = 0; i < 3; ++i) {
+        tri[i] = remap_[triangles_[triangle * 3 + i]];
+      }
+      if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+        continue;  // この走査の別の縮約で潰れた
+      }
+      if (wedge_[tri[0]] == wedge_[t] || wedge_[tri[1]] == wedge_[t] || wedge_[tri[2]] == wedge_[t]) {
+        continue;  // 潰れて消える
+      }
+      const Float3 before =
+          Cross(positions_[tri[1]] - positions_[tri[0]], positions_[tri[2]] - positions_[tri[0]]);
+      for (uint32_t& i : tri) {
+        i = i == v ? t : i;
+      }
+      const Float3 after = Cross(positions_[tri[1]] - positions_[tri[0]], positions_[tri[2]] - positions_[tri[0]]);
+      const float before_length = Length(before);
+      if (before_length > 0.0f && Dot(before, after) <= kMinNormalCosine * before_length * Length(after)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 継ぎ目の頂点 v を t に寄せるとき, 組のもう一方を寄せる先 (t と同じ位置で隣にある頂点). 無ければ v
+  uint32_t FindSeamTarget(uint32_t twin, uint32_t t) const {
+    for (uint32_t k = adjacency_offsets_[twin]; k < adjacency_offsets_[twin + 1]; ++k) {
+      for (int i = 0; i < 3; ++i) {
+        const uint32_t u = remap_[triangles_[adjacency_[k] * 3 + i]];
+        if (u != twin && wedge_[u] == wedge_[t]) {
+          return u;
+        }
+      }
+    }
+    return twin;
+  }
+
+  void Lock(uint32_t v) {
+    uint32_t w = v;
+    do {
+      locked_[w] = 1;
+      w = wedge_next_[w];
+    } while (w != v);
+  }
+
+  /**
+   * @return 縮約できたら true
+   */
+  bool RunPass(std::size_t triangle_goal) {
+    const std::size_t vertex_count = local_to_vertex_.size();
+    const std::size_t triangle_count = triangles_.size() / 3;
+    BuildEdges();
+
+    // 頂点ごとの三角形
+    adjacency_offsets_.assign(vertex_count + 1, 0);
+    for (const uint32_t v : triangles_) {
+      ++adjacency_offsets_[v + 1];
+    }
+    for (std::size_t v = 0; v < vertex_count; ++v) {
+      adjacency_offsets_[v + 1] += adjacency_offsets_[v];
+    }
+    adjacency_.resize(triangles_.size());
+    std::vector<uint32_t> fill(adjacency_offsets_.begin(), adjacency_offsets_.end() - 1);
+    for (std::size_t i = 0; i < triangles_.size(); ++i) {
+      adjacency_[fill[triangles_[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // wedge ごとに最も誤差の小さい縮約を選ぶ
+    std::vector<Collapse> best(wedge_size_.size(), {0, 0, std::numeric_limits<double>::infinity()});
+    for (std::size_t i = 0; i < triangles_.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        const uint32_t a = triangles_[i + e];
+        const uint32_t b = triangles_[i + (e + 1) % 3];
+        for (const auto& [v, t] : {std::make_pair(a, b), std::make_pair(b, a)}) {
+          if (!CanCollapse(v, t)) {
+            continue;
+          }
+          const double cost = quadrics_[wedge_[v]].Evaluate(positions_[t]);
+          Collapse& candidate = best[wedge_[v]];
+          if (cost < candidate.cost) {
+            candidate = {v, t, cost};
+          }
+        }
+      }
+    }
+    std::vector<Collapse> candidates;
+    for (const Collapse& collapse : best) {
+      if (collapse.cost != std::numeric_limits<double>::infinity()) {
+        candidates.push_back(collapse);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) {
+      return a.cost != b.cost ? a.cost < b.cost : a.v < b.v;
+    });
+
+    remap_.resize(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; ++v) {
+      remap_[v] = v;
+    }
+    locked_.assign(vertex_count, 0);
+    const double max_cost = static_cast<double>(options_.max_error) * options_.max_error * scale_ * scale_;
+    const std::size_t candidate_limit = (candidates.size() + kCandidateFractionDenominator - 1) /
+                                        kCandidateFractionDenominator;
+    std::size_t removed = 0;
+    bool collapsed = false;
+    for (std::size_t i = 0; i < candidate_limit && removed < triangle_goal; ++i) {
+      const Collapse& collapse = candidates[i];
+      if (collapse.cost > max_cost) {
+        break;
+      }
+      const uint32_t v = collapse.v;
+      const uint32_t t = collapse.t;
+      if (locked_[v] || locked_[t] || HasTriangleFlips(v, t)) {
+        continue;
+      }
+      uint32_t twin = v;
+      uint32_t twin_target = t;
+      if (kinds_[v] == VertexKind::kSeam) {
+        twin = wedge_next_[v];
+        twin_target = FindSeamTarget(twin, t);
+        if (twin_target == twin || locked_[twin_target] || !CanCollapse(twin, twin_target) ||
+            HasTriangleFlips(twin, twin_target)) {
+          continue;
+        }
+      }
+      remap_[v] = t;
+      remap_[twin] = twin_target;
+      quadrics_[wedge_[t]].Add(quadrics_[wedge_[v]]);
+      Lock(v);
+      Lock(t);
+      max_error_ = std::max(max_error_, collapse.cost);
+      // 内側の辺なら 2 つ, 縁なら 1 つ, 継ぎ目なら組の両側で 1 つずつ消える
+      removed += kinds_[v] == VertexKind::kBorder ? 1 : 2;
+      collapsed = true;
+    }
+    if (!collapsed) {
+      return false;
+    }
+
+    // 寄せた頂点を置き換え, 潰れた三角形を除く
+    std::size_t write = 0;
+    for (std::size_t i = 0; i < triangle_count; ++i) {
+      const uint32_t a = remap_[triangles_[i * 3]];
+      const uint32_t b = remap_[triangles_[i * 3 + 1]];
+      const uint32_t c = remap_[triangles_[i * 3 + 2]];
+      if (wedge_[a] == wedge_[b] || wedge_[b] == wedge_[c] || wedge_[a] == wedge_[c]) {
+        continue;
+      }
+      triangles_[write++] = a;
+      triangles_[write++] = b;
+      triangles_[write++] = c;
+    }
+    triangles_.resize(write);
+    return true;
+  }
+
+  PmdSpan<PmdVertex> vertices_;
+  SimplifyOptions options_;
+  std::vector<uint16_t> local_to_vertex_;
+  std::vector<uint32_t> triangles_;  // 詰めた頂点番号
+  std::vector<Float3> positions_;    // 正規化した位置
+  double scale_ = 1.0;
+  std::vector<uint32_t> wedge_;       // 頂点 -> 位置の番号
+  std::vector<uint32_t> wedge_next_;  // 同じ位置の次の頂点 (輪)
+  std::vector<uint32_t> wedge_size_;
+  std::vector<VertexKind> kinds_;
+  std::vector<Quadric> quadrics_;  // wedge ごと
+  EdgeSet position_edges_;
+  EdgeSet attribute_edges_;
+  std::vector<uint32_t> adjacency_offsets_;
+  std::vector<uint32_t> adjacency_;
+  std::vector<uint32_t> remap_;
+  std::vector<uint8_t> locked_;
+  double max_error_ = 0.0;  // 正規化した座標での誤差 (二乗)
+};
+
+}  // namespace
+
+std::vector<uint16_t> SimplifyIndices(PmdSpan<PmdVertex> vertices, const uint16_t* indices, std::size_t index_count,
+                                      std::size_t target_index_count, const SimplifyOptions& options,
+                                      float* result_error) {
+  if (result_error != nullptr) {
+    *result_error = 0.0f;
+  }
+  if (!std::all_of(indices, indices + index_count, [&](uint16_t i) { return i < vertices.size(); })) {
+    return std::vector<uint16_t>(indices, indices + index_count);  // 壊れたインデックスは簡略化しない
+  }
+  Simplifier simplifier(vertices, indices, index_count, options);
+  simplifier.Run(target_index_count / 3);
+  if (result_error != nullptr) {
+    *result_error = simplifier.Error();
+  }
+  return simplifier.Result();
+}
+
+MeshLods GenerateMeshLods(PmdSpan<PmdVertex> vertices, PmdSpan<uint16_t> indices,
+                          const std::vector<uint32_t>& index_counts, const LodOptions& options) {
+  MeshLods lods;
+  lods.indices.assign(indices.begin(), indices.end());
+
+  // 境界ボックスの中心を中心にした境界球
+  Float3 lo = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+               std::numeric_limits<float>::max()};
+  Float3 hi = -lo;
+  for (const PmdVertex& v : vertices) {
+    const Float3 p = Position(v);
+    lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+    hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+  }
+  if (!vertices.empty()) {
+    lods.center = (lo + hi) * 0.5f;
+    for (const PmdVertex& v : vertices) {
+      lods.radius = std::max(lods.radius, Length(Position(v) - lods.center));
+    }
+  }
+  const float extent = vertices.empty() ? 0.0f : std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+
+  MeshLodLevel base;
+  std::size_t offset = 0;
+  for (const uint32_t count : index_counts) {
+    const auto clamped = static_cast<uint32_t>(std::min<std::size_t>(count, indices.size() - offset));
+    base.index_counts.push_back(clamped);
+    offset += clamped;
+  }
+  base.triangles = offset / 3;
+  lods.levels.push_back(base);
+
+  SimplifyOptions simplify;
+  simplify.max_error = options.max_error * extent;
+  simplify.max_skin_delta = options.max_skin_delta;
+  simplify.lock_borders = options.lock_borders;
+  // マテリアルごとに 1 つの Simplifier で目標を下げながら続けて縮約し, 目標ごとの結果を段にする
+  const std::size_t level_count = std::max<std::size_t>(options.max_levels, 1);
+  std::vector<std::vector<uint16_t>> level_indices(level_count);
+  std::vector<MeshLodLevel> levels(level_count);
+  std::size_t source_offset = 0;
+  for (const uint32_t count : base.index_counts) {
+    const uint16_t* source = lods.indices.data() + source_offset;
+    source_offset += count;
+    const bool valid = std::all_of(source, source + count, [&](uint16_t i) { return i < vertices.size(); });
+    if (!valid || level_count == 1) {
+      for (std::size_t level = 1; level < level_count; ++level) {
+        level_indices[level].insert(level_indices[level].end(), source, source + count);  // 壊れたインデックス
+        levels[level].index_counts.push_back(count);
+        levels[level].triangles += count / 3;
+      }
+      continue;
+    }
+    Simplifier simplifier(vertices, source, count, simplify);
+    for (std::size_t level = 1; level < level_count; ++level) {
+      const float ratio = std::pow(options.reduction, static_cast<float>(level));
+      simplifier.Run(static_cast<std::size_t>(static_cast<float>(count / 3) * ratio));
+      std::vector<uint16_t> simplified = simplifier.Result();
+      OptimizeVertexCache(simplified.data(), simplified.size(), vertices.size());
+      level_indices[level].insert(level_indices[level].end(), simplified.begin(), simplified.end());
+      levels[level].index_counts.push_back(static_cast<uint32_t>(simplified.size()));
+      levels[level].triangles += simplified.size() / 3;
+      levels[level].error = std::max(levels[level].error, simplifier.Error());
+    }
+  }
+  for (std::size_t level = 1; level < level_count; ++level) {
+    if (static_cast<float>(levels[level].triangles) >
+        static_cast<float>(lods.levels.back().triangles) * kMinLevelReduction) {
+      break;  // 誤差の上限でほとんど減らせなかった (以降の段も同じ)
+    }
+    levels[level].index_offset = static_cast<uint32_t>(lods.indices.size());
+    lods.indices.insert(lods.indices.end(), level_indices[level].begin(), level_indices[level].end());
+    lods.levels.push_back(std::move(levels[level]));
+  }
+  return lods;
+}
+
+uint32_t SelectLodLevel(const MeshLods& lods, const Matrix4& world_view, const Matrix4& proj, float viewport_height,
+                        float max_pixel_error) {
+  if (lods.levels.size() <= 1) {
+    return 0;
+  }
+  // world_view の拡大率 (各軸の長さの最大)
+  float scale = 0.0f;
+  for (int r = 0; r < 3; ++r) {
+    scale = std::max(scale, Length(Float3{world_view.m[r][0], world_view.m[r][1], world_view.m[r][2]}));
+  }
+  const float nearest = TransformPoint(lods.center, world_view).z - lods.radius * scale;
+  if (nearest <= 0.0f) {
+    return 0;
+  }
+  // ビュー空間の長さ 1 が画面上で何画素になるか (最も手前の深さで)
+  const float pixels_per_unit = proj.m[1][1] * viewport_height * 0.5f / nearest;
+  uint32_t level = 0;
+  while (level + 1 < lods.levels.size() &&
+         lods.levels[level + 1].error * scale * pixels_per_unit <= max_pixel_error) {
+    ++level;
+  }
+  return level;
+}
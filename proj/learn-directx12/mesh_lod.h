@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_math.h"
+#include "pmd_file.h"
+
+/**
+ * @brief SimplifyIndices の設定
+ */
+struct SimplifyOptions {
+  float max_error = 0.01f;       // 許容する誤差 (頂点の座標と同じ単位の距離)
+  float max_skin_delta = 0.25f;  // まとめてよい 2 頂点のボーンの影響度の差 (0: 同じものだけ, 1: 制限しない)
+  bool lock_borders = true;      // 開いた縁 (マテリアルの境界を含む) の頂点を動かさない (隣のマテリアルとの隙間を防ぐ)
+};
+
+/**
+ * @brief 二次誤差 (QEM) で三角形を減らしたインデックス列を作る
+ * @details 辺を縮約して頂点を隣の頂点に寄せる (新しい頂点は作らないので, 頂点バッファとスキニングはそのまま使える).
+ *          - UV の継ぎ目 (位置が同じで UV などが違う頂点の組) は継ぎ目に沿ってだけ, 組の両方を同じ向きに寄せる
+ *          - ボーンの影響度が max_skin_delta より違う頂点には寄せない (関節の形が崩れないように)
+ *          - 三角形が裏返る縮約はしない
+ *          target_index_count に届くか, 次の縮約の誤差が max_error を超えたら止める.
+ * @param result_error 縮約で生じた誤差の最大 (options.max_error と同じ単位). 不要なら nullptr
+ */
+std::vector<uint16_t> SimplifyIndices(PmdSpan<PmdVertex> vertices, const uint16_t* indices, std::size_t index_count,
+                                      std::size_t target_index_count, const SimplifyOptions& options = {},
+                                      float* result_error = nullptr);
+
+/**
+ * @brief GenerateMeshLods の設定
+ */
+struct LodOptions {
+  std::size_t max_levels = 4;    // 元のメッシュ (LOD 0) を含む段数の上限
+  float reduction = 0.5f;        // 1 段ごとの三角形数の比
+  float max_error = 0.02f;       // 許容する誤差 (モデルの境界ボックスの最大辺に対する比)
+  float max_skin_delta = 0.25f;  // SimplifyOptions::max_skin_delta
+  bool lock_borders = true;      // SimplifyOptions::lock_borders
+};
+
+/**
+ * @brief LOD の 1 段
+ */
+struct MeshLodLevel {
+  uint32_t index_offset = 0;  // MeshLods::indices の中の先頭. マテリアルの範囲はここから順に並ぶ
+  std::vector<uint32_t> index_counts;  // マテリアルごとのインデックス数
+  float error = 0.0f;                  // 元のメッシュからの誤差 (モデル空間の距離)
+  std::size_t triangles = 0;
+};
+
+/**
+ * @brief マテリアルの範囲ごとに三角形を減らした LOD のインデックス列
+ */
+struct MeshLods {
+  std::vector<uint16_t> indices;     // 全ての段のインデックス (1 つのインデックスバッファに置く). 先頭は元のインデックス
+  std::vector<MeshLodLevel> levels;  // levels[0] が元のメッシュ. 細かい順
+  Float3 center = {0.0f, 0.0f, 0.0f};  // モデル空間の境界球 (SelectLodLevel で使う)
+  float radius = 0.0f;
+};
+
+/**
+ * @brief マテリアルの範囲ごとに LOD を作る
+ * @details 元の三角形数の reduction^i を目標に縮約を続け, 目標ごとの結果を段 i にする. 二次誤差は元の面から足し込むので,
+ *          段の誤差は元のメッシュに対するもの. 誤差の上限で前の段からほとんど減らなくなったらそこで打ち切る.
+ *          各段のマテリアルの範囲は頂点キャッシュ向けに並べ替える.
+ * @param index_counts マテリアルごとのインデックス数 (合計は indices の数以下)
+ */
+MeshLods GenerateMeshLods(PmdSpan<PmdVertex> vertices, PmdSpan<uint16_t> indices,
+                          const std::vector<uint32_t>& index_counts, const LodOptions& options = {});
+
+/**
+ * @brief 画面上の誤差が max_pixel_error 画素以下になる最も粗い段を選ぶ
+ * @details 境界球の最も手前の深さで, 段の誤差を射影行列 (SceneMatrices::proj) で画素に換算する.
+ *          カメラが境界球の中にあれば 0 を返す.
+ * @param world_view モデル空間からビュー空間への行列 (行ベクトルの規約)
+ * @param viewport_height 描画先の高さ (画素)
+ */
+uint32_t SelectLodLevel(const MeshLods& lods, const Matrix4& world_view, const Matrix4& proj, float viewport_height,
+                        float max_pixel_error = 1.0f);
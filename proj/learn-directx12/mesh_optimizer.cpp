@@ -0,0 +1,339 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+#include "cpu_math.h"
+
+namespace {
+
+/**
+ * @brief FIFO キャッシュのシミュレーター
+ * @details 頂点ごとに「何回目のミスで入ったか」を覚えておき, それ以降のミスが cache_size 回未満ならヒットとみなす.
+ */
+class FifoCache {
+ public:
+  FifoCache(std::size_t vertex_count, std::size_t cache_size) : stamps_(vertex_count, 0), cache_size_(cache_size) {}
+
+  /**
+   * @return ミスしたら true
+   */
+  bool Access(uint16_t vertex) {
+    std::size_t& stamp = stamps_[vertex];
+    if (stamp != 0 && misses_ - (stamp - 1) <= cache_size_) {
+      return false;
+    }
+    stamp = ++misses_;
+    return true;
+  }
+
+  std::size_t Misses() const { return misses_; }
+
+ private:
+  std::vector<std::size_t> stamps_;  // 入ったときのミス数 + 1 (0: 入ったことがない)
+  std::size_t cache_size_;
+  std::size_t misses_ = 0;
+};
+
+bool IndicesInRange(const uint16_t* indices, std::size_t index_count, std::size_t vertex_count) {
+  return std::all_of(indices, indices + index_count, [vertex_count](uint16_t i) { return i < vertex_count; });
+}
+
+//////////////////////////
+// Forsyth vertex cache //
+//////////////////////////
+
+// Forsyth の論文にあるパラメータ
+constexpr std::size_t kForsythCacheSize = 32;
+constexpr uint32_t kForsythMaxValence = 32;
+
+/**
+ * @brief 頂点のスコア (キャッシュ内の位置と残りの三角形数から決まる) を表にしたもの
+ */
+class ForsythScoreTable {
+ public:
+  ForsythScoreTable() {
+    for (std::size_t i = 0; i < kForsythCacheSize; ++i) {
+      // 直前の三角形の 3 頂点は同じ値にする (どの辺を共有する三角形を選んでも差が出ないように)
+      cache_[i] = i < 3 ? 0.75f : std::pow(1.0f - (i - 3) / static_cast<float>(kForsythCacheSize - 3), 1.5f);
+    }
+    for (uint32_t i = 1; i <= kForsythMaxValence; ++i) {
+      // 残りが少ない頂点を優先して片付ける
+      valence_[i] = 2.0f / std::sqrt(static_cast<float>(i));
+    }
+  }
+
+  /**
+   * @param cache_position キャッシュ内の位置 (-1: キャッシュに無い)
+   * @param remaining まだ出力していない三角形の数
+   */
+  float Score(int cache_position, uint32_t remaining) const {
+    if (remaining == 0) {
+      return -1.0f;
+    }
+    const float cache = cache_position < 0 ? 0.0f : cache_[cache_position];
+    return cache + valence_[std::min(remaining, kForsythMaxValence)];
+  }
+
+ private:
+  float cache_[kForsythCacheSize] = {};
+  float valence_[kForsythMaxValence + 1] = {};
+};
+
+}  // namespace
+
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, std::size_t index_count, std::size_t vertex_count,
+                                    std::size_t cache_size) {
+  VertexCacheStats stats;
+  stats.triangles = index_count / 3;
+  FifoCache cache(vertex_count, cache_size);
+  for (std::size_t i = 0; i < stats.triangles * 3; ++i) {
+    if (indices[i] < vertex_count) {
+      cache.Access(indices[i]);
+    }
+  }
+  stats.transformed = cache.Misses();
+  stats.acmr = stats.triangles == 0 ? 0.0f : static_cast<float>(stats.transformed) / stats.triangles;
+  stats.atvr = vertex_count == 0 ? 0.0f : static_cast<float>(stats.transformed) / vertex_count;
+  return stats;
+}
+
+void OptimizeVertexCache(uint16_t* indices, std::size_t index_count, std::size_t vertex_count) {
+  assert(IndicesInRange(indices, index_count, vertex_count));
+  const std::size_t triangle_count = index_count / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+  static const ForsythScoreTable table;
+
+  // 頂点 -> 三角形の隣接リスト. remaining[v] 個目までがまだ出力していない三角形
+  std::vector<uint32_t> remaining(vertex_count, 0);
+  for (std::size_t i = 0; i < triangle_count * 3; ++i) {
+    ++remaining[indices[i]];
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::partial_sum(remaining.begin(), remaining.end(), offsets.begin() + 1);
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  {
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < triangle_count * 3; ++i) {
+      adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cache_positions(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (std::size_t v = 0; v < vertex_count; ++v) {
+    vertex_scores[v] = table.Score(-1, remaining[v]);
+  }
+  std::vector<float> triangle_scores(triangle_count);
+  std::vector<bool> emitted(triangle_count, false);
+  auto triangle_score = [&](std::size_t t) {
+    return vertex_scores[indices[t * 3]] + vertex_scores[indices[t * 3 + 1]] + vertex_scores[indices[t * 3 + 2]];
+  };
+  for (std::size_t t = 0; t < triangle_count; ++t) {
+    triangle_scores[t] = triangle_score(t);
+  }
+
+  constexpr std::size_t kNone = ~std::size_t(0);
+  std::size_t best = std::max_element(triangle_scores.begin(), triangle_scores.end()) - triangle_scores.begin();
+  std::size_t scan = 0;  // 候補が無いときに未出力の三角形を探す位置
+  std::vector<uint16_t> output;
+  output.reserve(triangle_count * 3);
+  std::vector<uint16_t> cache;
+  std::vector<uint16_t> next_cache;
+  cache.reserve(kForsythCacheSize + 3);
+  next_cache.reserve(kForsythCacheSize + 3);
+
+  for (std::size_t n = 0; n < triangle_count; ++n) {
+    if (best == kNone) {
+      while (emitted[scan]) {
+        ++scan;
+      }
+      best = scan;
+    }
+    const uint16_t* triangle = indices + best * 3;
+    output.insert(output.end(), triangle, triangle + 3);
+    emitted[best] = true;
+
+    // 隣接リストから外し, 出力した頂点をキャッシュの先頭に入れる
+    next_cache.clear();
+    for (int k = 0; k < 3; ++k) {
+      const uint16_t v = triangle[k];
+      uint32_t* list = adjacency.data() + offsets[v];
+      auto it = std::find(list, list + remaining[v], static_cast<uint32_t>(best));
+      assert(it != list + remaining[v]);
+      std::swap(*it, list[--remaining[v]]);
+      if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+    for (auto v : cache) {
+      if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end()) {
+        next_cache.push_back(v);
+      }
+    }
+
+    // 押し出された頂点も含めてスコアを更新し, 次の三角形はキャッシュ内の頂点を使うものから選ぶ
+    for (std::size_t i = 0; i < next_cache.size(); ++i) {
+      const uint16_t v = next_cache[i];
+      cache_positions[v] = i < kForsythCacheSize ? static_cast<int>(i) : -1;
+      vertex_scores[v] = table.Score(cache_positions[v], remaining[v]);
+    }
+    best = kNone;
+    float best_score = -1.0f;
+    for (auto v : next_cache) {
+      for (uint32_t i = 0; i < remaining[v]; ++i) {
+        const uint32_t t = adjacency[offsets[v] + i];
+        triangle_scores[t] = triangle_score(t);
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    }
+    next_cache.resize(std::min(next_cache.size(), kForsythCacheSize));
+    std::swap(cache, next_cache);
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeOverdraw(uint16_t* indices, std::size_t index_count, PmdSpan<PmdVertex> vertices, float threshold) {
+  assert(IndicesInRange(indices, index_count, vertices.size()));
+  const std::size_t triangle_count = index_count / 3;
+  if (triangle_count < 2) {
+    return;
+  }
+
+  // 三角形ごとのキャッシュミス数. 3 つともミスした三角形からはどこから描き始めても効率は変わらない
+  std::vector<uint8_t> misses(triangle_count);
+  {
+    FifoCache cache(vertices.size(), kVertexCacheSimulationSize);
+    for (std::size_t t = 0; t < triangle_count; ++t) {
+      for (int k = 0; k < 3; ++k) {
+        misses[t] += cache.Access(indices[t * 3 + k]) ? 1 : 0;
+      }
+    }
+  }
+  const std::size_t total_misses = std::accumulate(misses.begin(), misses.end(), std::size_t(0));
+  const float target_acmr = static_cast<float>(total_misses) / triangle_count * threshold;
+
+  // クラスタの境界: 3 つともミスした位置 (ハード) と, クラスタの ACMR が目標以下になった位置 (ソフト)
+  std::vector<std::size_t> cluster_begins;
+  std::size_t cluster_misses = 0;
+  std::size_t cluster_triangles = 0;
+  for (std::size_t t = 0; t < triangle_count; ++t) {
+    const bool hard = misses[t] == 3;
+    const bool soft = cluster_triangles > 0 && static_cast<float>(cluster_misses) <= target_acmr * cluster_triangles;
+    if (t == 0 || hard || soft) {
+      cluster_begins.push_back(t);
+      cluster_misses = 0;
+      cluster_triangles = 0;
+    }
+    cluster_misses += misses[t];
+    ++cluster_triangles;
+  }
+  cluster_begins.push_back(triangle_count);
+  const std::size_t cluster_count = cluster_begins.size() - 1;
+  if (cluster_count < 2) {
+    return;
+  }
+
+  // クラスタの重心と法線 (面積で重み付け)
+  auto position = [&](uint16_t i) {
+    const PmdFloat3& p = vertices[i].pos;
+    return Float3{p.x, p.y, p.z};
+  };
+  std::vector<Float3> centroids(cluster_count);
+  std::vector<Float3> normals(cluster_count);
+  Float3 mesh_centroid;
+  float mesh_area = 0.0f;
+  for (std::size_t c = 0; c < cluster_count; ++c) {
+    Float3 centroid;
+    Float3 normal;
+    float area = 0.0f;
+    for (std::size_t t = cluster_begins[c]; t < cluster_begins[c + 1]; ++t) {
+      const Float3 a = position(indices[t * 3]);
+      const Float3 b = position(indices[t * 3 + 1]);
+      const Float3 d = position(indices[t * 3 + 2]);
+      // 時計回りが表なので (b - a) x (d - a) が外向き (長さは面積の 2 倍)
+      const Float3 n = Cross(b - a, d - a);
+      const float w = Length(n);
+      centroid = centroid + (a + b + d) * (w / 3.0f);
+      normal = normal + n;
+      area += w;
+    }
+    mesh_centroid = mesh_centroid + centroid;
+    mesh_area += area;
+    centroids[c] = area > 0.0f ? centroid * (1.0f / area) : position(indices[cluster_begins[c] * 3]);
+    normals[c] = Normalize(normal);
+  }
+  if (mesh_area > 0.0f) {
+    mesh_centroid = mesh_centroid * (1.0f / mesh_area);
+  }
+
+  // 外側を向いているクラスタほど先に描く (奥のクラスタが後から深度テストで弾かれる)
+  std::vector<float> keys(cluster_count);
+  for (std::size_t c = 0; c < cluster_count; ++c) {
+    keys[c] = Dot(centroids[c] - mesh_centroid, normals[c]);
+  }
+  std::vector<std::size_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), std::size_t(0));
+  std::stable_sort(order.begin(), order.end(), [&keys](std::size_t a, std::size_t b) { return keys[a] > keys[b]; });
+
+  std::vector<uint16_t> output;
+  output.reserve(triangle_count * 3);
+  for (auto c : order) {
+    output.insert(output.end(), indices + cluster_begins[c] * 3, indices + cluster_begins[c + 1] * 3);
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<uint32_t> OptimizeVertexFetch(uint16_t* indices, std::size_t index_count, std::size_t vertex_count) {
+  assert(IndicesInRange(indices, index_count, vertex_count));
+  constexpr uint32_t kUnassigned = 0xffffffff;
+  std::vector<uint32_t> old_to_new(vertex_count, kUnassigned);
+  std::vector<uint32_t> new_to_old;
+  new_to_old.reserve(vertex_count);
+  for (std::size_t i = 0; i < index_count; ++i) {
+    uint32_t& n = old_to_new[indices[i]];
+    if (n == kUnassigned) {
+      n = static_cast<uint32_t>(new_to_old.size());
+      new_to_old.push_back(indices[i]);
+    }
+    indices[i] = static_cast<uint16_t>(n);
+  }
+  for (std::size_t v = 0; v < vertex_count; ++v) {
+    if (old_to_new[v] == kUnassigned) {
+      new_to_old.push_back(static_cast<uint32_t>(v));
+    }
+  }
+  return new_to_old;
+}
+
+OptimizedMesh OptimizeMesh(PmdSpan<PmdVertex> vertices, PmdSpan<uint16_t> indices,
+                           const std::vector<uint32_t>& index_counts) {
+  OptimizedMesh mesh;
+  mesh.indices.assign(indices.begin(), indices.end());
+  if (IndicesInRange(mesh.indices.data(), mesh.indices.size(), vertices.size())) {
+    std::size_t offset = 0;
+    for (auto count : index_counts) {
+      count = static_cast<uint32_t>(std::min<std::size_t>(count, mesh.indices.size() - offset));
+      OptimizeVertexCache(mesh.indices.data() + offset, count, vertices.size());
+      OptimizeOverdraw(mesh.indices.data() + offset, count, vertices);
+      offset += count;
+    }
+    mesh.new_to_old = OptimizeVertexFetch(mesh.indices.data(), mesh.indices.size(), vertices.size());
+  } else {
+    // 壊れたインデックスを含むモデルは並べ替えない
+    mesh.new_to_old.resize(vertices.size());
+    std::iota(mesh.new_to_old.begin(), mesh.new_to_old.end(), 0u);
+  }
+  mesh.vertices.resize(vertices.size());
+  for (std::size_t i = 0; i < vertices.size(); ++i) {
+    mesh.vertices[i] = vertices[mesh.new_to_old[i]];
+  }
+  return mesh;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pmd_file.h"
+
+/**
+ * @brief 頂点キャッシュの効率 (FIFO キャッシュで見積もる)
+ */
+struct VertexCacheStats {
+  std::size_t triangles = 0;    // 三角形の数
+  std::size_t transformed = 0;  // 頂点シェーダーが実行される回数 (キャッシュミスの数)
+  float acmr = 0.0f;            // average cache miss ratio: 三角形あたりのミス数 (0.5 - 3.0, 小さいほど良い)
+  float atvr = 0.0f;            // average transformed vertex ratio: 頂点あたりのミス数 (1.0 が理想)
+};
+
+// 統計に使う FIFO キャッシュの大きさ (実際の GPU に近い値)
+constexpr std::size_t kVertexCacheSimulationSize = 16;
+
+/**
+ * @brief インデックス列を FIFO の頂点キャッシュで描画したときの統計を求める
+ * @param vertex_count 頂点数 (ATVR の分母)
+ */
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, std::size_t index_count, std::size_t vertex_count,
+                                    std::size_t cache_size = kVertexCacheSimulationSize);
+
+/**
+ * @brief 頂点キャッシュが効くよう三角形の順序を並べ替える (Tom Forsyth の線形時間アルゴリズム)
+ * @details 三角形の頂点の順序 (表裏) は変えない.
+ */
+void OptimizeVertexCache(uint16_t* indices, std::size_t index_count, std::size_t vertex_count);
+
+/**
+ * @brief 外側を向いた面から描くよう三角形のまとまりを並べ替え, オーバードローを減らす
+ * @details 頂点キャッシュ最適化の後に使う. キャッシュが途切れる位置で三角形をクラスタに分け,
+ *          クラスタの向き (モデル中心から見て外向きか) で並べる. クラスタ内の順序は保つので
+ *          ACMR の悪化は threshold 倍程度に収まる. 表面は時計回り (D3D の既定) を前提にする.
+ * @param threshold 許容する ACMR の悪化の割合 (1.05 なら 5 %)
+ */
+void OptimizeOverdraw(uint16_t* indices, std::size_t index_count, PmdSpan<PmdVertex> vertices,
+                      float threshold = 1.05f);
+
+/**
+ * @brief インデックス列で最初に使われる順に頂点を並べ替える (頂点フェッチの局所性のため)
+ * @details indices は新しい頂点番号に書き換える. 使われていない頂点は元の順序のまま末尾に置く.
+ * @return 新しい順序での元の頂点番号 (new_to_old[新しい番号] = 元の番号)
+ */
+std::vector<uint32_t> OptimizeVertexFetch(uint16_t* indices, std::size_t index_count, std::size_t vertex_count);
+
+/**
+ * @brief 最適化したメッシュ
+ */
+struct OptimizedMesh {
+  std::vector<PmdVertex> vertices;
+  std::vector<uint16_t> indices;
+  std::vector<uint32_t> new_to_old;  // OptimizeVertexFetch の戻り値
+};
+
+/**
+ * @brief マテリアルの範囲ごとに頂点キャッシュとオーバードローを最適化し, 最後に頂点を並べ替える
+ * @details 三角形はマテリアルの範囲をまたいで移動しないので, マテリアルのインデックス範囲はそのまま使える.
+ * @param index_counts マテリアルごとのインデックス数 (合計は indices の数以下)
+ */
+OptimizedMesh OptimizeMesh(PmdSpan<PmdVertex> vertices, PmdSpan<uint16_t> indices,
+                           const std::vector<uint32_t>& index_counts);
@@ -0,0 +1,238 @@
+#include "mip_generator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// これより小さいミップはスレッドに分けても得にならない
+constexpr std::size_t kParallelMinPixels = 64 * 64;
+constexpr std::size_t kRowsPerTask = 8;
+
+/**
+ * @brief sRGB <-> 線形の変換テーブル
+ */
+struct SrgbTables {
+  float to_unorm[256];   // 格納値をそのまま 0.0 - 1.0 にしたもの
+  float to_linear[256];
+  uint8_t from_linear[65536];  // 線形値 * 65535 を丸めたものから引く
+
+  SrgbTables() {
+    for (int i = 0; i < 256; ++i) {
+      const float s = i / 255.0f;
+      to_unorm[i] = s;
+      to_linear[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 65536; ++i) {
+      const float l = i / 65535.0f;
+      const float s = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+      from_linear[i] = static_cast<uint8_t>(std::clamp(s, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+  }
+
+  uint8_t Encode(float linear) const {
+    return from_linear[static_cast<int>(std::clamp(linear, 0.0f, 1.0f) * 65535.0f + 0.5f)];
+  }
+};
+
+const SrgbTables& GetSrgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+////////////////
+// box filter //
+////////////////
+
+/**
+ * @brief 縦横とも偶数 (または 1) の画像の dst 行 [y_begin, y_end) を 2x2 の平均で作る
+ */
+void DownsampleRowsEven(const Image& src, Image* dst, uint32_t y_begin, uint32_t y_end,
+                        const MipGenerationOptions& options) {
+  const SrgbTables* srgb = options.gamma_correct ? &GetSrgbTables() : nullptr;
+  for (uint32_t y = y_begin; y < y_end; ++y) {
+    const uint8_t* r0 = src.Row(std::min(y * 2, src.height - 1));
+    const uint8_t* r1 = src.Row(std::min(y * 2 + 1, src.height - 1));
+    uint8_t* out = dst->Row(y);
+    uint32_t x = 0;
+#ifdef MIP_GENERATOR_USE_SSE
+    if (options.use_simd && srgb == nullptr && src.width % 2 == 0) {
+      // 元の 8 画素 (32 bytes) x 2 行 -> 4 画素. 16 bit に広げて足し, (sum + 2) >> 2 で丸める
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i two = _mm_set1_epi16(2);
+      auto average_pairs = [&](__m128i a, __m128i b) {
+        const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        const __m128i sum_lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        const __m128i sum_hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(sum_lo, sum_hi), two), 2);
+      };
+      for (; x + 4 <= dst->width; x += 4) {
+        const uint8_t* p0 = r0 + std::size_t(x) * 8;
+        const uint8_t* p1 = r1 + std::size_t(x) * 8;
+        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p0));
+        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p0 + 16));
+        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1));
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p1 + 16));
+        const __m128i result = _mm_packus_epi16(average_pairs(a0, b0), average_pairs(a1, b1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + std::size_t(x) * 4), result);
+      }
+    }
+#endif
+    for (; x < dst->width; ++x) {
+      const uint8_t* t00 = r0 + std::size_t(std::min(x * 2, src.width - 1)) * 4;
+      const uint8_t* t10 = r0 + std::size_t(std::min(x * 2 + 1, src.width - 1)) * 4;
+      const uint8_t* t01 = r1 + std::size_t(std::min(x * 2, src.width - 1)) * 4;
+      const uint8_t* t11 = r1 + std::size_t(std::min(x * 2 + 1, src.width - 1)) * 4;
+      uint8_t* p = out + std::size_t(x) * 4;
+      const int color_channels = srgb != nullptr ? 3 : 4;
+      for (int c = 0; c < color_channels; ++c) {
+        if (srgb != nullptr) {
+          const float* l = srgb->to_linear;
+          p[c] = srgb->Encode((l[t00[c]] + l[t10[c]] + l[t01[c]] + l[t11[c]]) * 0.25f);
+        } else {
+          p[c] = static_cast<uint8_t>((t00[c] + t10[c] + t01[c] + t11[c] + 2) >> 2);
+        }
+      }
+      if (srgb != nullptr) {
+        p[3] = static_cast<uint8_t>((t00[3] + t10[3] + t01[3] + t11[3] + 2) >> 2);
+      }
+    }
+  }
+}
+
+/////////////////////
+// weighted filter //
+/////////////////////
+
+struct Tap {
+  uint32_t index;
+  float weight;
+};
+
+/**
+ * @brief 縮小後の画素 i が覆う元の画素と, その画素が占める割合 (合計 1)
+ */
+std::vector<std::vector<Tap>> ComputeTaps(uint32_t size, uint32_t dst_size) {
+  std::vector<std::vector<Tap>> taps(dst_size);
+  const double scale = static_cast<double>(size) / dst_size;
+  for (uint32_t i = 0; i < dst_size; ++i) {
+    const double begin = i * scale;
+    const double end = (i + 1) * scale;
+    for (uint32_t j = static_cast<uint32_t>(begin); j < size && j < end; ++j) {
+      const double w = std::min(end, j + 1.0) - std::max(begin, static_cast<double>(j));
+      if (w > 0.0) {
+        taps[i].push_back({j, static_cast<float>(w / scale)});
+      }
+    }
+  }
+  return taps;
+}
+
+/**
+ * @brief 辺が奇数の画像の dst 行 [y_begin, y_end) を面積で重み付けした平均で作る
+ */
+void DownsampleRowsWeighted(const Image& src, Image* dst, uint32_t y_begin, uint32_t y_end,
+                            const std::vector<std::vector<Tap>>& taps_x, const std::vector<std::vector<Tap>>& taps_y,
+                            const MipGenerationOptions& options) {
+  const SrgbTables& tables = GetSrgbTables();
+  const float* color_table = options.gamma_correct ? tables.to_linear : tables.to_unorm;
+  for (uint32_t y = y_begin; y < y_end; ++y) {
+    uint8_t* out = dst->Row(y);
+    for (uint32_t x = 0; x < dst->width; ++x) {
+      float sum[4] = {};
+      for (const Tap& ty : taps_y[y]) {
+        const uint8_t* row = src.Row(ty.index);
+        for (const Tap& tx : taps_x[x]) {
+          const uint8_t* t = row + std::size_t(tx.index) * 4;
+          const float w = ty.weight * tx.weight;
+          sum[0] += color_table[t[0]] * w;
+          sum[1] += color_table[t[1]] * w;
+          sum[2] += color_table[t[2]] * w;
+          sum[3] += tables.to_unorm[t[3]] * w;
+        }
+      }
+      uint8_t* p = out + std::size_t(x) * 4;
+      for (int c = 0; c < 4; ++c) {
+        p[c] = (options.gamma_correct && c < 3)
+                   ? tables.Encode(sum[c])
+                   : static_cast<uint8_t>(std::clamp(sum[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+uint32_t CountMipLevels(uint32_t width, uint32_t height) {
+  uint32_t size = std::max(width, height);
+  uint32_t levels = 1;
+  while (size > 1) {
+    size /= 2;
+    ++levels;
+  }
+  return levels;
+}
+
+Image DownsampleImage(const Image& src, const MipGenerationOptions& options, ThreadPool* pool) {
+  Image dst;
+  if (BytesPerPixel(src.format) != 4 || src.width == 0 || src.height == 0 ||
+      src.pixels.size() < src.row_pitch * src.height) {
+    return dst;
+  }
+  dst.format = src.format;
+  dst.width = std::max<uint32_t>(src.width / 2, 1);
+  dst.height = std::max<uint32_t>(src.height / 2, 1);
+  dst.row_pitch = std::size_t(dst.width) * 4;
+  dst.pixels.resize(dst.row_pitch * dst.height);
+
+  const bool even = (src.width % 2 == 0 || src.width == 1) && (src.height % 2 == 0 || src.height == 1);
+  std::vector<std::vector<Tap>> taps_x;
+  std::vector<std::vector<Tap>> taps_y;
+  if (!even) {
+    taps_x = ComputeTaps(src.width, dst.width);
+    taps_y = ComputeTaps(src.height, dst.height);
+  }
+  auto rows = [&](std::size_t begin, std::size_t end) {
+    if (even) {
+      DownsampleRowsEven(src, &dst, static_cast<uint32_t>(begin), static_cast<uint32_t>(end), options);
+    } else {
+      DownsampleRowsWeighted(src, &dst, static_cast<uint32_t>(begin), static_cast<uint32_t>(end), taps_x, taps_y,
+                             options);
+    }
+  };
+  if (pool != nullptr && std::size_t(dst.width) * dst.height >= kParallelMinPixels) {
+    pool->ParallelFor(0, dst.height, kRowsPerTask, rows);
+  } else {
+    rows(0, dst.height);
+  }
+  return dst;
+}
+
+std::vector<Image> GenerateMipChain(const Image& base, const MipGenerationOptions& options, ThreadPool* pool) {
+  std::vector<Image> levels;
+  if (BytesPerPixel(base.format) != 4 || base.width == 0 || base.height == 0) {
+    return levels;
+  }
+  uint32_t count = CountMipLevels(base.width, base.height);
+  if (options.max_levels != 0) {
+    count = std::min(count, options.max_levels);
+  }
+  levels.reserve(count);
+  levels.push_back(base);
+  for (uint32_t i = 1; i < count; ++i) {
+    Image next = DownsampleImage(levels.back(), options, pool);
+    if (next.pixels.empty()) {
+      break;
+    }
+    levels.push_back(std::move(next));
+  }
+  return levels;
+}
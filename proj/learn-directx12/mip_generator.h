@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+class ThreadPool;
+
+struct MipGenerationOptions {
+  // true なら sRGB としてデコードした線形空間で平均し, sRGB に戻す (アルファは常に線形)
+  // DXGI_FORMAT_*_UNORM_SRGB として読むテクスチャ向け. UNORM のまま読むテクスチャは false で格納値をそのまま平均する
+  bool gamma_correct = false;
+  // 作るミップの最大数 (level 0 を含む). 0 なら 1x1 まで全て
+  uint32_t max_levels = 0;
+  // false ならスカラー実装だけを使う (SIMD 実装の検証用)
+  bool use_simd = true;
+};
+
+/**
+ * @brief width x height のテクスチャの 1x1 までのミップ数 (D3D12_RESOURCE_DESC::MipLevels に 0 を指定した場合と同じ)
+ */
+uint32_t CountMipLevels(uint32_t width, uint32_t height);
+
+/**
+ * @brief 1 段小さいミップを作る (幅・高さはそれぞれ max(1, size / 2))
+ * @details 縦横とも偶数 (または 1) なら 2x2 の単純平均. 奇数の辺は元の画素が覆う面積で重み付けした平均にする.
+ *          RGBA8 / BGRA8 のどちらもチャンネルの並びに依存しない (アルファは 4 バイト目).
+ * @param pool nullptr でなければ行ごとに並列に処理する
+ */
+Image DownsampleImage(const Image& src, const MipGenerationOptions& options = {}, ThreadPool* pool = nullptr);
+
+/**
+ * @brief base を level 0 とするミップチェーンを作る
+ * @details 各段は 1 つ前の段から作る. 段の中は行ごとに並列に処理する.
+ * @return base の対応していないフォーマットなら空
+ */
+std::vector<Image> GenerateMipChain(const Image& base, const MipGenerationOptions& options = {},
+                                    ThreadPool* pool = nullptr);
@@ -0,0 +1,174 @@
+#include "mip_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+MipStreamer::MipStreamer(const Options& options) : options_(options) { stats_.budget_bytes = options.budget_bytes; }
+
+uint32_t MipStreamer::Register(uint64_t texture, uint32_t width, uint32_t height, uint32_t level_count,
+                               std::size_t bytes_per_pixel) {
+  Unregister(texture);
+  Entry entry;
+  level_count = std::max<uint32_t>(level_count, 1);
+  for (uint32_t i = 0; i < level_count; ++i) {
+    const uint32_t w = std::max<uint32_t>(width >> std::min(i, 31u), 1);
+    const uint32_t h = std::max<uint32_t>(height >> std::min(i, 31u), 1);
+    entry.level_bytes.push_back(std::size_t(w) * h * bytes_per_pixel);
+    if (std::max(w, h) > options_.resident_tail_size) {
+      entry.tail_level = std::min(i + 1, level_count - 1);
+    }
+  }
+  entry.first_level = entry.tail_level;
+  entry.wanted_level = entry.tail_level;
+  entry.reported_level = entry.tail_level;
+
+  for (std::size_t bytes : entry.level_bytes) {
+    stats_.full_bytes += bytes;
+  }
+  stats_.resident_bytes += ResidentBytes(entry);
+  stats_.peak_resident_bytes = std::max(stats_.peak_resident_bytes, stats_.resident_bytes);
+  ++stats_.textures;
+  const uint32_t first_level = entry.first_level;
+  entries_.emplace(texture, std::move(entry));
+  return first_level;
+}
+
+void MipStreamer::Unregister(uint64_t texture) {
+  auto it = entries_.find(texture);
+  if (it == entries_.end()) {
+    return;
+  }
+  for (std::size_t bytes : it->second.level_bytes) {
+    stats_.full_bytes -= bytes;
+  }
+  stats_.resident_bytes -= ResidentBytes(it->second);
+  --stats_.textures;
+  entries_.erase(it);
+}
+
+void MipStreamer::Request(uint64_t texture, float lod) {
+  auto it = entries_.find(texture);
+  if (it == entries_.end() || std::isnan(lod)) {
+    return;
+  }
+  Entry& entry = it->second;
+  const uint32_t level =
+      static_cast<uint32_t>(std::clamp(std::floor(lod), 0.0f, static_cast<float>(entry.tail_level)));
+  // 同じフレームで複数回要求されたら最も細かいものに合わせる
+  entry.wanted_level = entry.last_request == update_index_ ? std::min(entry.wanted_level, level) : level;
+  entry.last_request = update_index_;
+}
+
+std::vector<MipStreamer::Change> MipStreamer::Update() {
+  ++stats_.updates;
+  if (stats_.resident_bytes > options_.budget_bytes) {
+    MakeRoom(0, nullptr);  // SetBudget で予算が減った
+  }
+
+  // このフレームで要求され, まだ届いていないもの. 足りない段数が多いものから 1 段ずつ順番に読み込む
+  std::vector<std::pair<uint64_t, Entry*>> waiting;
+  for (auto& [texture, entry] : entries_) {
+    if (entry.last_request == update_index_ && entry.first_level > entry.wanted_level) {
+      waiting.emplace_back(texture, &entry);
+    }
+  }
+  std::sort(waiting.begin(), waiting.end(), [](const auto& a, const auto& b) {
+    const uint32_t gap_a = a.second->first_level - a.second->wanted_level;
+    const uint32_t gap_b = b.second->first_level - b.second->wanted_level;
+    return gap_a != gap_b ? gap_a > gap_b : a.first < b.first;
+  });
+
+  std::size_t uploaded = 0;
+  std::vector<bool> stalled(waiting.size(), false);
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (std::size_t i = 0; i < waiting.size(); ++i) {
+      Entry& entry = *waiting[i].second;
+      if (stalled[i] || entry.first_level <= entry.wanted_level) {
+        continue;
+      }
+      const std::size_t bytes = entry.level_bytes[entry.first_level - 1];
+      // 転送量の上限を超えるミップも, そのフレームの最初の 1 つなら読み込む (大きいミップが永久に届かなくならないように)
+      if (uploaded != 0 && uploaded + bytes > options_.upload_bytes_per_update) {
+        stalled[i] = true;
+        continue;
+      }
+      if (stats_.resident_bytes + bytes > options_.budget_bytes && !MakeRoom(bytes, &entry)) {
+        ++stats_.budget_stalls;
+        stalled[i] = true;
+        continue;
+      }
+      --entry.first_level;
+      stats_.resident_bytes += bytes;
+      stats_.bytes_streamed_in += bytes;
+      ++stats_.levels_streamed_in;
+      uploaded += bytes;
+      progress = true;
+    }
+  }
+  stats_.peak_resident_bytes = std::max(stats_.peak_resident_bytes, stats_.resident_bytes);
+
+  std::vector<Change> changes;
+  stats_.waiting_textures = 0;
+  for (auto& [texture, entry] : entries_) {
+    if (entry.first_level != entry.reported_level) {
+      changes.push_back({texture, entry.first_level, entry.reported_level});
+      entry.reported_level = entry.first_level;
+    }
+    if (entry.last_request == update_index_ && entry.first_level > entry.wanted_level) {
+      ++stats_.waiting_textures;
+    }
+  }
+  std::sort(changes.begin(), changes.end(), [](const Change& a, const Change& b) { return a.texture < b.texture; });
+  ++update_index_;
+  return changes;
+}
+
+uint32_t MipStreamer::FirstResidentLevel(uint64_t texture) const {
+  auto it = entries_.find(texture);
+  return it == entries_.end() ? 0 : it->second.first_level;
+}
+
+void MipStreamer::SetBudget(std::size_t budget_bytes) {
+  options_.budget_bytes = budget_bytes;
+  stats_.budget_bytes = budget_bytes;
+}
+
+MipStreamer::Stats MipStreamer::GetStats() const { return stats_; }
+
+std::size_t MipStreamer::ResidentBytes(const Entry& entry) const {
+  std::size_t bytes = 0;
+  for (std::size_t i = entry.first_level; i < entry.level_bytes.size(); ++i) {
+    bytes += entry.level_bytes[i];
+  }
+  return bytes;
+}
+
+bool MipStreamer::MakeRoom(std::size_t needed_bytes, const Entry* requester) {
+  // 最も長く要求されていないものから. このフレームで要求されたものは要求より細かい段だけ捨てられる
+  std::vector<std::pair<uint64_t, Entry*>> victims;
+  for (auto& [texture, entry] : entries_) {
+    if (&entry != requester && entry.first_level < entry.tail_level) {
+      victims.emplace_back(texture, &entry);
+    }
+  }
+  std::sort(victims.begin(), victims.end(), [](const auto& a, const auto& b) {
+    return a.second->last_request != b.second->last_request ? a.second->last_request < b.second->last_request
+                                                            : a.first < b.first;
+  });
+  for (auto& [texture, entry] : victims) {
+    const bool in_use = entry->last_request == update_index_;
+    while (stats_.resident_bytes + needed_bytes > options_.budget_bytes && entry->first_level < entry->tail_level &&
+           !(in_use && entry->first_level >= entry->wanted_level)) {
+      stats_.resident_bytes -= entry->level_bytes[entry->first_level];
+      ++entry->first_level;
+      ++stats_.levels_streamed_out;
+    }
+    if (stats_.resident_bytes + needed_bytes <= options_.budget_bytes) {
+      return true;
+    }
+  }
+  return stats_.resident_bytes + needed_bytes <= options_.budget_bytes;
+}
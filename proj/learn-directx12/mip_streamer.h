@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief テクスチャのミップの常駐状態を管理する (GPU には依存しない)
+ * @details
+ *  - 登録直後は小さいミップ (一辺が resident_tail_size 以下) だけが常駐する
+ *  - 描画側は毎フレーム Request() で必要な LOD を伝え, Update() で細かいミップを 1 段ずつ読み込む
+ *  - 1 回の Update() で読み込むのは upload_bytes_per_update まで (1 フレームの転送量を抑える)
+ *  - 常駐サイズが予算を超える場合は, 最も長く要求されていないテクスチャの細かいミップから捨てる
+ *  - 常駐するミップは常に first_level から最後の段まで連続している
+ *  実際の転送 (リソースの作り直し・SRV の MostDetailedMip の変更など) は Update() が返す変更を見て呼び出し側が行う.
+ *  スレッドセーフではない.
+ *
+ *   MipStreamer::Options options;
+ *   options.budget_bytes = std::size_t(128) << 20;
+ *   MipStreamer streamer(options);
+ *   streamer.Register(id, width, height, levels, 4);
+ *   // フレームごと
+ *   streamer.Request(id, lod);
+ *   for (auto& change : streamer.Update()) { ... change.first_level 以降を GPU に置く ... }
+ */
+class MipStreamer {
+ public:
+  struct Options {
+    std::size_t budget_bytes = std::size_t(256) << 20;           // 常駐するミップの合計サイズの上限
+    std::size_t upload_bytes_per_update = std::size_t(16) << 20;  // 1 回の Update() で読み込む量の上限
+    uint32_t resident_tail_size = 64;                             // 一辺がこれ以下のミップは常に常駐する
+  };
+
+  struct Stats {
+    std::size_t textures = 0;
+    std::size_t resident_bytes = 0;       // 常駐しているミップの合計サイズ
+    std::size_t peak_resident_bytes = 0;  // resident_bytes の最大値
+    std::size_t full_bytes = 0;           // 全ミップを常駐させた場合の合計サイズ
+    std::size_t budget_bytes = 0;
+    std::size_t waiting_textures = 0;     // 要求された LOD にまだ届いていないテクスチャの数
+    uint64_t levels_streamed_in = 0;      // 読み込んだミップの延べ数
+    uint64_t levels_streamed_out = 0;     // 予算のために捨てたミップの延べ数
+    uint64_t bytes_streamed_in = 0;
+    uint64_t budget_stalls = 0;           // 予算が空かず読み込めなかった回数
+    uint64_t updates = 0;
+  };
+
+  /**
+   * @brief first_level が変わったテクスチャ
+   */
+  struct Change {
+    uint64_t texture;
+    uint32_t first_level;     // 新しく常駐している最も細かいミップ
+    uint32_t previous_level;  // 変更前の first_level
+  };
+
+  MipStreamer() : MipStreamer(Options{}) {}
+  explicit MipStreamer(const Options& options);
+
+  /**
+   * @brief テクスチャを登録する (既に登録済みなら置き換える)
+   * @return 最初に常駐させるミップ (これ以降のミップを呼び出し側が GPU に置く)
+   */
+  uint32_t Register(uint64_t texture, uint32_t width, uint32_t height, uint32_t level_count,
+                    std::size_t bytes_per_pixel);
+
+  void Unregister(uint64_t texture);
+
+  /**
+   * @brief このフレームで texture をミップ lod (小数は切り捨て) まで使いたいことを伝える
+   */
+  void Request(uint64_t texture, float lod);
+
+  /**
+   * @brief 要求に応じてミップを読み込み・捨て, first_level が変わったテクスチャを返す
+   */
+  std::vector<Change> Update();
+
+  /**
+   * @brief 常駐している最も細かいミップ (未登録なら 0)
+   */
+  uint32_t FirstResidentLevel(uint64_t texture) const;
+
+  void SetBudget(std::size_t budget_bytes);
+
+  Stats GetStats() const;
+
+ private:
+  struct Entry {
+    std::vector<std::size_t> level_bytes;
+    uint32_t tail_level = 0;       // これ以降は常に常駐する
+    uint32_t first_level = 0;      // 常駐している最も細かいミップ
+    uint32_t wanted_level = 0;     // 最後に要求されたミップ
+    uint64_t last_request = 0;     // 最後に要求された Update の番号
+    uint32_t reported_level = 0;   // 最後に Change として返した first_level
+  };
+
+  std::size_t ResidentBytes(const Entry& entry) const;
+  /**
+   * @brief requester 以外から細かいミップを捨てて needed_bytes を空ける (requester は nullptr 可)
+   */
+  bool MakeRoom(std::size_t needed_bytes, const Entry* requester);
+
+  Options options_;
+  std::unordered_map<uint64_t, Entry> entries_;
+  uint64_t update_index_ = 1;  // 次の Update の番号 (Request はこの番号で記録する)
+  Stats stats_;
+};
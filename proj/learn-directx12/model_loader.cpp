@@ -0,0 +1,356 @@
+#include "model_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "material.h"
+#include "profiler.h"
+#include "string_util.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/**
+ * @brief トゥーン番号のファイル名
+ * @details 255 が toon00.bmp, 0 が toon01.bmp, ... (番号 + 1 の下位 8 bit)
+ */
+const char* ToonTextureName(uint8_t toon_index, char (&buffer)[16]) {
+  std::snprintf(buffer, sizeof(buffer), "toon%02u.bmp", static_cast<unsigned>((toon_index + 1) & 0xff));
+  return buffer;
+}
+
+/**
+ * @brief texFilePath を '*' で分割した各ファイル名を f(name, slot) に渡す (slot は .sph / .spa / それ以外)
+ * @details name は material の中を指す (コピーしない). texFilePath は 20 bytes ちょうどで終端文字が無い場合がある.
+ */
+template <typename F>
+void ForEachTextureName(const PmdMaterial& material, F&& f) {
+  const std::string_view text(material.texFilePath, strnlen(material.texFilePath, sizeof(material.texFilePath)));
+  std::size_t begin = 0;
+  while (begin < text.size()) {
+    std::size_t end = std::min(text.find('*', begin), text.size());
+    const std::string_view name = text.substr(begin, end - begin);
+    begin = end + 1;
+    // 拡張子で振り分ける (fs::path::extension() と同じく最後の '.' 以降)
+    const std::size_t dot = name.find_last_of("./\\");
+    const std::string_view ext = (dot != std::string_view::npos && name[dot] == '.') ? name.substr(dot) : std::string_view();
+    if (ext == ".sph") {
+      f(name, kBakedTextureSph);
+    } else if (ext == ".spa") {
+      f(name, kBakedTextureSpa);
+    } else {
+      f(name, kBakedTextureTex);
+    }
+  }
+}
+
+}  // namespace
+
+MaterialTexturePaths ResolveMaterialTexturePaths(const fs::path& model_filepath, const PmdMaterial& material) {
+  MaterialTexturePaths paths;
+  const fs::path model_dir = model_filepath.parent_path();
+
+  // トゥーンリソース
+  char toon_name[16];
+  paths.toon = model_dir / "toon" / ToonTextureName(material.toonIdx, toon_name);
+
+  // split して通常テクスチャ / sph / spa に振り分ける
+  ForEachTextureName(material, [&](std::string_view name, BakedTextureSlot slot) {
+    fs::path filepath = model_dir / PathFromPmdString(name);
+    (slot == kBakedTextureSph ? paths.sph : slot == kBakedTextureSpa ? paths.spa : paths.tex) = std::move(filepath);
+  });
+  return paths;
+}
+
+namespace {
+
+/**
+ * @brief モデルが参照するテクスチャファイルの重複を除いて LoadedModel::texture_files に並べる
+ * @details マテリアルの多くは同じトゥーンや同じテクスチャを参照するので, パスを作るのは初めて見た名前だけにする.
+ *          名前から番号への表は scratch に置く (パースが終わったら捨てる).
+ */
+class TextureFileTable {
+ public:
+  TextureFileTable(LoadedModel* model, std::pmr::memory_resource* scratch)
+      : model_(model), by_name_(scratch), by_offset_(scratch) {
+    std::fill(std::begin(toon_), std::end(toon_), MaterialTextureIndices::kNoTexture);
+  }
+
+  uint32_t Toon(const fs::path& model_dir, uint8_t toon_index) {
+    uint32_t& index = toon_[toon_index];
+    if (index == MaterialTextureIndices::kNoTexture) {
+      if (toon_dir_.empty()) {
+        toon_dir_ = model_dir / "toon";
+      }
+      char name[16];
+      index = Add(PathFromPmdString(toon_dir_, ToonTextureName(toon_index, name)));
+    }
+    return index;
+  }
+
+  // name は PMD のマップ領域を指すので, モデルが開いている間 (= この表を使う間) は有効
+  uint32_t Named(const fs::path& model_dir, std::string_view name) {
+    auto it = by_name_.find(name);
+    if (it != by_name_.end()) {
+      return it->second;
+    }
+    const uint32_t index = Add(PathFromPmdString(model_dir, name));
+    by_name_.emplace(name, index);
+    return index;
+  }
+
+  // ベイク済みファイルの文字列テーブルのオフセット (同じ文字列は同じオフセット)
+  uint32_t Baked(uint32_t string_offset, std::size_t material_index, BakedTextureSlot slot) {
+    if (string_offset == kBakedNoString) {
+      return MaterialTextureIndices::kNoTexture;
+    }
+    auto it = by_offset_.find(string_offset);
+    if (it != by_offset_.end()) {
+      return it->second;
+    }
+    const uint32_t index = Add(model_->baked.TexturePath(material_index, slot));
+    by_offset_.emplace(string_offset, index);
+    return index;
+  }
+
+ private:
+  uint32_t Add(fs::path path) {
+    model_->texture_files.push_back(std::move(path));
+    return static_cast<uint32_t>(model_->texture_files.size() - 1);
+  }
+
+  LoadedModel* model_;
+  fs::path toon_dir_;
+  uint32_t toon_[256];
+  std::pmr::unordered_map<std::string_view, uint32_t> by_name_;
+  std::pmr::unordered_map<uint32_t, uint32_t> by_offset_;
+};
+
+/**
+ * @brief モデルを開き, 描画に必要なビューとテクスチャの一覧を LoadedModel に設定する
+ * @details .pmdb を直接指定された場合と, PMD の隣に新しいベイク済みファイルがある場合はそれを使う.
+ * @param scratch 一時的なデータの確保先 (戻った後は参照しない)
+ */
+bool OpenModel(const fs::path& path, LoadedModel* model, std::pmr::memory_resource* scratch, std::string* error) {
+  const bool is_baked = path.extension() == kBakedModelExtension;
+  const fs::path baked_path = is_baked ? path : BakedModelPath(path);
+  std::error_code ec;
+  if (is_baked || fs::exists(baked_path, ec)) {
+    if (model->baked.Open(baked_path) && (is_baked || model->baked.IsUpToDate(path))) {
+      auto& baked = model->baked;
+      model->vertices = baked.Vertices();
+      model->indices = baked.Indices();
+      model->bones = baked.Bones();
+      model->material_constants = baked.MaterialConstants();
+      const std::size_t material_count = baked.Materials().size();
+      model->material_index_counts.resize(material_count);
+      model->texture_indices.resize(material_count);
+      TextureFileTable files(model, scratch);
+      for (std::size_t i = 0; i < material_count; ++i) {
+        const BakedMaterial& material = baked.Materials()[i];
+        model->material_index_counts[i] = material.index_count;
+        auto& indices = model->texture_indices[i];
+        indices.tex = files.Baked(material.texture_names[kBakedTextureTex], i, kBakedTextureTex);
+        indices.sph = files.Baked(material.texture_names[kBakedTextureSph], i, kBakedTextureSph);
+        indices.spa = files.Baked(material.texture_names[kBakedTextureSpa], i, kBakedTextureSpa);
+        indices.toon = files.Baked(material.texture_names[kBakedTextureToon], i, kBakedTextureToon);
+      }
+      return true;
+    }
+    if (is_baked) {
+      *error = model->baked.Error();
+      return false;
+    }
+    model->baked = BakedModel();  // 古い・壊れたベイク済みファイルは無視して PMD を読む
+  }
+
+  if (!model->pmd.Open(path)) {
+    *error = model->pmd.Error();
+    return false;
+  }
+  auto materials = model->pmd.Materials();
+  model->vertices = model->pmd.Vertices();
+  model->indices = model->pmd.Indices();
+  model->bones = model->pmd.Bones();
+  model->packed_material_constants.resize(materials.size() * kMaterialConstantStride);
+  PackMaterialConstants(materials, model->packed_material_constants.data());
+  model->material_constants =
+      PmdSpan<uint8_t>(model->packed_material_constants.data(), model->packed_material_constants.size());
+  model->material_index_counts.resize(materials.size());
+  model->texture_indices.resize(materials.size());
+  const fs::path model_dir = path.parent_path();
+  TextureFileTable files(model, scratch);
+  uint64_t index_offset = 0;
+  for (std::size_t i = 0; i < materials.size(); ++i) {
+    const PmdMaterial& material = materials[i];
+    model->material_index_counts[i] = material.indicesNum;
+    index_offset += material.indicesNum;
+    if (index_offset > model->indices.size()) {
+      *error = "material " + std::to_string(i) + " refers beyond the index buffer";
+      return false;
+    }
+    auto& indices = model->texture_indices[i];
+    indices.toon = files.Toon(model_dir, material.toonIdx);
+    ForEachTextureName(material, [&](std::string_view name, BakedTextureSlot slot) {
+      const uint32_t index = files.Named(model_dir, name);
+      (slot == kBakedTextureSph ? indices.sph : slot == kBakedTextureSpa ? indices.spa : indices.tex) = index;
+    });
+  }
+  return true;
+}
+
+/**
+ * @brief デコードしたテクスチャをマテリアルごとの MaterialTextures に配る
+ */
+void AssignMaterialTextures(LoadedModel* model) {
+  auto image = [model](uint32_t index) {
+    return index == MaterialTextureIndices::kNoTexture ? nullptr : model->texture_images[index];
+  };
+  model->textures.resize(model->texture_indices.size());
+  for (std::size_t i = 0; i < model->texture_indices.size(); ++i) {
+    const auto& indices = model->texture_indices[i];
+    auto& textures = model->textures[i];
+    textures.tex = image(indices.tex);
+    textures.sph = image(indices.sph);
+    textures.spa = image(indices.spa);
+    textures.toon = image(indices.toon);
+  }
+}
+
+}  // namespace
+
+ModelLoader::ModelLoader(ThreadPool& pool, TextureDecoder decoder) : pool_(pool), decoder_(std::move(decoder)) {}
+
+std::vector<std::future<std::shared_ptr<LoadedModel>>> ModelLoader::LoadAsync(const std::vector<fs::path>& paths) {
+  std::vector<std::future<std::shared_ptr<LoadedModel>>> futures;
+  futures.reserve(paths.size());
+  for (auto& path : paths) {
+    auto promise = std::make_shared<std::promise<std::shared_ptr<LoadedModel>>>();
+    futures.push_back(promise->get_future());
+    LoadOne(path, [promise](std::shared_ptr<LoadedModel> model, std::string error) {
+      if (model) {
+        promise->set_value(std::move(model));
+      } else {
+        promise->set_exception(std::make_exception_ptr(std::runtime_error(error)));
+      }
+    });
+  }
+  return futures;
+}
+
+void ModelLoader::LoadAsync(const std::vector<fs::path>& paths, Callback callback) {
+  auto shared_callback = std::make_shared<Callback>(std::move(callback));
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    LoadOne(paths[i], [shared_callback, i](std::shared_ptr<LoadedModel> model, std::string error) {
+      (*shared_callback)(i, std::move(model), error);
+    });
+  }
+}
+
+void ModelLoader::LoadOne(const fs::path& path, Done done) {
+  pool_.Post([this, path, done = std::move(done)]() {
+    // 1. parse (ベイク済みならマップするだけ)
+    auto model = std::make_shared<LoadedModel>();
+    std::string error;
+    bool opened = false;
+    {
+      ProfileScope profile("model parse");
+      std::unique_ptr<Arena> scratch = AcquireScratchArena();
+      const uint64_t blocks_before = scratch->GetStats().block_allocations;
+      // ワーカーから例外を出すとプロセスごと落ちるので, 壊れたファイルなどは読み込みのエラーにする
+      try {
+        opened = OpenModel(path, model.get(), scratch.get(), &error);
+      } catch (const std::exception& e) {
+        error = e.what();
+      } catch (...) {
+        error = "unknown error";
+      }
+      ReleaseScratchArena(std::move(scratch), blocks_before);
+    }
+    if (!opened) {
+      Finish(nullptr, done, path.u8string() + ": " + error);
+      return;
+    }
+
+    // 2. decode textures (パース済みのモデルを待たせずにプールへ流す). 同じファイルは texture_files に 1 つだけ
+    const std::size_t texture_count = model->texture_files.size();
+    model->texture_images.resize(texture_count);
+    if (texture_count == 0) {
+      AssignMaterialTextures(model.get());
+      Finish(model, done, {});
+      return;
+    }
+    struct Pending {
+      std::shared_ptr<LoadedModel> model;
+      Done done;
+      std::atomic<std::size_t> remaining;
+    };
+    auto pending = std::make_shared<Pending>();
+    pending->model = std::move(model);
+    pending->done = done;
+    pending->remaining = texture_count;
+    for (std::size_t i = 0; i < texture_count; ++i) {
+      pool_.Post([this, pending, i]() {
+        LoadedModel* model = pending->model.get();
+        std::shared_ptr<const Image> image;
+        try {
+          image = decoder_(model->texture_files[i]);
+        } catch (...) {
+          image = nullptr;  // デコードに失敗したテクスチャは既定のテクスチャで代用する
+        }
+        model->texture_images[i] = std::move(image);
+        if (pending->remaining.fetch_sub(1) == 1) {
+          AssignMaterialTextures(model);
+          Finish(pending->model, pending->done, {});
+        }
+      });
+    }
+  });
+}
+
+void ModelLoader::Finish(const std::shared_ptr<LoadedModel>& model, const Done& done, const std::string& error) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.models;
+    if (model != nullptr) {
+      const auto& arena = model->arena.GetStats();
+      stats_.arena_allocations += arena.allocations;
+      stats_.arena_blocks += arena.block_allocations;
+      stats_.model_arena_bytes += arena.used_bytes;
+    }
+  }
+  done(model, error);
+}
+
+std::unique_ptr<Arena> ModelLoader::AcquireScratchArena() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (scratch_arenas_.empty()) {
+    ++stats_.scratch_arenas;
+    return std::make_unique<Arena>();
+  }
+  std::unique_ptr<Arena> arena = std::move(scratch_arenas_.back());
+  scratch_arenas_.pop_back();
+  return arena;
+}
+
+void ModelLoader::ReleaseScratchArena(std::unique_ptr<Arena> arena, uint64_t blocks_before) {
+  const auto& arena_stats = arena->GetStats();
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.arena_allocations += arena_stats.allocations;
+  stats_.arena_blocks += arena_stats.block_allocations - blocks_before;
+  stats_.peak_scratch_bytes = std::max(stats_.peak_scratch_bytes, arena_stats.used_bytes);
+  arena->Reset();
+  scratch_arenas_.push_back(std::move(arena));
+}
+
+ModelLoader::Stats ModelLoader::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "baked_model.h"
+#include "image.h"
+#include "pmd_file.h"
+
+class ThreadPool;
+
+/**
+ * @brief マテリアルが参照するテクスチャのパス (無いものは空)
+ *
+ */
+struct MaterialTexturePaths {
+  std::filesystem::path tex;   // register(t0)
+  std::filesystem::path sph;   // register(t1)
+  std::filesystem::path spa;   // register(t2)
+  std::filesystem::path toon;  // register(t3)
+};
+
+/**
+ * @brief マテリアルが参照するデコード済みテクスチャ (無いもの・失敗したものは nullptr)
+ *
+ */
+struct MaterialTextures {
+  std::shared_ptr<const Image> tex;
+  std::shared_ptr<const Image> sph;
+  std::shared_ptr<const Image> spa;
+  std::shared_ptr<const Image> toon;
+};
+
+/**
+ * @brief マテリアルが参照するテクスチャの LoadedModel::texture_files の番号 (無いものは kNoTexture)
+ *
+ */
+struct MaterialTextureIndices {
+  static constexpr uint32_t kNoTexture = 0xffffffff;
+
+  uint32_t tex = kNoTexture;   // register(t0)
+  uint32_t sph = kNoTexture;   // register(t1)
+  uint32_t spa = kNoTexture;   // register(t2)
+  uint32_t toon = kNoTexture;  // register(t3)
+};
+
+/**
+ * @brief パースとテクスチャのデコードまで終わったモデル
+ * @details ベイク済みファイル (.pmdb) があればそちらを使い, 無ければ PMD を読む.
+ *          どちらから読んだ場合も vertices 以降のメンバーから参照すればよい.
+ *          マテリアルごとの配列は arena に置くので, モデルを破棄するとまとめて解放される.
+ */
+struct LoadedModel {
+  Arena arena;  // 下の std::pmr コンテナの確保先 (最初に作り, 最後に破棄する)
+
+  PmdFile pmd;       // PMD から読んだ場合のみ開いている
+  BakedModel baked;  // ベイク済みファイルから読んだ場合のみ開いている
+
+  PmdSpan<PmdVertex> vertices;
+  PmdSpan<uint16_t> indices;
+  PmdSpan<PmdBone> bones;
+  PmdSpan<uint8_t> material_constants;                                // kMaterialConstantStride ごとの MaterialForHlsl
+  std::pmr::vector<uint32_t> material_index_counts{&arena};           // マテリアルごとのインデックス数
+  std::pmr::vector<std::filesystem::path> texture_files{&arena};      // 参照するテクスチャ (重複なし)
+  std::pmr::vector<std::shared_ptr<const Image>> texture_images{&arena};  // texture_files と同じ順のデコード結果
+  std::pmr::vector<MaterialTextureIndices> texture_indices{&arena};   // マテリアルごと
+  std::pmr::vector<MaterialTextures> textures{&arena};                // マテリアルごと
+
+  std::pmr::vector<uint8_t> packed_material_constants{&arena};  // PMD から読んだ場合の material_constants の実体
+};
+
+/**
+ * @brief マテリアルのテクスチャパスを解決する
+ * @details texFilePath を '*' で分割して通常テクスチャ / sph / spa に振り分け, toonIdx からトゥーンのパスを作る.
+ *
+ * トゥーン番号とトゥーンテクスチャのファイル名との関係
+ *  _________________________
+ * | toon index | filename   |
+ * |        255 | toon00.bmp |
+ * |          0 | toon01.bmp |
+ * |          1 | toon02.bmp |
+ * |          2 | toon03.bmp |
+ *  _________________________
+ */
+MaterialTexturePaths ResolveMaterialTexturePaths(const std::filesystem::path& model_filepath,
+                                                 const PmdMaterial& material);
+
+/**
+ * @brief 複数の PMD をスレッドプール上で並列に読み込む
+ * @details 1 モデルのパースが終わるとテクスチャのデコードタスクを投入し, 全て終わった時点で完了とする.
+ *          PMD の隣に新しいベイク済みファイルがあればパースの代わりにそれをマップする.
+ *          パースとデコードはパイプライン化されるので, 読み込み時間はファイル数の合計ではなくコア数に応じて短くなる.
+ *          GPU リソースの作成は行わない (デバイスを持つスレッドで LoadedModel から作ること).
+ *          パース中の一時的なデータ (テクスチャ名の重複除去など) は使い回すスクラッチアリーナに置き,
+ *          パースが終わるとまとめて捨てる. 読み込むモデルが増えてもヒープの確保はほぼ増えない.
+ */
+class ModelLoader {
+ public:
+  /**
+   * @brief 画像ファイルをデコードする関数. 失敗したら nullptr を返す. 複数スレッドから同時に呼ばれる.
+   */
+  using TextureDecoder = std::function<std::shared_ptr<const Image>(const std::filesystem::path&)>;
+
+  /**
+   * @brief 読み込み完了時に呼ばれる. 失敗時は model が nullptr で error に理由が入る. ワーカースレッドから呼ばれる.
+   */
+  using Callback = std::function<void(std::size_t index, std::shared_ptr<LoadedModel> model, const std::string& error)>;
+
+  struct Stats {
+    uint64_t models = 0;                    // 読み込みが終わったモデル (失敗を含む)
+    uint64_t arena_allocations = 0;         // アリーナから切り出した回数 (ヒープの確保の代わり)
+    uint64_t arena_blocks = 0;              // アリーナがヒープから確保したブロックの数
+    std::size_t scratch_arenas = 0;         // 作ったスクラッチアリーナの数 (同時にパースしたモデル数の最大)
+    std::size_t peak_scratch_bytes = 0;     // 1 モデルのパースで使ったスクラッチの最大
+    std::size_t model_arena_bytes = 0;      // 読み込んだモデルのアリーナで使った合計
+  };
+
+  ModelLoader(ThreadPool& pool, TextureDecoder decoder);
+
+  /**
+   * @brief 読み込みを開始し, モデルごとの future を返す
+   * @details 失敗したモデルの future は get() で std::runtime_error を投げる.
+   */
+  std::vector<std::future<std::shared_ptr<LoadedModel>>> LoadAsync(const std::vector<std::filesystem::path>& paths);
+
+  /**
+   * @brief 読み込みを開始し, モデルごとに完了コールバックを呼ぶ
+   */
+  void LoadAsync(const std::vector<std::filesystem::path>& paths, Callback callback);
+
+  Stats GetStats() const;
+
+ private:
+  using Done = std::function<void(std::shared_ptr<LoadedModel>, std::string)>;
+
+  void LoadOne(const std::filesystem::path& path, Done done);
+  void Finish(const std::shared_ptr<LoadedModel>& model, const Done& done, const std::string& error);
+  std::unique_ptr<Arena> AcquireScratchArena();
+  void ReleaseScratchArena(std::unique_ptr<Arena> arena, uint64_t blocks_before);
+
+  ThreadPool& pool_;
+  TextureDecoder decoder_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Arena>> scratch_arenas_;  // 使っていないスクラッチアリーナ
+  Stats stats_;
+};
@@ -0,0 +1,371 @@
+#include "null_render_backend.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "mapped_file.h"
+#include "texture_content_store.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+uint32_t LevelExtent(uint32_t extent, uint32_t level) { return std::max<uint32_t>(extent >> level, 1); }
+
+// ミップチェーン全体を詰めて置いた場合のバイト数
+uint64_t TextureBytes(const TextureDesc& desc) {
+  uint64_t bytes = 0;
+  for (uint32_t level = 0; level < desc.mip_levels; ++level) {
+    bytes += uint64_t(RowBytes(desc.format, LevelExtent(desc.width, level))) *
+             RowCount(desc.format, LevelExtent(desc.height, level));
+  }
+  return bytes;
+}
+
+constexpr char kMagic[4] = {'R', 'C', 'A', 'P'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t command_count;
+  uint32_t pass_count;
+};
+
+struct PassRecord {
+  uint32_t width;
+  uint32_t height;
+  uint32_t flags;  // 1: clear_color, 2: clear_depth
+  float color[4];
+  float depth;
+};
+
+}  // namespace
+
+///////////////////////
+// NullRenderBackend //
+///////////////////////
+
+ResourceHandle NullRenderBackend::CreateBuffer(uint64_t size) {
+  if (size == 0) {
+    ++stats_.failed_operations;
+    return 0;
+  }
+  Resource resource;
+  resource.size = size;
+  resource.data.resize(static_cast<std::size_t>(size));
+  ++stats_.buffers_created;
+  return Add(std::move(resource));
+}
+
+ResourceHandle NullRenderBackend::CreateTexture(const TextureDesc& desc) {
+  // ミップは 1x1 までしか作れない
+  if (desc.width == 0 || desc.height == 0 || desc.mip_levels == 0 || desc.mip_levels > 32 ||
+      desc.format == PixelFormat::kUnknown || (std::max(desc.width, desc.height) >> (desc.mip_levels - 1)) == 0) {
+    ++stats_.failed_operations;
+    return 0;
+  }
+  Resource resource;
+  resource.texture = true;
+  resource.desc = desc;
+  resource.size = TextureBytes(desc);
+  resource.level_hashes.assign(desc.mip_levels, 0);
+  ++stats_.textures_created;
+  return Add(std::move(resource));
+}
+
+uint8_t* NullRenderBackend::MapBuffer(ResourceHandle buffer) {
+  Resource* resource = Find(buffer);
+  if (resource == nullptr || resource->texture) {
+    ++stats_.failed_operations;
+    return nullptr;
+  }
+  return resource->data.data();
+}
+
+bool NullRenderBackend::WriteTexture(ResourceHandle texture, uint32_t level, const Image& image) {
+  Resource* resource = Find(texture);
+  if (resource == nullptr || !resource->texture || level >= resource->desc.mip_levels ||
+      image.format != resource->desc.format || image.width != LevelExtent(resource->desc.width, level) ||
+      image.height != LevelExtent(resource->desc.height, level) ||
+      image.pixels.size() < image.row_pitch * RowCount(image.format, image.height)) {
+    ++stats_.failed_operations;
+    return false;
+  }
+  resource->level_hashes[level] = HashImagePixels(image);
+  const uint64_t bytes = uint64_t(RowBytes(image.format, image.width)) * RowCount(image.format, image.height);
+  ++stats_.texture_writes;
+  stats_.texture_write_bytes += bytes;
+  events_.push_back({EventType::kWrite, texture, frame_, bytes});
+  return true;
+}
+
+void NullRenderBackend::ReleaseResource(ResourceHandle handle) {
+  Resource* resource = Find(handle);
+  if (resource == nullptr) {
+    ++stats_.failed_operations;
+    return;
+  }
+  resource->live = false;
+  resource->data = {};
+  --stats_.live_resources;
+  stats_.live_bytes -= resource->size;
+  ++stats_.releases;
+  events_.push_back({EventType::kRelease, handle, frame_, resource->size});
+}
+
+std::vector<ResourceHandle> NullRenderBackend::LiveResources() const {
+  std::vector<ResourceHandle> live;
+  for (std::size_t i = 0; i < resources_.size(); ++i) {
+    if (resources_[i].live) {
+      live.push_back(i + 1);
+    }
+  }
+  return live;
+}
+
+uint64_t NullRenderBackend::TextureLevelHash(ResourceHandle texture, uint32_t level) const {
+  if (texture == 0 || texture > resources_.size()) {
+    return 0;
+  }
+  const Resource& resource = resources_[texture - 1];
+  return resource.texture && level < resource.level_hashes.size() ? resource.level_hashes[level] : 0;
+}
+
+NullRenderBackend::Resource* NullRenderBackend::Find(ResourceHandle resource) {
+  if (resource == 0 || resource > resources_.size() || !resources_[resource - 1].live) {
+    return nullptr;
+  }
+  return &resources_[resource - 1];
+}
+
+ResourceHandle NullRenderBackend::Add(Resource resource) {
+  const uint64_t size = resource.size;
+  resources_.push_back(std::move(resource));
+  const ResourceHandle handle = resources_.size();
+  ++stats_.live_resources;
+  stats_.live_bytes += size;
+  stats_.peak_live_bytes = std::max(stats_.peak_live_bytes, stats_.live_bytes);
+  events_.push_back({EventType::kCreate, handle, frame_, size});
+  return handle;
+}
+
+///////////////////
+// RecordedFrame //
+///////////////////
+
+void RecordedFrame::Append(const RecordedFrame& other) {
+  const uint32_t pass_base = static_cast<uint32_t>(passes.size());
+  passes.insert(passes.end(), other.passes.begin(), other.passes.end());
+  commands.reserve(commands.size() + other.commands.size());
+  for (RenderCommand command : other.commands) {
+    if (command.type == RenderCommandType::kBeginPass) {
+      command.a += pass_base;
+    }
+    commands.push_back(command);
+  }
+}
+
+bool RecordedFrame::operator==(const RecordedFrame& other) const {
+  auto same_pass = [](const PassDesc& a, const PassDesc& b) {
+    return a.width == b.width && a.height == b.height && a.clear_color == b.clear_color &&
+           a.clear_depth == b.clear_depth && std::equal(a.color, a.color + 4, b.color) && a.depth == b.depth;
+  };
+  return commands == other.commands && passes.size() == other.passes.size() &&
+         std::equal(passes.begin(), passes.end(), other.passes.begin(), same_pass);
+}
+
+//////////////////////////
+// RecordingCommandList //
+//////////////////////////
+
+void RecordingCommandList::BeginPass(const PassDesc& pass) {
+  Push(RenderCommandType::kBeginPass, static_cast<uint32_t>(frame_.passes.size()));
+  frame_.passes.push_back(pass);
+}
+
+void RecordingCommandList::SetVertexBuffer(const BufferView& view) {
+  Push(RenderCommandType::kSetVertexBuffer, view.size, view.stride, view.buffer, view.offset);
+}
+
+void RecordingCommandList::SetIndexBuffer(const BufferView& view) {
+  Push(RenderCommandType::kSetIndexBuffer, view.size, view.stride, view.buffer, view.offset);
+}
+
+void RecordingCommandList::SetConstantBuffer(uint64_t gpu_address) {
+  Push(RenderCommandType::kSetConstantBuffer, 0, 0, 0, gpu_address);
+}
+
+void RecordingCommandList::SetPipeline(uint32_t pipeline) { Push(RenderCommandType::kSetPipeline, pipeline); }
+
+void RecordingCommandList::SetGeometry(uint32_t geometry) { Push(RenderCommandType::kSetGeometry, geometry); }
+
+void RecordingCommandList::SetMaterial(uint32_t material) { Push(RenderCommandType::kSetMaterial, material); }
+
+void RecordingCommandList::DrawIndexed(uint32_t index_count, uint32_t index_offset) {
+  Push(RenderCommandType::kDrawIndexed, index_count, index_offset);
+}
+
+////////////////////
+// replay / stats //
+////////////////////
+
+void ReplayFrame(const RecordedFrame& frame, RenderCommandList& list) {
+  for (const RenderCommand& command : frame.commands) {
+    switch (command.type) {
+      case RenderCommandType::kBeginPass:
+        list.BeginPass(frame.passes[command.a]);
+        break;
+      case RenderCommandType::kSetVertexBuffer:
+        list.SetVertexBuffer({command.resource, command.offset, command.a, command.b});
+        break;
+      case RenderCommandType::kSetIndexBuffer:
+        list.SetIndexBuffer({command.resource, command.offset, command.a, command.b});
+        break;
+      case RenderCommandType::kSetConstantBuffer:
+        list.SetConstantBuffer(command.offset);
+        break;
+      case RenderCommandType::kSetPipeline:
+        list.SetPipeline(command.a);
+        break;
+      case RenderCommandType::kSetGeometry:
+        list.SetGeometry(command.a);
+        break;
+      case RenderCommandType::kSetMaterial:
+        list.SetMaterial(command.a);
+        break;
+      case RenderCommandType::kDrawIndexed:
+        list.DrawIndexed(command.a, command.b);
+        break;
+    }
+  }
+}
+
+FrameAnalysis AnalyzeFrame(const RecordedFrame& frame) {
+  FrameAnalysis analysis;
+  analysis.commands = frame.commands.size();
+  // 種類ごとに最後に設定したコマンド (未設定なら nullptr)
+  const RenderCommand* current[static_cast<std::size_t>(RenderCommandType::kDrawIndexed)] = {};
+  for (const RenderCommand& command : frame.commands) {
+    switch (command.type) {
+      case RenderCommandType::kBeginPass:
+        ++analysis.passes;
+        std::fill(std::begin(current), std::end(current), nullptr);
+        continue;
+      case RenderCommandType::kDrawIndexed:
+        ++analysis.draws;
+        analysis.indices += command.a;
+        continue;
+      case RenderCommandType::kSetVertexBuffer:
+      case RenderCommandType::kSetIndexBuffer:
+      case RenderCommandType::kSetConstantBuffer:
+        ++analysis.buffer_bindings;
+        break;
+      case RenderCommandType::kSetPipeline:
+        ++analysis.pipeline_changes;
+        break;
+      case RenderCommandType::kSetGeometry:
+        ++analysis.geometry_changes;
+        break;
+      case RenderCommandType::kSetMaterial:
+        ++analysis.material_changes;
+        break;
+    }
+    const RenderCommand*& last = current[static_cast<std::size_t>(command.type)];
+    if (last != nullptr && *last == command) {
+      ++analysis.redundant_changes;
+    }
+    last = &command;
+  }
+  return analysis;
+}
+
+//////////////////
+// capture file //
+//////////////////
+
+bool SaveFrameCapture(const fs::path& path, const RecordedFrame& frame, std::string* error) {
+  FileHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.command_count = static_cast<uint32_t>(frame.commands.size());
+  header.pass_count = static_cast<uint32_t>(frame.passes.size());
+  std::vector<PassRecord> passes;
+  passes.reserve(frame.passes.size());
+  for (const PassDesc& pass : frame.passes) {
+    PassRecord record = {};
+    record.width = pass.width;
+    record.height = pass.height;
+    record.flags = (pass.clear_color ? 1u : 0u) | (pass.clear_depth ? 2u : 0u);
+    std::copy(pass.color, pass.color + 4, record.color);
+    record.depth = pass.depth;
+    passes.push_back(record);
+  }
+
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(frame.commands.data()),
+            static_cast<std::streamsize>(frame.commands.size() * sizeof(RenderCommand)));
+  ofs.write(reinterpret_cast<const char*>(passes.data()),
+            static_cast<std::streamsize>(passes.size() * sizeof(PassRecord)));
+  if (!ofs) {
+    *error = path.u8string() + ": write failed";
+    return false;
+  }
+  return true;
+}
+
+bool LoadFrameCapture(const fs::path& path, RecordedFrame* frame, std::string* error) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    *error = file.Error();
+    return false;
+  }
+  FileHeader header;
+  if (file.size() < sizeof(header)) {
+    *error = path.u8string() + ": not a frame capture";
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    *error = path.u8string() + ": not a frame capture";
+    return false;
+  }
+  if (header.version != kVersion) {
+    *error = path.u8string() + ": unsupported version " + std::to_string(header.version);
+    return false;
+  }
+  const uint64_t expected_size = sizeof(header) + uint64_t(header.command_count) * sizeof(RenderCommand) +
+                                 uint64_t(header.pass_count) * sizeof(PassRecord);
+  if (file.size() != expected_size) {
+    *error = path.u8string() + ": truncated frame capture";
+    return false;
+  }
+
+  RecordedFrame loaded;
+  loaded.commands.resize(header.command_count);
+  std::memcpy(loaded.commands.data(), file.data() + sizeof(header), header.command_count * sizeof(RenderCommand));
+  const uint8_t* pass_data = file.data() + sizeof(header) + header.command_count * sizeof(RenderCommand);
+  for (uint32_t i = 0; i < header.pass_count; ++i) {
+    PassRecord record;
+    std::memcpy(&record, pass_data + i * sizeof(PassRecord), sizeof(record));
+    PassDesc pass;
+    pass.width = record.width;
+    pass.height = record.height;
+    pass.clear_color = (record.flags & 1) != 0;
+    pass.clear_depth = (record.flags & 2) != 0;
+    std::copy(record.color, record.color + 4, pass.color);
+    pass.depth = record.depth;
+    loaded.passes.push_back(pass);
+  }
+  for (const RenderCommand& command : loaded.commands) {
+    if (command.type > RenderCommandType::kDrawIndexed ||
+        (command.type == RenderCommandType::kBeginPass && command.a >= header.pass_count)) {
+      *error = path.u8string() + ": invalid command";
+      return false;
+    }
+  }
+  *frame = std::move(loaded);
+  return true;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "render_backend.h"
+
+/**
+ * @brief リソースをメモリ上に作るだけのバックエンド (GPU も Windows も要らない)
+ * @details バッファは CPU のメモリを確保して MapBuffer() で返す. テクスチャは中身を持たず, ミップごとのハッシュだけを残す.
+ *          作成・書き込み・破棄をフレーム番号付きで記録するので, リソースの寿命やリークを確かめられる.
+ *          ハンドルは使い回さないので, 破棄したリソースへの操作は失敗する. スレッドセーフではない.
+ */
+class NullRenderBackend : public RenderBackend {
+ public:
+  enum class EventType : uint32_t {
+    kCreate,
+    kWrite,
+    kRelease,
+  };
+
+  struct Event {
+    EventType type;
+    ResourceHandle resource;
+    uint64_t frame;  // NextFrame() の回数
+    uint64_t bytes;  // kCreate ならリソースの大きさ, kWrite なら書いたバイト数
+  };
+
+  struct Stats {
+    uint64_t buffers_created = 0;
+    uint64_t textures_created = 0;
+    uint64_t releases = 0;
+    uint64_t texture_writes = 0;
+    uint64_t texture_write_bytes = 0;
+    uint64_t failed_operations = 0;  // 無効なハンドルや形式の合わない書き込み
+    std::size_t live_resources = 0;
+    uint64_t live_bytes = 0;
+    uint64_t peak_live_bytes = 0;
+  };
+
+  ResourceHandle CreateBuffer(uint64_t size) override;
+  ResourceHandle CreateTexture(const TextureDesc& desc) override;
+  uint8_t* MapBuffer(ResourceHandle buffer) override;
+  bool WriteTexture(ResourceHandle texture, uint32_t level, const Image& image) override;
+  void ReleaseResource(ResourceHandle resource) override;
+
+  /**
+   * @brief 以降のイベントを次のフレームのものとして記録する
+   */
+  void NextFrame() { ++frame_; }
+
+  const std::vector<Event>& Events() const { return events_; }
+  /**
+   * @brief 破棄されていないリソース (作った順)
+   */
+  std::vector<ResourceHandle> LiveResources() const;
+  /**
+   * @brief テクスチャの level 番目のミップに最後に書いた内容のハッシュ (書いていなければ 0)
+   */
+  uint64_t TextureLevelHash(ResourceHandle texture, uint32_t level) const;
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct Resource {
+    bool live = true;
+    bool texture = false;
+    TextureDesc desc;
+    uint64_t size = 0;
+    std::vector<uint8_t> data;          // バッファの中身
+    std::vector<uint64_t> level_hashes;  // テクスチャのミップごとのハッシュ
+  };
+
+  Resource* Find(ResourceHandle resource);
+  ResourceHandle Add(Resource resource);
+
+  std::vector<Resource> resources_;  // ハンドル - 1 番目
+  std::vector<Event> events_;
+  uint64_t frame_ = 0;
+  Stats stats_;
+};
+
+enum class RenderCommandType : uint32_t {
+  kBeginPass,          // a: RecordedFrame::passes の番号
+  kSetVertexBuffer,    // resource, offset, a: size, b: stride
+  kSetIndexBuffer,     // resource, offset, a: size, b: stride
+  kSetConstantBuffer,  // offset: GPU のアドレス
+  kSetPipeline,        // a: パイプライン
+  kSetGeometry,        // a: ジオメトリ
+  kSetMaterial,        // a: マテリアル
+  kDrawIndexed,        // a: インデックス数, b: 開始インデックス
+};
+
+/**
+ * @brief 記録したコマンド 1 つ (32 bytes)
+ */
+struct RenderCommand {
+  RenderCommandType type;
+  uint32_t a;
+  uint32_t b;
+  uint32_t reserved;
+  uint64_t resource;
+  uint64_t offset;
+
+  bool operator==(const RenderCommand& other) const {
+    return type == other.type && a == other.a && b == other.b && resource == other.resource &&
+           offset == other.offset;
+  }
+};
+
+static_assert(sizeof(RenderCommand) == 32, "render command must be 32 bytes");
+
+/**
+ * @brief 1 フレーム (またはコマンドリスト 1 つ) 分の記録
+ */
+struct RecordedFrame {
+  std::vector<RenderCommand> commands;
+  std::vector<PassDesc> passes;
+
+  void Clear() {
+    commands.clear();
+    passes.clear();
+  }
+  /**
+   * @brief other のコマンドを後ろに足す (区間ごとのリストを実行する順につなげる)
+   */
+  void Append(const RecordedFrame& other);
+  bool operator==(const RecordedFrame& other) const;
+};
+
+/**
+ * @brief コマンドを RecordedFrame に記録するだけのコマンドリスト
+ */
+class RecordingCommandList : public RenderCommandList {
+ public:
+  void Reset() { frame_.Clear(); }
+  const RecordedFrame& Frame() const { return frame_; }
+
+  void BeginPass(const PassDesc& pass) override;
+  void SetVertexBuffer(const BufferView& view) override;
+  void SetIndexBuffer(const BufferView& view) override;
+  void SetConstantBuffer(uint64_t gpu_address) override;
+  void SetPipeline(uint32_t pipeline) override;
+  void SetGeometry(uint32_t geometry) override;
+  void SetMaterial(uint32_t material) override;
+  void DrawIndexed(uint32_t index_count, uint32_t index_offset) override;
+
+ private:
+  void Push(RenderCommandType type, uint32_t a = 0, uint32_t b = 0, uint64_t resource = 0, uint64_t offset = 0) {
+    frame_.commands.push_back({type, a, b, 0, resource, offset});
+  }
+
+  RecordedFrame frame_;
+};
+
+/**
+ * @brief 記録したコマンドを list に順に発行する
+ */
+void ReplayFrame(const RecordedFrame& frame, RenderCommandList& list);
+
+/**
+ * @brief 記録したフレームのコマンドの内訳
+ * @details 状態は kBeginPass で全て未設定に戻る (コマンドリストは状態を引き継がないので).
+ *          redundant_changes は直前と同じ値を設定し直したもの (kSetPipeline / kSetGeometry / kSetMaterial / バッファ).
+ */
+struct FrameAnalysis {
+  std::size_t commands = 0;
+  std::size_t passes = 0;
+  std::size_t draws = 0;
+  uint64_t indices = 0;
+  std::size_t pipeline_changes = 0;
+  std::size_t geometry_changes = 0;
+  std::size_t material_changes = 0;
+  std::size_t buffer_bindings = 0;  // 頂点・インデックス・定数バッファの設定
+  std::size_t redundant_changes = 0;
+};
+
+FrameAnalysis AnalyzeFrame(const RecordedFrame& frame);
+
+/**
+ * @brief 記録したフレームをファイルに書く (Windows で記録したものを他の環境で再生・解析する用)
+ * @return 失敗したら false. 理由は error に入れる
+ */
+bool SaveFrameCapture(const std::filesystem::path& path, const RecordedFrame& frame, std::string* error);
+
+/**
+ * @return 読めなければ false. 理由は error に入れる
+ */
+bool LoadFrameCapture(const std::filesystem::path& path, RecordedFrame* frame, std::string* error);
@@ -0,0 +1,3647 @@
+// CPU 側の処理のスループットを測るツール
+//
+//   perf-bench skinning [--model model.pmd] [--vertices N] [--bones N] [--instances N] [--iterations N] [--threads N]
+//   perf-bench motion [--characters N] [--bones N] [--keys N] [--frames N]
+//   perf-bench command-recording [--models N] [--materials N] [--threads N] [--ranges N] [--work N] [--iterations N]
+//   perf-bench draw-list [--models N] [--materials N] [--textures N] [--iterations N]
+//   perf-bench culling [--models N] [--materials N] [--frames N] [--depth-width N] [--depth-height N]
+//   perf-bench lod [--model model.pmd] [--rings N] [--segments N] [--levels N] [--iterations N]
+//   perf-bench heap-allocator [--operations N] [--textures N] [--heap-mb N]
+//   perf-bench render-backend [--models N] [--materials N] [--textures N] [--frames N] [--threads N]
+//                             [--capture frame_capture.rcap]
+//   perf-bench frame-pipeline [--frames N] [--cpu-us N] [--gpu-us N] [--max-in-flight N]
+//   perf-bench profiler [--scopes N] [--threads N] [--events N] [--trace trace.json]
+//   perf-bench model-load [--models N] [--materials N] [--textures N] [--threads N]
+//   perf-bench pmd-load [--models N] [--vertices N] [--materials N] [--iterations N]
+//   perf-bench startup [--vertices N] [--materials N] [--textures N] [--texture-size N] [--iterations N] [--threads N]
+//                      [--json results.json]
+//   perf-bench mips [--size N] [--iterations N] [--threads N] [--textures N] [--frames N] [--budget-mb N]
+//   perf-bench bc [--size N] [--iterations N] [--threads N] [--cache DIR]
+//   perf-bench image-decode [--size N] [--iterations N] [--dir DIR]
+//   perf-bench raster [--model model.pmd] [--spheres N] [--width N] [--height N] [--iterations N] [--threads N]
+//                     [--output frame.png] [--expect HASH]
+//   perf-bench texture-sampler [--size N] [--samples N] [--iterations N]
+//   perf-bench upload-allocator [--frames N] [--objects N] [--in-flight N] [--page-kb N]
+//   perf-bench vertex-compression [--model model.pmd] [--vertices N] [--bones N] [--iterations N]
+//
+// --model を省略した場合は乱数で作った頂点とボーンを使う. motion は乱数で作った VMD を全キャラクターで共有して再生する.
+// mips はミップチェーンの生成 (SIMD 版がスカラー版と一致するか) と, ミップのストリーミングを
+// カメラが移動するシーンを模した要求で測る.
+// bc はテクスチャを模した画像を BC1 / BC3 / BC7 に圧縮し, PSNR とエンコードの速さ (スカラー / SIMD / 並列) を表示する.
+// 圧縮済みミップチェーンのキャッシュ (--cache, 省略時は一時ディレクトリ) に書いて読み直せるかも確かめる.
+// image-decode は同じ画像を BMP (8 / 24 / 32 bit) ・TGA (無圧縮 / RLE) ・PNG で書き出して組み込みのデコーダーで読み,
+// 元の画素と一致するかとデコードの速さを表示する. --dir を指定した場合はそのディレクトリの画像ファイルも全て読む.
+// model-load は乱数で作った PMD を ModelLoader で何度も読み, 1 モデルあたりのヒープの確保回数とアリーナの使用量を表示する
+// (テクスチャのデコードは測らない). マテリアルごとにパスを作っていた以前の方法の確保回数と比べる.
+// pmd-load は乱数で作った大きな PMD を何個も書き出し, 頂点ごとに fread していた以前の読み方と PmdFile::Open で
+// 全ての頂点・インデックス・マテリアルを読み終えるまでの時間を比べる. 両者が同じデータを読むかも確かめる.
+// OS のファイルキャッシュは消さないので, ファイルはメモリから読まれる.
+// startup は乱数で作ったモデルとテクスチャ (PNG / BMP) をディスクに書き, 起動時の読み込みを段階ごとに測る
+// (モデルのパース, テクスチャパスの解決, マテリアルの定数, デコード, ミップの生成と BC 圧縮, 全体).
+// cold はキャッシュ (ベイク済みモデル・TextureCache・CompressedTextureCache) が無い初回起動, warm は全てある場合.
+// OS のファイルキャッシュは消さないので, cold でもファイルはメモリから読まれる.
+// --json を指定した場合は段階ごとの p50 / p99 / 最大 (ms) を JSON で書く (回帰の追跡用).
+// raster は main と同じカメラでモデル (省略時は球を並べたシーン) をソフトウェアラスタライザーで描く.
+// フレームの内容のハッシュを表示し, --expect を指定した場合は一致しなければ失敗する (ゴールデンイメージの比較用).
+// 浮動小数点の演算結果が変わるので, ハッシュはビルド設定 (/arch:AVX2 など) ごとに記録すること.
+// texture-sampler は乱数で作ったミップ付きテクスチャを smp / smpToon の設定でサンプリングし,
+// SIMD 版 (SampleTextureBatch) がスカラー版 (SampleTexture) と一致するか確かめる.
+// upload-allocator はフレームごとに物体の数だけ行列とマテリアルの定数を LinearUploadAllocator から切り出し
+// (ページは CPU のメモリ), GPU が使用中のはずの領域が次のフレームで上書きされていないか, アライメントが正しいかを確かめる.
+// 物体ごとにバッファを確保する場合とヒープの確保回数を比べる.
+// draw-list は乱数で作ったシーン (モデル数 x マテリアル数の描画) をソート・結合し, 結果が元の描画と同じになるか確かめる.
+// culling は格子状に並べたモデル (マテリアルごとに箱) と中央の壁を, シーンの周りを回るカメラで視錐台と壁の深度で判定する.
+// 視錐台で除いた描画の頂点が全て同じクリップ平面の外にあるか, 壁で除いた描画の境界ボックスの頂点が全て壁に隠れるか,
+// 残ったコマンド列が見える描画を同じ状態で描くかを確かめ, 1 フレームと 1 描画あたりの時間を表示する.
+// lod はモデル (省略時は UV の継ぎ目とボーンの境界を持つ球) の LOD を作り, 段ごとの三角形数と誤差, 作る時間を表示する.
+// 各段がマテリアルの範囲の外の頂点を使わないか, 球では継ぎ目をまたぐ三角形・影響度の違う頂点を結ぶ辺・裏返った三角形が
+// 無いかを確かめる. 距離を変えて選んだ段が遠いほど粗く, 画面上の誤差が 1 画素以下になるかも確かめる.
+// command-recording は乱数で作ったシーンのコマンド列を区間に分け, 記録するだけのバックエンド (1 コマンドにつき --work 回の
+// 計算でドライバーの負荷を模す) に並列に記録する. 区間を順に再生した描画が 1 スレッドで記録したものと一致するか確かめる.
+// heap-allocator は TlsfAllocator に乱数で割り当てと解放を繰り返し, 範囲の重なり・アライメント・空きの結合を
+// 素朴な実装 (std::map) と比べて確かめ, 速さを表示する. HeapSuballocator にテクスチャを模した割り当てを置き,
+// 半分を解放して Defragment() で詰めた後に中身 (タグ) が正しく移っているか, ヒープが減るかを確かめる.
+// テクスチャごとにヒープを作る場合 (CreateCommittedResource, 64 KiB 単位) と使用量を比べる.
+// render-backend は main と同じ手順 (テクスチャ・バッファの作成, フレームごとの定数と頂点の更新, 区間ごとの並列記録) を
+// NullRenderBackend で GPU 無しに動かし, 1 フレームの CPU 時間とコマンドの内訳 (状態変更の数) を表示する.
+// 並列に記録したものが 1 スレッドで記録したものと一致するか, ファイルに書いて読み直して再生したものが一致するか,
+// テクスチャの差し替えで作ったリソースが全て破棄されるかを確かめる.
+// --capture を指定した場合は main が書き出したフレーム (kCaptureFrame) を読んで内訳を表示し, 再生を測る.
+// frame-pipeline は GPU の代わりに指定時間だけ眠るスレッドで FrameScheduler を動かし, 同時に投げるフレーム数ごとの
+// フレーム時間を表示する. GPU が使用中のスロットを CPU が再利用していないかも確かめる.
+// profiler は ProfileScope 1 つのコスト (記録先が無い場合とある場合) を測り, 複数のスレッドから記録した区間が
+// スレッドごとのリングバッファ (--events 個) に順に残っているか, 記録中に取ったスナップショットに上書き中の区間が
+// 混ざらないか, パーセンタイルと Chrome trace の JSON が正しいかを確かめる. --trace を指定した場合は trace を残す.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "baked_model.h"
+#include "bc_encoder.h"
+#include "command_recording.h"
+#include "compressed_texture_cache.h"
+#include "culling.h"
+#include "draw_list.h"
+#include "frame_scheduler.h"
+#include "hash.h"
+#include "heap_allocator.h"
+#include "image_decoder.h"
+#include "mapped_file.h"
+#include "mesh_lod.h"
+#include "material.h"
+#include "mip_generator.h"
+#include "mip_streamer.h"
+#include "model_loader.h"
+#include "null_render_backend.h"
+#include "pmd_file.h"
+#include "png_writer.h"
+#include "profiler.h"
+#include "skinning.h"
+#include "software_rasterizer.h"
+#include "texture_cache.h"
+#include "texture_content_store.h"
+#include "texture_sampler.h"
+#include "thread_pool.h"
+#include "upload_allocator.h"
+#include "vertex_compression.h"
+#include "vmd_motion.h"
+
+namespace fs = std::filesystem;
+
+// model-load でヒープの確保回数を数えるため, このプログラム全体の operator new を置き換える
+std::atomic<uint64_t> g_heap_allocations{0};
+
+void* operator new(std::size_t size) {
+  ++g_heap_allocations;
+  if (void* p = std::malloc(size != 0 ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+// std::stable_sort の一時バッファなどは nothrow 版で確保するので, 同じ malloc / free の組にそろえる
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  ++g_heap_allocations;
+  return std::malloc(size != 0 ? size : 1);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"  // 置き換えた new と対になっているので誤検出
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+namespace {
+
+/**
+ * @brief "--name value" 形式の引数
+ */
+class Options {
+ public:
+  explicit Options(const std::vector<std::string>& args) {
+    for (std::size_t i = 0; i + 1 < args.size(); i += 2) {
+      values_[args[i]] = args[i + 1];
+    }
+  }
+
+  std::string Get(const std::string& name, const std::string& default_value = {}) const {
+    auto it = values_.find(name);
+    return it == values_.end() ? default_value : it->second;
+  }
+
+  std::size_t GetSize(const std::string& name, std::size_t default_value) const {
+    auto it = values_.find(name);
+    return it == values_.end() ? default_value : std::strtoull(it->second.c_str(), nullptr, 10);
+  }
+
+ private:
+  std::map<std::string, std::string> values_;
+};
+
+/**
+ * @brief 1 回あたりの平均時間 (秒)
+ */
+double MeasureSeconds(std::size_t iterations, const std::function<void()>& f) {
+  f();  // ウォームアップ (メモリの確保やスレッドの起動を計測から外す)
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    f();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(iterations);
+}
+
+//////////////
+// skinning //
+//////////////
+
+int RunSkinning(const Options& options) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  // 入力
+  std::vector<PmdVertex> synthetic_vertices;
+  std::vector<PmdBone> synthetic_bones;
+  PmdSpan<PmdVertex> vertices;
+  PmdSpan<PmdBone> bones;
+  PmdFile pmd;
+  const std::string model_path = options.Get("--model");
+  if (!model_path.empty()) {
+    if (!pmd.Open(fs::u8path(model_path))) {
+      std::cerr << model_path << ": " << pmd.Error() << std::endl;
+      return EXIT_FAILURE;
+    }
+    vertices = pmd.Vertices();
+    bones = pmd.Bones();
+  } else {
+    synthetic_bones.resize(std::max<std::size_t>(options.GetSize("--bones", 128), 1));
+    for (std::size_t i = 0; i < synthetic_bones.size(); ++i) {
+      PmdBone& bone = synthetic_bones[i];
+      bone = {};
+      bone.parent_no = i == 0 ? kNoParentBone : static_cast<uint16_t>(rng() % i);
+      bone.head_pos = {dist(rng), dist(rng), dist(rng)};
+    }
+    synthetic_vertices.resize(options.GetSize("--vertices", 100000));
+    for (auto& v : synthetic_vertices) {
+      v = {};
+      v.pos = {dist(rng), dist(rng), dist(rng)};
+      v.normal = {dist(rng), dist(rng), dist(rng)};
+      v.bone_no[0] = static_cast<uint16_t>(rng() % synthetic_bones.size());
+      v.bone_no[1] = static_cast<uint16_t>(rng() % synthetic_bones.size());
+      v.weight = static_cast<uint8_t>(rng() % 101);
+    }
+    vertices = PmdSpan<PmdVertex>(synthetic_vertices.data(), synthetic_vertices.size());
+    bones = PmdSpan<PmdBone>(synthetic_bones.data(), synthetic_bones.size());
+  }
+
+  Skeleton skeleton;
+  skeleton.Build(bones);
+  std::vector<BonePose> pose(skeleton.BoneCount());
+  for (auto& p : pose) {
+    p.rotation = QuaternionRotationAxis({dist(rng), dist(rng), dist(rng)}, dist(rng));
+    p.translation = {dist(rng) * 0.1f, dist(rng) * 0.1f, dist(rng) * 0.1f};
+  }
+  std::vector<Matrix4> matrices;
+  skeleton.ComputeSkinningMatrices(pose, &matrices);
+  if (matrices.empty()) {
+    matrices.resize(1);
+  }
+
+  // キャラクター数分の入力を用意する (同じメッシュでも別々のメモリを読む)
+  const std::size_t instances = std::max<std::size_t>(options.GetSize("--instances", 1), 1);
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 20), 1);
+  std::vector<SkinningStreams> streams(instances, MakeSkinningStreams(vertices, skeleton.BoneCount()));
+  std::vector<SkinnedVertices> reference(instances);
+  std::vector<SkinnedVertices> simd(instances);
+  std::vector<SkinnedVertices> parallel(instances);
+  for (std::size_t i = 0; i < instances; ++i) {
+    reference[i].Resize(vertices.size());
+    simd[i].Resize(vertices.size());
+  }
+  ThreadPool pool(options.GetSize("--threads", 0));
+
+  const double total_vertices = static_cast<double>(vertices.size() * instances);
+  auto report = [&](const char* name, double seconds) {
+    std::cout << "  " << name << ": " << seconds * 1e3 << " ms/frame, " << total_vertices / seconds / 1e6
+              << " M vertices/s" << std::endl;
+  };
+  std::cout << "skinning: " << vertices.size() << " vertices x " << instances << " instances, "
+            << skeleton.BoneCount() << " bones, " << pool.ThreadCount() << " threads" << std::endl;
+
+  report("reference", MeasureSeconds(iterations, [&]() {
+           for (std::size_t i = 0; i < instances; ++i) {
+             SkinVerticesReference(streams[i], matrices, 0, vertices.size(), &reference[i]);
+           }
+         }));
+  report("simd     ", MeasureSeconds(iterations, [&]() {
+           for (std::size_t i = 0; i < instances; ++i) {
+             SkinVerticesSimd(streams[i], matrices, 0, vertices.size(), &simd[i]);
+           }
+         }));
+  report("parallel ", MeasureSeconds(iterations, [&]() {
+           for (std::size_t i = 0; i < instances; ++i) {
+             SkinVerticesParallel(pool, streams[i], matrices, &parallel[i]);
+           }
+         }));
+
+  // 参照実装との差 (丸め誤差の範囲であること)
+  float max_error = 0.0f;
+  for (std::size_t i = 0; i < instances; ++i) {
+    for (const SkinnedVertices* result : {&simd[i], &parallel[i]}) {
+      for (std::size_t v = 0; v < vertices.size(); ++v) {
+        max_error = std::max({max_error, std::fabs(result->px[v] - reference[i].px[v]),
+                              std::fabs(result->py[v] - reference[i].py[v]),
+                              std::fabs(result->pz[v] - reference[i].pz[v]),
+                              std::fabs(result->nx[v] - reference[i].nx[v]),
+                              std::fabs(result->ny[v] - reference[i].ny[v]),
+                              std::fabs(result->nz[v] - reference[i].nz[v])});
+      }
+    }
+  }
+  std::cout << "  max error vs reference: " << max_error << std::endl;
+  return max_error <= 1e-4f ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////
+// motion //
+////////////
+
+int RunMotion(const Options& options) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  // PMD のボーン番号は 16 bit (kNoParentBone は親無し)
+  const std::size_t bone_count = std::clamp<std::size_t>(options.GetSize("--bones", 128), 1, kNoParentBone);
+  const std::size_t key_count = std::max<std::size_t>(options.GetSize("--keys", 300), 1);
+  const std::size_t characters = std::max<std::size_t>(options.GetSize("--characters", 1000), 1);
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 300), 1);
+
+  // 半分のボーンは VMD の 15 bytes より長い名前にする (VMD 側では切られる)
+  std::vector<PmdBone> bones(bone_count);
+  for (std::size_t i = 0; i < bones.size(); ++i) {
+    bones[i] = {};
+    std::snprintf(bones[i].name, sizeof(bones[i].name), i % 2 == 0 ? "bone%u" : "%05u_long_bone_x",
+                  static_cast<unsigned int>(static_cast<uint16_t>(i)));
+    bones[i].parent_no = i == 0 ? kNoParentBone : static_cast<uint16_t>(rng() % i);
+  }
+  Skeleton skeleton;
+  skeleton.Build(PmdSpan<PmdBone>(bones.data(), bones.size()));
+
+  // VMD をメモリ上に組み立てる. キーの間隔はボーンごとにばらつかせ, ファイル上の順序もシャッフルする
+  std::vector<uint8_t> curve_palette(32 * 16);
+  for (auto& c : curve_palette) {
+    c = static_cast<uint8_t>(rng() % 128);
+  }
+  std::vector<VmdMotion> motions;
+  motions.reserve(bone_count * key_count);
+  for (std::size_t b = 0; b < bone_count; ++b) {
+    uint32_t frame = 0;
+    for (std::size_t k = 0; k < key_count; ++k) {
+      VmdMotion m = {};
+      std::memcpy(m.bone_name, bones[b].name, sizeof(m.bone_name));
+      m.frame_no = frame;
+      m.location = {dist(rng), dist(rng), dist(rng)};
+      const Quaternion q = QuaternionRotationAxis({dist(rng), dist(rng), dist(rng)}, dist(rng) * 3.0f);
+      m.quaternion[0] = q.x;
+      m.quaternion[1] = q.y;
+      m.quaternion[2] = q.z;
+      m.quaternion[3] = q.w;
+      // 実際のモーションは少ない種類のカーブ (半分は既定の直線) を使い回すので, 32 種類から選ぶ
+      const std::size_t curve = rng() % 64;
+      for (int i = 0; i < 16; ++i) {
+        m.interpolation[i] = curve < 32 ? static_cast<uint8_t>(i < 8 ? 20 : 107)
+                                        : curve_palette[(curve - 32) * 16 + i];
+      }
+      motions.push_back(m);
+      frame += 1 + rng() % 8;
+    }
+  }
+  std::shuffle(motions.begin(), motions.end(), rng);
+  VmdHeader header = {};
+  std::memcpy(header.signature, "Vocaloid Motion Data 0002", 25);
+  const uint32_t motion_count = static_cast<uint32_t>(motions.size());
+  std::vector<uint8_t> blob(sizeof(header) + sizeof(motion_count) + motions.size() * sizeof(VmdMotion));
+  std::memcpy(blob.data(), &header, sizeof(header));
+  std::memcpy(blob.data() + sizeof(header), &motion_count, sizeof(motion_count));
+  std::memcpy(blob.data() + sizeof(header) + sizeof(motion_count), motions.data(), motions.size() * sizeof(VmdMotion));
+
+  VmdFile vmd;
+  if (!vmd.Parse(blob.data(), blob.size())) {
+    std::cerr << "motion: " << vmd.Error() << std::endl;
+    return EXIT_FAILURE;
+  }
+  MotionClip clip;
+  auto build_start = std::chrono::steady_clock::now();
+  clip.Build(vmd, skeleton);
+  std::chrono::duration<double> build_seconds = std::chrono::steady_clock::now() - build_start;
+  for (std::size_t b = 0; b < bone_count; ++b) {
+    if (clip.Track(b).size() != key_count) {
+      std::cerr << "motion: bone " << bones[b].name << " has " << clip.Track(b).size() << " of " << key_count
+                << " keys" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  // 補間カーブの表がニュートン法で解いた曲線に近いこと
+  float max_curve_error = 0.0f;
+  for (const BezierTable& table : clip.CurveTables()) {
+    for (int i = 0; i <= 256; ++i) {
+      const float x = static_cast<float>(i) / 256.0f;
+      max_curve_error = std::max(max_curve_error, std::fabs(table.Evaluate(x) - table.curve.Evaluate(x)));
+    }
+  }
+
+  // キャラクターごとに再生位置をずらす. ループで先頭に戻るとき MotionPlayer は二分探索に切り替わる
+  const float loop = static_cast<float>(clip.FrameCount() + 1);
+  std::vector<float> offsets(characters);
+  for (auto& o : offsets) {
+    o = std::uniform_real_distribution<float>(0.0f, loop)(rng);
+  }
+  auto frame_of = [&](std::size_t c, std::size_t f) { return std::fmod(offsets[c] + static_cast<float>(f), loop); };
+
+  std::vector<MotionPlayer> players(characters, MotionPlayer(clip));
+  std::vector<std::vector<BonePose>> cursor_poses(characters);
+  std::vector<std::vector<BonePose>> search_poses(characters);
+
+  const double samples = static_cast<double>(characters * bone_count);
+  auto report = [&](const char* name, double seconds) {
+    std::cout << "  " << name << ": " << seconds * 1e3 << " ms/frame, " << samples / seconds / 1e6 << " M bones/s"
+              << std::endl;
+  };
+  std::cout << "motion: " << characters << " characters, " << bone_count << " bones, " << motions.size()
+            << " keys (" << clip.FrameCount() << " frames), build " << build_seconds.count() * 1e3 << " ms"
+            << std::endl;
+  std::cout << "  curve tables: " << clip.CurveTables().size() << ", max error vs newton " << max_curve_error
+            << std::endl;
+
+  // 1 回の計測で frames フレーム分を連続再生する
+  report("binary search", MeasureSeconds(1, [&]() {
+                                 for (std::size_t f = 0; f < frames; ++f) {
+                                   for (std::size_t c = 0; c < characters; ++c) {
+                                     clip.Sample(frame_of(c, f), &search_poses[c]);
+                                   }
+                                 }
+                               }) / static_cast<double>(frames));
+  report("cursor       ", MeasureSeconds(1, [&]() {
+                                 for (std::size_t f = 0; f < frames; ++f) {
+                                   for (std::size_t c = 0; c < characters; ++c) {
+                                     players[c].Sample(frame_of(c, f), &cursor_poses[c]);
+                                   }
+                                 }
+                               }) / static_cast<double>(frames));
+
+  // 最後のフレームの結果が一致すること
+  float max_error = 0.0f;
+  for (std::size_t c = 0; c < characters; ++c) {
+    clip.Sample(frame_of(c, frames - 1), &search_poses[c]);
+    for (std::size_t b = 0; b < bone_count; ++b) {
+      const BonePose& a = cursor_poses[c][b];
+      const BonePose& s = search_poses[c][b];
+      max_error = std::max({max_error, std::fabs(a.rotation.x - s.rotation.x), std::fabs(a.rotation.y - s.rotation.y),
+                            std::fabs(a.rotation.z - s.rotation.z), std::fabs(a.rotation.w - s.rotation.w),
+                            std::fabs(a.translation.x - s.translation.x), std::fabs(a.translation.y - s.translation.y),
+                            std::fabs(a.translation.z - s.translation.z)});
+    }
+  }
+  std::cout << "  max error vs binary search: " << max_error << std::endl;
+  return max_error <= 1e-5f && max_curve_error <= 1e-3f ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+///////////////
+// draw list //
+///////////////
+
+/**
+ * @brief コマンド列を実行した結果が元の描画と同じか確かめる
+ * @details ジオメトリごとに, 結合された描画が元の描画を連続して並べたもので, マテリアルも同じであること.
+ *          半透明の描画は全ての不透明の描画の後に奥から順に並んでいること.
+ */
+bool VerifyDrawList(const DrawListBuilder& builder, const std::vector<DrawItem>& items, std::string* error) {
+  struct Segment {
+    uint32_t geometry;
+    uint32_t offset;
+    uint32_t count;
+    uint32_t material;
+    std::size_t order;  // コマンド列での位置
+  };
+  std::vector<Segment> segments;
+  uint32_t geometry = ~0u;
+  uint32_t material = ~0u;
+  for (const DrawCommand& c : builder.Commands()) {
+    if (c.type == DrawCommandType::kSetGeometry) {
+      geometry = c.value;
+    } else if (c.type == DrawCommandType::kSetMaterial) {
+      material = c.value;
+    } else if (c.type == DrawCommandType::kDrawIndexed) {
+      segments.push_back({geometry, c.offset, c.value, material, segments.size()});
+    }
+  }
+
+  std::vector<const DrawItem*> sorted(items.size());
+  for (std::size_t i = 0; i < items.size(); ++i) {
+    sorted[i] = &items[i];
+  }
+  auto by_range = [](auto& a, auto& b) { return std::tie(a.geometry, a.offset) < std::tie(b.geometry, b.offset); };
+  std::sort(sorted.begin(), sorted.end(),
+            [](const DrawItem* a, const DrawItem* b) {
+              return std::tie(a->geometry, a->index_offset) < std::tie(b->geometry, b->index_offset);
+            });
+  std::vector<Segment> by_geometry = segments;
+  std::sort(by_geometry.begin(), by_geometry.end(), by_range);
+
+  std::vector<std::size_t> item_order(items.size());  // 元の描画がコマンド列の何番目の描画に入ったか
+  std::size_t next = 0;
+  for (const Segment& segment : by_geometry) {
+    uint32_t covered = 0;
+    while (covered < segment.count) {
+      if (next >= sorted.size() || sorted[next]->geometry != segment.geometry ||
+          sorted[next]->index_offset != segment.offset + covered || sorted[next]->material != segment.material) {
+        *error = "draw at geometry " + std::to_string(segment.geometry) + " offset " +
+                 std::to_string(segment.offset + covered) + " does not match the input";
+        return false;
+      }
+      item_order[sorted[next] - items.data()] = segment.order;
+      covered += sorted[next]->index_count;
+      ++next;
+    }
+    if (covered != segment.count) {
+      *error = "merged draw overruns the input ranges";
+      return false;
+    }
+  }
+  if (next != sorted.size()) {
+    *error = "some draws were dropped";
+    return false;
+  }
+
+  std::size_t last_opaque = 0;
+  std::size_t first_translucent = segments.size();
+  std::vector<std::pair<std::size_t, float>> translucent;
+  for (std::size_t i = 0; i < items.size(); ++i) {
+    if (items[i].translucent) {
+      first_translucent = std::min(first_translucent, item_order[i]);
+      translucent.push_back({item_order[i], items[i].depth});
+    } else {
+      last_opaque = std::max(last_opaque, item_order[i]);
+    }
+  }
+  if (!translucent.empty() && first_translucent < last_opaque) {
+    *error = "translucent draw precedes an opaque draw";
+    return false;
+  }
+  std::sort(translucent.begin(), translucent.end());
+  for (std::size_t i = 1; i < translucent.size(); ++i) {
+    // キーの量子化 (24 bit) の範囲で奥から手前に並ぶこと
+    if (translucent[i].second > translucent[i - 1].second + 1e-6f) {
+      *error = "translucent draws are not sorted back to front";
+      return false;
+    }
+  }
+  return true;
+}
+
+int RunDrawList(const Options& options) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 200), 1);
+  const std::size_t materials_per_model = std::max<std::size_t>(options.GetSize("--materials", 60), 1);
+  const std::size_t texture_count = std::max<std::size_t>(options.GetSize("--textures", 64), 1);
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 50), 1);
+
+  // マテリアルの重複が同一性だけで判定されていること
+  {
+    DrawListBuilder builder;
+    MaterialForHlsl a = {};
+    a.alpha = 1.0f;
+    MaterialForHlsl b = a;
+    b.specularity = 5.0f;
+    const uint32_t ma = builder.AddMaterial(a, {1, 0, 0, 2});
+    if (builder.AddMaterial(a, {1, 0, 0, 2}) != ma || builder.AddMaterial(b, {1, 0, 0, 2}) == ma ||
+        builder.AddMaterial(a, {1, 0, 0, 3}) == ma || builder.MaterialCount() != 3) {
+      std::cerr << "draw-list: material deduplication failed" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // シーン: キャラクターは数種類のテクスチャ・色の組み合わせを共有する (同じモデルの色違いなど)
+  struct SceneMaterial {
+    MaterialForHlsl constants;
+    TextureSet textures;
+    uint32_t pipeline;  // 輪郭線の有無などで使い分けるパイプライン
+  };
+  std::vector<SceneMaterial> palette(materials_per_model * 4);
+  for (auto& m : palette) {
+    m.constants = {};
+    m.constants.diffuse = {std::floor(unit(rng) * 4) / 4, std::floor(unit(rng) * 4) / 4, 1.0f};
+    m.constants.alpha = unit(rng) < 0.1f ? 0.5f : 1.0f;
+    m.constants.specularity = 5.0f;
+    m.textures = {1 + rng() % texture_count, 0, 0, 1000 + rng() % 10};
+    m.pipeline = static_cast<uint32_t>(rng() % 2);
+  }
+  std::vector<DrawItem> items;
+  std::vector<SceneMaterial> item_materials;
+  for (std::size_t model = 0; model < model_count; ++model) {
+    const float depth = unit(rng);
+    const std::size_t variant = rng() % 4;
+    uint32_t offset = 0;
+    for (std::size_t i = 0; i < materials_per_model; ++i) {
+      const SceneMaterial& m = palette[variant * materials_per_model + (unit(rng) < 0.3f ? 0 : i)];
+      DrawItem item;
+      item.pipeline = m.pipeline;
+      item.translucent = m.constants.alpha < 1.0f;
+      item.geometry = static_cast<uint32_t>(model);
+      item.index_offset = offset;
+      item.index_count = 3 * (1 + rng() % 1000);
+      item.depth = depth;
+      offset += item.index_count;
+      items.push_back(item);
+      item_materials.push_back(m);
+    }
+  }
+
+  DrawListBuilder builder;
+  auto build = [&]() {
+    builder.Clear();
+    for (std::size_t i = 0; i < items.size(); ++i) {
+      items[i].material = builder.AddMaterial(item_materials[i].constants, item_materials[i].textures);
+      builder.AddDraw(items[i]);
+    }
+    builder.Build();
+  };
+  const double seconds = MeasureSeconds(iterations, build);
+
+  const DrawListBuilder::Stats unsorted = DrawListBuilder::CountUnsortedStateChanges(items);
+  const DrawListBuilder::Stats& sorted = builder.GetStats();
+  auto report = [](const char* name, const DrawListBuilder::Stats& stats) {
+    std::cout << "  " << name << ": " << stats.draw_commands << " draws, " << stats.pipeline_changes
+              << " pipeline / " << stats.geometry_changes << " geometry / " << stats.material_changes
+              << " material changes" << std::endl;
+  };
+  std::cout << "draw-list: " << items.size() << " draws (" << model_count << " models x " << materials_per_model
+            << " materials), " << sorted.unique_materials << " unique materials" << std::endl;
+  std::cout << "  build: " << seconds * 1e3 << " ms, " << items.size() / seconds / 1e6 << " M draws/s, "
+            << builder.Commands().size() * sizeof(DrawCommand) << " bytes of commands" << std::endl;
+  report("unsorted", unsorted);
+  report("sorted  ", sorted);
+
+  std::string error;
+  if (!VerifyDrawList(builder, items, &error)) {
+    std::cerr << "draw-list: " << error << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "  verify: ok" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+/////////////
+// culling //
+/////////////
+
+/**
+ * @brief コマンド列を順に実行したときの描画と, そのときの状態
+ */
+std::vector<std::pair<DrawState, DrawCommand>> ReplayDraws(const std::vector<DrawCommand>& commands) {
+  std::vector<std::pair<DrawState, DrawCommand>> draws;
+  DrawState state;
+  for (const DrawCommand& command : commands) {
+    switch (command.type) {
+      case DrawCommandType::kSetPipeline:
+        state.pipeline = command.value;
+        break;
+      case DrawCommandType::kSetGeometry:
+        state.geometry = command.value;
+        break;
+      case DrawCommandType::kSetMaterial:
+        state.material = command.value;
+        break;
+      case DrawCommandType::kDrawIndexed:
+        draws.emplace_back(state, command);
+        break;
+    }
+  }
+  return draws;
+}
+
+int RunCulling(const Options& options) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 400), 1);
+  const std::size_t parts_per_model = std::max<std::size_t>(options.GetSize("--materials", 16), 1);
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 120), 1);
+  const std::size_t depth_width = std::max<std::size_t>(options.GetSize("--depth-width", 256), 1);
+  const std::size_t depth_height = std::max<std::size_t>(options.GetSize("--depth-height", 128), 1);
+
+  // シーン: 格子状に並べたモデル (マテリアルごとに箱 1 つ) と, 中央に立てた壁 (遮蔽物)
+  struct SceneMesh {
+    std::vector<float> px, py, pz;
+    std::vector<uint16_t> indices;
+  };
+  const float spacing = 4.0f;
+  const std::size_t columns = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(model_count))));
+  const float extent = spacing * static_cast<float>(columns);
+  std::vector<SceneMesh> meshes(model_count + 1);
+  auto add_box = [](SceneMesh* mesh, const Float3& lo, const Float3& hi) {
+    const auto base = static_cast<uint16_t>(mesh->px.size());
+    for (int corner = 0; corner < 8; ++corner) {
+      mesh->px.push_back(corner & 1 ? hi.x : lo.x);
+      mesh->py.push_back(corner & 2 ? hi.y : lo.y);
+      mesh->pz.push_back(corner & 4 ? hi.z : lo.z);
+    }
+    static const uint16_t kFaces[36] = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                                        2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    for (const uint16_t index : kFaces) {
+      mesh->indices.push_back(static_cast<uint16_t>(base + index));
+    }
+  };
+  DrawListBuilder builder;
+  std::vector<DrawItem> items;
+  for (std::size_t model = 0; model < model_count; ++model) {
+    const Float3 origin = {(static_cast<float>(model % columns) + 0.5f) * spacing - extent * 0.5f, 0.0f,
+                           (static_cast<float>(model / columns) + 0.5f) * spacing - extent * 0.5f};
+    SceneMesh& mesh = meshes[model];
+    for (std::size_t part = 0; part < parts_per_model; ++part) {
+      const Float3 lo = {origin.x + unit(rng) * 2.0f - 1.5f, origin.y + unit(rng) * 3.0f,
+                         origin.z + unit(rng) * 2.0f - 1.5f};
+      const Float3 size = {0.2f + unit(rng), 0.2f + unit(rng), 0.2f + unit(rng)};
+      DrawItem item;
+      item.geometry = static_cast<uint32_t>(model);
+      item.index_offset = static_cast<uint32_t>(mesh.indices.size());
+      item.index_count = 36;
+      add_box(&mesh, lo, lo + size);
+      MaterialForHlsl constants = {};
+      constants.diffuse = {static_cast<float>(part) / static_cast<float>(parts_per_model), 0.5f, 0.5f};
+      constants.alpha = 1.0f;
+      item.material = builder.AddMaterial(constants, {static_cast<uint32_t>(part + 1), 0, 0, 0});
+      builder.AddDraw(item);
+      items.push_back(item);
+    }
+  }
+  {
+    // 壁は両面が見える四角形 (三角形 2 つ) で, 格子の中央を横切る
+    SceneMesh& wall = meshes[model_count];
+    const float half = extent * 0.3f;
+    wall.px = {-half, half, -half, half};
+    wall.py = {0.0f, 0.0f, 12.0f, 12.0f};
+    wall.pz = {0.0f, 0.0f, 0.0f, 0.0f};
+    wall.indices = {0, 2, 1, 1, 2, 3};
+    MaterialForHlsl constants = {};
+    constants.alpha = 1.0f;
+    DrawItem item;
+    item.geometry = static_cast<uint32_t>(model_count);
+    item.index_count = 6;
+    item.material = builder.AddMaterial(constants, {0, 0, 0, 0});
+    builder.AddDraw(item);
+    items.push_back(item);
+  }
+  builder.Build();
+  const uint32_t wall_material = items.back().material;
+
+  std::vector<CullingMesh> culling_meshes;
+  for (const SceneMesh& mesh : meshes) {
+    CullingMesh m;
+    m.px = mesh.px.data();
+    m.py = mesh.py.data();
+    m.pz = mesh.pz.data();
+    m.vertex_count = mesh.px.size();
+    m.indices = mesh.indices.data();
+    m.index_count = mesh.indices.size();
+    culling_meshes.push_back(m);
+  }
+
+  DrawCuller::Options frustum_options;
+  DrawCuller frustum_culler(frustum_options);
+  frustum_culler.SetCommands(builder.Commands());
+  frustum_culler.UpdateBounds(culling_meshes);
+  DrawCuller::Options occlusion_options;
+  occlusion_options.occlusion = true;
+  occlusion_options.depth_width = static_cast<uint32_t>(depth_width);
+  occlusion_options.depth_height = static_cast<uint32_t>(depth_height);
+  DrawCuller occlusion_culler(occlusion_options);
+  // 判定を確かめられるように, 遮蔽物は壁だけにする
+  occlusion_culler.SetCommands(builder.Commands(), [&](uint32_t material) { return material == wall_material; });
+  occlusion_culler.UpdateBounds(culling_meshes);
+
+  const auto fail = [](const std::string& message) {
+    std::cerr << "culling: " << message << std::endl;
+    return EXIT_FAILURE;
+  };
+
+  // メッシュが無ければ全て見えるものとする
+  {
+    DrawCuller culler;
+    culler.SetCommands(builder.Commands());
+    const Matrix4 behind = MatrixLookAtLH({0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, -1.0f}, {0.0f, 1.0f, 0.0f}) *
+                           MatrixPerspectiveFovLH(1.0f, 1.0f, 1.0f, 2.0f);
+    culler.Cull(behind);
+    if (culler.GetStats().visible != culler.GetStats().draws) {
+      return fail("draws without bounds must stay visible");
+    }
+  }
+
+  // カメラ: シーンの周りを回りながら中心を見る
+  const float near_z = 0.5f;
+  const float far_z = extent * 2.0f;
+  const Matrix4 proj = MatrixPerspectiveFovLH(1.0f, 16.0f / 9.0f, near_z, far_z);
+  auto camera = [&](std::size_t frame) {
+    const float angle = 6.2831853f * static_cast<float>(frame) / static_cast<float>(frames);
+    const float radius = extent * 0.45f;
+    return Float3{std::cos(angle) * radius, 6.0f, std::sin(angle) * radius};
+  };
+  auto view_proj = [&](const Float3& eye) {
+    const Float3 target = {-eye.x, 2.0f, -eye.z};
+    return MatrixLookAtLH(eye, target, {0.0f, 1.0f, 0.0f}) * proj;
+  };
+
+  // 視錐台で除いた描画は, 全ての頂点がクリップ座標で同じ平面の外にあること
+  auto outside_one_plane = [&](const CullingMesh& mesh, uint32_t offset, uint32_t count, const Matrix4& matrix) {
+    int outside[6] = {};
+    for (uint32_t i = offset; i < offset + count; ++i) {
+      const uint16_t v = mesh.indices[i];
+      const Float4 c = Transform({mesh.px[v], mesh.py[v], mesh.pz[v], 1.0f}, matrix);
+      outside[0] += c.x < -c.w;
+      outside[1] += c.x > c.w;
+      outside[2] += c.y < -c.w;
+      outside[3] += c.y > c.w;
+      outside[4] += c.z < 0.0f;
+      outside[5] += c.z > c.w;
+    }
+    return std::any_of(std::begin(outside), std::end(outside),
+                       [&](int n) { return n == static_cast<int>(count); });
+  };
+  // 遮蔽物で除いた描画は, 箱の全ての頂点からカメラへの線分が壁と交わること
+  const SceneMesh& wall = meshes[model_count];
+  auto hidden_by_wall = [&](const Float3& eye, const Float3& p) {
+    const float dz = p.z - eye.z;
+    if (dz == 0.0f) {
+      return false;
+    }
+    const float t = (wall.pz[0] - eye.z) / dz;
+    if (t <= 0.0f || t >= 1.0f) {
+      return false;
+    }
+    const float x = eye.x + (p.x - eye.x) * t;
+    const float y = eye.y + (p.y - eye.y) * t;
+    return x >= wall.px[0] && x <= wall.px[1] && y >= wall.py[0] && y <= wall.py[2];
+  };
+
+  const auto expected_draws = ReplayDraws(builder.Commands());
+  uint64_t frustum_culled = 0;
+  uint64_t occlusion_culled = 0;
+  uint64_t visible = 0;
+  for (std::size_t frame = 0; frame < frames; ++frame) {
+    const Float3 eye = camera(frame);
+    const Matrix4 matrix = view_proj(eye);
+    const auto& frustum_commands = frustum_culler.Cull(matrix);
+    const auto& occlusion_commands = occlusion_culler.Cull(matrix);
+    const auto& frustum_visible = frustum_culler.Visibility();
+    const auto& occlusion_visible = occlusion_culler.Visibility();
+
+    // 残った描画を順に実行すると, 元の描画のうち見えるものが同じ状態で描かれること
+    for (const auto* culler : {&frustum_culler, &occlusion_culler}) {
+      const auto& commands = culler == &frustum_culler ? frustum_commands : occlusion_commands;
+      const auto replayed = ReplayDraws(commands);
+      std::size_t next = 0;
+      for (std::size_t i = 0; i < expected_draws.size(); ++i) {
+        if (!culler->Visibility()[i]) {
+          continue;
+        }
+        const auto& [state, command] = expected_draws[i];
+        if (next >= replayed.size() || replayed[next].first.pipeline != state.pipeline ||
+            replayed[next].first.geometry != state.geometry || replayed[next].first.material != state.material ||
+            replayed[next].second.offset != command.offset || replayed[next].second.value != command.value) {
+          return fail("culled commands differ from the visible draws at frame " + std::to_string(frame));
+        }
+        ++next;
+      }
+      if (next != replayed.size()) {
+        return fail("culled commands have extra draws at frame " + std::to_string(frame));
+      }
+    }
+
+    for (std::size_t i = 0; i < expected_draws.size(); ++i) {
+      const auto& [state, command] = expected_draws[i];
+      if (!frustum_visible[i] &&
+          !outside_one_plane(culling_meshes[state.geometry], command.offset, command.value, matrix)) {
+        return fail("draw " + std::to_string(i) + " inside the frustum was culled at frame " + std::to_string(frame));
+      }
+      if (frustum_visible[i] != 0 && occlusion_visible[i] == 0) {
+        const BoundingBox& box = occlusion_culler.Bounds()[i];
+        for (int corner = 0; corner < 8; ++corner) {
+          const Float3 p = {corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y,
+                            corner & 4 ? box.max.z : box.min.z};
+          if (!hidden_by_wall(eye, p)) {
+            return fail("draw " + std::to_string(i) + " not hidden by the wall was culled at frame " +
+                        std::to_string(frame));
+          }
+        }
+      }
+    }
+    frustum_culled += frustum_culler.GetStats().frustum_culled;
+    occlusion_culled += occlusion_culler.GetStats().occlusion_culled;
+    visible += occlusion_culler.GetStats().visible;
+  }
+  if (occlusion_culled == 0) {
+    return fail("the wall hid nothing (the scene should have occluded draws)");
+  }
+
+  std::size_t frame = 0;
+  const double frustum_seconds = MeasureSeconds(frames, [&]() { frustum_culler.Cull(view_proj(camera(frame++))); });
+  frame = 0;
+  const double occlusion_seconds =
+      MeasureSeconds(frames, [&]() { occlusion_culler.Cull(view_proj(camera(frame++))); });
+  const double bounds_seconds = MeasureSeconds(frames, [&]() { frustum_culler.UpdateBounds(culling_meshes); });
+
+  const std::size_t draws = expected_draws.size();
+  const double per_frame = static_cast<double>(frames);
+  std::cout << "culling: " << draws << " draws (" << model_count << " models x " << parts_per_model
+            << " materials + wall), " << frames << " frames, depth " << depth_width << "x" << depth_height << std::endl;
+  std::cout << "  per frame: " << visible / per_frame << " visible, " << frustum_culled / per_frame
+            << " frustum culled, " << occlusion_culled / per_frame << " occlusion culled" << std::endl;
+  std::cout << "  frustum:   " << frustum_seconds * 1e6 << " us/frame, " << frustum_seconds * 1e9 / draws
+            << " ns/draw" << std::endl;
+  std::cout << "  occlusion: " << occlusion_seconds * 1e6 << " us/frame, " << occlusion_seconds * 1e9 / draws
+            << " ns/draw (" << occlusion_culler.GetStats().occluder_triangles << " occluder triangles)" << std::endl;
+  std::cout << "  bounds:    " << bounds_seconds * 1e6 << " us" << std::endl;
+  std::cout << "  verify: ok" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+/////////
+// lod //
+/////////
+
+/**
+ * @brief UV 球 (経度 0 / 1 に UV の継ぎ目) を作る
+ * @details 下半分はボーン 0, 上半分はボーン 1 に従い, 赤道の 1 周だけ半分ずつ影響を受ける.
+ *          緯度の 1/4 より下をマテリアル 0, 上をマテリアル 1 にする.
+ */
+void MakeLodTestSphere(std::size_t rings, std::size_t segments, std::vector<PmdVertex>* vertices,
+                       std::vector<uint16_t>* indices, std::vector<uint32_t>* index_counts) {
+  const float pi = 3.14159265f;
+  vertices->clear();
+  for (std::size_t r = 0; r <= rings; ++r) {
+    const float theta = pi * static_cast<float>(r) / static_cast<float>(rings);
+    const float ring_radius = r == 0 || r == rings ? 0.0f : std::sin(theta);  // 極は 1 点に潰す
+    for (std::size_t s = 0; s <= segments; ++s) {
+      // 継ぎ目の両側が同じ位置になるよう, 最後の列は最初の列の座標をそのまま使う
+      const float phi = 2.0f * pi * static_cast<float>(s % segments) / static_cast<float>(segments);
+      PmdVertex v = {};
+      v.pos = {ring_radius * std::cos(phi), -std::cos(theta), ring_radius * std::sin(phi)};
+      v.normal = v.pos;
+      v.uv = {static_cast<float>(s) / static_cast<float>(segments), static_cast<float>(r) / static_cast<float>(rings)};
+      v.bone_no[0] = r * 2 < rings ? 0 : 1;
+      v.bone_no[1] = r * 2 < rings ? 1 : 0;
+      v.weight = r * 2 == rings ? 50 : 100;
+      vertices->push_back(v);
+    }
+  }
+  indices->clear();
+  index_counts->assign(2, 0);
+  for (std::size_t r = 0; r < rings; ++r) {
+    for (std::size_t s = 0; s < segments; ++s) {
+      const auto i0 = static_cast<uint16_t>(r * (segments + 1) + s);
+      const auto i1 = static_cast<uint16_t>(i0 + 1);
+      const auto i2 = static_cast<uint16_t>(i0 + segments + 1);
+      const auto i3 = static_cast<uint16_t>(i2 + 1);
+      // 外から見て時計回り
+      for (const uint16_t i : {i0, i2, i1, i1, i2, i3}) {
+        indices->push_back(i);
+      }
+      (*index_counts)[r * 4 < rings ? 0 : 1] += 6;
+    }
+  }
+}
+
+int RunLod(const Options& options) {
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 5), 1);
+  LodOptions lod_options;
+  lod_options.max_levels = std::max<std::size_t>(options.GetSize("--levels", 4), 1);
+
+  // 入力
+  std::vector<PmdVertex> synthetic_vertices;
+  std::vector<uint16_t> synthetic_indices;
+  std::vector<uint32_t> index_counts;
+  PmdSpan<PmdVertex> vertices;
+  PmdSpan<uint16_t> indices;
+  PmdFile pmd;
+  const std::string model_path = options.Get("--model");
+  if (!model_path.empty()) {
+    if (!pmd.Open(fs::u8path(model_path))) {
+      std::cerr << model_path << ": " << pmd.Error() << std::endl;
+      return EXIT_FAILURE;
+    }
+    vertices = pmd.Vertices();
+    indices = pmd.Indices();
+    for (const PmdMaterial& material : pmd.Materials()) {
+      index_counts.push_back(static_cast<uint32_t>(material.indicesNum));  // 1 byte アライメントなので値で渡す
+    }
+  } else {
+    const std::size_t rings = std::clamp<std::size_t>(options.GetSize("--rings", 96), 4, 240);
+    const std::size_t segments = std::clamp<std::size_t>(options.GetSize("--segments", 192), 4, 240);
+    MakeLodTestSphere(rings, segments, &synthetic_vertices, &synthetic_indices, &index_counts);
+    vertices = PmdSpan<PmdVertex>(synthetic_vertices.data(), synthetic_vertices.size());
+    indices = PmdSpan<uint16_t>(synthetic_indices.data(), synthetic_indices.size());
+  }
+  const bool synthetic = model_path.empty();
+
+  const auto fail = [](const std::string& message) {
+    std::cerr << "lod: " << message << std::endl;
+    return EXIT_FAILURE;
+  };
+
+  MeshLods lods;
+  const double seconds =
+      MeasureSeconds(iterations, [&]() { lods = GenerateMeshLods(vertices, indices, index_counts, lod_options); });
+  std::cout << "lod: " << vertices.size() << " vertices, " << lods.levels[0].triangles << " triangles, "
+            << index_counts.size() << " materials, generate " << seconds * 1e3 << " ms" << std::endl;
+
+  const float extent = 2.0f * lods.radius;
+  auto edge_skin_distance = [&](const uint16_t* tri) {
+    float distance = 0.0f;
+    for (int e = 0; e < 3; ++e) {
+      const PmdVertex& a = vertices[tri[e]];
+      const PmdVertex& b = vertices[tri[(e + 1) % 3]];
+      const float wa = a.weight / 100.0f;
+      const float wb = b.weight / 100.0f;
+      // 同じ 2 本のボーン (順序は問わない) の影響度の差
+      const float a1 = a.bone_no[0] == 1 ? wa : 1.0f - wa;
+      const float b1 = b.bone_no[0] == 1 ? wb : 1.0f - wb;
+      distance = std::max(distance, std::fabs(a1 - b1));
+    }
+    return distance;
+  };
+  // LOD 0 のマテリアルごとに使われている頂点
+  std::vector<std::vector<uint8_t>> material_vertices(index_counts.size(), std::vector<uint8_t>(vertices.size(), 0));
+  float base_skin_distance = 0.0f;
+  {
+    std::size_t offset = 0;
+    for (std::size_t m = 0; m < index_counts.size(); ++m) {
+      for (std::size_t i = 0; i < lods.levels[0].index_counts[m]; ++i) {
+        material_vertices[m][indices[offset + i]] = 1;
+      }
+      for (std::size_t i = 0; synthetic && i + 3 <= lods.levels[0].index_counts[m]; i += 3) {
+        base_skin_distance = std::max(base_skin_distance, edge_skin_distance(indices.data() + offset + i));
+      }
+      offset += lods.levels[0].index_counts[m];
+    }
+  }
+
+  for (std::size_t level = 0; level < lods.levels.size(); ++level) {
+    const MeshLodLevel& lod = lods.levels[level];
+    std::cout << "  level " << level << ": " << lod.triangles << " triangles ("
+              << 100.0 * lod.triangles / lods.levels[0].triangles << " %), error " << lod.error << " ("
+              << 100.0f * lod.error / extent << " % of size)" << std::endl;
+    if (lod.index_counts.size() != index_counts.size()) {
+      return fail("level " + std::to_string(level) + " has a wrong number of materials");
+    }
+    if (level > 0 && lod.triangles >= lods.levels[level - 1].triangles) {
+      return fail("level " + std::to_string(level) + " did not reduce triangles");
+    }
+    std::size_t offset = lod.index_offset;
+    for (std::size_t m = 0; m < index_counts.size(); ++m) {
+      const uint32_t count = lod.index_counts[m];
+      if (count % 3 != 0 || offset + count > lods.indices.size()) {
+        return fail("level " + std::to_string(level) + " material " + std::to_string(m) + " has a broken range");
+      }
+      for (std::size_t i = 0; i < count; i += 3) {
+        const uint16_t* tri = lods.indices.data() + offset + i;
+        for (int k = 0; k < 3; ++k) {
+          if (tri[k] >= vertices.size() || !material_vertices[m][tri[k]]) {
+            return fail("level " + std::to_string(level) + " uses a vertex outside material " + std::to_string(m));
+          }
+        }
+        if (!synthetic) {
+          continue;
+        }
+        // 継ぎ目をまたぐ三角形は UV がテクスチャの端から端まで伸びる
+        const float u[3] = {vertices[tri[0]].uv.x, vertices[tri[1]].uv.x, vertices[tri[2]].uv.x};
+        if (*std::max_element(u, u + 3) - *std::min_element(u, u + 3) > 0.5f) {
+          return fail("level " + std::to_string(level) + " has a triangle across the uv seam");
+        }
+        if (edge_skin_distance(tri) > base_skin_distance) {
+          return fail("level " + std::to_string(level) + " joins vertices with different bone weights");
+        }
+        // 球なので全ての三角形は外を向く (外から見て時計回りなら左手系の外積は外向き)
+        const Float3 p[3] = {{vertices[tri[0]].pos.x, vertices[tri[0]].pos.y, vertices[tri[0]].pos.z},
+                             {vertices[tri[1]].pos.x, vertices[tri[1]].pos.y, vertices[tri[1]].pos.z},
+                             {vertices[tri[2]].pos.x, vertices[tri[2]].pos.y, vertices[tri[2]].pos.z}};
+        // 面積がほぼ 0 の三角形 (極の三角形など) は向きが丸め誤差で決まるので判定しない.
+        // 向きは外積と中心方向のなす角の余弦で比べる (FMA などで演算の丸めが変わっても結果が変わらないように)
+        constexpr float kDegenerateSine = 1e-4f;  // これより辺のなす角の正弦が小さければ面積 0 とみなす
+        constexpr float kFlipCosine = 1e-4f;      // これより外積が中心方向から逆を向けば裏返りとみなす
+        const Float3 edge1 = p[1] - p[0];
+        const Float3 edge2 = p[2] - p[0];
+        const Float3 normal = Cross(edge1, edge2);
+        const float normal_length = Length(normal);
+        if (normal_length <= kDegenerateSine * Length(edge1) * Length(edge2)) {
+          continue;
+        }
+        const Float3 center = p[0] + p[1] + p[2];
+        if (Dot(normal, center) < -kFlipCosine * normal_length * Length(center)) {
+          return fail("level " + std::to_string(level) + " has a flipped triangle");
+        }
+      }
+      offset += count;
+    }
+  }
+  if (synthetic && (lods.levels.size() < 2 || lods.levels[1].triangles > lods.levels[0].triangles * 6 / 10)) {
+    return fail("the sphere was not simplified to about half");
+  }
+
+  // 画面上の大きさによる選択: 遠いほど粗く, 選んだ段の誤差は許容する画素数以下
+  const float viewport_height = 1080.0f;
+  const float max_pixel_error = 1.0f;
+  const Matrix4 proj = MatrixPerspectiveFovLH(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+  uint32_t previous = 0;
+  std::size_t selected_triangles = 0;
+  const std::size_t distances = 200;
+  std::vector<std::size_t> level_histogram(lods.levels.size(), 0);
+  for (std::size_t i = 0; i < distances; ++i) {
+    const float distance = lods.radius * 0.5f * std::pow(1.03f, static_cast<float>(i));
+    const Matrix4 world_view = MatrixTranslation(Float3{0.0f, 0.0f, distance} - lods.center);
+    const uint32_t level = SelectLodLevel(lods, world_view, proj, viewport_height, max_pixel_error);
+    if (level < previous) {
+      return fail("a farther camera selected a finer level");
+    }
+    if (i == 0 && level != 0) {
+      return fail("a camera inside the bounds must select level 0");
+    }
+    const float nearest = distance - lods.radius;
+    if (level != 0 &&
+        lods.levels[level].error * proj.m[1][1] * viewport_height * 0.5f / nearest > max_pixel_error * 1.001f) {
+      return fail("the selected level exceeds the pixel error");
+    }
+    previous = level;
+    selected_triangles += lods.levels[level].triangles;
+    ++level_histogram[level];
+  }
+  std::cout << "  select: " << distances << " distances (0.5 - " << 0.5f * std::pow(1.03f, distances - 1.0f)
+            << " x radius), levels";
+  for (const std::size_t count : level_histogram) {
+    std::cout << " " << count;
+  }
+  std::cout << ", " << 100.0 * selected_triangles / (lods.levels[0].triangles * distances)
+            << " % of the full triangles" << std::endl;
+  std::cout << "  verify: ok" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+////////////////
+// model-load //
+////////////////
+
+/**
+ * @brief 最小限の PMD (ヘッダー・頂点・インデックス・マテリアル) を作る
+ * @details マテリアル i は tex(i % textures).bmp を参照し, 3 つに 1 つは sph も持つ. トゥーンは 10 種類を順に使う.
+ *          頂点は格子状に並べ, 三角形 (頂点とほぼ同数) をマテリアルに均等に振り分ける.
+ * @param texture_extension tex の拡張子 (sph は常に .sph)
+ */
+std::vector<uint8_t> MakeSyntheticPmd(uint32_t material_count, uint32_t texture_count, uint32_t vertex_count = 3,
+                                      const char* texture_extension = "bmp") {
+  std::vector<uint8_t> data;
+  auto append = [&data](const void* p, std::size_t size) {
+    data.insert(data.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + size);
+  };
+  PmdHeader header = {};
+  std::memcpy(header.signature, "Pmd", 3);
+  header.version = 1.0f;
+  append(&header, sizeof(header));
+  vertex_count = std::clamp<uint32_t>(vertex_count, 3, 65535);  // インデックスは 16 bit
+  append(&vertex_count, sizeof(vertex_count));
+  for (uint32_t i = 0; i < vertex_count; ++i) {
+    PmdVertex v = {};
+    v.pos = {float(i % 256), float(i / 256), 0.0f};
+    v.normal = {0.0f, 0.0f, -1.0f};
+    v.uv = {float(i % 256) / 255.0f, float(i / 256 % 256) / 255.0f};
+    v.weight = 100;
+    append(&v, sizeof(v));
+  }
+  const uint32_t triangles_per_material = std::max(vertex_count / material_count, 1u);
+  const uint32_t index_count = 3 * triangles_per_material * material_count;
+  append(&index_count, sizeof(index_count));
+  for (uint32_t i = 0; i < index_count; ++i) {
+    const uint16_t index = static_cast<uint16_t>((i / 3 + i % 3) % vertex_count);
+    append(&index, sizeof(index));
+  }
+  append(&material_count, sizeof(material_count));
+  for (uint32_t i = 0; i < material_count; ++i) {
+    PmdMaterial m = {};
+    m.diffuse = {1.0f, 1.0f, 1.0f};
+    m.alpha = 1.0f;
+    m.toonIdx = static_cast<uint8_t>(i % 10);
+    m.indicesNum = 3 * triangles_per_material;
+    const uint32_t t = i % std::max(texture_count, 1u);
+    if (i % 3 == 0) {
+      std::snprintf(m.texFilePath, sizeof(m.texFilePath), "tex%02u.%s*sph%02u.sph", t % 100, texture_extension,
+                    t % 100);
+    } else {
+      std::snprintf(m.texFilePath, sizeof(m.texFilePath), "tex%02u.%s", t % 100, texture_extension);
+    }
+    append(&m, sizeof(m));
+  }
+  return data;
+}
+
+int RunModelLoad(const Options& options) {
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 100), 1);
+  const uint32_t material_count = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--materials", 40), 1, 4096));
+  const uint32_t texture_count = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--textures", 8), 1, 100));
+  ThreadPool pool(options.GetSize("--threads", 0));
+
+  const fs::path dir = fs::temp_directory_path() / "perf-bench-model-load";
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  const fs::path model_path = dir / "model.pmd";
+  {
+    const std::vector<uint8_t> pmd = MakeSyntheticPmd(material_count, texture_count);
+    std::ofstream ofs(model_path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(pmd.data()), static_cast<std::streamsize>(pmd.size()));
+    if (!ofs) {
+      std::cerr << model_path.u8string() << ": write failed" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // テクスチャは全て同じ画像を返す (ローダー自身の確保だけを数える)
+  auto image = std::make_shared<Image>();
+  image->format = PixelFormat::kRGBA8;
+  image->width = image->height = 1;
+  image->row_pitch = 4;
+  image->pixels.assign(4, 0xff);
+  std::atomic<uint64_t> decode_calls{0};
+  ModelLoader loader(pool, [&](const fs::path&) {
+    ++decode_calls;
+    return image;
+  });
+  const std::vector<fs::path> paths(model_count, model_path);
+
+  bool ok = true;
+  // 1 回目はスクラッチアリーナのブロックを確保するので, 2 回目を測る
+  std::vector<std::shared_ptr<LoadedModel>> models;
+  double seconds = 0.0;
+  uint64_t heap_allocations = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    models.clear();
+    const uint64_t allocations_before = g_heap_allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    auto futures = loader.LoadAsync(paths);
+    for (auto& future : futures) {
+      try {
+        models.push_back(future.get());
+      } catch (const std::exception& e) {
+        std::cerr << "model-load: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    heap_allocations = g_heap_allocations.load() - allocations_before;
+  }
+  const auto stats = loader.GetStats();
+
+  // 以前の方法: マテリアルごとに 4 つのパスを作り, パスごとにデコードを依頼する
+  const uint64_t legacy_before = g_heap_allocations.load();
+  {
+    PmdFile pmd;
+    pmd.Open(model_path);
+    for (std::size_t m = 0; m < model_count; ++m) {
+      std::vector<MaterialTexturePaths> texture_paths;
+      for (const PmdMaterial& material : pmd.Materials()) {
+        texture_paths.push_back(ResolveMaterialTexturePaths(model_path, material));
+      }
+    }
+  }
+  const uint64_t legacy_allocations = g_heap_allocations.load() - legacy_before;
+
+  const LoadedModel& model = *models.front();
+  std::cout << "model-load: " << model_count << " models x " << material_count << " materials, "
+            << model.texture_files.size() << " unique textures per model, " << pool.ThreadCount() << " threads"
+            << std::endl;
+  std::cout << "  load: " << seconds * 1e3 << " ms, " << seconds / model_count * 1e6 << " us/model" << std::endl;
+  std::cout << "  heap allocations: " << heap_allocations << " (" << double(heap_allocations) / model_count
+            << " per model, including futures and texture tasks)" << std::endl;
+  std::cout << "  arena: " << stats.arena_allocations << " allocations in " << stats.arena_blocks << " blocks, "
+            << stats.scratch_arenas << " scratch arenas, scratch peak " << stats.peak_scratch_bytes
+            << " bytes, model arenas " << stats.model_arena_bytes / double(stats.models) << " bytes/model"
+            << std::endl;
+  std::cout << "  per-material path resolution (previous loader): " << legacy_allocations << " heap allocations ("
+            << double(legacy_allocations) / model_count << " per model)" << std::endl;
+
+  // 内容の確認: マテリアルごとのテクスチャが正しく配られている
+  const PmdMaterial* materials = nullptr;
+  PmdFile pmd;
+  if (pmd.Open(model_path)) {
+    materials = pmd.Materials().data();
+  }
+  for (uint32_t i = 0; ok && materials != nullptr && i < material_count; ++i) {
+    const MaterialTexturePaths expected = ResolveMaterialTexturePaths(model_path, materials[i]);
+    const auto& indices = model.texture_indices[i];
+    auto path = [&](uint32_t index) {
+      return index == MaterialTextureIndices::kNoTexture ? fs::path() : model.texture_files[index];
+    };
+    ok = path(indices.tex) == expected.tex && path(indices.sph) == expected.sph && path(indices.spa) == expected.spa &&
+         path(indices.toon) == expected.toon && model.textures[i].tex == image && model.textures[i].toon == image &&
+         (model.textures[i].sph != nullptr) == !expected.sph.empty();
+    if (!ok) {
+      std::cerr << "model-load: material " << i << " textures differ from ResolveMaterialTexturePaths" << std::endl;
+    }
+  }
+  if (decode_calls.load() != 2 * model_count * model.texture_files.size()) {
+    std::cerr << "model-load: each unique texture should be requested once per model" << std::endl;
+    ok = false;
+  }
+  models.clear();
+  fs::remove_all(dir, ec);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//////////
+// mips //
+//////////
+
+int RunMips(const Options& options) {
+  std::mt19937 rng(12345);
+  const uint32_t size = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--size", 2048), 1, 16384));
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 5), 1);
+  ThreadPool pool(options.GetSize("--threads", 0));
+
+  auto make_image = [&](uint32_t width, uint32_t height) {
+    Image image;
+    image.format = PixelFormat::kRGBA8;
+    image.width = width;
+    image.height = height;
+    image.row_pitch = std::size_t(width) * 4;
+    image.pixels.resize(image.row_pitch * height);
+    for (auto& p : image.pixels) {
+      p = static_cast<uint8_t>(rng());
+    }
+    return image;
+  };
+  auto chain_bytes = [](const std::vector<Image>& chain) {
+    std::size_t bytes = 0;
+    for (const auto& level : chain) {
+      bytes += level.SizeInBytes();
+    }
+    return bytes;
+  };
+  auto same_chain = [](const std::vector<Image>& a, const std::vector<Image>& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i) {
+      if (a[i].width != b[i].width || a[i].height != b[i].height || a[i].pixels != b[i].pixels) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  bool ok = true;
+  // 2 の累乗と, 奇数の辺を含むもの
+  const Image images[] = {make_image(size, size), make_image(std::max<uint32_t>(size / 2 - 1, 1), size / 4 + 3)};
+  std::cout << "mips: " << pool.ThreadCount() << " threads" << std::endl;
+  for (const Image& image : images) {
+    struct Variant {
+      const char* name;
+      MipGenerationOptions options;
+      ThreadPool* pool;
+    };
+    MipGenerationOptions scalar_options;
+    scalar_options.use_simd = false;
+    MipGenerationOptions gamma_options;
+    gamma_options.gamma_correct = true;
+    const Variant variants[] = {
+        {"box scalar", scalar_options, nullptr},
+        {"box simd", {}, nullptr},
+        {"box simd parallel", {}, &pool},
+        {"gamma parallel", gamma_options, &pool},
+    };
+    std::vector<Image> reference;
+    std::cout << "  " << image.width << "x" << image.height << " (" << CountMipLevels(image.width, image.height)
+              << " levels)" << std::endl;
+    for (const Variant& variant : variants) {
+      std::vector<Image> chain;
+      const double seconds =
+          MeasureSeconds(iterations, [&]() { chain = GenerateMipChain(image, variant.options, variant.pool); });
+      std::cout << "    " << variant.name << ": " << seconds * 1e3 << " ms, "
+                << (chain_bytes(chain) - image.SizeInBytes()) / seconds / (1 << 20) << " MiB/s written" << std::endl;
+      if (chain.size() != CountMipLevels(image.width, image.height) || chain.back().width != 1 ||
+          chain.back().height != 1) {
+        std::cerr << "mips: " << variant.name << ": unexpected chain shape" << std::endl;
+        ok = false;
+      }
+      if (!variant.options.gamma_correct) {
+        if (reference.empty()) {
+          reference = chain;
+        } else if (!same_chain(reference, chain)) {
+          std::cerr << "mips: " << variant.name << " differs from scalar reference" << std::endl;
+          ok = false;
+        }
+      }
+    }
+  }
+
+  // 既知の値: 単色は単色のまま, 黒と白の市松模様は box で 128, ガンマ補正で sRGB の 188 になる
+  Image checker = make_image(4, 4);
+  for (uint32_t y = 0; y < 4; ++y) {
+    for (uint32_t x = 0; x < 4; ++x) {
+      std::memset(checker.Row(y) + x * 4, (x + y) % 2 ? 0xff : 0x00, 4);
+    }
+  }
+  MipGenerationOptions gamma_options;
+  gamma_options.gamma_correct = true;
+  const Image box = DownsampleImage(checker);
+  const Image gamma = DownsampleImage(checker, gamma_options);
+  if (box.Row(0)[0] != 128 || gamma.Row(0)[0] != 188 || gamma.Row(0)[3] != 128) {
+    std::cerr << "mips: checker average mismatch (" << int(box.Row(0)[0]) << ", " << int(gamma.Row(0)[0]) << ")"
+              << std::endl;
+    ok = false;
+  }
+
+  // ストリーミング: テクスチャが 1 列に並んでいて, カメラが見ている範囲を毎フレーム要求する.
+  // 近いものほど細かいミップを要求する
+  const std::size_t texture_count = std::max<std::size_t>(options.GetSize("--textures", 400), 1);
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 600), 1);
+  MipStreamer::Options streamer_options;
+  streamer_options.budget_bytes = options.GetSize("--budget-mb", 256) << 20;
+  streamer_options.upload_bytes_per_update = std::size_t(32) << 20;
+  MipStreamer streamer(streamer_options);
+  std::uniform_int_distribution<uint32_t> size_dist(8, 11);  // 256 - 2048
+  for (std::size_t i = 0; i < texture_count; ++i) {
+    const uint32_t s = 1u << size_dist(rng);
+    streamer.Register(i, s, s, CountMipLevels(s, s), 4);
+  }
+  const std::size_t visible = std::max<std::size_t>(texture_count / 10, 1);
+  std::size_t satisfied_frames = 0;
+  std::size_t max_resident = 0;
+  // 状態が変わっていくのでウォームアップはしない
+  const auto stream_start = std::chrono::steady_clock::now();
+  for (std::size_t frame = 0; frame < frames; ++frame) {
+    const std::size_t camera = frame * texture_count / frames;
+    for (std::size_t k = 0; k < visible; ++k) {
+      streamer.Request((camera + k) % texture_count, static_cast<float>(k * 4 / visible));
+    }
+    streamer.Update();
+    const auto stats = streamer.GetStats();
+    max_resident = std::max(max_resident, stats.resident_bytes);
+    satisfied_frames += stats.waiting_textures == 0 ? 1 : 0;
+  }
+  const std::chrono::duration<double> stream_seconds = std::chrono::steady_clock::now() - stream_start;
+  const auto stats = streamer.GetStats();
+  std::cout << "  streaming: " << stats.textures << " textures, " << frames << " frames, "
+            << stream_seconds.count() / frames * 1e6 << " us/update" << std::endl;
+  std::cout << "    resident " << stats.resident_bytes / double(1 << 20) << " MiB (peak "
+            << stats.peak_resident_bytes / double(1 << 20) << " MiB, budget " << stats.budget_bytes / double(1 << 20)
+            << " MiB, all mips " << stats.full_bytes / double(1 << 20) << " MiB)" << std::endl;
+  std::cout << "    streamed in " << stats.levels_streamed_in << " levels (" << stats.bytes_streamed_in / double(1 << 20)
+            << " MiB), out " << stats.levels_streamed_out << " levels, " << stats.budget_stalls
+            << " budget stalls, requests satisfied in " << satisfied_frames << " / " << frames << " frames"
+            << std::endl;
+  if (max_resident > stats.budget_bytes && stats.levels_streamed_in != 0) {
+    std::cerr << "mips: resident size exceeded the budget" << std::endl;
+    ok = false;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////
+// bc //
+////////
+
+/**
+ * @brief テクスチャらしい画像 (なめらかなグラデーション + 塗り分けの境界 + 弱いノイズ)
+ * @param cutout true ならアルファに抜き (0) と半透明のグラデーションを入れる
+ */
+Image MakeTextureLikeImage(uint32_t width, uint32_t height, bool cutout, std::mt19937& rng) {
+  Image image;
+  image.format = PixelFormat::kRGBA8;
+  image.width = width;
+  image.height = height;
+  image.row_pitch = std::size_t(width) * 4;
+  image.pixels.resize(image.row_pitch * height);
+  std::uniform_int_distribution<int> noise(-6, 6);
+  for (uint32_t y = 0; y < height; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      const float u = static_cast<float>(x) / width;
+      const float v = static_cast<float>(y) / height;
+      // 円の内側と外側で色相を変える (アニメ調の塗り分け)
+      const bool inside = (u - 0.5f) * (u - 0.5f) + (v - 0.5f) * (v - 0.5f) < 0.09f;
+      const float base[3] = {inside ? 230.0f : 60.0f + 120.0f * u, inside ? 180.0f : 90.0f + 100.0f * v,
+                             inside ? 160.0f - 60.0f * v : 200.0f - 80.0f * u};
+      const float wave = 20.0f * std::sin(u * 40.0f) * std::cos(v * 25.0f);
+      uint8_t* p = image.Row(y) + std::size_t(x) * 4;
+      for (int c = 0; c < 3; ++c) {
+        p[c] = static_cast<uint8_t>(std::clamp(base[c] + wave + noise(rng), 0.0f, 255.0f));
+      }
+      p[3] = cutout ? static_cast<uint8_t>(u < 0.25f ? 0 : std::min(255.0f, 255.0f * v + 32.0f)) : 255;
+    }
+  }
+  return image;
+}
+
+int RunBc(const Options& options) {
+  std::mt19937 rng(12345);
+  const uint32_t size = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--size", 1024), 4, 16384)) & ~3u;
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 3), 1);
+  ThreadPool pool(options.GetSize("--threads", 0));
+  const Image opaque = MakeTextureLikeImage(size, size, false, rng);
+  const Image cutout = MakeTextureLikeImage(size, size, true, rng);
+  const double pixels = double(size) * size;
+
+  struct Case {
+    const char* name;
+    const Image* image;
+    PixelFormat format;
+    double min_psnr;  // これを下回ったら失敗 (RGB + アルファ)
+  };
+  const Case cases[] = {
+      {"bc1 opaque", &opaque, PixelFormat::kBC1, 32.0},
+      {"bc3 cutout", &cutout, PixelFormat::kBC3, 32.0},
+      {"bc7 opaque", &opaque, PixelFormat::kBC7, 38.0},
+      {"bc7 cutout", &cutout, PixelFormat::kBC7, 38.0},
+  };
+  BcEncodeOptions scalar_options;
+  scalar_options.use_simd = false;
+
+  bool ok = true;
+  std::cout << "bc: " << size << "x" << size << ", " << pool.ThreadCount() << " threads" << std::endl;
+  for (const Case& c : cases) {
+    Image scalar;
+    Image simd;
+    Image parallel;
+    const double scalar_seconds =
+        MeasureSeconds(iterations, [&]() { scalar = CompressImage(*c.image, c.format, scalar_options); });
+    const double simd_seconds = MeasureSeconds(iterations, [&]() { simd = CompressImage(*c.image, c.format); });
+    const double parallel_seconds =
+        MeasureSeconds(iterations, [&]() { parallel = CompressImage(*c.image, c.format, {}, &pool); });
+    const Image decoded = DecompressImage(parallel);
+    const double psnr_rgb = ComputePsnr(*c.image, decoded, false);
+    const double psnr_rgba = ComputePsnr(*c.image, decoded, true);
+    const double scalar_psnr = ComputePsnr(*c.image, DecompressImage(scalar), true);
+    std::size_t differing_blocks = 0;
+    const std::size_t block_bytes = BytesPerBlock(c.format);
+    for (std::size_t i = 0; i < scalar.pixels.size(); i += block_bytes) {
+      differing_blocks += std::memcmp(&scalar.pixels[i], &simd.pixels[i], block_bytes) != 0 ? 1 : 0;
+    }
+    std::cout << "  " << c.name << ": " << c.image->SizeInBytes() / double(1 << 20) << " -> "
+              << parallel.SizeInBytes() / double(1 << 20) << " MiB, PSNR rgb " << psnr_rgb << " dB, rgba "
+              << psnr_rgba << " dB" << std::endl;
+    std::cout << "    scalar " << pixels / scalar_seconds / 1e6 << " MPix/s, simd " << pixels / simd_seconds / 1e6
+              << " MPix/s (x" << scalar_seconds / simd_seconds << "), simd parallel "
+              << pixels / parallel_seconds / 1e6 << " MPix/s (x" << scalar_seconds / parallel_seconds << ")"
+              << std::endl;
+    if (simd.pixels != parallel.pixels) {
+      std::cerr << "bc: " << c.name << ": parallel result differs from single-threaded" << std::endl;
+      ok = false;
+    }
+    // FMA で縮約されるビルドではスカラー版と選ぶインデックスがまれに変わるので, 画質が同じかどうかで比べる
+    if (differing_blocks != 0) {
+      std::cout << "    " << differing_blocks << " blocks differ from scalar (PSNR " << scalar_psnr << " dB)"
+                << std::endl;
+      if (std::fabs(scalar_psnr - psnr_rgba) > 0.01) {
+        std::cerr << "bc: " << c.name << ": simd quality differs from scalar reference" << std::endl;
+        ok = false;
+      }
+    }
+    if (!(psnr_rgba >= c.min_psnr)) {
+      std::cerr << "bc: " << c.name << ": PSNR " << psnr_rgba << " dB is below " << c.min_psnr << " dB" << std::endl;
+      ok = false;
+    }
+  }
+
+  // 既知の値: 565 で表せる単色は BC1 / BC3 でそのまま戻り, BC1 の抜きはアルファ 0 になる.
+  // BC7 (モード 6) は p-bit を RGBA で共有するので, 全チャンネルが奇数の単色ならそのまま戻る
+  uint8_t solid[64];
+  uint8_t odd[64];
+  for (int i = 0; i < 16; ++i) {
+    const uint8_t pixel[4] = {255, 0, 0, uint8_t(i < 4 ? 0 : 255)};
+    const uint8_t odd_pixel[4] = {201, 99, 51, 255};
+    std::memcpy(solid + i * 4, pixel, 4);
+    std::memcpy(odd + i * 4, odd_pixel, 4);
+  }
+  uint8_t block[16];
+  uint8_t decoded[64];
+  EncodeBC1Block(solid, block);
+  DecodeBC1Block(block, decoded);
+  const bool bc1_ok = decoded[0 * 4 + 3] == 0 && decoded[4 * 4 + 0] == 255 && decoded[4 * 4 + 1] == 0 &&
+                      decoded[4 * 4 + 3] == 255;
+  EncodeBC3Block(solid, block);
+  DecodeBC3Block(block, decoded);
+  const bool bc3_ok = std::memcmp(decoded, solid, 64) == 0;
+  EncodeBC7Block(odd, block);
+  DecodeBC7Block(block, decoded);
+  const bool bc7_ok = std::memcmp(decoded, odd, 64) == 0;
+  if (!bc1_ok || !bc3_ok || !bc7_ok) {
+    std::cerr << "bc: known block mismatch (bc1 " << bc1_ok << ", bc3 " << bc3_ok << ", bc7 " << bc7_ok << ")"
+              << std::endl;
+    ok = false;
+  }
+
+  // キャッシュ: 1 回目はミップを作ってエンコードし, 2 回目はファイルから読むだけになる
+  const fs::path cache_dir = options.Get("--cache").empty() ? fs::temp_directory_path() / "perf-bench-bc-cache"
+                                                             : fs::u8path(options.Get("--cache"));
+  std::error_code ec;
+  fs::remove_all(cache_dir, ec);
+  CompressedTextureCache cache(cache_dir);
+  std::vector<Image> levels[2];
+  double cache_seconds[2] = {};
+  for (int pass = 0; pass < 2; ++pass) {
+    const auto start = std::chrono::steady_clock::now();
+    levels[pass] = LoadOrCompressTexture(cutout, PixelFormat::kUnknown, {}, &cache, &pool);
+    cache_seconds[pass] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  const auto cache_stats = cache.GetStats();
+  std::cout << "  cache: encode " << cache_seconds[0] * 1e3 << " ms (" << levels[0].size() << " mips, "
+            << (levels[0].empty() ? "none" : levels[0][0].format == PixelFormat::kBC7 ? "bc7" : "bc1") << "), hit "
+            << cache_seconds[1] * 1e3 << " ms, " << cache_stats.hits << " hits, " << cache_stats.misses << " misses, "
+            << cache_stats.bytes_written / double(1 << 20) << " MiB written" << std::endl;
+  bool same_levels = levels[0].size() == levels[1].size() && !levels[0].empty();
+  for (std::size_t i = 0; same_levels && i < levels[0].size(); ++i) {
+    same_levels = levels[0][i].width == levels[1][i].width && levels[0][i].pixels == levels[1][i].pixels;
+  }
+  if (cache_stats.hits != 1 || cache_stats.misses != 1 || !same_levels) {
+    std::cerr << "bc: cache round trip failed" << std::endl;
+    ok = false;
+  }
+  // 設定が違えば既定の設定でエンコードしたものを返さない
+  BcEncodeOptions unrefined;
+  unrefined.refine_iterations = 0;
+  bool other_hit = false;
+  LoadOrCompressTexture(cutout, PixelFormat::kUnknown, unrefined, &cache, &pool, &other_hit);
+  if (other_hit) {
+    std::cerr << "bc: cache returned blocks encoded with different options" << std::endl;
+    ok = false;
+  }
+  fs::remove_all(cache_dir, ec);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//////////////////
+// image-decode //
+//////////////////
+
+void AppendLE16(std::vector<uint8_t>* out, uint32_t v) {
+  out->push_back(static_cast<uint8_t>(v));
+  out->push_back(static_cast<uint8_t>(v >> 8));
+}
+
+void AppendLE32(std::vector<uint8_t>* out, uint32_t v) {
+  AppendLE16(out, v & 0xFFFF);
+  AppendLE16(out, v >> 16);
+}
+
+/**
+ * @brief RGBA8 の画像を BMP (下から上) にする. 8 bit はグレーのパレット (R を使う)
+ */
+std::vector<uint8_t> EncodeBmp(const Image& image, int bit_count) {
+  const uint32_t stride = ((image.width * bit_count + 31) / 32) * 4;
+  const uint32_t palette_bytes = bit_count == 8 ? 256 * 4 : 0;
+  const uint32_t offset = 14 + 40 + palette_bytes;
+  std::vector<uint8_t> out = {'B', 'M'};
+  AppendLE32(&out, offset + stride * image.height);
+  AppendLE32(&out, 0);
+  AppendLE32(&out, offset);
+  for (uint32_t v : {40u, image.width, image.height}) {
+    AppendLE32(&out, v);
+  }
+  AppendLE16(&out, 1);
+  AppendLE16(&out, bit_count);
+  for (int i = 0; i < 6; ++i) {
+    AppendLE32(&out, 0);  // BI_RGB, サイズ, 解像度, 色数
+  }
+  for (uint32_t i = 0; i < palette_bytes / 4; ++i) {
+    AppendLE32(&out, i * 0x010101);
+  }
+  for (uint32_t y = image.height; y-- > 0;) {
+    const uint8_t* src = image.Row(y);
+    const std::size_t begin = out.size();
+    for (uint32_t x = 0; x < image.width; ++x) {
+      const uint8_t* p = src + x * 4;
+      if (bit_count == 8) {
+        out.push_back(p[0]);
+      } else {
+        out.insert(out.end(), {p[2], p[1], p[0]});
+        if (bit_count == 32) {
+          out.push_back(p[3]);
+        }
+      }
+    }
+    out.resize(begin + stride, 0);
+  }
+  return out;
+}
+
+/**
+ * @brief RGBA8 の画像を 32 bit の TGA (上から下) にする
+ */
+std::vector<uint8_t> EncodeTga(const Image& image, bool rle) {
+  std::vector<uint8_t> out = {0, 0, uint8_t(rle ? 10 : 2), 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  AppendLE16(&out, image.width);
+  AppendLE16(&out, image.height);
+  out.push_back(32);
+  out.push_back(0x28);  // アルファ 8 bit, 上から下
+  auto append_pixel = [&](const uint8_t* p) { out.insert(out.end(), {p[2], p[1], p[0], p[3]}); };
+  for (uint32_t y = 0; y < image.height; ++y) {
+    const uint8_t* row = image.Row(y);
+    for (uint32_t x = 0; x < image.width;) {
+      if (!rle) {
+        append_pixel(row + x * 4);
+        ++x;
+        continue;
+      }
+      // 同じ画素が続けば繰り返し, そうでなければ次の繰り返しの手前までを生のパケットにする
+      uint32_t run = 1;
+      while (x + run < image.width && run < 128 && std::memcmp(row + x * 4, row + (x + run) * 4, 4) == 0) {
+        ++run;
+      }
+      if (run > 1) {
+        out.push_back(static_cast<uint8_t>(0x80 | (run - 1)));
+        append_pixel(row + x * 4);
+        x += run;
+        continue;
+      }
+      uint32_t count = 1;
+      while (x + count < image.width && count < 128 &&
+             !(x + count + 1 < image.width && std::memcmp(row + (x + count) * 4, row + (x + count + 1) * 4, 4) == 0)) {
+        ++count;
+      }
+      out.push_back(static_cast<uint8_t>(count - 1));
+      for (uint32_t i = 0; i < count; ++i) {
+        append_pixel(row + (x + i) * 4);
+      }
+      x += count;
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief decoded が expected (RGBA8) と同じ画素か (BGRA8 なら並べ替えて比べる)
+ */
+bool SameAsRgba(const Image& expected, const Image& decoded) {
+  if (decoded.width != expected.width || decoded.height != expected.height) {
+    return false;
+  }
+  const bool bgra = decoded.format == PixelFormat::kBGRA8;
+  for (uint32_t y = 0; y < expected.height; ++y) {
+    const uint8_t* a = expected.Row(y);
+    const uint8_t* b = decoded.Row(y);
+    for (uint32_t x = 0; x < expected.width; ++x) {
+      const uint8_t* p = a + x * 4;
+      const uint8_t* q = b + x * 4;
+      if (p[0] != q[bgra ? 2 : 0] || p[1] != q[1] || p[2] != q[bgra ? 0 : 2] || p[3] != q[3]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int RunImageDecode(const Options& options) {
+  std::mt19937 rng(12345);
+  const uint32_t size = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--size", 1024), 1, 16384));
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 10), 1);
+  const Image source = MakeTextureLikeImage(size, size, true, rng);
+  // 24 bit と 8 bit はアルファを持たないので, 不透明 (8 bit はさらにグレー) にしたものと比べる
+  Image opaque = source;
+  Image gray = source;
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      uint8_t* p = opaque.Row(y) + x * 4;
+      p[3] = 255;
+      uint8_t* g = gray.Row(y) + x * 4;
+      g[1] = g[2] = g[0];
+      g[3] = 255;
+    }
+  }
+  // toon テクスチャのような単色の帯が続く画像 (RLE が効く)
+  Image bands = source;
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      std::memcpy(bands.Row(y) + x * 4, source.Row(y / 16 * 16) + (x / 64 * 64) * 4, 4);
+    }
+  }
+
+  struct Case {
+    const char* name;
+    std::vector<uint8_t> data;
+    const Image* expected;
+  };
+  const Case cases[] = {
+      {"bmp 8 bit", EncodeBmp(gray, 8), &gray},
+      {"bmp 24 bit", EncodeBmp(opaque, 24), &opaque},
+      {"bmp 32 bit", EncodeBmp(opaque, 32), &opaque},
+      {"tga 32 bit", EncodeTga(source, false), &source},
+      {"tga 32 bit rle", EncodeTga(bands, true), &bands},
+      {"png stored", EncodePng(source), &source},
+  };
+
+  ImageDecoderRegistry decoders;
+  bool ok = true;
+  std::cout << "image-decode: " << size << "x" << size << std::endl;
+  const double pixels = double(size) * size;
+  for (const Case& c : cases) {
+    const ImageCodec* codec = decoders.Find(c.data.data(), c.data.size());
+    // 呼び出し側のバッファを使い回す (2 回目以降は確保しない)
+    Image decoded;
+    std::string error;
+    bool decoded_ok = true;
+    const double seconds = MeasureSeconds(
+        iterations, [&]() { decoded_ok = decoders.Decode(c.data.data(), c.data.size(), &decoded, &error) && decoded_ok; });
+    std::cout << "  " << c.name << " (" << (codec != nullptr ? codec->name : "?") << ", "
+              << c.data.size() / double(1 << 20) << " MiB): " << seconds * 1e3 << " ms, " << pixels / seconds / 1e6
+              << " MPix/s, " << c.data.size() / seconds / double(1 << 20) << " MiB/s" << std::endl;
+    if (!decoded_ok) {
+      std::cerr << "image-decode: " << c.name << ": " << error << std::endl;
+      ok = false;
+    } else if (!SameAsRgba(*c.expected, decoded)) {
+      std::cerr << "image-decode: " << c.name << ": decoded pixels differ from the source" << std::endl;
+      ok = false;
+    }
+  }
+
+  // プールから取ったバッファにデコードして捨てる (TextureContentStore で重複が捨てられる場合と同じ)
+  auto pool = std::make_shared<PixelBufferPool>();
+  const double pooled_seconds = MeasureSeconds(iterations, [&]() {
+    for (const Case& c : cases) {
+      std::string error;
+      ok = decoders.Decode(c.data.data(), c.data.size(), pool, &error) != nullptr && ok;
+    }
+  });
+  const auto pool_stats = pool->GetStats();
+  std::cout << "  pooled: " << pooled_seconds / std::size(cases) * 1e3 << " ms/image, " << pool_stats.reused << " / "
+            << pool_stats.acquired << " buffers reused" << std::endl;
+
+  // マジックナンバーで判定するので, 壊れた・知らない形式は拡張子に関係なく失敗する
+  const uint8_t unknown[32] = {'J', 'U', 'N', 'K'};
+  if (decoders.Find(unknown, sizeof(unknown)) != nullptr) {
+    std::cerr << "image-decode: unknown data was accepted" << std::endl;
+    ok = false;
+  }
+
+  const std::string dir = options.Get("--dir");
+  if (!dir.empty()) {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(fs::u8path(dir), ec)) {
+      MappedFile file;
+      if (!entry.is_regular_file() || !file.Open(entry.path())) {
+        continue;
+      }
+      const ImageCodec* codec = decoders.Find(file.data(), file.size());
+      if (codec == nullptr) {
+        continue;
+      }
+      Image decoded;
+      std::string error;
+      bool decoded_ok = true;
+      const double seconds = MeasureSeconds(
+          iterations, [&]() { decoded_ok = decoders.Decode(file.data(), file.size(), &decoded, &error) && decoded_ok; });
+      std::cout << "  " << entry.path().filename().u8string() << " (" << codec->name << ", " << decoded.width << "x"
+                << decoded.height << "): ";
+      if (!decoded_ok) {
+        std::cout << "failed: " << error << std::endl;
+        ok = false;
+        continue;
+      }
+      std::cout << seconds * 1e3 << " ms, " << double(decoded.width) * decoded.height / seconds / 1e6 << " MPix/s, "
+                << file.size() / seconds / double(1 << 20) << " MiB/s, hash " << std::hex
+                << HashBytes(decoded.pixels.data(), decoded.pixels.size()) << std::dec << std::endl;
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////
+// raster //
+////////////
+
+/**
+ * @brief 半径 radius の UV 球を vertices / indices に追加する (表は時計回り)
+ */
+void AppendSphere(const Float3& center, float radius, uint32_t rings, uint32_t segments,
+                  std::vector<PmdVertex>* vertices, std::vector<uint16_t>* indices) {
+  const uint16_t base = static_cast<uint16_t>(vertices->size());
+  constexpr float kPi = 3.14159265358979f;
+  for (uint32_t r = 0; r <= rings; ++r) {
+    const float phi = kPi * r / rings;
+    for (uint32_t s = 0; s <= segments; ++s) {
+      const float theta = 2.0f * kPi * s / segments;
+      const Float3 n = {std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta)};
+      PmdVertex v = {};
+      const Float3 p = center + n * radius;
+      v.pos = {p.x, p.y, p.z};
+      v.normal = {n.x, n.y, n.z};
+      v.uv = {static_cast<float>(s) / segments * 4.0f, static_cast<float>(r) / rings * 2.0f};
+      v.weight = 100;
+      vertices->push_back(v);
+    }
+  }
+  for (uint32_t r = 0; r < rings; ++r) {
+    for (uint32_t s = 0; s < segments; ++s) {
+      const uint16_t a = static_cast<uint16_t>(base + r * (segments + 1) + s);
+      const uint16_t b = static_cast<uint16_t>(a + segments + 1);
+      indices->insert(indices->end(), {a, static_cast<uint16_t>(a + 1), b, b, static_cast<uint16_t>(a + 1),
+                                       static_cast<uint16_t>(b + 1)});
+    }
+  }
+}
+
+Image MakeCheckerImage(uint32_t size, uint32_t cell) {
+  Image image;
+  image.format = PixelFormat::kRGBA8;
+  image.width = size;
+  image.height = size;
+  image.row_pitch = std::size_t(size) * 4;
+  image.pixels.resize(image.row_pitch * size);
+  for (uint32_t y = 0; y < size; ++y) {
+    for (uint32_t x = 0; x < size; ++x) {
+      const uint8_t c = ((x / cell + y / cell) % 2) ? 0xff : 0x60;
+      uint8_t* p = image.Row(y) + x * 4;
+      p[0] = c;
+      p[1] = c;
+      p[2] = 0xff;
+      p[3] = 0xff;
+    }
+  }
+  return image;
+}
+
+int RunRaster(const Options& options) {
+  const uint32_t width = static_cast<uint32_t>(std::max<std::size_t>(options.GetSize("--width", 1280), 1));
+  const uint32_t height = static_cast<uint32_t>(std::max<std::size_t>(options.GetSize("--height", 720), 1));
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 10), 1);
+
+  std::vector<PmdVertex> synthetic_vertices;
+  std::vector<uint16_t> synthetic_indices;
+  PmdSpan<PmdVertex> vertices;
+  PmdSpan<uint16_t> indices;
+  std::vector<SoftwareMaterial> materials;
+  std::vector<uint32_t> index_counts;
+  const Image checker = MakeCheckerImage(64, 8);
+  PmdFile pmd;
+  const std::string model_path = options.Get("--model");
+  if (!model_path.empty()) {
+    // テクスチャは読まない (既定のテクスチャで描く)
+    if (!pmd.Open(fs::u8path(model_path))) {
+      std::cerr << model_path << ": " << pmd.Error() << std::endl;
+      return EXIT_FAILURE;
+    }
+    vertices = pmd.Vertices();
+    indices = pmd.Indices();
+    for (auto& m : pmd.Materials()) {
+      SoftwareMaterial material;
+      material.constants = MakeMaterialForHlsl(m);
+      materials.push_back(material);
+      index_counts.push_back(static_cast<uint32_t>(m.indicesNum));  // 1 byte アライメントなので値で渡す
+    }
+  } else {
+    // 5 x N 個の球をカメラの前に並べる. 1 つ目のマテリアルにはチェッカーのテクスチャを貼る
+    const std::size_t spheres = std::max<std::size_t>(options.GetSize("--spheres", 60), 1);
+    for (std::size_t i = 0; i < spheres; ++i) {
+      const std::size_t begin = synthetic_indices.size();
+      const Float3 center = {(static_cast<float>(i % 5) - 2.0f) * 2.5f, 17.0f + (static_cast<float>(i / 5 % 3) - 1.0f) * 2.5f,
+                             2.0f + static_cast<float>(i / 15) * 3.0f};
+      AppendSphere(center, 1.2f, 24, 32, &synthetic_vertices, &synthetic_indices);
+      SoftwareMaterial material;
+      material.constants.diffuse = {0.3f + 0.7f * (i % 3 == 0), 0.3f + 0.7f * (i % 3 == 1), 0.3f + 0.7f * (i % 3 == 2)};
+      material.constants.alpha = 1.0f;
+      material.constants.specular = {0.5f, 0.5f, 0.5f};
+      material.constants.specularity = 10.0f;
+      material.constants.ambient = {0.2f, 0.2f, 0.2f};
+      material.tex = i % 4 == 0 ? &checker : nullptr;
+      materials.push_back(material);
+      index_counts.push_back(static_cast<uint32_t>(synthetic_indices.size() - begin));
+      if (synthetic_vertices.size() > 0xffff - 25 * 33) {
+        break;  // 16 bit インデックスに収まる分だけ
+      }
+    }
+    vertices = PmdSpan<PmdVertex>(synthetic_vertices.data(), synthetic_vertices.size());
+    indices = PmdSpan<uint16_t>(synthetic_indices.data(), synthetic_indices.size());
+  }
+
+  // main と同じカメラ
+  SoftwareSceneConstants scene;
+  scene.eye = {0.0f, 17.0f, -5.0f};
+  scene.view = MatrixLookAtLH(scene.eye, {0.0f, 17.0f, 0.0f}, {0.0f, 1.0f, 0.0f});
+  scene.proj = MatrixPerspectiveFovLH(3.14159265358979f / 2.0f, static_cast<float>(width) / height, 1.0f, 100.0f);
+
+  ThreadPool pool(options.GetSize("--threads", 0));
+  SoftwareRasterizer rasterizer(width, height);
+  const float clear_color[] = {1.0f, 1.0f, 1.0f, 1.0f};
+  const double seconds = MeasureSeconds(iterations, [&]() {
+    rasterizer.Clear(clear_color);
+    rasterizer.Draw(pool, scene, vertices, indices, materials, index_counts);
+  });
+
+  const auto& stats = rasterizer.GetStats();
+  const Image& frame = rasterizer.ColorBuffer();
+  char hash[17];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(HashBytes(frame.pixels.data(), frame.pixels.size())));
+  std::cout << "raster: " << width << "x" << height << ", " << vertices.size() << " vertices, " << stats.triangles
+            << " triangles, " << materials.size() << " materials, " << pool.ThreadCount() << " threads" << std::endl;
+  std::cout << "  " << seconds * 1e3 << " ms/frame, " << stats.triangles / seconds / 1e6 << " M triangles/s, "
+            << stats.pixels_shaded / seconds / 1e6 << " M pixels/s (" << stats.rasterized << " rasterized, "
+            << stats.tile_triangles << " tile bins, " << stats.pixels_shaded << " pixels shaded)" << std::endl;
+  std::cout << "  frame hash: " << hash << std::endl;
+
+  const std::string output = options.Get("--output");
+  if (!output.empty()) {
+    std::string error;
+    if (!WritePng(fs::u8path(output), frame, &error)) {
+      std::cerr << error << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  const std::string expect = options.Get("--expect");
+  if (!expect.empty() && expect != hash) {
+    std::cerr << "raster: frame hash " << hash << " does not match " << expect << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/////////////////////
+// texture sampler //
+/////////////////////
+
+int RunTextureSampler(const Options& options) {
+  std::mt19937 rng(12345);
+  const uint32_t size = static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--size", 256), 1, 8192));
+  const std::size_t sample_count = std::max<std::size_t>(options.GetSize("--samples", 1 << 20), 1);
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 10), 1);
+
+  // 中身は乱数 (サンプラーの検証にはミップ同士が縮小の関係である必要はない)
+  auto make_levels = [&](PixelFormat format) {
+    std::vector<Image> levels;
+    uint32_t w = size;
+    uint32_t h = std::max<uint32_t>(size / 2, 1);  // 正方形でない場合も確かめる
+    while (true) {
+      Image image;
+      image.format = format;
+      image.width = w;
+      image.height = h;
+      image.row_pitch = std::size_t(w) * 4;
+      image.pixels.resize(image.row_pitch * h);
+      for (auto& p : image.pixels) {
+        p = static_cast<uint8_t>(rng());
+      }
+      levels.push_back(std::move(image));
+      if (w == 1 && h == 1) {
+        break;
+      }
+      w = std::max<uint32_t>(w / 2, 1);
+      h = std::max<uint32_t>(h / 2, 1);
+    }
+    return levels;
+  };
+  const std::vector<Image> rgba_levels = make_levels(PixelFormat::kRGBA8);
+  const std::vector<Image> bgra_levels = make_levels(PixelFormat::kBGRA8);
+  const TextureView rgba(rgba_levels.data(), static_cast<uint32_t>(rgba_levels.size()));
+  const TextureView bgra(bgra_levels.data(), static_cast<uint32_t>(bgra_levels.size()));
+
+  // 範囲外・境界・NaN を含む座標と, 4 点ごとに揃えた LOD (画面上の隣接ピクセルに相当) と, ばらばらの LOD
+  std::uniform_real_distribution<float> coord(-3.0f, 3.0f);
+  std::uniform_real_distribution<float> lod_dist(-1.0f, static_cast<float>(rgba_levels.size()) + 1.0f);
+  const float specials[] = {0.0f, 1.0f, -1.0f, 0.5f, 1e-8f, -1e-8f, 1e30f, -1e30f, std::nanf(""), INFINITY};
+  std::vector<float> u(sample_count);
+  std::vector<float> v(sample_count);
+  std::vector<float> coherent_lod(sample_count);
+  std::vector<float> random_lod(sample_count);
+  for (std::size_t i = 0; i < sample_count; ++i) {
+    u[i] = i % 97 == 0 ? specials[i / 97 % std::size(specials)] : coord(rng);
+    v[i] = i % 89 == 0 ? specials[i / 89 % std::size(specials)] : coord(rng);
+    coherent_lod[i] = i % 8 == 0 ? lod_dist(rng) : coherent_lod[i - i % 8];
+    random_lod[i] = lod_dist(rng);
+  }
+
+  struct Case {
+    const char* name;
+    const TextureView* texture;
+    SamplerDesc sampler;
+    const std::vector<float>* lod;
+  };
+  const Case cases[] = {
+      {"smp rgba lod 0", &rgba, kSamplerSmp, nullptr},
+      {"smp rgba coherent lod", &rgba, kSamplerSmp, &coherent_lod},
+      {"smp bgra random lod", &bgra, kSamplerSmp, &random_lod},
+      {"smpToon rgba lod 0", &rgba, kSamplerSmpToon, nullptr},
+      {"smpToon bgra coherent lod", &bgra, kSamplerSmpToon, &coherent_lod},
+  };
+
+  std::cout << "texture-sampler: " << size << "x" << std::max<uint32_t>(size / 2, 1) << ", " << rgba_levels.size()
+            << " mips, " << sample_count << " samples, batch width " << TextureSamplerBatchWidth() << std::endl;
+  bool ok = true;
+  std::vector<Float4> scalar(sample_count);
+  std::vector<Float4> batch(sample_count);
+  for (const Case& c : cases) {
+    const float* lod = c.lod != nullptr ? c.lod->data() : nullptr;
+    const double scalar_seconds = MeasureSeconds(iterations, [&]() {
+      for (std::size_t i = 0; i < sample_count; ++i) {
+        scalar[i] = SampleTexture(*c.texture, c.sampler, u[i], v[i], lod != nullptr ? lod[i] : 0.0f);
+      }
+    });
+    const double batch_seconds = MeasureSeconds(iterations, [&]() {
+      SampleTextureBatch(*c.texture, c.sampler, u.data(), v.data(), lod, sample_count, batch.data());
+    });
+
+    float max_error = 0.0f;
+    for (std::size_t i = 0; i < sample_count; ++i) {
+      max_error = std::max({max_error, std::fabs(scalar[i].x - batch[i].x), std::fabs(scalar[i].y - batch[i].y),
+                            std::fabs(scalar[i].z - batch[i].z), std::fabs(scalar[i].w - batch[i].w)});
+      if (!(scalar[i].x >= 0.0f && scalar[i].x <= 1.0f && scalar[i].w >= 0.0f && scalar[i].w <= 1.0f)) {
+        max_error = INFINITY;  // NaN や範囲外の値を返してはいけない
+      }
+    }
+    std::cout << "  " << c.name << ": scalar " << sample_count / scalar_seconds / 1e6 << " M samples/s, batch "
+              << sample_count / batch_seconds / 1e6 << " M samples/s (x" << scalar_seconds / batch_seconds
+              << "), max error " << max_error << std::endl;
+    if (!(max_error <= 1e-6f)) {
+      std::cerr << "texture-sampler: " << c.name << ": batch result differs from scalar reference" << std::endl;
+      ok = false;
+    }
+  }
+
+  // 既知の値: 2x1 のテクスチャの中点はテクセルの平均, wrap は端で反対側と混ざり, clamp は混ざらない
+  Image two;
+  two.format = PixelFormat::kRGBA8;
+  two.width = 2;
+  two.height = 1;
+  two.row_pitch = 8;
+  two.pixels = {0, 0, 0, 0, 255, 255, 255, 255};
+  const Float4 mid = SampleTexture(two, kSamplerSmp, 0.5f, 0.5f);
+  const Float4 wrap_edge = SampleTexture(two, kSamplerSmp, 0.0f, 0.5f);
+  const Float4 clamp_edge = SampleTexture(two, kSamplerSmpToon, 0.0f, 0.5f);
+  if (std::fabs(mid.x - 0.5f) > 1e-6f || std::fabs(wrap_edge.x - 0.5f) > 1e-6f || clamp_edge.x != 0.0f) {
+    std::cerr << "texture-sampler: addressing mismatch (" << mid.x << ", " << wrap_edge.x << ", " << clamp_edge.x
+              << ")" << std::endl;
+    ok = false;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////////////////
+// vertex compression //
+////////////////////////
+
+int RunVertexCompression(const Options& options) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  std::vector<PmdVertex> synthetic_vertices;
+  PmdSpan<PmdVertex> vertices;
+  PmdFile pmd;
+  const std::string model_path = options.Get("--model");
+  if (!model_path.empty()) {
+    if (!pmd.Open(fs::u8path(model_path))) {
+      std::cerr << model_path << ": " << pmd.Error() << std::endl;
+      return EXIT_FAILURE;
+    }
+    vertices = pmd.Vertices();
+  } else {
+    const std::size_t bone_count = std::max<std::size_t>(options.GetSize("--bones", 128), 1);
+    synthetic_vertices.resize(options.GetSize("--vertices", 100000));
+    for (auto& v : synthetic_vertices) {
+      v = {};
+      v.pos = {dist(rng), dist(rng), dist(rng)};
+      const Float3 n = Normalize(Float3{dist(rng), dist(rng), dist(rng)});
+      v.normal = {n.x, n.y, n.z};
+      v.uv = {dist(rng) * 0.5f + 0.5f, dist(rng) * 0.5f + 0.5f};
+      v.bone_no[0] = static_cast<uint16_t>(rng() % bone_count);
+      v.bone_no[1] = static_cast<uint16_t>(rng() % bone_count);
+      v.weight = static_cast<uint8_t>(rng() % 101);
+      v.EdgeFlag = static_cast<uint8_t>(rng() % 2);
+    }
+    vertices = PmdSpan<PmdVertex>(synthetic_vertices.data(), synthetic_vertices.size());
+  }
+
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 20), 1);
+  CompactVertexBuffer buffer;
+  const double seconds = MeasureSeconds(iterations, [&]() { buffer = CompressVertices(vertices); });
+  const VertexCompressionError error = MeasureCompressionError(vertices, buffer);
+
+  const std::size_t original_bytes = vertices.size_bytes();
+  std::cout << "vertex-compression: " << vertices.size() << " vertices, "
+            << (buffer.format == CompactVertexFormat::kNarrowBones ? "8" : "16") << "-bit bones" << std::endl;
+  std::cout << "  size: " << original_bytes << " -> " << buffer.data.size() << " bytes (" << sizeof(PmdVertex)
+            << " -> " << buffer.stride << " bytes/vertex, "
+            << (original_bytes == 0 ? 0.0 : 100.0 * (1.0 - static_cast<double>(buffer.data.size()) / original_bytes))
+            << " % smaller)" << std::endl;
+  std::cout << "  encode: " << seconds * 1e3 << " ms, " << vertices.size() / seconds / 1e6 << " M vertices/s"
+            << std::endl;
+  std::cout << "  normal error: max " << error.max_normal_degrees << " deg, mean " << error.mean_normal_degrees
+            << " deg (" << error.zero_normals << " zero-length normals skipped)" << std::endl;
+  std::cout << "  uv error: max " << error.max_uv_error << std::endl;
+  std::cout << "  mismatched vertices: " << error.mismatched << std::endl;
+  // 16 bit の octahedral 表現なら角度の誤差は 0.01 度未満に収まる
+  return error.mismatched == 0 && error.max_normal_degrees < 0.01f ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+///////////////////////
+// command recording //
+///////////////////////
+
+/**
+ * @brief 記録するだけのコマンドバッファ (RecordDrawRange の記録先)
+ * @details 各コマンドで work 回の計算をしてドライバーがコマンドを書き込む手間を模す.
+ *          Draws() は記録したコマンドを頭から再生した時の描画 (その時点の状態を含む) を返す.
+ */
+class NullCommandBuffer {
+ public:
+  struct Draw {
+    DrawState state;
+    uint32_t index_count;
+    uint32_t index_offset;
+    bool operator==(const Draw& other) const {
+      return state.pipeline == other.state.pipeline && state.geometry == other.state.geometry &&
+             state.material == other.state.material && index_count == other.index_count &&
+             index_offset == other.index_offset;
+    }
+  };
+
+  explicit NullCommandBuffer(std::size_t work = 0) : work_(work) {}
+
+  void Reset() { words_.clear(); }
+  void SetPipeline(uint32_t value) { Write(0, value, 0); }
+  void SetGeometry(uint32_t value) { Write(1, value, 0); }
+  void SetMaterial(uint32_t value) { Write(2, value, 0); }
+  void DrawIndexed(uint32_t index_count, uint32_t index_offset) { Write(3, index_count, index_offset); }
+
+  std::size_t CommandCount() const { return words_.size() / 4; }
+
+  /**
+   * @brief 記録したコマンドを再生して描画を out に追加する. 状態は呼び出しをまたいで引き継がない
+   */
+  void AppendDraws(std::vector<Draw>* out) const {
+    DrawState state;
+    for (std::size_t i = 0; i < words_.size(); i += 4) {
+      switch (words_[i]) {
+        case 0:
+          state.pipeline = words_[i + 1];
+          break;
+        case 1:
+          state.geometry = words_[i + 1];
+          break;
+        case 2:
+          state.material = words_[i + 1];
+          break;
+        default:
+          out->push_back({state, words_[i + 1], words_[i + 2]});
+          break;
+      }
+    }
+  }
+
+ private:
+  void Write(uint32_t type, uint32_t value, uint32_t offset) {
+    uint64_t h = (uint64_t(type) << 32 | value) ^ offset;
+    for (std::size_t i = 0; i < work_; ++i) {
+      h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ull;
+    }
+    words_.insert(words_.end(), {type, value, offset, static_cast<uint32_t>(h)});
+  }
+
+  std::size_t work_;
+  std::vector<uint32_t> words_;
+};
+
+int RunCommandRecording(const Options& options) {
+  std::mt19937 rng(12345);
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 500), 1);
+  const std::size_t materials_per_model = std::max<std::size_t>(options.GetSize("--materials", 40), 1);
+  const std::size_t work = options.GetSize("--work", 200);
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 20), 1);
+  ThreadPool pool(options.GetSize("--threads", 0));
+  const std::size_t max_ranges = std::max<std::size_t>(options.GetSize("--ranges", pool.ThreadCount() + 1), 1);
+
+  // シーン: モデルごとにマテリアルが並び, 一部は他のモデルと同じマテリアルを使う
+  DrawListBuilder builder;
+  for (std::size_t model = 0; model < model_count; ++model) {
+    uint32_t offset = 0;
+    for (std::size_t i = 0; i < materials_per_model; ++i) {
+      MaterialForHlsl constants = {};
+      constants.alpha = 1.0f;
+      constants.specularity = static_cast<float>(rng() % 8);
+      DrawItem item;
+      item.pipeline = static_cast<uint32_t>(rng() % 2);
+      item.geometry = static_cast<uint32_t>(model);
+      item.material = builder.AddMaterial(constants, {1 + rng() % 64, 0, 0, 0});
+      item.index_offset = offset;
+      item.index_count = 3 * (1 + rng() % 1000);
+      item.depth = static_cast<float>(rng() % 1000) / 1000.0f;
+      offset += item.index_count + 3 * (rng() % 2);  // 時々隙間を空けて結合されない描画を作る
+      builder.AddDraw(item);
+    }
+  }
+  builder.Build();
+  const auto& commands = builder.Commands();
+
+  // 1 スレッドで 1 つのバッファに記録したもの (正解)
+  NullCommandBuffer serial_buffer(work);
+  RecordRange whole;
+  whole.end = commands.size();
+  const double serial_seconds = MeasureSeconds(iterations, [&]() {
+    serial_buffer.Reset();
+    RecordDrawRange(commands, whole, serial_buffer);
+  });
+  std::vector<NullCommandBuffer::Draw> expected;
+  serial_buffer.AppendDraws(&expected);
+
+  std::cout << "command-recording: " << commands.size() << " commands, " << expected.size() << " draws, "
+            << pool.ThreadCount() << " threads (+ caller)" << std::endl;
+  std::cout << "  serial: " << serial_seconds * 1e3 << " ms" << std::endl;
+
+  bool ok = true;
+  for (std::size_t ranges_limit = 1; ranges_limit <= max_ranges; ranges_limit *= 2) {
+    const auto ranges = PartitionDrawCommands(commands, ranges_limit, 64);
+    std::vector<NullCommandBuffer> buffers(ranges.size(), NullCommandBuffer(work));
+    const double seconds = MeasureSeconds(iterations, [&]() {
+      RecordRangesParallel(pool, ranges, [&](std::size_t range_index, const RecordRange& range) {
+        buffers[range_index].Reset();
+        RecordDrawRange(commands, range, buffers[range_index]);
+      });
+    });
+
+    // 区間の順に再生した描画が 1 スレッドのものと一致すること
+    std::vector<NullCommandBuffer::Draw> draws;
+    std::size_t recorded_commands = 0;
+    for (const auto& buffer : buffers) {
+      buffer.AppendDraws(&draws);
+      recorded_commands += buffer.CommandCount();
+    }
+    const bool same = draws == expected;
+    ok = ok && same;
+    std::cout << "  " << ranges.size() << " ranges: " << seconds * 1e3 << " ms (x" << serial_seconds / seconds
+              << "), " << recorded_commands - commands.size() << " commands to restore state"
+              << (same ? "" : ", MISMATCH") << std::endl;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//////////////////////
+// upload allocator //
+//////////////////////
+
+int RunUploadAllocator(const Options& options) {
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 300), 1);
+  const std::size_t objects = std::max<std::size_t>(options.GetSize("--objects", 2000), 1);
+  const uint64_t in_flight = std::max<std::size_t>(options.GetSize("--in-flight", 2), 1);
+  LinearUploadAllocator::Options allocator_options;
+  allocator_options.page_size = std::max<std::size_t>(options.GetSize("--page-kb", 1024), 1) << 10;
+  constexpr std::size_t kObjectConstants = 64 * 4;  // world / view / proj と予備 (行列 4 つ)
+  constexpr std::size_t kMaterialConstants = sizeof(MaterialForHlsl);
+  const std::size_t large_size = allocator_options.page_size * 3 / 2;  // ページに収まらない要求
+
+  // ページは CPU のメモリ. GPU のアドレスの代わりに適当な値を振る
+  uint64_t next_gpu_address = uint64_t(1) << 32;
+  LinearUploadAllocator allocator(
+      allocator_options,
+      [&](std::size_t size, UploadPage* page) {
+        page->cpu = static_cast<uint8_t*>(::operator new(size, std::align_val_t(256)));
+        page->gpu_address = next_gpu_address;
+        next_gpu_address += (size + 0xffff) & ~std::size_t(0xffff);
+        return true;
+      },
+      [](const UploadPage& page) { ::operator delete(page.cpu, std::align_val_t(256)); });
+
+  // フレームごとに切り出した領域と書いた値 (GPU が終えるまで変わっていてはいけない)
+  struct Written {
+    UploadAllocation allocation;
+    uint64_t tag;
+  };
+  std::deque<std::vector<Written>> frames_in_flight;
+  std::size_t overwritten = 0;
+  std::size_t misaligned = 0;
+  auto check_frame = [&](const std::vector<Written>& written) {
+    for (const auto& w : written) {
+      uint64_t head, tail;
+      std::memcpy(&head, w.allocation.cpu, sizeof(head));
+      std::memcpy(&tail, w.allocation.cpu + w.allocation.size - sizeof(tail), sizeof(tail));
+      overwritten += head != w.tag || tail != w.tag ? 1 : 0;
+    }
+  };
+
+  std::size_t failed = 0;
+  for (uint64_t frame = 1; frame <= frames; ++frame) {
+    // フェンス値 = フレーム番号. GPU は in_flight フレーム遅れで終わるものとする
+    const uint64_t completed = frame > in_flight ? frame - in_flight : 0;
+    while (!frames_in_flight.empty() && frames_in_flight.size() > frame - 1 - completed) {
+      check_frame(frames_in_flight.front());
+      frames_in_flight.pop_front();
+    }
+    allocator.BeginFrame(completed);
+
+    std::vector<Written> written;
+    written.reserve(objects + objects / 4 + 1);
+    auto write = [&](std::size_t size, std::size_t alignment) {
+      const UploadAllocation allocation = allocator.Allocate(size, alignment);
+      if (!allocation) {
+        ++failed;
+        return;
+      }
+      misaligned += allocation.gpu_address % (alignment == 0 ? 256 : alignment) != 0 ? 1 : 0;
+      const uint64_t tag = frame << 32 | written.size();
+      std::memcpy(allocation.cpu, &tag, sizeof(tag));
+      std::memcpy(allocation.cpu + size - sizeof(tag), &tag, sizeof(tag));
+      written.push_back({allocation, tag});
+    };
+    for (std::size_t i = 0; i < objects; ++i) {
+      write(kObjectConstants, 0);
+      if (i % 4 == 0) {
+        write(kMaterialConstants, 0);  // アニメーションするマテリアル
+      }
+    }
+    if (frame % 50 == 0) {
+      write(large_size, 0);
+    }
+    write(24, 16);  // 小さいアライメントの要求
+    allocator.EndFrame(frame);
+    frames_in_flight.push_back(std::move(written));
+  }
+  for (const auto& written : frames_in_flight) {
+    check_frame(written);
+  }
+  const auto stats = allocator.GetStats();
+
+  // 速さ: 定数を書くだけ (確認はしない). 続きのフレーム番号を使うので, ページは上の確認で作ったものを使い回す
+  uint8_t constants[kObjectConstants] = {};
+  uint64_t next_frame = frames + 1;
+  const uint64_t pages_before = allocator.GetStats().page_creations;
+  const uint64_t heap_before = g_heap_allocations.load();
+  const double seconds = MeasureSeconds(1, [&]() {
+    for (std::size_t i = 0; i < frames; ++i) {
+      const uint64_t frame = next_frame++;
+      allocator.BeginFrame(frame - in_flight);
+      for (std::size_t i = 0; i < objects + objects / 4; ++i) {
+        constants[0] = static_cast<uint8_t>(i);
+        allocator.Upload(constants);
+      }
+      allocator.EndFrame(frame);
+    }
+  });
+  const uint64_t heap_allocations = g_heap_allocations.load() - heap_before;
+  const uint64_t timed_page_creations = allocator.GetStats().page_creations - pages_before;
+
+  // 比較: 物体ごとにバッファを確保して解放する (リソースを毎回作る場合の下限. 実際の CreateCommittedResource はずっと遅い)
+  const uint64_t per_object_before = g_heap_allocations.load();
+  const double per_object_seconds = MeasureSeconds(1, [&]() {
+    for (std::size_t frame = 0; frame < frames; ++frame) {
+      for (std::size_t i = 0; i < objects + objects / 4; ++i) {
+        constants[0] = static_cast<uint8_t>(i);
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[sizeof(constants)]);
+        std::memcpy(buffer.get(), constants, sizeof(constants));
+      }
+    }
+  });
+  const uint64_t per_object_allocations = g_heap_allocations.load() - per_object_before;
+
+  const std::size_t uploads = frames * (objects + objects / 4);
+  std::cout << "upload-allocator: " << frames << " frames x " << objects << " objects, " << in_flight
+            << " frames in flight, " << (allocator_options.page_size >> 10) << " KiB pages" << std::endl;
+  std::cout << "  upload: " << seconds * 1e3 << " ms (" << seconds * 1e9 / uploads << " ns/object), "
+            << heap_allocations << " heap allocations, " << timed_page_creations << " pages created" << std::endl;
+  std::cout << "  pages: " << stats.page_creations << " created, " << stats.page_reuses << " reused, " << stats.pages
+            << " held (" << stats.reserved_bytes << " bytes), peak " << stats.peak_frame_bytes << " bytes/frame"
+            << std::endl;
+  std::cout << "  per-object buffers: " << per_object_seconds * 1e3 << " ms ("
+            << per_object_seconds * 1e9 / uploads << " ns/object), " << per_object_allocations << " heap allocations"
+            << std::endl;
+  std::cout << "  overwritten while in flight: " << overwritten << ", misaligned: " << misaligned
+            << ", failed: " << failed << std::endl;
+  // 通常のページは in_flight + 1 フレーム分あれば足りる (専用のページは毎回作る)
+  const std::size_t frame_pages =
+      (objects * kObjectConstants + objects / 4 * 256) / allocator_options.page_size + 2;
+  const bool pages_bounded = stats.page_creations <= (in_flight + 1) * frame_pages + frames / 50;
+  if (!pages_bounded) {
+    std::cout << "  error: pages were not recycled" << std::endl;
+  }
+  return overwritten == 0 && misaligned == 0 && failed == 0 && pages_bounded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////////////
+// render backend //
+////////////////////
+
+void PrintFrameAnalysis(const FrameAnalysis& analysis) {
+  std::cout << "  " << analysis.commands << " commands, " << analysis.passes << " passes, " << analysis.draws
+            << " draws (" << analysis.indices << " indices), state changes: " << analysis.pipeline_changes
+            << " pipeline, " << analysis.geometry_changes << " geometry, " << analysis.material_changes
+            << " material, " << analysis.buffer_bindings << " buffer bindings, " << analysis.redundant_changes
+            << " redundant" << std::endl;
+}
+
+int RunRenderBackend(const Options& options) {
+  const std::string capture_path = options.Get("--capture");
+  if (!capture_path.empty()) {
+    RecordedFrame captured;
+    std::string error;
+    if (!LoadFrameCapture(capture_path, &captured, &error)) {
+      std::cerr << error << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "render-backend: " << capture_path << std::endl;
+    PrintFrameAnalysis(AnalyzeFrame(captured));
+    RecordingCommandList replayed;
+    const double seconds = MeasureSeconds(100, [&]() {
+      replayed.Reset();
+      ReplayFrame(captured, replayed);
+    });
+    std::cout << "  replay: " << seconds * 1e6 << " us/frame" << std::endl;
+    return replayed.Frame() == captured ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  std::mt19937 rng(12345);
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 100), 1);
+  const std::size_t materials_per_model = std::max<std::size_t>(options.GetSize("--materials", 40), 1);
+  const std::size_t texture_count = std::max<std::size_t>(options.GetSize("--textures", 32), 1);
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 200), 1);
+  ThreadPool pool(options.GetSize("--threads", 0));
+  constexpr uint32_t kFramesInFlight = 2;
+  constexpr uint32_t kVertexStride = 38;  // sizeof(PmdVertex)
+  bool ok = true;
+  auto fail = [&](const std::string& message) {
+    std::cout << "  error: " << message << std::endl;
+    ok = false;
+  };
+
+  NullRenderBackend backend;
+  {
+    // テクスチャ: ストリーミングのように小さいミップだけで作り, 後で全ミップのものに差し替える
+    std::vector<std::vector<Image>> mip_chains;
+    std::vector<ResourceHandle> textures;
+    for (std::size_t i = 0; i < texture_count; ++i) {
+      const uint32_t size = 64u << (rng() % 3);
+      mip_chains.push_back(GenerateMipChain(MakeTextureLikeImage(size, size, i % 4 == 0, rng)));
+      textures.push_back(CreateTextureFromLevels(backend, mip_chains.back(), 2));
+    }
+
+    // シーン: command-recording と同じく, モデルごとにマテリアルが並ぶ
+    DrawListBuilder builder;
+    uint32_t index_count = 0;
+    for (std::size_t model = 0; model < model_count; ++model) {
+      for (std::size_t i = 0; i < materials_per_model; ++i) {
+        MaterialForHlsl constants = {};
+        constants.alpha = rng() % 8 == 0 ? 0.5f : 1.0f;
+        constants.specularity = static_cast<float>(rng() % 8);
+        DrawItem item;
+        item.pipeline = static_cast<uint32_t>(rng() % 2);
+        item.translucent = constants.alpha < 1.0f;
+        item.geometry = static_cast<uint32_t>(model);
+        item.material = builder.AddMaterial(constants, {textures[rng() % textures.size()], 0, 0, 0});
+        item.index_offset = index_count;
+        item.index_count = 3 * (1 + rng() % 500);
+        item.depth = static_cast<float>(rng() % 1000) / 1000.0f;
+        index_count += item.index_count;
+        builder.AddDraw(item);
+      }
+    }
+    builder.Build();
+    const auto& commands = builder.Commands();
+    const auto ranges = PartitionDrawCommands(commands, pool.ThreadCount() + 1, 64);
+
+    // 頂点・インデックス・マテリアルのバッファ (頂点はフレームごとに区画を分ける)
+    const std::size_t vertex_count = std::min<std::size_t>(index_count, 65536);
+    const std::size_t vertex_bytes = vertex_count * kVertexStride;
+    const std::size_t slice_size = (vertex_bytes + 255) / 256 * 256;
+    std::vector<uint8_t> vertex_data(vertex_bytes);
+    for (auto& byte : vertex_data) {
+      byte = static_cast<uint8_t>(rng());
+    }
+    const ResourceHandle vertex_buffer = backend.CreateBuffer(slice_size * kFramesInFlight);
+    const ResourceHandle index_buffer = backend.CreateBuffer(uint64_t(index_count) * sizeof(uint16_t));
+    const ResourceHandle material_buffer = backend.CreateBuffer(256 * builder.MaterialCount());
+    uint8_t* vertex_map = backend.MapBuffer(vertex_buffer);
+    auto* index_map = reinterpret_cast<uint16_t*>(backend.MapBuffer(index_buffer));
+    uint8_t* material_map = backend.MapBuffer(material_buffer);
+    if (vertex_map == nullptr || index_map == nullptr || material_map == nullptr) {
+      fail("failed to create buffers");
+      return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < index_count; ++i) {
+      index_map[i] = static_cast<uint16_t>(i % vertex_count);
+    }
+    for (std::size_t i = 0; i < builder.MaterialCount(); ++i) {
+      std::memcpy(material_map + 256 * i, &builder.MaterialConstants(static_cast<uint32_t>(i)),
+                  sizeof(MaterialForHlsl));
+    }
+
+    // GPU の代わりにシグナルしたらすぐ終わるタイムライン
+    uint64_t gpu_value = 0;
+    FrameScheduler scheduler(kFramesInFlight, {[&](uint64_t value) { gpu_value = value; },
+                                               [&]() { return gpu_value; }, [](uint64_t) {}});
+    LinearUploadAllocator upload(
+        {},
+        [&](std::size_t size, UploadPage* page) {
+          const ResourceHandle buffer = backend.CreateBuffer(size);
+          page->cpu = backend.MapBuffer(buffer);
+          page->gpu_address = buffer << 32;
+          page->handle = reinterpret_cast<void*>(static_cast<uintptr_t>(buffer));
+          return page->cpu != nullptr;
+        },
+        [&](const UploadPage& page) {
+          backend.ReleaseResource(static_cast<ResourceHandle>(reinterpret_cast<uintptr_t>(page.handle)));
+        });
+
+    PassDesc clear_pass;
+    clear_pass.width = 1280;
+    clear_pass.height = 720;
+    clear_pass.clear_color = true;
+    clear_pass.clear_depth = true;
+    std::fill(clear_pass.color, clear_pass.color + 4, 1.0f);
+    PassDesc draw_pass = clear_pass;
+    draw_pass.clear_color = false;
+    draw_pass.clear_depth = false;
+
+    // main のメッセージループの 1 周と同じ手順
+    RecordingCommandList main_list;
+    std::vector<RecordingCommandList> range_lists(ranges.size());
+    SceneBindings bindings;
+    std::size_t frame = 0;
+    auto render_frame = [&]() {
+      const uint32_t slot = scheduler.BeginFrame();
+      upload.BeginFrame(scheduler.CompletedValue());
+      float scene[64] = {};  // 行列 4 つ (SceneMatrices)
+      scene[0] = static_cast<float>(frame);
+      const UploadAllocation constants = upload.Upload(scene);
+      std::memcpy(vertex_map + slice_size * slot, vertex_data.data(), vertex_bytes);  // スキニング結果の代わり
+
+      // 時々テクスチャを全ミップのものに差し替える
+      if (frame % 8 == 0 && frame / 8 < textures.size()) {
+        const std::size_t index = frame / 8;
+        scheduler.WaitIdle();
+        const ResourceHandle replaced = CreateTextureFromLevels(backend, mip_chains[index], 0);
+        if (replaced != 0) {
+          backend.ReleaseResource(textures[index]);
+          textures[index] = replaced;
+        }
+      }
+
+      main_list.Reset();
+      main_list.BeginPass(clear_pass);
+      bindings = {{vertex_buffer, slice_size * slot, static_cast<uint32_t>(vertex_bytes), kVertexStride},
+                  {index_buffer, 0, index_count * static_cast<uint32_t>(sizeof(uint16_t)), sizeof(uint16_t)},
+                  constants.gpu_address};
+      RecordRangesParallel(pool, ranges, [&](std::size_t range_index, const RecordRange& range) {
+        range_lists[range_index].Reset();
+        RecordSceneRange(commands, range, draw_pass, bindings, range_lists[range_index]);
+      });
+      scheduler.EndFrame();
+      upload.EndFrame(scheduler.LastSubmittedValue());
+      backend.NextFrame();
+      ++frame;
+    };
+    const double seconds = MeasureSeconds(frames, render_frame);
+
+    // 実行する順につなげたもの
+    RecordedFrame recorded = main_list.Frame();
+    for (const auto& list : range_lists) {
+      recorded.Append(list.Frame());
+    }
+    std::cout << "render-backend: " << commands.size() << " draw list commands, " << ranges.size() << " ranges, "
+              << pool.ThreadCount() << " threads (+ caller), " << frames << " frames: " << seconds * 1e6
+              << " us/frame" << std::endl;
+    PrintFrameAnalysis(AnalyzeFrame(recorded));
+
+    // 1 スレッドで記録したものと同じであること
+    RecordingCommandList serial;
+    serial.BeginPass(clear_pass);
+    for (const auto& range : ranges) {
+      RecordSceneRange(commands, range, draw_pass, bindings, serial);
+    }
+    if (!(serial.Frame() == recorded)) {
+      fail("parallel recording differs from serial recording");
+    }
+
+    // ファイルに書いて読み直し, 再生したものが同じであること
+    const auto path = std::filesystem::temp_directory_path() / "perf_bench_frame_capture.rcap";
+    RecordedFrame loaded;
+    std::string error;
+    if (!SaveFrameCapture(path, recorded, &error) || !LoadFrameCapture(path, &loaded, &error)) {
+      fail(error);
+    }
+    std::filesystem::remove(path);
+    RecordingCommandList replayed;
+    const double replay_seconds = MeasureSeconds(20, [&]() {
+      replayed.Reset();
+      ReplayFrame(loaded, replayed);
+    });
+    if (!(replayed.Frame() == recorded)) {
+      fail("replayed frame differs from the recorded frame");
+    }
+    std::cout << "  capture: " << recorded.commands.size() * sizeof(RenderCommand) / 1024 << " KiB, replay "
+              << replay_seconds * 1e6 << " us" << std::endl;
+
+    // 差し替えたテクスチャは全ミップ, それ以外は level 2 からの中身が書かれていること
+    for (std::size_t i = 0; i < textures.size(); ++i) {
+      const uint32_t first_level = i * 8 < frame ? 0 : 2;
+      for (uint32_t level = first_level; level < mip_chains[i].size(); ++level) {
+        if (backend.TextureLevelHash(textures[i], level - first_level) != HashImagePixels(mip_chains[i][level])) {
+          fail("texture " + std::to_string(i) + " level " + std::to_string(level) + " has wrong contents");
+          break;
+        }
+      }
+    }
+    scheduler.WaitIdle();
+    for (ResourceHandle texture : textures) {
+      backend.ReleaseResource(texture);
+    }
+    for (ResourceHandle buffer : {vertex_buffer, index_buffer, material_buffer}) {
+      backend.ReleaseResource(buffer);
+    }
+  }
+
+  // アップロードのページも含めて全て破棄されていること
+  const auto& stats = backend.GetStats();
+  std::cout << "  resources: " << stats.buffers_created << " buffers, " << stats.textures_created << " textures, "
+            << stats.releases << " released, " << stats.texture_write_bytes / 1024 << " KiB written, peak "
+            << stats.peak_live_bytes / 1024 << " KiB, " << backend.Events().size() << " lifetime events"
+            << std::endl;
+  if (!backend.LiveResources().empty() || stats.failed_operations != 0) {
+    fail(std::to_string(backend.LiveResources().size()) + " resources leaked, " +
+         std::to_string(stats.failed_operations) + " failed operations");
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////////////
+// heap allocator //
+////////////////////
+
+// 対数一様に近いサイズ (小さいものほど多い. テクスチャやバッファを模す)
+uint64_t RandomResourceSize(std::mt19937& rng, uint64_t min_size, uint64_t max_size) {
+  std::uniform_real_distribution<double> dist(std::log2(static_cast<double>(min_size)),
+                                              std::log2(static_cast<double>(max_size)));
+  return static_cast<uint64_t>(std::exp2(dist(rng)));
+}
+
+int RunHeapAllocator(const Options& options) {
+  std::mt19937 rng(12345);
+  const std::size_t operations = std::max<std::size_t>(options.GetSize("--operations", 200000), 1);
+  const std::size_t texture_count = std::max<std::size_t>(options.GetSize("--textures", 2000), 2);
+  const uint64_t heap_size = uint64_t(std::max<std::size_t>(options.GetSize("--heap-mb", 64), 1)) << 20;
+  bool ok = true;
+  auto fail = [&](const std::string& message) {
+    std::cout << "  error: " << message << std::endl;
+    ok = false;
+  };
+
+  // TLSF: 割り当て済みの範囲を std::map で持って重なりなどを確かめる
+  {
+    constexpr uint64_t kCapacity = uint64_t(256) << 20;
+    constexpr uint64_t kGranularity = 256;
+    const uint64_t alignments[] = {1, 256, 4096, 65536, uint64_t(4) << 20};
+    TlsfAllocator tlsf(kCapacity, kGranularity);
+    std::map<uint64_t, uint64_t> reference;  // オフセット -> サイズ
+    std::vector<uint64_t> live;
+    uint64_t used = 0;
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < operations && ok; ++i) {
+      if (live.empty() || rng() % 100 < 55) {
+        const uint64_t size = RandomResourceSize(rng, 1, uint64_t(4) << 20);
+        const uint64_t alignment = alignments[rng() % std::size(alignments)];
+        const uint64_t offset = tlsf.Allocate(size, alignment);
+        if (offset == TlsfAllocator::kInvalidOffset) {
+          ++failures;
+          continue;
+        }
+        const uint64_t rounded = (size + kGranularity - 1) / kGranularity * kGranularity;
+        auto next = reference.lower_bound(offset);
+        if (offset % alignment != 0 || offset + rounded > kCapacity ||
+            (next != reference.end() && next->first < offset + rounded) ||
+            (next != reference.begin() && std::prev(next)->first + std::prev(next)->second > offset)) {
+          fail("tlsf returned an overlapping or misaligned range");
+        }
+        reference[offset] = rounded;
+        live.push_back(offset);
+        used += rounded;
+      } else {
+        const std::size_t index = rng() % live.size();
+        tlsf.Free(live[index]);
+        used -= reference[live[index]];
+        reference.erase(live[index]);
+        live[index] = live.back();
+        live.pop_back();
+      }
+    }
+    const auto stats = tlsf.GetStats();
+    if (stats.used_bytes != used || stats.allocations != live.size()) {
+      fail("tlsf statistics do not match");
+    }
+    std::cout << "heap-allocator: tlsf " << operations << " random operations, " << live.size() << " live, "
+              << failures << " failed, " << stats.free_blocks << " free blocks, fragmentation "
+              << stats.Fragmentation() << std::endl;
+    for (uint64_t offset : live) {
+      tlsf.Free(offset);
+    }
+    const auto empty = tlsf.GetStats();
+    if (empty.free_blocks != 1 || empty.largest_free_block != kCapacity || empty.used_bytes != 0) {
+      fail("tlsf did not coalesce free blocks");
+    }
+
+    // 同じサイズで埋め尽くせること (最後の 1 つまで取りこぼさない)
+    std::size_t filled = 0;
+    while (tlsf.Allocate(3 << 20, 1) != TlsfAllocator::kInvalidOffset) {
+      ++filled;
+    }
+    if (filled != kCapacity / (3 << 20)) {
+      fail("tlsf could not fill the range");
+    }
+  }
+
+  // 速さ: 割り当てと解放を繰り返す
+  {
+    TlsfAllocator tlsf(uint64_t(1) << 30, 4096);
+    std::vector<uint64_t> sizes(4096);
+    for (auto& size : sizes) {
+      size = RandomResourceSize(rng, 4096, uint64_t(1) << 20);
+    }
+    std::vector<uint64_t> live(sizes.size() / 2, TlsfAllocator::kInvalidOffset);
+    std::size_t cursor = 0;
+    const std::size_t iterations = 1000000;
+    const double seconds = MeasureSeconds(1, [&]() {
+      for (std::size_t i = 0; i < iterations; ++i) {
+        uint64_t& slot = live[i % live.size()];
+        if (slot != TlsfAllocator::kInvalidOffset) {
+          tlsf.Free(slot);
+        }
+        slot = tlsf.Allocate(sizes[cursor++ % sizes.size()], 4096);
+      }
+    });
+    std::cout << "  tlsf: " << seconds * 1e9 / iterations << " ns per free + allocate" << std::endl;
+  }
+
+  // ヒープ: テクスチャを置き, 半分を解放して詰める. 中身の代わりにタグを移す
+  {
+    constexpr uint64_t kCommittedGranularity = uint64_t(64) << 10;
+    std::map<std::pair<void*, uint64_t>, uint64_t> contents;  // (ヒープ, オフセット) -> タグ
+    std::vector<std::unique_ptr<int>> heap_objects;
+    HeapSuballocator::Options heap_options;
+    heap_options.heap_size = heap_size;
+    heap_options.granularity = 4096;
+    HeapSuballocator heaps(
+        heap_options,
+        [&](uint64_t) {
+          heap_objects.push_back(std::make_unique<int>(0));
+          return static_cast<void*>(heap_objects.back().get());
+        },
+        [](void*) {});
+
+    struct Texture {
+      HeapAllocation allocation;
+      uint64_t tag;
+    };
+    std::vector<Texture> textures;
+    uint64_t committed_bytes = 0;
+    uint64_t requested_bytes = 0;
+    for (std::size_t i = 0; i < texture_count; ++i) {
+      // 4 KiB 境界に置ける小さいテクスチャと 64 KiB 境界のもの. 時々ヒープより大きいもの
+      const uint64_t size = i % 500 == 499 ? heap_size + (uint64_t(1) << 20)
+                                           : RandomResourceSize(rng, 4096, uint64_t(16) << 20);
+      const uint64_t alignment = size <= (uint64_t(64) << 10) ? 4096 : uint64_t(64) << 10;
+      const HeapAllocation allocation = heaps.Allocate(size, alignment);
+      if (!allocation || allocation.offset % alignment != 0) {
+        fail("heap allocation failed");
+        break;
+      }
+      contents[{allocation.heap, allocation.offset}] = i;
+      textures.push_back({allocation, i});
+      committed_bytes += (size + kCommittedGranularity - 1) / kCommittedGranularity * kCommittedGranularity;
+      requested_bytes += size;
+    }
+    const auto full = heaps.GetStats();
+    std::cout << "  heaps: " << textures.size() << " textures (" << requested_bytes / (1 << 20) << " MiB) in "
+              << full.heaps << " heaps (" << full.dedicated_heaps << " dedicated), " << full.heap_bytes / (1 << 20)
+              << " MiB reserved, " << full.used_bytes / (1 << 20) << " MiB used; committed resources: "
+              << textures.size() << " heaps, " << committed_bytes / (1 << 20) << " MiB" << std::endl;
+
+    std::shuffle(textures.begin(), textures.end(), rng);
+    for (std::size_t i = 0; i < textures.size() / 2; ++i) {
+      contents.erase({textures[i].allocation.heap, textures[i].allocation.offset});
+      heaps.Free(textures[i].allocation);
+    }
+    textures.erase(textures.begin(), textures.begin() + textures.size() / 2);
+    const auto half = heaps.GetStats();
+
+    std::size_t bad_moves = 0;
+    const std::size_t moved = heaps.Defragment(~uint64_t(0), [&](const HeapAllocation& from, const HeapAllocation& to) {
+      auto it = contents.find({from.heap, from.offset});
+      if (it == contents.end() || contents.count({to.heap, to.offset}) != 0 || to.size != from.size) {
+        ++bad_moves;
+        return false;
+      }
+      const uint64_t tag = it->second;
+      contents.erase(it);
+      contents[{to.heap, to.offset}] = tag;
+      for (auto& texture : textures) {
+        if (texture.allocation.heap == from.heap && texture.allocation.offset == from.offset) {
+          texture.allocation = to;
+          break;
+        }
+      }
+      return true;
+    });
+    const auto compacted = heaps.GetStats();
+    for (const auto& texture : textures) {
+      auto it = contents.find({texture.allocation.heap, texture.allocation.offset});
+      if (it == contents.end() || it->second != texture.tag) {
+        ++bad_moves;
+      }
+    }
+    if (bad_moves != 0 || compacted.heaps > half.heaps || compacted.allocations != textures.size()) {
+      fail("defragmentation lost or corrupted allocations");
+    }
+    std::cout << "  after freeing half: " << half.heaps << " heaps, " << half.heap_bytes / (1 << 20)
+              << " MiB reserved, fragmentation " << half.Fragmentation() << std::endl;
+    std::cout << "  after defragment (" << moved << " moves): " << compacted.heaps << " heaps, "
+              << compacted.heap_bytes / (1 << 20) << " MiB reserved, fragmentation " << compacted.Fragmentation()
+              << ", " << compacted.heap_creations << " heaps created in total" << std::endl;
+    for (const auto& texture : textures) {
+      heaps.Free(texture.allocation);
+    }
+    if (heaps.GetStats().heaps > 1) {
+      fail("empty heaps were not released");
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+////////////////////
+// frame pipeline //
+////////////////////
+
+/**
+ * @brief GPU のキューの代わり. 投げられた仕事を 1 つずつ指定時間だけ眠って実行し, フェンス値を書き込む
+ */
+class SimulatedGpuQueue {
+ public:
+  SimulatedGpuQueue() : thread_([this]() { Loop(); }) {}
+  ~SimulatedGpuQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  void Execute(std::chrono::microseconds duration) { Push({duration, 0}); }
+  void Signal(uint64_t value) { Push({std::chrono::microseconds(0), value}); }
+  uint64_t CompletedValue() const { return completed_.load(); }
+  void Wait(uint64_t value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return completed_.load() >= value; });
+  }
+
+  GpuTimeline Timeline() {
+    return {[this](uint64_t value) { Signal(value); }, [this]() { return CompletedValue(); },
+            [this](uint64_t value) { Wait(value); }};
+  }
+
+ private:
+  struct Work {
+    std::chrono::microseconds duration;
+    uint64_t signal;  // 0 なら書き込まない
+  };
+
+  void Push(const Work& work) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(work);
+    }
+    cv_.notify_all();
+  }
+
+  void Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      const Work work = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+      std::this_thread::sleep_for(work.duration);
+      lock.lock();
+      if (work.signal != 0) {
+        completed_.store(work.signal);
+        cv_.notify_all();
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Work> queue_;
+  std::atomic<uint64_t> completed_{0};
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+int RunFramePipeline(const Options& options) {
+  const std::size_t frames = std::max<std::size_t>(options.GetSize("--frames", 120), 1);
+  const std::chrono::microseconds cpu_time(options.GetSize("--cpu-us", 4000));
+  const std::chrono::microseconds gpu_time(options.GetSize("--gpu-us", 6000));
+  const uint32_t max_in_flight = static_cast<uint32_t>(std::max<std::size_t>(options.GetSize("--max-in-flight", 3), 1));
+
+  std::cout << "frame-pipeline: " << frames << " frames, cpu " << cpu_time.count() << " us, gpu " << gpu_time.count()
+            << " us per frame" << std::endl;
+  bool ok = true;
+  double single_frame_ms = 0.0;
+  for (uint32_t in_flight = 1; in_flight <= max_in_flight; ++in_flight) {
+    SimulatedGpuQueue gpu;
+    FrameScheduler scheduler(in_flight, gpu.Timeline());
+    std::vector<uint64_t> slot_frames(in_flight, 0);  // スロットを最後に使ったフレームのフェンス値
+    std::size_t reused_busy_slots = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t frame = 0; frame < frames; ++frame) {
+      const uint32_t slot = scheduler.BeginFrame();
+      if (gpu.CompletedValue() < slot_frames[slot]) {
+        ++reused_busy_slots;
+      }
+      std::this_thread::sleep_for(cpu_time);  // コマンドの記録の代わり
+      gpu.Execute(gpu_time);
+      scheduler.EndFrame();
+      slot_frames[slot] = scheduler.LastSubmittedValue();
+    }
+    scheduler.WaitIdle();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const auto& stats = scheduler.GetStats();
+    const double frame_ms = seconds * 1e3 / frames;
+    if (in_flight == 1) {
+      single_frame_ms = frame_ms;
+    }
+    std::cout << "  " << in_flight << " in flight: " << frame_ms << " ms/frame (x" << single_frame_ms / frame_ms
+              << "), waited " << stats.waits << " times, " << stats.wait_seconds * 1e3 / frames
+              << " ms/frame, max " << stats.max_frames_ahead << " frames ahead" << std::endl;
+    if (reused_busy_slots != 0 || stats.max_frames_ahead > in_flight || stats.frames != frames ||
+        gpu.CompletedValue() != scheduler.LastSubmittedValue()) {
+      std::cout << "    error: " << reused_busy_slots << " slots reused while the gpu was using them" << std::endl;
+      ok = false;
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/////////////
+// startup //
+/////////////
+
+/**
+ * @brief 読み込みの段階 1 つの計測結果
+ */
+struct StartupResult {
+  std::string stage;
+  std::string cache;  // "cold" / "warm" / "none"
+  DurationSummary duration;
+};
+
+bool WriteFileBytes(const fs::path& path, const std::vector<uint8_t>& data) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  return static_cast<bool>(ofs);
+}
+
+/**
+ * @brief 計測結果を JSON で書く (回帰の追跡用. 段階ごとに平均・中央値・p99・最大をミリ秒で書く)
+ */
+bool WriteStartupResults(const fs::path& path, const std::vector<std::pair<std::string, std::size_t>>& config,
+                         const std::vector<StartupResult>& results) {
+  std::string json = "{\n  \"benchmark\": \"startup\",\n  \"config\": {";
+  for (std::size_t i = 0; i < config.size(); ++i) {
+    json += (i == 0 ? "" : ", ") + ("\"" + config[i].first + "\": ") + std::to_string(config[i].second);
+  }
+  json += "},\n  \"results\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const StartupResult& r = results[i];
+    char line[320];
+    std::snprintf(line, sizeof(line),
+                  "%s\n    {\"stage\": \"%s\", \"cache\": \"%s\", \"iterations\": %zu, \"mean_ms\": %.4f, "
+                  "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}",
+                  i == 0 ? "" : ",", r.stage.c_str(), r.cache.c_str(), r.duration.count, r.duration.mean_ms,
+                  r.duration.p50_ms, r.duration.p99_ms, r.duration.max_ms);
+    json += line;
+  }
+  json += "\n  ]\n}\n";
+  return WriteFileBytes(path, std::vector<uint8_t>(json.begin(), json.end()));
+}
+
+int RunStartup(const Options& options) {
+  std::mt19937 rng(12345);
+  const uint32_t vertex_count =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--vertices", 30000), 3, 65535));
+  const uint32_t material_count =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--materials", 40), 1, 4096));
+  const uint32_t texture_count =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--textures", 8), 1, 100));
+  const uint32_t texture_size =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--texture-size", 256), 4, 4096)) / 4 * 4;
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 5), 1);
+  const std::string json_path = options.Get("--json");
+  ThreadPool pool(options.GetSize("--threads", 0));
+  bool ok = true;
+  auto fail = [&](const std::string& message) {
+    std::cout << "  error: " << message << std::endl;
+    ok = false;
+  };
+
+  // モデルとテクスチャを書き出す. tex は PNG, sph は BMP, toon はモデルの隣の toon ディレクトリに小さい BMP
+  const fs::path dir = fs::temp_directory_path() / "perf-bench-startup";
+  const fs::path bc_cache_dir = dir / "texture_cache";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir / "toon", ec);
+  const fs::path model_path = dir / "model.pmd";
+  bool written = WriteFileBytes(model_path, MakeSyntheticPmd(material_count, texture_count, vertex_count, "png"));
+  for (uint32_t i = 0; written && i < texture_count; ++i) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "tex%02u.png", i);
+    written = WriteFileBytes(dir / name, EncodePng(MakeTextureLikeImage(texture_size, texture_size, i % 4 == 0, rng)));
+    std::snprintf(name, sizeof(name), "sph%02u.sph", i);
+    const uint32_t sph_size = std::max(texture_size / 4 / 4 * 4, 4u);
+    written = written && WriteFileBytes(dir / name, EncodeBmp(MakeTextureLikeImage(sph_size, sph_size, false, rng), 24));
+  }
+  for (uint32_t i = 0; written && i <= 10; ++i) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "toon%02u.bmp", i);
+    written = WriteFileBytes(dir / "toon" / name, EncodeBmp(MakeTextureLikeImage(32, 32, false, rng), 32));
+  }
+  if (!written) {
+    std::cerr << dir.u8string() << ": write failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "startup: " << vertex_count << " vertices, " << material_count << " materials, " << texture_count
+            << " textures (" << texture_size << "x" << texture_size << "), " << iterations << " iterations, "
+            << pool.ThreadCount() << " threads" << std::endl;
+  std::vector<StartupResult> results;
+  // iterations 回測る. prepare は計測の外で毎回呼ぶ (cold にするためにキャッシュを消すなど)
+  const auto measure = [&](const std::string& stage, const std::string& cache, const std::function<void()>& prepare,
+                           const std::function<void()>& body) {
+    std::vector<uint64_t> durations;
+    for (std::size_t i = 0; i < iterations; ++i) {
+      if (prepare) {
+        prepare();
+      }
+      const auto start = std::chrono::steady_clock::now();
+      body();
+      durations.push_back(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+    results.push_back({stage, cache, SummarizeDurations(std::move(durations))});
+    const DurationSummary& d = results.back().duration;
+    std::printf("  %-20s %-5s p50 %9.3f ms, p99 %9.3f ms, max %9.3f ms\n", stage.c_str(), cache.c_str(), d.p50_ms,
+                d.p99_ms, d.max_ms);
+  };
+
+  // 1. モデル: PMD のパース (cold) とベイク済みファイルのマップ (warm. pmd-bake で作ったもの)
+  const fs::path baked_path = BakedModelPath(model_path);
+  std::size_t parsed_materials = 0;
+  measure("model open", "cold", {}, [&]() {
+    PmdFile pmd;
+    parsed_materials = pmd.Open(model_path) ? pmd.Materials().size() : 0;
+  });
+  {
+    PmdFile pmd;
+    std::vector<uint8_t> baked;
+    std::string error;
+    if (!pmd.Open(model_path) || !BakeModel(pmd, model_path, {}, &baked, &error) ||
+        !WriteBakedModel(baked_path, baked, &error)) {
+      fail("bake: " + error);
+    }
+  }
+  std::size_t baked_materials = 0;
+  measure("model open", "warm", {}, [&]() {
+    BakedModel baked;
+    baked_materials = baked.Open(baked_path) && baked.IsUpToDate(model_path) ? baked.Materials().size() : 0;
+  });
+  if (parsed_materials != material_count || baked_materials != material_count) {
+    fail("model has " + std::to_string(parsed_materials) + " / " + std::to_string(baked_materials) + " materials");
+  }
+
+  // 2. マテリアル: '*' の分割とトゥーンのパス, HLSL 用の定数
+  PmdFile pmd;
+  pmd.Open(model_path);
+  std::vector<MaterialTexturePaths> texture_paths(pmd.Materials().size());
+  measure("texture paths", "none", {}, [&]() {
+    for (std::size_t i = 0; i < texture_paths.size(); ++i) {
+      texture_paths[i] = ResolveMaterialTexturePaths(model_path, pmd.Materials()[i]);
+    }
+  });
+  std::vector<uint8_t> material_constants;
+  measure("material constants", "none", {}, [&]() { material_constants = PackMaterialConstants(pmd.Materials()); });
+
+  // 3. テクスチャのデコード (1 スレッド). cold は TextureCache を作り直し, warm は同じキャッシュから引く
+  std::vector<fs::path> texture_files;
+  for (const auto& paths : texture_paths) {
+    for (const auto* path : {&paths.tex, &paths.sph, &paths.spa, &paths.toon}) {
+      if (!path->empty() && std::find(texture_files.begin(), texture_files.end(), *path) == texture_files.end()) {
+        texture_files.push_back(*path);
+      }
+    }
+  }
+  ImageDecoderRegistry decoders;
+  const TextureCache::Decoder decode = [&decoders](const fs::path&, const uint8_t* data, std::size_t size) {
+    std::string error;
+    return decoders.Decode(data, size, std::shared_ptr<PixelBufferPool>(), &error);
+  };
+  std::unique_ptr<TextureCache> texture_cache;
+  std::size_t decoded = 0;
+  const auto decode_all = [&]() {
+    decoded = 0;
+    for (const auto& path : texture_files) {
+      decoded += texture_cache->Get(path) != nullptr ? 1 : 0;
+    }
+  };
+  measure("texture decode", "cold", [&]() { texture_cache = std::make_unique<TextureCache>(decode); }, decode_all);
+  measure("texture decode", "warm", {}, decode_all);
+  if (decoded != texture_files.size()) {
+    fail(std::to_string(decoded) + " of " + std::to_string(texture_files.size()) + " textures decoded");
+  }
+
+  // 4. ミップの生成と BC 圧縮 (並列). cold はキャッシュのディレクトリを消し, warm はファイルから読む
+  std::vector<std::shared_ptr<const Image>> images;
+  for (const auto& path : texture_files) {
+    images.push_back(texture_cache->Get(path));
+  }
+  std::unique_ptr<CompressedTextureCache> bc_cache;
+  std::size_t bc_hits = 0;
+  const auto compress_all = [&]() {
+    bc_hits = 0;
+    for (const auto& image : images) {
+      if (image == nullptr) {
+        continue;
+      }
+      bool hit = false;
+      LoadOrCompressTexture(*image, PixelFormat::kUnknown, {}, bc_cache.get(), &pool, &hit);
+      bc_hits += hit ? 1 : 0;
+    }
+  };
+  const auto clear_bc_cache = [&]() {
+    fs::remove_all(bc_cache_dir, ec);
+    bc_cache = std::make_unique<CompressedTextureCache>(bc_cache_dir);
+  };
+  measure("mips + bc", "cold", clear_bc_cache, compress_all);
+  measure("mips + bc", "warm", {}, compress_all);
+  if (bc_hits != images.size()) {
+    fail(std::to_string(bc_hits) + " of " + std::to_string(images.size()) + " compressed textures cached");
+  }
+
+  // 5. 全体: main と同じく ModelLoader (パース + デコード) の後にテクスチャを圧縮する.
+  // cold はベイク済みファイル・デコード結果・圧縮結果のどのキャッシュも無い初回起動, warm は全てある 2 回目以降
+  std::shared_ptr<LoadedModel> model;
+  ModelLoader loader(pool, [&](const fs::path& path) { return texture_cache->Get(path); });
+  const auto load_all = [&]() {
+    auto futures = loader.LoadAsync({model_path});
+    try {
+      model = futures[0].get();
+    } catch (const std::exception& e) {
+      fail(e.what());
+      return;
+    }
+    images.assign(model->texture_images.begin(), model->texture_images.end());
+    compress_all();
+  };
+  measure("load pipeline", "cold",
+          [&]() {
+            fs::remove(baked_path, ec);
+            texture_cache = std::make_unique<TextureCache>(decode);
+            clear_bc_cache();
+          },
+          load_all);
+  {
+    std::vector<uint8_t> baked;
+    std::string error;
+    if (!BakeModel(pmd, model_path, {}, &baked, &error) || !WriteBakedModel(baked_path, baked, &error)) {
+      fail("bake: " + error);
+    }
+  }
+  measure("load pipeline", "warm", {}, load_all);
+  if (model == nullptr || !model->baked.IsOpen() || model->texture_files.size() != texture_files.size() ||
+      bc_hits != images.size()) {
+    fail("warm load did not use the baked model and the caches");
+  }
+
+  if (!json_path.empty()) {
+    const std::vector<std::pair<std::string, std::size_t>> config = {
+        {"vertices", vertex_count},         {"materials", material_count}, {"textures", texture_count},
+        {"texture_size", texture_size},     {"iterations", iterations},    {"threads", pool.ThreadCount()}};
+    if (!WriteStartupResults(fs::u8path(json_path), config, results)) {
+      fail(json_path + ": write failed");
+    } else {
+      std::cout << "  results: " << json_path << std::endl;
+    }
+  }
+  model.reset();
+  images.clear();
+  texture_cache.reset();
+  bc_cache.reset();
+  fs::remove_all(dir, ec);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//////////////
+// pmd-load //
+//////////////
+
+/**
+ * @brief PmdFile を入れる前の main の読み方: 頂点ごとに fread し, セクションごとに std::vector にコピーする
+ */
+struct FreadPmd {
+  std::vector<PmdVertex> vertices;
+  std::vector<uint16_t> indices;
+  std::vector<PmdMaterial> materials;
+};
+
+bool LoadPmdWithFread(const fs::path& path, FreadPmd* out) {
+#ifdef _WIN32
+  std::FILE* fp = _wfopen(path.c_str(), L"rb");
+#else
+  std::FILE* fp = std::fopen(path.c_str(), "rb");
+#endif
+  if (fp == nullptr) {
+    return false;
+  }
+  PmdHeader header;
+  bool ok = std::fread(&header, sizeof(header), 1, fp) == 1;
+  uint32_t vertex_num = 0;
+  ok = ok && std::fread(&vertex_num, sizeof(vertex_num), 1, fp) == 1;
+  out->vertices.resize(ok ? vertex_num : 0);
+  for (std::size_t i = 0; ok && i < out->vertices.size(); ++i) {
+    ok = std::fread(&out->vertices[i], sizeof(PmdVertex), 1, fp) == 1;
+  }
+  uint32_t indices_num = 0;
+  ok = ok && std::fread(&indices_num, sizeof(indices_num), 1, fp) == 1;
+  out->indices.resize(ok ? indices_num : 0);
+  ok = ok && std::fread(out->indices.data(), out->indices.size() * sizeof(uint16_t), 1, fp) == 1;
+  uint32_t material_num = 0;
+  ok = ok && std::fread(&material_num, sizeof(material_num), 1, fp) == 1;
+  out->materials.resize(ok ? material_num : 0);
+  ok = ok && std::fread(out->materials.data(), out->materials.size() * sizeof(PmdMaterial), 1, fp) == 1;
+  std::fclose(fp);
+  return ok;
+}
+
+int RunPmdLoad(const Options& options) {
+  const std::size_t model_count = std::max<std::size_t>(options.GetSize("--models", 50), 1);
+  const uint32_t vertex_count =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--vertices", 65535), 3, 65535));
+  const uint32_t material_count =
+      static_cast<uint32_t>(std::clamp<std::size_t>(options.GetSize("--materials", 40), 1, 4096));
+  const std::size_t iterations = std::max<std::size_t>(options.GetSize("--iterations", 5), 1);
+  bool ok = true;
+  auto fail = [&](const std::string& message) {
+    std::cout << "  error: " << message << std::endl;
+    ok = false;
+  };
+
+  // 起動時に何百体も読むのを模して, 別々のファイルを書き出す (中身は同じ)
+  const fs::path dir = fs::temp_directory_path() / "perf-bench-pmd-load";
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  fs::create_directories(dir, ec);
+  const std::vector<uint8_t> pmd_bytes = MakeSyntheticPmd(material_count, 8, vertex_count);
+  std::vector<fs::path> paths;
+  for (std::size_t i = 0; i < model_count; ++i) {
+    paths.push_back(dir / ("model" + std::to_string(i) + ".pmd"));
+    if (!WriteFileBytes(paths.back(), pmd_bytes)) {
+      std::cerr << paths.back().u8string() << ": write failed" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // どちらも全ての頂点とインデックスを読むところまで測る (マップしたページへの最初のアクセスを含める)
+  uint64_t fread_hash = 0;
+  uint64_t mapped_hash = 0;
+  std::vector<uint64_t> fread_ns;
+  std::vector<uint64_t> mapped_ns;
+  const auto elapsed_ns = [](std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  };
+  for (std::size_t iteration = 0; iteration < iterations; ++iteration) {
+    for (const fs::path& path : paths) {
+      auto start = std::chrono::steady_clock::now();
+      FreadPmd fread_pmd;
+      if (!LoadPmdWithFread(path, &fread_pmd)) {
+        fail(path.u8string() + ": fread failed");
+        break;
+      }
+      fread_hash = HashBytes(fread_pmd.vertices.data(), fread_pmd.vertices.size() * sizeof(PmdVertex));
+      fread_hash = HashBytes(fread_pmd.indices.data(), fread_pmd.indices.size() * sizeof(uint16_t), fread_hash);
+      fread_hash = HashBytes(fread_pmd.materials.data(), fread_pmd.materials.size() * sizeof(PmdMaterial), fread_hash);
+      fread_ns.push_back(elapsed_ns(start));
+
+      start = std::chrono::steady_clock::now();
+      PmdFile pmd;
+      if (!pmd.Open(path)) {
+        fail(path.u8string() + ": " + pmd.Error());
+        break;
+      }
+      mapped_hash = HashBytes(pmd.Vertices().data(), pmd.Vertices().size_bytes());
+      mapped_hash = HashBytes(pmd.Indices().data(), pmd.Indices().size_bytes(), mapped_hash);
+      mapped_hash = HashBytes(pmd.Materials().data(), pmd.Materials().size_bytes(), mapped_hash);
+      mapped_ns.push_back(elapsed_ns(start));
+      if (mapped_hash != fread_hash) {
+        fail(path.u8string() + ": PmdFile and the fread loader read different data");
+        break;
+      }
+    }
+  }
+  fs::remove_all(dir, ec);
+  if (!ok) {
+    return EXIT_FAILURE;
+  }
+
+  const DurationSummary fread_summary = SummarizeDurations(fread_ns);
+  const DurationSummary mapped_summary = SummarizeDurations(mapped_ns);
+  const double megabytes = static_cast<double>(pmd_bytes.size()) / (1024.0 * 1024.0);
+  std::cout << "pmd-load: " << model_count << " models x " << iterations << " iterations, " << vertex_count
+            << " vertices, " << material_count << " materials, " << megabytes << " MiB per file" << std::endl;
+  const auto print = [&](const char* name, const DurationSummary& summary) {
+    std::cout << "  " << name << ": mean " << summary.mean_ms << " ms, p50 " << summary.p50_ms << " ms, p99 "
+              << summary.p99_ms << " ms, " << megabytes / (summary.mean_ms / 1e3) << " MiB/s" << std::endl;
+  };
+  print("fread (per vertex)", fread_summary);
+  print("PmdFile::Open     ", mapped_summary);
+  std::cout << "  speedup: " << fread_summary.mean_ms / mapped_summary.mean_ms << " x" << std::endl;
+  std::cout << "  verify: ok" << std::endl;
+  return EXIT_SUCCESS;
+}
+
+//////////////
+// profiler //
+//////////////
+
+int RunProfiler(const Options& options) {
+  const std::size_t scopes = std::max<std::size_t>(options.GetSize("--scopes", 1000000), 1);
+  const std::size_t events_per_thread = std::max<std::size_t>(options.GetSize("--events", 4096), 1);
+  ThreadPool pool(options.GetSize("--threads", 0));
+  bool ok = true;
+  auto fail = [&](const std::string& message) {
+    std::cout << "  error: " << message << std::endl;
+    ok = false;
+  };
+  std::cout << "profiler: " << scopes << " scopes, " << pool.ThreadCount() << " threads, " << events_per_thread
+            << " events per thread" << std::endl;
+
+  // 1 区間あたりのコスト (記録先が無い場合と, リングバッファに書く場合)
+  {
+    volatile uint64_t sink = 0;
+    const auto run_scopes = [&]() {
+      for (std::size_t i = 0; i < scopes; ++i) {
+        ProfileScope scope("scope");
+        sink = sink + i;
+      }
+    };
+    const double clock = MeasureSeconds(1, [&]() {
+      for (std::size_t i = 0; i < scopes; ++i) {
+        sink = sink + std::chrono::steady_clock::now().time_since_epoch().count();
+      }
+    });
+    Profiler::SetCurrent(nullptr);
+    const double disabled = MeasureSeconds(1, run_scopes);
+    Profiler profiler;
+    Profiler::SetCurrent(&profiler);
+    const double enabled = MeasureSeconds(1, run_scopes);
+    Profiler::SetCurrent(nullptr);
+    std::cout << "  overhead: " << disabled * 1e9 / scopes << " ns/scope disabled, " << enabled * 1e9 / scopes
+              << " ns/scope enabled (steady_clock::now() " << clock * 1e9 / scopes << " ns, 2 per scope)" << std::endl;
+    if (profiler.GetStats().events != 2 * scopes) {
+      fail("recorded " + std::to_string(profiler.GetStats().events) + " scopes");
+    }
+  }
+
+  // 複数のスレッドから記録し, スレッドごとのリングバッファに直近の区間だけが順に残っているか確かめる
+  Profiler::Options profiler_options;
+  profiler_options.events_per_thread = events_per_thread;
+  profiler_options.frame_window = 10;
+  Profiler profiler(profiler_options);
+  Profiler::SetCurrent(&profiler);
+  profiler.SetThreadName("main \"bench\"");  // JSON のエスケープを確かめる
+  constexpr std::size_t kTasks = 64;
+  const std::size_t scopes_per_task = std::max<std::size_t>(scopes / kTasks, 1);
+  pool.ParallelFor(0, kTasks, 1, [&](std::size_t, std::size_t) {
+    for (std::size_t i = 0; i < scopes_per_task; ++i) {
+      ProfileScope scope("task");
+    }
+  });
+  for (int i = 0; i < 25; ++i) {
+    ProfileScope scope("frame work");
+    profiler.MarkFrame();
+  }
+  const auto stats = profiler.GetStats();
+  const auto snapshot = profiler.Snapshot();
+  std::size_t snapshot_events = 0;
+  for (const auto& thread : snapshot) {
+    uint64_t previous_begin = 0;
+    for (const auto& event : thread.events) {
+      if (event.begin_ns < previous_begin || event.end_ns < event.begin_ns) {
+        fail("events of thread " + std::to_string(thread.thread_id) + " are out of order");
+        break;
+      }
+      previous_begin = event.begin_ns;
+    }
+    snapshot_events += thread.events.size();
+  }
+  const uint64_t expected_events = kTasks * scopes_per_task + 25 + 24;  // frame work + frame
+  if (stats.events != expected_events) {
+    fail("recorded " + std::to_string(stats.events) + " events, expected " + std::to_string(expected_events));
+  }
+  // 上書きされた区間はスナップショットに残らない. 書き手が上書き中かもしれない最も古い区間もスレッドごとに 1 つまで除かれる
+  const uint64_t missing = stats.events - snapshot_events;
+  if (missing < stats.overwritten || missing > stats.overwritten + stats.threads) {
+    fail("snapshot has " + std::to_string(snapshot_events) + " of " + std::to_string(stats.events) + " events, " +
+         std::to_string(stats.overwritten) + " overwritten");
+  }
+  if (stats.frames != 24 || profiler.FrameSummary().count != profiler_options.frame_window) {
+    fail("frame window has " + std::to_string(profiler.FrameSummary().count) + " frames");
+  }
+  std::cout << "  threads: " << stats.threads << ", " << stats.events << " events, " << stats.overwritten
+            << " overwritten" << std::endl;
+  std::cout << profiler.FormatSummary();
+
+  // パーセンタイル (nearest-rank)
+  {
+    std::vector<uint64_t> durations;
+    for (uint64_t ms = 100; ms >= 1; --ms) {
+      durations.push_back(ms * 1000000);
+    }
+    const DurationSummary summary = SummarizeDurations(durations);
+    if (summary.count != 100 || summary.p50_ms != 50.0 || summary.p99_ms != 99.0 || summary.max_ms != 100.0 ||
+        summary.mean_ms != 50.5) {
+      fail("wrong percentiles: p50 " + std::to_string(summary.p50_ms) + ", p99 " + std::to_string(summary.p99_ms));
+    }
+    if (SummarizeDurations({7000000}).p99_ms != 7.0 || SummarizeDurations({}).count != 0) {
+      fail("wrong percentiles of a single frame");
+    }
+  }
+
+  // 記録中のスレッドからスナップショットを取っても, 上書き中の区間が混ざらないか
+  // (書き手は連番を begin_ns, 連番 + 1 を end_ns に書くので, 壊れた区間や抜けがあれば分かる)
+  {
+    Profiler::Options concurrent_options;
+    concurrent_options.events_per_thread = 256;
+    Profiler concurrent(concurrent_options);
+    std::atomic<bool> stop{false};
+    std::thread writer([&]() {
+      for (uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+        concurrent.Record("seq", i, i + 1);
+      }
+    });
+    std::size_t snapshots = 0;
+    std::size_t torn = 0;
+    const auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200)) {
+      for (const auto& thread : concurrent.Snapshot()) {
+        for (std::size_t i = 0; i < thread.events.size(); ++i) {
+          const auto& event = thread.events[i];
+          if (event.end_ns != event.begin_ns + 1 || event.begin_ns != thread.events.front().begin_ns + i ||
+              std::strcmp(event.name, "seq") != 0) {
+            ++torn;
+            break;
+          }
+        }
+      }
+      ++snapshots;
+    }
+    stop = true;
+    writer.join();
+    std::cout << "  concurrent snapshots: " << snapshots << ", " << concurrent.GetStats().events << " events written"
+              << std::endl;
+    if (torn != 0) {
+      fail(std::to_string(torn) + " snapshots had torn events");
+    }
+  }
+
+  // Chrome trace
+  {
+    const fs::path trace_path = options.Get("--trace").empty()
+                                    ? fs::temp_directory_path() / "perf_bench_profiler_trace.json"
+                                    : fs::path(options.Get("--trace"));
+    std::string error;
+    if (!profiler.WriteChromeTrace(trace_path, &error)) {
+      fail(error);
+    } else {
+      std::ifstream ifs(trace_path, std::ios::binary);
+      const std::string json((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+      // 文字列の外の括弧が対応しているか, 区間の数が合っているか
+      int depth = 0;
+      bool in_string = false;
+      bool balanced = true;
+      for (std::size_t i = 0; i < json.size(); ++i) {
+        const char c = json[i];
+        if (in_string) {
+          if (c == '\\') {
+            ++i;
+          } else if (c == '"') {
+            in_string = false;
+          }
+        } else if (c == '"') {
+          in_string = true;
+        } else if (c == '{' || c == '[') {
+          ++depth;
+        } else if (c == '}' || c == ']') {
+          balanced = balanced && --depth >= 0;
+        }
+      }
+      std::size_t complete_events = 0;
+      for (std::size_t pos = json.find("\"ph\":\"X\""); pos != std::string::npos;
+           pos = json.find("\"ph\":\"X\"", pos + 1)) {
+        ++complete_events;
+      }
+      std::cout << "  trace: " << trace_path.u8string() << ", " << json.size() << " bytes, " << complete_events
+                << " events" << std::endl;
+      if (!balanced || depth != 0 || in_string || json.find("main \\\"bench\\\"") == std::string::npos) {
+        fail("invalid trace json");
+      }
+      if (complete_events != snapshot_events) {
+        fail("trace has " + std::to_string(complete_events) + " events, expected " + std::to_string(snapshot_events));
+      }
+    }
+    if (options.Get("--trace").empty()) {
+      std::error_code ec;
+      fs::remove(trace_path, ec);
+    }
+  }
+  Profiler::SetCurrent(nullptr);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::map<std::string, std::function<int(const Options&)>> benchmarks = {
+      {"bc", RunBc},
+      {"command-recording", RunCommandRecording},
+      {"culling", RunCulling},
+      {"draw-list", RunDrawList},
+      {"frame-pipeline", RunFramePipeline},
+      {"heap-allocator", RunHeapAllocator},
+      {"image-decode", RunImageDecode},
+      {"lod", RunLod},
+      {"mips", RunMips},
+      {"model-load", RunModelLoad},
+      {"motion", RunMotion},
+      {"pmd-load", RunPmdLoad},
+      {"profiler", RunProfiler},
+      {"raster", RunRaster},
+      {"render-backend", RunRenderBackend},
+      {"texture-sampler", RunTextureSampler},
+      {"skinning", RunSkinning},
+      {"startup", RunStartup},
+      {"upload-allocator", RunUploadAllocator},
+      {"vertex-compression", RunVertexCompression},
+  };
+  if (argc < 2 || benchmarks.count(argv[1]) == 0) {
+    std::cerr << "usage: perf-bench <benchmark> [--option value]..." << std::endl << "benchmarks:";
+    for (auto& b : benchmarks) {
+      std::cerr << " " << b.first;
+    }
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+  return benchmarks.at(argv[1])(Options(std::vector<std::string>(argv + 2, argv + argc)));
+}
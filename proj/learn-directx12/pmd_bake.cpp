@@ -0,0 +1,255 @@
+// PMD をベイク済みフォーマット (.pmdb) に変換するツール
+//
+//   pmd-bake [--optimize] [--verify] [--bench N] model.pmd...
+//
+// 出力は PMD と同じディレクトリに拡張子 .pmdb で書き出す.
+//   --optimize 頂点キャッシュ・オーバードロー・頂点フェッチの最適化をかけ, 前後の ACMR / ATVR を表示する
+//   --verify   書き出したファイルを読み直し, PMD から作った値と一致するか確かめる
+//   --bench N  PMD のパースとベイク済みファイルの読み込みをそれぞれ N 回行い, 平均時間を表示する
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "baked_model.h"
+#include "material.h"
+#include "mesh_optimizer.h"
+#include "model_loader.h"
+#include "pmd_file.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/**
+ * @brief インデックス範囲の三角形を頂点データで表し, 並べ替えて比較できる形にする
+ * @details 表裏が変わらないよう, 頂点の巡回だけを許して最小の並びに揃える.
+ */
+std::vector<std::string> CanonicalTriangles(const PmdVertex* vertices, PmdSpan<uint16_t> indices, std::size_t begin,
+                                            std::size_t end) {
+  std::vector<std::string> triangles;
+  for (std::size_t i = begin; i + 3 <= end; i += 3) {
+    std::string v[3];
+    for (int k = 0; k < 3; ++k) {
+      v[k].assign(reinterpret_cast<const char*>(&vertices[indices[i + k]]), sizeof(PmdVertex));
+    }
+    const int first = static_cast<int>(std::min_element(v, v + 3) - v);
+    triangles.push_back(v[first] + v[(first + 1) % 3] + v[(first + 2) % 3]);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+/**
+ * @brief 最適化したメッシュが, マテリアルごとに元と同じ三角形の集合になっているか確かめる
+ */
+bool VerifyOptimizedMesh(const PmdFile& pmd, const BakedModel& baked, std::string* error) {
+  auto materials = pmd.Materials();
+  std::size_t offset = 0;
+  for (std::size_t i = 0; i < materials.size(); ++i) {
+    const std::size_t end = offset + materials[i].indicesNum;
+    if (CanonicalTriangles(pmd.Vertices().data(), pmd.Indices(), offset, end) !=
+        CanonicalTriangles(baked.Vertices().data(), baked.Indices(), offset, end)) {
+      *error = "material " + std::to_string(i) + " triangles differ";
+      return false;
+    }
+    offset = end;
+  }
+  return true;
+}
+
+/**
+ * @brief ベイク済みモデルが PMD から作ったものと同じ内容か確かめる
+ * @details 最適化済みなら頂点とインデックスは並びではなく三角形の集合で比べる.
+ */
+bool VerifyRoundTrip(const PmdFile& pmd, const fs::path& model_filepath, const BakedModel& baked, std::string* error) {
+  auto vertices = pmd.Vertices();
+  auto indices = pmd.Indices();
+  auto materials = pmd.Materials();
+  if (baked.Vertices().size() != vertices.size() || baked.Indices().size() != indices.size() ||
+      baked.Materials().size() != materials.size() || baked.Bones().size() != pmd.Bones().size()) {
+    *error = "element counts differ";
+    return false;
+  }
+  if (baked.Header().flags & kBakedFlagOptimizedMesh) {
+    if (!VerifyOptimizedMesh(pmd, baked, error)) {
+      return false;
+    }
+  } else {
+    if (std::memcmp(baked.Vertices().data(), vertices.data(), vertices.size_bytes()) != 0) {
+      *error = "vertices differ";
+      return false;
+    }
+    if (std::memcmp(baked.Indices().data(), indices.data(), indices.size_bytes()) != 0) {
+      *error = "indices differ";
+      return false;
+    }
+  }
+  if (std::memcmp(baked.Bones().data(), pmd.Bones().data(), pmd.Bones().size_bytes()) != 0) {
+    *error = "bones differ";
+    return false;
+  }
+  const auto constants = PackMaterialConstants(materials);
+  if (baked.MaterialConstants().size() != constants.size() ||
+      std::memcmp(baked.MaterialConstants().data(), constants.data(), constants.size()) != 0) {
+    *error = "material constants differ";
+    return false;
+  }
+  if (!baked.IsUpToDate(model_filepath)) {
+    *error = "source stamp does not match";
+    return false;
+  }
+  uint32_t index_offset = 0;
+  for (std::size_t i = 0; i < materials.size(); ++i) {
+    auto& m = baked.Materials()[i];
+    if (m.index_offset != index_offset || m.index_count != materials[i].indicesNum) {
+      *error = "material " + std::to_string(i) + " index range differs";
+      return false;
+    }
+    index_offset += m.index_count;
+
+    auto paths = ResolveMaterialTexturePaths(model_filepath, materials[i]);
+    const std::pair<const fs::path*, BakedTextureSlot> slots[] = {
+        {&paths.tex, kBakedTextureTex},
+        {&paths.sph, kBakedTextureSph},
+        {&paths.spa, kBakedTextureSpa},
+        {&paths.toon, kBakedTextureToon},
+    };
+    for (auto& slot : slots) {
+      if (slot.first->lexically_normal() != baked.TexturePath(i, slot.second).lexically_normal()) {
+        *error = "material " + std::to_string(i) + " texture path differs: " + slot.first->u8string();
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief 1 回あたりの平均時間 (マイクロ秒)
+ */
+template <typename F>
+double MeasureMicroseconds(int iterations, F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+/**
+ * @brief 起動時に行う処理 (マテリアル定数とテクスチャパスの準備まで) をそれぞれの形式で計測する
+ */
+void Benchmark(const fs::path& model_filepath, const fs::path& baked_path, int iterations) {
+  const double pmd_us = MeasureMicroseconds(iterations, [&]() {
+    PmdFile pmd;
+    pmd.Open(model_filepath);
+    auto constants = PackMaterialConstants(pmd.Materials());
+    for (auto& material : pmd.Materials()) {
+      ResolveMaterialTexturePaths(model_filepath, material);
+    }
+  });
+  const double baked_us = MeasureMicroseconds(iterations, [&]() {
+    BakedModel baked;
+    baked.Open(baked_path);
+    baked.IsUpToDate(model_filepath);
+    for (std::size_t i = 0; i < baked.Materials().size(); ++i) {
+      for (uint32_t slot = 0; slot < kBakedTextureSlotCount; ++slot) {
+        baked.TexturePath(i, static_cast<BakedTextureSlot>(slot));
+      }
+    }
+  });
+  std::cout << "  load: pmd " << pmd_us << " us, baked " << baked_us << " us (" << iterations << " runs)"
+            << std::endl;
+}
+
+/**
+ * @brief 最適化前後の頂点キャッシュの統計を表示する
+ */
+void PrintVertexCacheStats(const PmdFile& pmd, const BakedModel& baked) {
+  const std::vector<uint16_t> original(pmd.Indices().begin(), pmd.Indices().end());
+  const VertexCacheStats before = AnalyzeVertexCache(original.data(), original.size(), pmd.Vertices().size());
+  const VertexCacheStats after =
+      AnalyzeVertexCache(baked.Indices().data(), baked.Indices().size(), baked.Vertices().size());
+  std::cout << "  vertex cache (" << kVertexCacheSimulationSize << " entries): ACMR " << before.acmr << " -> "
+            << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+int Run(const std::vector<fs::path>& args) {
+  BakeOptions options;
+  bool verify = false;
+  int bench_iterations = 0;
+  std::vector<fs::path> inputs;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--optimize") {
+      options.optimize_mesh = true;
+    } else if (args[i] == "--verify") {
+      verify = true;
+    } else if (args[i] == "--bench" && i + 1 < args.size()) {
+      bench_iterations = std::max(1, std::atoi(args[++i].string().c_str()));
+    } else {
+      inputs.push_back(args[i]);
+    }
+  }
+  if (inputs.empty()) {
+    std::cerr << "usage: pmd-bake [--optimize] [--verify] [--bench N] model.pmd..." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int failures = 0;
+  for (auto& input : inputs) {
+    const fs::path model_filepath = fs::absolute(input);
+    const fs::path baked_path = BakedModelPath(model_filepath);
+    std::string error;
+
+    PmdFile pmd;
+    std::vector<uint8_t> data;
+    if (!pmd.Open(model_filepath)) {
+      error = pmd.Error();
+    } else if (BakeModel(pmd, model_filepath, options, &data, &error) && WriteBakedModel(baked_path, data, &error)) {
+      std::cout << baked_path.u8string() << ": " << data.size() << " bytes, " << pmd.Vertices().size()
+                << " vertices, " << pmd.Indices().size() << " indices, " << pmd.Materials().size() << " materials"
+                << std::endl;
+      if (verify || options.optimize_mesh) {
+        BakedModel baked;
+        if (!baked.Open(baked_path)) {
+          error = baked.Error();
+        } else {
+          if (options.optimize_mesh) {
+            PrintVertexCacheStats(pmd, baked);
+          }
+          if (verify && VerifyRoundTrip(pmd, model_filepath, baked, &error)) {
+            std::cout << "  verify: ok" << std::endl;
+          }
+        }
+      }
+      if (error.empty() && bench_iterations > 0) {
+        Benchmark(model_filepath, baked_path, bench_iterations);
+      }
+    }
+    if (!error.empty()) {
+      std::cerr << model_filepath.u8string() << ": " << error << std::endl;
+      ++failures;
+    }
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+
+// Windows ではモデル名 (日本語) をそのまま受け取れるようワイド文字の引数を使う
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+#else
+int main(int argc, char* argv[]) {
+#endif
+  std::vector<fs::path> args(argv + 1, argv + argc);
+  return Run(args);
+}
@@ -0,0 +1,172 @@
+#include "pmd_file.h"
+
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+/////////////
+// PmdFile //
+/////////////
+
+namespace {
+
+/**
+ * @brief 範囲チェック付きの前方カーソル
+ *
+ */
+class PmdCursor {
+ public:
+  PmdCursor(const std::uint8_t* data, std::size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  bool ReadValue(T& out) {
+    if (!Has(sizeof(T))) {
+      return false;
+    }
+    std::memcpy(&out, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  template <typename T>
+  bool ReadPointer(const T*& out) {
+    if (!Has(sizeof(T))) {
+      return false;
+    }
+    out = reinterpret_cast<const T*>(data_ + offset_);
+    offset_ += sizeof(T);
+    return true;
+  }
+
+  template <typename T>
+  bool ReadSpan(std::size_t count, PmdSpan<T>& out) {
+    if (count > (size_ - offset_) / sizeof(T)) {
+      return false;
+    }
+    out = PmdSpan<T>(reinterpret_cast<const T*>(data_ + offset_), count);
+    offset_ += count * sizeof(T);
+    return true;
+  }
+
+  bool AtEnd() const { return offset_ == size_; }
+  std::size_t Offset() const { return offset_; }
+
+ private:
+  bool Has(std::size_t bytes) const { return bytes <= size_ - offset_; }
+
+  const std::uint8_t* data_;
+  std::size_t size_;
+  std::size_t offset_ = 0;
+};
+
+}  // namespace
+
+bool PmdFile::Open(const fs::path& path) {
+  path_ = path;
+  if (!file_.Open(path)) {
+    error_ = file_.Error();
+    return false;
+  }
+  return Parse(file_.data(), file_.size());
+}
+
+bool PmdFile::Parse(const void* data, std::size_t size) {
+  header_ = nullptr;
+  vertices_ = {};
+  indices_ = {};
+  aligned_indices_.clear();
+  materials_ = {};
+  bones_ = {};
+  ik_chains_.clear();
+  morphs_.clear();
+  error_.clear();
+
+  if (data == nullptr && size != 0) {
+    error_ = "PMD data is null";
+    return false;
+  }
+  PmdCursor cursor(static_cast<const std::uint8_t*>(data), size);
+  auto fail = [&](const char* section) {
+    error_ = std::string("PMD file is truncated in ") + section + " section (offset " +
+             std::to_string(cursor.Offset()) + ")";
+    return false;
+  };
+
+  if (!cursor.ReadPointer(header_)) {
+    return fail("header");
+  }
+  if (header_->signature[0] != 'P' || header_->signature[1] != 'm' || header_->signature[2] != 'd') {
+    error_ = "Not a PMD file (bad signature)";
+    header_ = nullptr;
+    return false;
+  }
+
+  // vertices
+  uint32_t vertex_num = 0;
+  if (!cursor.ReadValue(vertex_num) || !cursor.ReadSpan(vertex_num, vertices_)) {
+    return fail("vertex");
+  }
+
+  // indices
+  uint32_t indices_num = 0;
+  if (!cursor.ReadValue(indices_num) || !cursor.ReadSpan(indices_num, indices_)) {
+    return fail("index");
+  }
+  // ファイル上のインデックス列は奇数オフセットにあり, そのままでは uint16_t として読めないので
+  // アライメントの合ったバッファにコピーする (数百 KB 程度で, 頂点と違ってコピーは安い)
+  if (reinterpret_cast<std::uintptr_t>(indices_.data()) % alignof(uint16_t) != 0) {
+    aligned_indices_.resize(indices_.size());
+    std::memcpy(aligned_indices_.data(), indices_.data(), indices_.size_bytes());
+    indices_ = PmdSpan<uint16_t>(aligned_indices_.data(), aligned_indices_.size());
+  }
+
+  // materials
+  uint32_t material_num = 0;
+  if (!cursor.ReadValue(material_num) || !cursor.ReadSpan(material_num, materials_)) {
+    return fail("material");
+  }
+
+  // 以降のセクションは古いツールの出力では欠けていることがあるので, 無ければそこで終了する
+  if (cursor.AtEnd()) {
+    return true;
+  }
+
+  // bones
+  uint16_t bone_num = 0;
+  if (!cursor.ReadValue(bone_num) || !cursor.ReadSpan(bone_num, bones_)) {
+    return fail("bone");
+  }
+  if (cursor.AtEnd()) {
+    return true;
+  }
+
+  // IK chains (可変長)
+  uint16_t ik_num = 0;
+  if (!cursor.ReadValue(ik_num)) {
+    return fail("IK");
+  }
+  ik_chains_.resize(ik_num);
+  for (auto& ik : ik_chains_) {
+    if (!cursor.ReadPointer(ik.header) || !cursor.ReadSpan(ik.header->chain_length, ik.child_bones)) {
+      return fail("IK");
+    }
+  }
+  if (cursor.AtEnd()) {
+    return true;
+  }
+
+  // morphs (可変長)
+  uint16_t morph_num = 0;
+  if (!cursor.ReadValue(morph_num)) {
+    return fail("morph");
+  }
+  morphs_.resize(morph_num);
+  for (auto& morph : morphs_) {
+    if (!cursor.ReadPointer(morph.header) || !cursor.ReadSpan(morph.header->vertex_count, morph.vertices)) {
+      return fail("morph");
+    }
+  }
+
+  // 表示枠・英語名・トゥーン名・剛体などは未対応 (読み飛ばす)
+  return true;
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+////////////////////////////
+// PMD on-disk structures //
+////////////////////////////
+
+// ファイル上のレイアウトそのままなので 1 byte アライメントで定義する
+#pragma pack(push, 1)
+struct PmdFloat2 {
+  float x;
+  float y;
+};
+
+struct PmdFloat3 {
+  float x;
+  float y;
+  float z;
+};
+
+/**
+ * @brief PMD ヘッダー構造体 (先頭の "Pmd" シグネチャを含む)
+ *
+ */
+struct PmdHeader {
+  char signature[3];    // "Pmd"
+  float version;        // 例：00 00 80 3F == 1.00
+  char model_name[20];  // モデル名
+  char comment[256];    // モデルコメント
+};
+
+/**
+ * @brief PMD 頂点構造体 (ファイル上は 38 bytes でパディングなし)
+ *
+ */
+struct PmdVertex {
+  PmdFloat3 pos;
+  PmdFloat3 normal;
+  PmdFloat2 uv;
+  uint16_t bone_no[2];
+  uint8_t weight;    // bone_no[0] の影響度 (0 - 100)
+  uint8_t EdgeFlag;  // 輪郭線フラグ
+};
+
+/**
+ * @brief PMD マテリアル構造体
+ *
+ */
+struct PmdMaterial {
+  PmdFloat3 diffuse;        // 4 bytes * 3 ディフューズ色
+  float alpha;              // 4 bytes      ディフューズα
+  float specularity;        // 4 bytes      スペキュラの強さ (乗算値)
+  PmdFloat3 specular;       // 4 bytes * 3 スペキュラ色
+  PmdFloat3 ambient;        // 4 bytes * 3 アンビエント色
+  unsigned char toonIdx;    // 1 byte      トゥーン番号
+  unsigned char edgeFlg;    // 1 byte      マテリアルごとの輪郭線フラグ
+  unsigned int indicesNum;  // 4 bytes     このマテリアルが割り当てられるインデックス数
+  char texFilePath[20];     // 1 byte * 20 テクスチャファイルパス + alpha
+};
+
+struct PmdBone {
+  char name[20];        // ボーン名
+  uint16_t parent_no;   // 親ボーン番号 (0xffff: なし)
+  uint16_t tail_no;     // 先端のボーン番号
+  uint8_t type;         // ボーン種別
+  uint16_t ik_bone_no;  // IK ボーン番号
+  PmdFloat3 head_pos;   // ボーンの基準点
+};
+
+/**
+ * @brief IK データの固定長部分 (直後に chain_length 個の uint16_t が続く)
+ *
+ */
+struct PmdIkHeader {
+  uint16_t bone_no;         // IK ボーン
+  uint16_t target_bone_no;  // ターゲットボーン
+  uint8_t chain_length;     // 子ボーンの数
+  uint16_t iterations;      // 再帰演算回数
+  float control_weight;     // 1 回あたりの角度制限
+};
+
+/**
+ * @brief 表情 (skin) データの固定長部分 (直後に vertex_count 個の PmdMorphVertex が続く)
+ *
+ */
+struct PmdMorphHeader {
+  char name[20];
+  uint32_t vertex_count;
+  uint8_t type;  // 0: base, 1: まゆ, 2: 目, 3: リップ, 4: その他
+};
+
+struct PmdMorphVertex {
+  uint32_t vertex_index;
+  PmdFloat3 offset;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(PmdHeader) == 283, "PMD header must be 283 bytes");
+static_assert(sizeof(PmdVertex) == 38, "PMD vertex must be 38 bytes");
+static_assert(sizeof(PmdMaterial) == 70, "PMD material must be 70 bytes");
+static_assert(sizeof(PmdBone) == 39, "PMD bone must be 39 bytes");
+static_assert(sizeof(PmdIkHeader) == 11, "PMD IK header must be 11 bytes");
+static_assert(sizeof(PmdMorphHeader) == 25, "PMD morph header must be 25 bytes");
+static_assert(sizeof(PmdMorphVertex) == 16, "PMD morph vertex must be 16 bytes");
+
+/**
+ * @brief 読み取り専用の範囲ビュー
+ * @details operator[] はデバッグビルドでのみ範囲チェックする. 常にチェックしたい場合は at() を使う.
+ *          要素型は 1 byte アライメントの構造体 (または memcpy で読む前提の型) であること.
+ */
+template <typename T>
+class PmdSpan {
+ public:
+  PmdSpan() = default;
+  PmdSpan(const T* data, std::size_t size) : data_(data), size_(size) {}
+
+  const T* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  std::size_t size_bytes() const { return size_ * sizeof(T); }
+  bool empty() const { return size_ == 0; }
+
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+  const T& operator[](std::size_t i) const {
+#ifdef _DEBUG
+    if (i >= size_) {
+      throw std::out_of_range("PmdSpan index out of range");
+    }
+#endif
+    return data_[i];
+  }
+
+  const T& at(std::size_t i) const {
+    if (i >= size_) {
+      throw std::out_of_range("PmdSpan index out of range");
+    }
+    return data_[i];
+  }
+
+ private:
+  const T* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+struct PmdIkChain {
+  const PmdIkHeader* header = nullptr;
+  PmdSpan<uint16_t> child_bones;  // 奇数オフセットに置かれることがあるので memcpy で読むこと
+};
+
+struct PmdMorph {
+  const PmdMorphHeader* header = nullptr;
+  PmdSpan<PmdMorphVertex> vertices;
+};
+
+/**
+ * @brief PMD ファイルのゼロコピーリーダー
+ * @details ファイルをメモリマップし, 各セクションをマップ領域上のビューとして返す.
+ *          要素ごとの fread やコピーは行わない (アライメントの合わないインデックス列だけはまとめてコピーする).
+ *          返したビューは PmdFile が生きている間だけ有効.
+ *
+ *   PmdFile pmd;
+ *   if (!pmd.Open(path)) { ... pmd.Error() ... }
+ *   for (auto& v : pmd.Vertices()) { ... }
+ */
+class PmdFile {
+ public:
+  PmdFile() = default;
+  PmdFile(const PmdFile&) = delete;
+  PmdFile& operator=(const PmdFile&) = delete;
+  PmdFile(PmdFile&&) noexcept = default;
+  PmdFile& operator=(PmdFile&&) noexcept = default;
+
+  /**
+   * @brief ファイルをマップしてパースする
+   * @return 失敗したら false. 理由は Error() で取得できる
+   */
+  bool Open(const std::filesystem::path& path);
+
+  /**
+   * @brief メモリ上の PMD データをパースする (データは呼び出し側が保持し続けること)
+   */
+  bool Parse(const void* data, std::size_t size);
+
+  const PmdHeader& Header() const { return *header_; }
+  PmdSpan<PmdVertex> Vertices() const { return vertices_; }
+  // ファイル上では奇数オフセットに置かれるので, 必要ならアライメントの合ったコピーを返す (要素を直接読んでよい)
+  PmdSpan<uint16_t> Indices() const { return indices_; }
+  PmdSpan<PmdMaterial> Materials() const { return materials_; }
+  PmdSpan<PmdBone> Bones() const { return bones_; }
+  const std::vector<PmdIkChain>& IkChains() const { return ik_chains_; }
+  const std::vector<PmdMorph>& Morphs() const { return morphs_; }
+
+  const std::filesystem::path& Path() const { return path_; }
+  const std::string& Error() const { return error_; }
+
+ private:
+  MappedFile file_;
+  std::filesystem::path path_;
+  const PmdHeader* header_ = nullptr;
+  PmdSpan<PmdVertex> vertices_;
+  PmdSpan<uint16_t> indices_;
+  std::vector<uint16_t> aligned_indices_;  // indices_ がファイル上で uint16_t に揃っていないときのコピー
+  PmdSpan<PmdMaterial> materials_;
+  PmdSpan<PmdBone> bones_;
+  std::vector<PmdIkChain> ik_chains_;
+  std::vector<PmdMorph> morphs_;
+  std::string error_;
+};
@@ -0,0 +1,118 @@
+#include "png_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+
+namespace {
+
+const std::array<uint32_t, 256>& Crc32Table() {
+  static const std::array<uint32_t, 256> table = []() {
+    std::array<uint32_t, 256> t = {};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  return table;
+}
+
+uint32_t Crc32(const uint8_t* data, std::size_t size, uint32_t crc = 0) {
+  const auto& table = Crc32Table();
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void PutU32(std::vector<uint8_t>& out, uint32_t v) {
+  out.push_back(static_cast<uint8_t>(v >> 24));
+  out.push_back(static_cast<uint8_t>(v >> 16));
+  out.push_back(static_cast<uint8_t>(v >> 8));
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+void PutChunk(std::vector<uint8_t>& out, const char type[4], const std::vector<uint8_t>& data) {
+  PutU32(out, static_cast<uint32_t>(data.size()));
+  const std::size_t crc_begin = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  PutU32(out, Crc32(out.data() + crc_begin, out.size() - crc_begin));
+}
+
+}  // namespace
+
+std::vector<uint8_t> EncodePng(const Image& image) {
+  if (image.format != PixelFormat::kRGBA8 && image.format != PixelFormat::kBGRA8) {
+    return {};
+  }
+
+  // 各行の先頭にフィルタ種別 (0: なし) を付けた生データ
+  const std::size_t row_bytes = std::size_t(image.width) * 4;
+  std::vector<uint8_t> raw;
+  raw.reserve((row_bytes + 1) * image.height);
+  for (uint32_t y = 0; y < image.height; ++y) {
+    raw.push_back(0);
+    const uint8_t* row = image.Row(y);
+    if (image.format == PixelFormat::kRGBA8) {
+      raw.insert(raw.end(), row, row + row_bytes);
+    } else {
+      for (std::size_t x = 0; x < row_bytes; x += 4) {
+        raw.insert(raw.end(), {row[x + 2], row[x + 1], row[x], row[x + 3]});
+      }
+    }
+  }
+
+  // zlib ストリーム: ヘッダー + 無圧縮ブロック (最大 65535 bytes) の列 + Adler-32
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  std::size_t offset = 0;
+  do {
+    const std::size_t len = std::min<std::size_t>(raw.size() - offset, 65535);
+    const bool last = offset + len == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(static_cast<uint8_t>(len));
+    zlib.push_back(static_cast<uint8_t>(len >> 8));
+    zlib.push_back(static_cast<uint8_t>(~len));
+    zlib.push_back(static_cast<uint8_t>(~len >> 8));
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + len);
+    offset += len;
+  } while (offset < raw.size());
+  uint32_t a = 1;
+  uint32_t b = 0;
+  for (auto byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  PutU32(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  std::vector<uint8_t> ihdr;
+  PutU32(ihdr, image.width);
+  PutU32(ihdr, image.height);
+  ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0});  // 8 bit, RGBA, deflate, filter 0, interlace なし
+  PutChunk(png, "IHDR", ihdr);
+  PutChunk(png, "IDAT", zlib);
+  PutChunk(png, "IEND", {});
+  return png;
+}
+
+bool WritePng(const std::filesystem::path& path, const Image& image, std::string* error) {
+  const std::vector<uint8_t> png = EncodePng(image);
+  if (png.empty()) {
+    *error = path.u8string() + ": unsupported pixel format";
+    return false;
+  }
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+  if (!ofs) {
+    *error = path.u8string() + ": write failed";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+/**
+ * @brief 画像を PNG (8 bit RGBA) にエンコードする
+ * @details 圧縮はしない (deflate の無圧縮ブロックのみ). ゴールデンイメージの比較やデバッグ出力用.
+ * @return 対応していないフォーマットなら空
+ */
+std::vector<uint8_t> EncodePng(const Image& image);
+
+/**
+ * @brief 画像を PNG ファイルに書き出す
+ * @return 失敗したら false
+ */
+bool WritePng(const std::filesystem::path& path, const Image& image, std::string* error);
@@ -0,0 +1,261 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <map>
+
+namespace {
+
+std::size_t RoundUpToPowerOfTwo(std::size_t value) {
+  std::size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+double ToMs(uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+void AppendJsonString(std::string* out, const std::string& value) {
+  out->push_back('"');
+  for (const char c : value) {
+    switch (c) {
+      case '"':
+        *out += "\\\"";
+        break;
+      case '\\':
+        *out += "\\\\";
+        break;
+      case '\n':
+        *out += "\\n";
+        break;
+      case '\t':
+        *out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buffer[8];
+          std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned int>(c));
+          *out += buffer;
+        } else {
+          out->push_back(c);  // UTF-8 はそのまま
+        }
+        break;
+    }
+  }
+  out->push_back('"');
+}
+
+// Chrome trace の時刻はマイクロ秒
+void AppendMicroseconds(std::string* out, uint64_t ns) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%" PRIu64 ".%03u", ns / 1000, static_cast<unsigned int>(ns % 1000));
+  *out += buffer;
+}
+
+}  // namespace
+
+DurationSummary SummarizeDurations(std::vector<uint64_t> durations_ns) {
+  DurationSummary summary;
+  if (durations_ns.empty()) {
+    return summary;
+  }
+  std::sort(durations_ns.begin(), durations_ns.end());
+  const std::size_t count = durations_ns.size();
+  const auto percentile = [&](std::size_t p) {
+    // nearest-rank: 小さい方から ceil(p / 100 * count) 番目
+    const std::size_t rank = std::max<std::size_t>((p * count + 99) / 100, 1);
+    return ToMs(durations_ns[rank - 1]);
+  };
+  double total = 0.0;
+  for (const uint64_t duration : durations_ns) {
+    total += static_cast<double>(duration);
+  }
+  summary.count = count;
+  summary.mean_ms = total / static_cast<double>(count) / 1e6;
+  summary.p50_ms = percentile(50);
+  summary.p99_ms = percentile(99);
+  summary.max_ms = ToMs(durations_ns.back());
+  return summary;
+}
+
+std::atomic<Profiler*> Profiler::current_{nullptr};
+std::atomic<uint64_t> Profiler::next_id_{1};
+
+Profiler::Profiler(const Options& options)
+    : id_(next_id_.fetch_add(1, std::memory_order_relaxed)),
+      origin_(std::chrono::steady_clock::now()),
+      capacity_(RoundUpToPowerOfTwo(std::max<std::size_t>(options.events_per_thread, 1))),
+      mask_(capacity_ - 1) {
+  frame_times_ns_.reserve(std::max<std::size_t>(options.frame_window, 1));
+}
+
+Profiler::~Profiler() {
+  Profiler* self = this;
+  current_.compare_exchange_strong(self, nullptr);
+}
+
+Profiler::ThreadBuffer* Profiler::RegisterThread() {
+  const auto owner = std::this_thread::get_id();
+  std::lock_guard<std::mutex> lock(mutex_);
+  // 別のプロファイラーを使った後に戻ってきたスレッドは前のバッファを使い続ける
+  for (const auto& buffer : buffers_) {
+    if (buffer->owner == owner) {
+      return buffer.get();
+    }
+  }
+  auto buffer = std::make_unique<ThreadBuffer>(capacity_);
+  buffer->owner = owner;
+  buffer->thread_id = static_cast<uint32_t>(buffers_.size() + 1);
+  buffers_.push_back(std::move(buffer));
+  return buffers_.back().get();
+}
+
+void Profiler::SetThreadName(const std::string& name) {
+  ThreadBuffer* buffer = LocalBuffer();
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffer->thread_name = name;
+}
+
+void Profiler::MarkFrame() {
+  const uint64_t now = NowNs();
+  if (frame_started_) {
+    Record("frame", last_frame_ns_, now);
+    const uint64_t duration = now - last_frame_ns_;
+    if (frame_times_ns_.size() < frame_times_ns_.capacity()) {
+      frame_times_ns_.push_back(duration);
+    } else {
+      frame_times_ns_[frames_ % frame_times_ns_.size()] = duration;
+    }
+    ++frames_;
+  }
+  last_frame_ns_ = now;
+  frame_started_ = true;
+}
+
+DurationSummary Profiler::FrameSummary() const { return SummarizeDurations(frame_times_ns_); }
+
+std::vector<Profiler::ThreadEvents> Profiler::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<ThreadEvents> result;
+  result.reserve(buffers_.size());
+  for (const auto& buffer : buffers_) {
+    ThreadEvents thread;
+    thread.thread_id = buffer->thread_id;
+    thread.thread_name = buffer->thread_name;
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    const uint64_t first = written > capacity_ ? written - capacity_ : 0;
+    thread.events.reserve(static_cast<std::size_t>(written - first));
+    for (uint64_t i = first; i < written; ++i) {
+      const Slot& slot = buffer->slots[i & mask_];
+      thread.events.push_back({slot.name.load(std::memory_order_relaxed),
+                               slot.begin_ns.load(std::memory_order_relaxed),
+                               slot.end_ns.load(std::memory_order_relaxed)});
+    }
+    // 読んでいる間に書き手が上書きを始めたスロットは壊れているかもしれない.
+    // 書き手が書いている区間は after 番目以前なので (Record() の fence と対になる), 同じスロットを使う
+    // index + capacity_ <= after の区間を捨てる
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = buffer->written.load(std::memory_order_relaxed);
+    const uint64_t valid_first = after >= capacity_ ? after - capacity_ + 1 : 0;
+    if (valid_first > first) {
+      const auto drop = static_cast<std::size_t>(std::min(valid_first, written) - first);
+      thread.events.erase(thread.events.begin(), thread.events.begin() + drop);
+    }
+    result.push_back(std::move(thread));
+  }
+  return result;
+}
+
+std::vector<Profiler::StageSummary> Profiler::StageSummaries() const {
+  std::map<std::string, std::vector<uint64_t>> durations;
+  for (const auto& thread : Snapshot()) {
+    for (const auto& event : thread.events) {
+      durations[event.name].push_back(event.end_ns - event.begin_ns);
+    }
+  }
+  std::vector<StageSummary> result;
+  result.reserve(durations.size());
+  for (auto& [name, values] : durations) {
+    StageSummary stage;
+    stage.name = name;
+    stage.duration = SummarizeDurations(std::move(values));
+    stage.total_ms = stage.duration.mean_ms * static_cast<double>(stage.duration.count);
+    result.push_back(std::move(stage));
+  }
+  std::sort(result.begin(), result.end(), [](const StageSummary& a, const StageSummary& b) {
+    return a.total_ms != b.total_ms ? a.total_ms > b.total_ms : a.name < b.name;
+  });
+  return result;
+}
+
+Profiler::Stats Profiler::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  stats.threads = buffers_.size();
+  for (const auto& buffer : buffers_) {
+    const uint64_t written = buffer->written.load(std::memory_order_acquire);
+    stats.events += written;
+    stats.overwritten += written > capacity_ ? written - capacity_ : 0;
+  }
+  stats.frames = frames_;
+  return stats;
+}
+
+std::string Profiler::FormatSummary() const {
+  std::string text;
+  char line[256];
+  const DurationSummary frame = FrameSummary();
+  std::snprintf(line, sizeof(line), "frame: p50 %.2f ms, p99 %.2f ms, max %.2f ms (last %zu frames)\n", frame.p50_ms,
+                frame.p99_ms, frame.max_ms, frame.count);
+  text += line;
+  for (const auto& stage : StageSummaries()) {
+    std::snprintf(line, sizeof(line), "  %-16s %8zu calls, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, total %.1f ms\n",
+                  stage.name.c_str(), stage.duration.count, stage.duration.mean_ms, stage.duration.p50_ms,
+                  stage.duration.p99_ms, stage.total_ms);
+    text += line;
+  }
+  return text;
+}
+
+bool Profiler::WriteChromeTrace(const std::filesystem::path& path, std::string* error) const {
+  const auto threads = Snapshot();
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  const auto begin_event = [&]() {
+    json += first ? "\n" : ",\n";
+    first = false;
+  };
+  for (const auto& thread : threads) {
+    const std::string tid = std::to_string(thread.thread_id);
+    begin_event();
+    json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid + ",\"args\":{\"name\":";
+    AppendJsonString(&json, thread.thread_name.empty() ? "thread " + tid : thread.thread_name);
+    json += "}}";
+    for (const auto& event : thread.events) {
+      begin_event();
+      json += "{\"name\":";
+      AppendJsonString(&json, event.name != nullptr ? event.name : "");
+      json += ",\"ph\":\"X\",\"pid\":1,\"tid\":" + tid + ",\"ts\":";
+      AppendMicroseconds(&json, event.begin_ns);
+      json += ",\"dur\":";
+      AppendMicroseconds(&json, event.end_ns - event.begin_ns);
+      json += "}";
+    }
+  }
+  json += "\n]}\n";
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    *error = path.u8string() + ": open failed";
+    return false;
+  }
+  file.write(json.data(), static_cast<std::streamsize>(json.size()));
+  if (!file) {
+    *error = path.u8string() + ": write failed";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 区間の時間の分布 (ミリ秒)
+ */
+struct DurationSummary {
+  std::size_t count = 0;
+  double mean_ms = 0.0;
+  double p50_ms = 0.0;
+  double p99_ms = 0.0;
+  double max_ms = 0.0;
+};
+
+/**
+ * @brief durations_ns (ナノ秒) の分布を求める. パーセンタイルは nearest-rank
+ */
+DurationSummary SummarizeDurations(std::vector<uint64_t> durations_ns);
+
+/**
+ * @brief 処理の段階ごとの CPU 時間を記録するプロファイラー
+ * @details 記録はスレッドごとのリングバッファに書くだけで, ロックを取らない (スレッドを初めて使うときだけ登録でロックする).
+ *          リングバッファが一周すると古い区間から上書きされるので, 直近のフレームだけが残る.
+ *          リリースビルドでも有効にしたまま使える程度に軽くしてある (perf-bench profiler で計測できる).
+ *
+ * @code
+ *   Profiler profiler;
+ *   Profiler::SetCurrent(&profiler);
+ *   {
+ *     ProfileScope scope("model parse");
+ *     ...
+ *   }
+ *   profiler.MarkFrame();
+ *   profiler.WriteChromeTrace("frame_trace.json", &error);  // chrome://tracing や Perfetto で開く
+ * @endcode
+ */
+class Profiler {
+ public:
+  struct Options {
+    std::size_t events_per_thread = std::size_t(1) << 16;  // 2 の冪に切り上げる
+    std::size_t frame_window = 300;                        // フレーム時間の分布を取る直近のフレーム数
+  };
+
+  /**
+   * @brief 記録した区間 1 つ. 時刻はプロファイラーを作ってからのナノ秒
+   */
+  struct Event {
+    const char* name;  // 文字列リテラルなど, プロファイラーより長く生きるもの
+    uint64_t begin_ns;
+    uint64_t end_ns;
+  };
+
+  struct ThreadEvents {
+    uint32_t thread_id;  // 登録した順に 1 から
+    std::string thread_name;
+    std::vector<Event> events;  // 古い順
+  };
+
+  struct StageSummary {
+    std::string name;
+    DurationSummary duration;
+    double total_ms = 0.0;
+  };
+
+  struct Stats {
+    std::size_t threads = 0;
+    uint64_t events = 0;       // 記録した区間の数
+    uint64_t overwritten = 0;  // リングバッファが一周して上書きされた区間の数
+    uint64_t frames = 0;
+  };
+
+  Profiler() : Profiler(Options()) {}
+  explicit Profiler(const Options& options);
+  ~Profiler();
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  /**
+   * @brief ProfileScope が記録するプロファイラー (無ければ nullptr で, 何も記録しない)
+   */
+  static Profiler* Current() { return current_.load(std::memory_order_acquire); }
+  /**
+   * @brief profiler を ProfileScope の記録先にする. 記録中のスレッドがある間に破棄しないこと
+   */
+  static void SetCurrent(Profiler* profiler) { current_.store(profiler, std::memory_order_release); }
+
+  uint64_t NowNs() const {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count());
+  }
+
+  /**
+   * @brief 呼び出したスレッドのリングバッファに区間を書く
+   */
+  void Record(const char* name, uint64_t begin_ns, uint64_t end_ns) {
+    ThreadBuffer* buffer = LocalBuffer();
+    const uint64_t index = buffer->written.load(std::memory_order_relaxed);
+    // スロットを書き換える前に, Snapshot() が written = index を読めるようにする (読み終えた後に上書きを検出するため)
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& slot = buffer->slots[index & mask_];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.begin_ns.store(begin_ns, std::memory_order_relaxed);
+    slot.end_ns.store(end_ns, std::memory_order_relaxed);
+    buffer->written.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief 呼び出したスレッドに Chrome trace で表示する名前を付ける
+   */
+  void SetThreadName(const std::string& name);
+
+  /**
+   * @brief フレームの区切り. 前回の呼び出しからを "frame" として記録し, フレーム時間の分布に加える
+   * @details MarkFrame() と FrameSummary() は同じスレッド (メインスレッド) から呼ぶこと
+   */
+  void MarkFrame();
+  /**
+   * @brief 直近 Options::frame_window フレームのフレーム時間の分布
+   */
+  DurationSummary FrameSummary() const;
+
+  /**
+   * @brief 全スレッドのリングバッファに残っている区間を集める
+   * @details 記録中のスレッドがあっても呼べる. 読んでいる間に上書きされた可能性のある区間は除く
+   *          (リングバッファが一周していれば, 書き手が上書き中かもしれない最も古い区間も除く)
+   */
+  std::vector<ThreadEvents> Snapshot() const;
+  /**
+   * @brief リングバッファに残っている区間の名前ごとの分布 (合計時間の長い順)
+   */
+  std::vector<StageSummary> StageSummaries() const;
+  Stats GetStats() const;
+  /**
+   * @brief FrameSummary() と StageSummaries() を人が読む形にしたもの (1 行に 1 項目)
+   */
+  std::string FormatSummary() const;
+
+  /**
+   * @brief リングバッファに残っている区間を Chrome trace の JSON で書き出す
+   * @return 失敗したら false. 理由は error に入れる
+   */
+  bool WriteChromeTrace(const std::filesystem::path& path, std::string* error) const;
+
+ private:
+  struct Slot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> begin_ns{0};
+    std::atomic<uint64_t> end_ns{0};
+  };
+
+  struct ThreadBuffer {
+    explicit ThreadBuffer(std::size_t capacity) : slots(new Slot[capacity]) {}
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> written{0};  // 書いた区間の数 (書いたスロットの内容より後に更新する)
+    std::thread::id owner;
+    uint32_t thread_id = 0;
+    std::string thread_name;  // mutex_ で保護する
+  };
+
+  ThreadBuffer* LocalBuffer() {
+    // スレッドごとに最後に使ったプロファイラーのバッファを覚えておく (id はプロファイラーごとに一意)
+    thread_local struct {
+      uint64_t profiler_id = 0;
+      ThreadBuffer* buffer = nullptr;
+    } cache;
+    if (cache.profiler_id != id_) {
+      cache.buffer = RegisterThread();
+      cache.profiler_id = id_;
+    }
+    return cache.buffer;
+  }
+  ThreadBuffer* RegisterThread();
+
+  static std::atomic<Profiler*> current_;
+  static std::atomic<uint64_t> next_id_;
+
+  const uint64_t id_;
+  const std::chrono::steady_clock::time_point origin_;
+  std::size_t capacity_;
+  uint64_t mask_;
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+
+  std::vector<uint64_t> frame_times_ns_;  // 直近のフレーム時間のリングバッファ
+  uint64_t frames_ = 0;
+  uint64_t last_frame_ns_ = 0;
+  bool frame_started_ = false;
+};
+
+/**
+ * @brief 生存期間を Profiler::Current() に記録する
+ * @details Current() が nullptr なら時刻も取らない. name は文字列リテラルを渡すこと
+ */
+class ProfileScope {
+ public:
+  explicit ProfileScope(const char* name)
+      : profiler_(Profiler::Current()), name_(name), begin_ns_(profiler_ != nullptr ? profiler_->NowNs() : 0) {}
+  ~ProfileScope() {
+    if (profiler_ != nullptr) {
+      profiler_->Record(name_, begin_ns_, profiler_->NowNs());
+    }
+  }
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+ private:
+  Profiler* profiler_;
+  const char* name_;
+  uint64_t begin_ns_;
+};
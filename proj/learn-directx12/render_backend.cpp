@@ -0,0 +1,34 @@
+#include "render_backend.h"
+
+ResourceHandle CreateTextureFromLevels(RenderBackend& backend, const std::vector<Image>& levels,
+                                       uint32_t first_level) {
+  if (first_level >= levels.size()) {
+    return 0;
+  }
+  const Image& top = levels[first_level];
+  TextureDesc desc;
+  desc.format = top.format;
+  desc.width = top.width;
+  desc.height = top.height;
+  desc.mip_levels = static_cast<uint32_t>(levels.size() - first_level);
+  const ResourceHandle texture = backend.CreateTexture(desc);
+  if (texture == 0) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < desc.mip_levels; ++i) {
+    if (!backend.WriteTexture(texture, i, levels[first_level + i])) {
+      backend.ReleaseResource(texture);
+      return 0;
+    }
+  }
+  return texture;
+}
+
+void RecordSceneRange(const std::vector<DrawCommand>& commands, const RecordRange& range, const PassDesc& pass,
+                      const SceneBindings& bindings, RenderCommandList& list) {
+  list.BeginPass(pass);
+  list.SetVertexBuffer(bindings.vertices);
+  list.SetIndexBuffer(bindings.indices);
+  list.SetConstantBuffer(bindings.constants);
+  RecordDrawRange(commands, range, list);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "command_recording.h"
+#include "draw_list.h"
+#include "image.h"
+
+// バックエンドが作ったリソースの識別子 (D3D12 なら ID3D12Resource* の値). 0 は無効
+using ResourceHandle = uint64_t;
+
+/**
+ * @brief 2D テクスチャの形式
+ */
+struct TextureDesc {
+  PixelFormat format = PixelFormat::kUnknown;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t mip_levels = 1;
+};
+
+/**
+ * @brief バッファの一部を頂点・インデックスバッファとして使う範囲
+ */
+struct BufferView {
+  ResourceHandle buffer = 0;
+  uint64_t offset = 0;  // バッファの先頭からのバイト数
+  uint32_t size = 0;
+  uint32_t stride = 0;  // 頂点バッファなら 1 頂点, インデックスバッファなら 1 インデックス (2 か 4) のバイト数
+};
+
+/**
+ * @brief 描画先 (バックバッファと深度バッファ) の設定
+ */
+struct PassDesc {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  bool clear_color = false;
+  bool clear_depth = false;
+  float color[4] = {};
+  float depth = 1.0f;
+};
+
+/**
+ * @brief リソースを作るバックエンド (D3D12 や, メモリ上に記録するだけの NullRenderBackend)
+ * @details main.cpp の描画処理はこのインターフェース越しにリソースを作るので, GPU の無い環境でも同じ処理を動かせる.
+ *          呼び出しはメインスレッドからだけ行う.
+ */
+class RenderBackend {
+ public:
+  virtual ~RenderBackend() = default;
+
+  /**
+   * @brief CPU から書けて GPU から読めるバッファ (D3D12 ならアップロードヒープ) を作る
+   * @return 失敗したら 0
+   */
+  virtual ResourceHandle CreateBuffer(uint64_t size) = 0;
+
+  /**
+   * @brief シェーダーから読むテクスチャを作る. 中身は WriteTexture() で書く
+   * @return 失敗したら 0
+   */
+  virtual ResourceHandle CreateTexture(const TextureDesc& desc) = 0;
+
+  /**
+   * @brief バッファの中身の CPU のアドレス (ReleaseResource() するまで有効)
+   * @return 失敗したら nullptr
+   */
+  virtual uint8_t* MapBuffer(ResourceHandle buffer) = 0;
+
+  /**
+   * @brief テクスチャの level 番目のミップに image を書く (image の形式と大きさはミップと同じであること)
+   */
+  virtual bool WriteTexture(ResourceHandle texture, uint32_t level, const Image& image) = 0;
+
+  /**
+   * @brief リソースを破棄する. GPU が使い終わってから呼ぶこと
+   */
+  virtual void ReleaseResource(ResourceHandle resource) = 0;
+};
+
+/**
+ * @brief 描画コマンドの記録先 (D3D12 ならコマンドリスト 1 つ)
+ * @details RecordDrawRange() の Backend としてそのまま使える. コマンドリストは状態を引き継がないので,
+ *          BeginPass() の後に頂点・インデックスバッファなどを設定し直す. 1 つのリストは 1 つのスレッドから使う.
+ */
+class RenderCommandList {
+ public:
+  virtual ~RenderCommandList() = default;
+
+  /**
+   * @brief 描画先・ビューポートを設定し, 指定があればクリアする
+   */
+  virtual void BeginPass(const PassDesc& pass) = 0;
+  virtual void SetVertexBuffer(const BufferView& view) = 0;
+  virtual void SetIndexBuffer(const BufferView& view) = 0;
+  // シーンの定数 (b0) の GPU のアドレス (LinearUploadAllocator で切り出したもの)
+  virtual void SetConstantBuffer(uint64_t gpu_address) = 0;
+  virtual void SetPipeline(uint32_t pipeline) = 0;
+  virtual void SetGeometry(uint32_t geometry) = 0;
+  // DrawListBuilder が重複を除いたマテリアルの番号
+  virtual void SetMaterial(uint32_t material) = 0;
+  virtual void DrawIndexed(uint32_t index_count, uint32_t index_offset) = 0;
+};
+
+/**
+ * @brief ミップチェーンの first_level 以降を持つテクスチャを作って全ミップを書く
+ * @param levels level 0 から順に並んだミップ
+ * @return 失敗したら 0 (作りかけのリソースは破棄する)
+ */
+ResourceHandle CreateTextureFromLevels(RenderBackend& backend, const std::vector<Image>& levels,
+                                       uint32_t first_level);
+
+/**
+ * @brief シーンの描画に共通のバインディング
+ */
+struct SceneBindings {
+  BufferView vertices;
+  BufferView indices;
+  uint64_t constants = 0;  // シーンの定数の GPU のアドレス
+};
+
+/**
+ * @brief 描画コマンドの区間を list に記録する (パスの開始とバインディングの設定を含む)
+ * @details 区間ごとのコマンドリストの中身はこれだけなので, D3D12 と RecordingCommandList で同じものが記録される.
+ * @param pass 区間ごとに設定し直すので, クリアは指定しない (フレームの最初のコマンドリストで行う)
+ */
+void RecordSceneRange(const std::vector<DrawCommand>& commands, const RecordRange& range, const PassDesc& pass,
+                      const SceneBindings& bindings, RenderCommandList& list);
@@ -0,0 +1,219 @@
+#include "skinning.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKINNING_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+//////////////
+// Skeleton //
+//////////////
+
+void Skeleton::Build(PmdSpan<PmdBone> bones) {
+  const std::size_t n = bones.size();
+  parents_.assign(n, kNoParentBone);
+  heads_.resize(n);
+  names_.resize(n);
+  order_.clear();
+  order_.reserve(n);
+
+  std::vector<std::vector<uint16_t>> children(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    const PmdBone& bone = bones[i];
+    heads_[i] = {bone.head_pos.x, bone.head_pos.y, bone.head_pos.z};
+    names_[i].assign(bone.name, strnlen(bone.name, sizeof(bone.name)));
+    if (bone.parent_no < n && bone.parent_no != i) {
+      parents_[i] = bone.parent_no;
+      children[bone.parent_no].push_back(static_cast<uint16_t>(i));
+    }
+  }
+
+  // ルートから幅優先でたどる. 循環していて到達できなかったボーンはルート扱いにしてたどり直す
+  std::vector<bool> visited(n, false);
+  auto visit_from = [&](uint16_t root) {
+    std::deque<uint16_t> queue = {root};
+    visited[root] = true;
+    while (!queue.empty()) {
+      const uint16_t bone = queue.front();
+      queue.pop_front();
+      order_.push_back(bone);
+      for (auto child : children[bone]) {
+        if (!visited[child]) {
+          visited[child] = true;
+          queue.push_back(child);
+        }
+      }
+    }
+  };
+  for (std::size_t i = 0; i < n; ++i) {
+    if (parents_[i] == kNoParentBone) {
+      visit_from(static_cast<uint16_t>(i));
+    }
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    if (!visited[i]) {
+      parents_[i] = kNoParentBone;
+      visit_from(static_cast<uint16_t>(i));
+    }
+  }
+}
+
+int Skeleton::FindBone(const std::string& name) const {
+  auto it = std::find(names_.begin(), names_.end(), name);
+  return it == names_.end() ? -1 : static_cast<int>(it - names_.begin());
+}
+
+void Skeleton::ComputeSkinningMatrices(const std::vector<BonePose>& pose, std::vector<Matrix4>* out) const {
+  out->resize(BoneCount());
+  for (auto bone : order_) {
+    Matrix4 local;
+    if (bone < pose.size()) {
+      const BonePose& p = pose[bone];
+      const Float3& head = heads_[bone];
+      local = MatrixTranslation(-head) * MatrixRotationQuaternion(p.rotation) * MatrixTranslation(head + p.translation);
+    }
+    const uint16_t parent = parents_[bone];
+    (*out)[bone] = parent == kNoParentBone ? local : local * (*out)[parent];
+  }
+}
+
+/////////////////////
+// Vertex skinning //
+/////////////////////
+
+void SkinnedVertices::Resize(std::size_t n) {
+  count = n;
+  for (auto* v : {&px, &py, &pz, &nx, &ny, &nz}) {
+    v->resize(n);
+  }
+}
+
+SkinningStreams MakeSkinningStreams(PmdSpan<PmdVertex> vertices, std::size_t bone_count) {
+  SkinningStreams s;
+  s.count = vertices.size();
+  for (auto* v : {&s.px, &s.py, &s.pz, &s.nx, &s.ny, &s.nz, &s.weight}) {
+    v->resize(s.count);
+  }
+  s.bone0.resize(s.count);
+  s.bone1.resize(s.count);
+  for (std::size_t i = 0; i < s.count; ++i) {
+    const PmdVertex& v = vertices[i];
+    s.px[i] = v.pos.x;
+    s.py[i] = v.pos.y;
+    s.pz[i] = v.pos.z;
+    s.nx[i] = v.normal.x;
+    s.ny[i] = v.normal.y;
+    s.nz[i] = v.normal.z;
+    s.weight[i] = std::min<uint8_t>(v.weight, 100) / 100.0f;
+    // ボーンが無いモデルでも行列 1 つ (単位行列) で処理できるよう範囲外は 0 にする
+    s.bone0[i] = v.bone_no[0] < bone_count ? v.bone_no[0] : 0;
+    s.bone1[i] = v.bone_no[1] < bone_count ? v.bone_no[1] : 0;
+  }
+  return s;
+}
+
+void SkinVerticesReference(const SkinningStreams& in, const std::vector<Matrix4>& matrices, std::size_t begin,
+                           std::size_t end, SkinnedVertices* out) {
+  assert(end <= in.count && end <= out->count && !matrices.empty());
+  for (std::size_t i = begin; i < end; ++i) {
+    const Matrix4& a = matrices[in.bone0[i]];
+    const Matrix4& b = matrices[in.bone1[i]];
+    const float w = in.weight[i];
+    Matrix4 m;
+    for (int r = 0; r < 4; ++r) {
+      for (int c = 0; c < 4; ++c) {
+        m.m[r][c] = b.m[r][c] + w * (a.m[r][c] - b.m[r][c]);
+      }
+    }
+    const Float3 p = TransformPoint({in.px[i], in.py[i], in.pz[i]}, m);
+    const Float3 n = Normalize(TransformNormal({in.nx[i], in.ny[i], in.nz[i]}, m));
+    out->px[i] = p.x;
+    out->py[i] = p.y;
+    out->pz[i] = p.z;
+    out->nx[i] = n.x;
+    out->ny[i] = n.y;
+    out->nz[i] = n.z;
+  }
+}
+
+void SkinVerticesSimd(const SkinningStreams& in, const std::vector<Matrix4>& matrices, std::size_t begin,
+                      std::size_t end, SkinnedVertices* out) {
+  assert(end <= in.count && end <= out->count && !matrices.empty());
+  std::size_t i = begin;
+#ifdef SKINNING_USE_SSE
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= end; i += 4) {
+    // 4 頂点分のブレンド行列を作り, 行ごとに転置して成分ごとのレジスタにする
+    // rows[r][c] は「r 行目 c 列目の値を 4 頂点分並べたもの」
+    __m128 rows[4][4];
+    for (int lane = 0; lane < 4; ++lane) {
+      const Matrix4& a = matrices[in.bone0[i + lane]];
+      const Matrix4& b = matrices[in.bone1[i + lane]];
+      const __m128 w = _mm_set1_ps(in.weight[i + lane]);
+      for (int r = 0; r < 4; ++r) {
+        const __m128 ra = _mm_loadu_ps(a.m[r]);
+        const __m128 rb = _mm_loadu_ps(b.m[r]);
+        rows[r][lane] = _mm_add_ps(rb, _mm_mul_ps(w, _mm_sub_ps(ra, rb)));
+      }
+    }
+    for (int r = 0; r < 4; ++r) {
+      _MM_TRANSPOSE4_PS(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+    }
+
+    const __m128 px = _mm_loadu_ps(&in.px[i]);
+    const __m128 py = _mm_loadu_ps(&in.py[i]);
+    const __m128 pz = _mm_loadu_ps(&in.pz[i]);
+    const __m128 nx = _mm_loadu_ps(&in.nx[i]);
+    const __m128 ny = _mm_loadu_ps(&in.ny[i]);
+    const __m128 nz = _mm_loadu_ps(&in.nz[i]);
+
+    __m128 out_p[3];
+    __m128 out_n[3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128 linear_p =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, rows[0][c]), _mm_mul_ps(py, rows[1][c])), _mm_mul_ps(pz, rows[2][c]));
+      out_p[c] = _mm_add_ps(linear_p, rows[3][c]);
+      out_n[c] =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, rows[0][c]), _mm_mul_ps(ny, rows[1][c])), _mm_mul_ps(nz, rows[2][c]));
+    }
+
+    // 法線の正規化 (長さ 0 のものはそのまま)
+    const __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(out_n[0], out_n[0]), _mm_mul_ps(out_n[1], out_n[1])),
+                                   _mm_mul_ps(out_n[2], out_n[2]));
+    const __m128 valid = _mm_cmpgt_ps(len2, zero);
+    const __m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(_mm_or_ps(_mm_and_ps(valid, len2), _mm_andnot_ps(valid, one))));
+
+    _mm_storeu_ps(&out->px[i], out_p[0]);
+    _mm_storeu_ps(&out->py[i], out_p[1]);
+    _mm_storeu_ps(&out->pz[i], out_p[2]);
+    _mm_storeu_ps(&out->nx[i], _mm_mul_ps(out_n[0], inv_len));
+    _mm_storeu_ps(&out->ny[i], _mm_mul_ps(out_n[1], inv_len));
+    _mm_storeu_ps(&out->nz[i], _mm_mul_ps(out_n[2], inv_len));
+  }
+#endif
+  // 端数 (と SSE が無い環境) は参照実装で処理する
+  SkinVerticesReference(in, matrices, i, end, out);
+}
+
+void SkinVerticesParallel(ThreadPool& pool, const SkinningStreams& in, const std::vector<Matrix4>& matrices,
+                          SkinnedVertices* out, std::size_t chunk) {
+  out->Resize(in.count);
+  chunk = std::max<std::size_t>((chunk + 3) & ~std::size_t(3), 4);
+  pool.ParallelFor(0, in.count, chunk,
+                   [&](std::size_t begin, std::size_t end) { SkinVerticesSimd(in, matrices, begin, end, out); });
+}
+
+void WriteSkinnedVertices(const SkinnedVertices& skinned, std::size_t begin, std::size_t end, PmdVertex* dst) {
+  for (std::size_t i = begin; i < end; ++i) {
+    dst[i].pos = {skinned.px[i], skinned.py[i], skinned.pz[i]};
+    dst[i].normal = {skinned.nx[i], skinned.ny[i], skinned.nz[i]};
+  }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu_math.h"
+#include "pmd_file.h"
+
+class ThreadPool;
+
+constexpr uint16_t kNoParentBone = 0xffff;
+
+/**
+ * @brief ボーン 1 本分の姿勢 (バインドポーズからの差分)
+ */
+struct BonePose {
+  Quaternion rotation;  // ボーンの基準点まわりの回転
+  Float3 translation;   // 基準点の移動量
+};
+
+/**
+ * @brief PMD のボーン階層
+ * @details 親が範囲外のボーンや循環しているボーンはルートとして扱う.
+ */
+class Skeleton {
+ public:
+  void Build(PmdSpan<PmdBone> bones);
+
+  std::size_t BoneCount() const { return parents_.size(); }
+  uint16_t Parent(std::size_t bone) const { return parents_[bone]; }
+  const Float3& HeadPosition(std::size_t bone) const { return heads_[bone]; }
+  // ファイル上の名前 (Shift-JIS) をそのまま保持する
+  const std::string& Name(std::size_t bone) const { return names_[bone]; }
+
+  /**
+   * @brief 名前からボーンを探す
+   * @return 見つからなければ -1
+   */
+  int FindBone(const std::string& name) const;
+
+  /**
+   * @brief 親が必ず子より先に来る順序
+   */
+  const std::vector<uint16_t>& EvaluationOrder() const { return order_; }
+
+  /**
+   * @brief 姿勢からスキニング行列を求める
+   * @details ボーンごとに「基準点を原点へ移動 -> 回転 -> 基準点 (+ 移動量) へ戻す」を作り, 親の行列を掛けていく.
+   * @param pose ボーンごとの姿勢. 要素数が足りない分はバインドポーズとみなす
+   * @param out ボーンごとの行列 (頂点に掛けるとポーズ後の位置になる)
+   */
+  void ComputeSkinningMatrices(const std::vector<BonePose>& pose, std::vector<Matrix4>* out) const;
+
+ private:
+  std::vector<uint16_t> parents_;
+  std::vector<Float3> heads_;
+  std::vector<std::string> names_;
+  std::vector<uint16_t> order_;
+};
+
+/**
+ * @brief スキニング入力 (structure of arrays)
+ * @details SIMD でまとめて読めるよう成分ごとの配列に分けておく. 範囲外のボーン番号は 0 に置き換え済み.
+ */
+struct SkinningStreams {
+  std::size_t count = 0;
+  std::vector<float> px, py, pz;  // バインドポーズの位置
+  std::vector<float> nx, ny, nz;  // バインドポーズの法線
+  std::vector<float> weight;      // bone0 の影響度 (0.0 - 1.0). bone1 は 1 - weight
+  std::vector<uint16_t> bone0, bone1;
+};
+
+/**
+ * @brief スキニング結果 (structure of arrays)
+ */
+struct SkinnedVertices {
+  std::size_t count = 0;
+  std::vector<float> px, py, pz;
+  std::vector<float> nx, ny, nz;
+
+  void Resize(std::size_t n);
+};
+
+/**
+ * @brief PMD の頂点列からスキニング入力を作る (モデルの読み込み時に 1 回だけ行う)
+ */
+SkinningStreams MakeSkinningStreams(PmdSpan<PmdVertex> vertices, std::size_t bone_count);
+
+/**
+ * @brief 線形ブレンドスキニングの参照実装 (スカラー)
+ * @details 位置と法線を 2 本のボーン行列の重み付き和で変換し, 法線は正規化する. [begin, end) の頂点を処理する.
+ */
+void SkinVerticesReference(const SkinningStreams& in, const std::vector<Matrix4>& matrices, std::size_t begin,
+                           std::size_t end, SkinnedVertices* out);
+
+/**
+ * @brief 線形ブレンドスキニングの SIMD 実装 (SSE で 4 頂点ずつ)
+ * @details 結果は参照実装と浮動小数点の丸め誤差の範囲で一致する. SSE が無い環境では参照実装になる.
+ */
+void SkinVerticesSimd(const SkinningStreams& in, const std::vector<Matrix4>& matrices, std::size_t begin,
+                      std::size_t end, SkinnedVertices* out);
+
+/**
+ * @brief SIMD 実装をスレッドプールで並列に実行する
+ * @param chunk 1 タスクあたりの頂点数 (4 の倍数に切り上げる)
+ */
+void SkinVerticesParallel(ThreadPool& pool, const SkinningStreams& in, const std::vector<Matrix4>& matrices,
+                          SkinnedVertices* out, std::size_t chunk = 4096);
+
+/**
+ * @brief スキニング結果を GPU 用の頂点列 (PmdVertex) の位置と法線に書き戻す
+ */
+void WriteSkinnedVertices(const SkinnedVertices& skinned, std::size_t begin, std::size_t end, PmdVertex* dst);
@@ -0,0 +1,479 @@
+#include "software_rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "texture_sampler.h"
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTERIZER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// 頂点シェーダーの出力のうちピクセルシェーダーが使うもの
+// normal.xyz, vnormal.xy, uv, ray.xyz
+constexpr int kVaryingCount = 10;
+
+struct ShadedVertex {
+  Float4 clip;  // SV_POSITION
+  float varyings[kVaryingCount];
+};
+
+/**
+ * @brief ラスタライズの準備ができた三角形
+ * @details 辺 i は頂点 i の対辺. 辺関数は端点を座標順に並べ替えて評価し (sign で向きを戻す),
+ *          隣り合う三角形が共有する辺で全く同じ値になるようにしている.
+ */
+struct SetupTriangle {
+  float z[3];      // 正規化デバイス座標の深度
+  float inv_w[3];  // 1 / w
+  float varyings[3][kVaryingCount];  // varying / w (パースペクティブ補正用)
+  float ax[3], ay[3];  // 辺の始点
+  float dx[3], dy[3];  // 辺のベクトル
+  float sign[3];
+  bool top_left[3];  // 辺上のピクセルを含めるか (top-left ルール)
+  float inv_area;
+  int min_x, min_y, max_x, max_y;  // ピクセルの範囲 (両端を含む)
+  uint32_t material;
+};
+
+//////////////
+// textures //
+//////////////
+
+Image MakeFilledImage(uint32_t width, uint32_t height, uint8_t value) {
+  Image image;
+  image.format = PixelFormat::kRGBA8;
+  image.width = width;
+  image.height = height;
+  image.row_pitch = std::size_t(width) * 4;
+  image.pixels.assign(image.row_pitch * height, value);
+  return image;
+}
+
+/**
+ * @brief main の CreateGrayGradationTexture と同じ (上が白, 下が黒の 4x256)
+ */
+Image MakeGrayGradationImage() {
+  Image image = MakeFilledImage(4, 256, 0xff);
+  for (uint32_t y = 0; y < image.height; ++y) {
+    uint8_t* row = image.Row(y);
+    for (uint32_t x = 0; x < image.width; ++x) {
+      std::memset(row + x * 4, static_cast<int>(0xff - y), 3);
+    }
+  }
+  return image;
+}
+
+struct DefaultTextures {
+  Image white = MakeFilledImage(4, 4, 0xff);
+  Image black = MakeFilledImage(4, 4, 0x00);
+  Image gradation = MakeGrayGradationImage();
+};
+
+const DefaultTextures& GetDefaultTextures() {
+  static const DefaultTextures textures;
+  return textures;
+}
+
+////////////////////
+// shader helpers //
+////////////////////
+
+float Saturate(float v) { return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; }  // NaN は 0
+
+/**
+ * @brief UNORM_SRGB のレンダーターゲットへの書き込みと同じ変換
+ */
+uint8_t LinearToSrgb8(float v) {
+  v = Saturate(v);
+  const float s = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(s * 255.0f + 0.5f);
+}
+
+uint8_t LinearToUnorm8(float v) { return static_cast<uint8_t>(Saturate(v) * 255.0f + 0.5f); }
+
+/**
+ * @brief BasicVS
+ */
+ShadedVertex RunVertexShader(const PmdVertex& v, const Matrix4& wvp, const SoftwareSceneConstants& scene) {
+  ShadedVertex out;
+  const Float3 pos = {v.pos.x, v.pos.y, v.pos.z};
+  out.clip = Transform({pos.x, pos.y, pos.z, 1.0f}, wvp);
+  const Float3 normal = TransformNormal({v.normal.x, v.normal.y, v.normal.z}, scene.world);  // normal.w = 0
+  const Float3 vnormal = TransformNormal(normal, scene.view);
+  const Float3 ray = Normalize(pos - scene.eye);  // output.pos はワールド変換前の座標
+  const float varyings[kVaryingCount] = {normal.x, normal.y, normal.z, vnormal.x, vnormal.y,
+                                         v.uv.x,   v.uv.y,   ray.x,    ray.y,     ray.z};
+  std::memcpy(out.varyings, varyings, sizeof(varyings));
+  return out;
+}
+
+/**
+ * @brief BasicPS を count (4 以下) ピクセル分まとめて実行する
+ * @param in ピクセルごとの補間済みの varying
+ * @details テクスチャは 4 ピクセル分を SampleTextureBatch でまとめてサンプリングする.
+ *          main はミップチェーン全体をバインドするが, ここでは意図して LOD 0 (元の解像度) だけをサンプリングする.
+ *          縮小して描かれるテクスチャは GPU の結果と一致しない (ミップを含めない比較のためのリファレンス).
+ */
+void RunPixelShader4(const float in[4][kVaryingCount], int count, const SoftwareMaterial& material, Float4 out[4]) {
+  const DefaultTextures& defaults = GetDefaultTextures();
+  const Image& tex = material.tex != nullptr ? *material.tex : defaults.white;
+  const Image& sph = material.sph != nullptr ? *material.sph : defaults.white;
+  const Image& spa = material.spa != nullptr ? *material.spa : defaults.black;
+  const Image& toon = material.toon != nullptr ? *material.toon : defaults.gradation;
+  const MaterialForHlsl& m = material.constants;
+
+  static const Float3 light = Normalize(Float3{1.0f, -1.0f, 1.0f});
+  float uv_u[4], uv_v[4], sphere_u[4], sphere_v[4], toon_u[4], toon_v[4], specular_scale[4];
+  for (int i = 0; i < count; ++i) {
+    const Float3 normal = {in[i][0], in[i][1], in[i][2]};
+    const Float3 ray = {in[i][7], in[i][8], in[i][9]};
+
+    // reflect(light, normal) (法線は補間したまま正規化しない)
+    const Float3 ref_light = Normalize(light - normal * (2.0f * Dot(light, normal)));
+    const float specular_b = std::pow(Saturate(Dot(ref_light, -ray)), m.specularity);
+    const float is_surface = Dot(normal, -light) >= 0.0f ? 1.0f : 0.0f;
+    specular_scale[i] = is_surface * specular_b;
+
+    uv_u[i] = in[i][5];
+    uv_v[i] = in[i][6];
+    sphere_u[i] = (in[i][3] + 1.0f) * 0.5f;
+    sphere_v[i] = (in[i][4] - 1.0f) * -0.5f;
+    toon_u[i] = 0.0f;
+    toon_v[i] = 1.0f - Saturate(Dot(-light, normal));
+  }
+
+  Float4 texture_color[4], sph_color[4], spa_color[4], toon_diffuse[4];
+  SampleTextureBatch(tex, kSamplerSmp, uv_u, uv_v, nullptr, count, texture_color);
+  SampleTextureBatch(sph, kSamplerSmp, sphere_u, sphere_v, nullptr, count, sph_color);
+  SampleTextureBatch(spa, kSamplerSmp, sphere_u, sphere_v, nullptr, count, spa_color);
+  SampleTextureBatch(toon, kSamplerSmpToon, toon_u, toon_v, nullptr, count, toon_diffuse);
+
+  for (int i = 0; i < count; ++i) {
+    const Float4 brightness = {std::max(toon_diffuse[i].x, m.ambient.x), std::max(toon_diffuse[i].y, m.ambient.y),
+                               std::max(toon_diffuse[i].z, m.ambient.z), 1.0f};
+    const Float4& t = texture_color[i];
+    const Float4& s = sph_color[i];
+    const Float4& a = spa_color[i];
+    out[i] = {brightness.x * m.diffuse.x * t.x * s.x + a.x + specular_scale[i] * m.specular.x,
+              brightness.y * m.diffuse.y * t.y * s.y + a.y + specular_scale[i] * m.specular.y,
+              brightness.z * m.diffuse.z * t.z * s.z + a.z + specular_scale[i] * m.specular.z,
+              brightness.w * m.alpha * t.w * s.w + a.w + specular_scale[i]};
+  }
+}
+
+////////////////////////
+// clipping and setup //
+////////////////////////
+
+ShadedVertex LerpVertex(const ShadedVertex& a, const ShadedVertex& b, float t) {
+  ShadedVertex r;
+  r.clip = {a.clip.x + (b.clip.x - a.clip.x) * t, a.clip.y + (b.clip.y - a.clip.y) * t,
+            a.clip.z + (b.clip.z - a.clip.z) * t, a.clip.w + (b.clip.w - a.clip.w) * t};
+  for (int k = 0; k < kVaryingCount; ++k) {
+    r.varyings[k] = a.varyings[k] + (b.varyings[k] - a.varyings[k]) * t;
+  }
+  return r;
+}
+
+/**
+ * @brief ニアクリップ面 (z >= 0) で三角形を切る
+ * @return 多角形の頂点数 (0, 3, 4)
+ */
+int ClipNear(const ShadedVertex* in[3], ShadedVertex out[4]) {
+  int count = 0;
+  for (int i = 0; i < 3; ++i) {
+    const ShadedVertex& a = *in[i];
+    const ShadedVertex& b = *in[(i + 1) % 3];
+    const bool a_inside = a.clip.z >= 0.0f;
+    const bool b_inside = b.clip.z >= 0.0f;
+    if (a_inside) {
+      out[count++] = a;
+    }
+    if (a_inside != b_inside) {
+      out[count++] = LerpVertex(a, b, a.clip.z / (a.clip.z - b.clip.z));
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief クリップ後の三角形をスクリーン座標に変換し, 辺関数を求める
+ * @return 画面に 1 ピクセルも掛からない・面積 0 なら false
+ */
+bool SetupTriangleForRaster(const ShadedVertex& v0, const ShadedVertex& v1, const ShadedVertex& v2, uint32_t width,
+                            uint32_t height, uint32_t material, SetupTriangle* out) {
+  const ShadedVertex* v[3] = {&v0, &v1, &v2};
+  float sx[3];
+  float sy[3];
+  for (int i = 0; i < 3; ++i) {
+    const float inv_w = 1.0f / v[i]->clip.w;
+    // ビューポート変換. D3D と同じくサブピクセル精度 (1/256) に丸める
+    sx[i] = std::round((v[i]->clip.x * inv_w * 0.5f + 0.5f) * width * 256.0f) / 256.0f;
+    sy[i] = std::round((0.5f - v[i]->clip.y * inv_w * 0.5f) * height * 256.0f) / 256.0f;
+  }
+  float area = (sx[2] - sx[0]) * (sy[1] - sy[0]) - (sy[2] - sy[0]) * (sx[1] - sx[0]);
+  if (!(area != 0.0f) || !std::isfinite(area)) {
+    return false;
+  }
+  if (area < 0.0f) {
+    // カリングしないので, 裏向きの三角形は頂点の順序を入れ替えて同じように扱う
+    std::swap(v[1], v[2]);
+    std::swap(sx[1], sx[2]);
+    std::swap(sy[1], sy[2]);
+    area = -area;
+  }
+
+  const float min_x = std::min({sx[0], sx[1], sx[2]});
+  const float max_x = std::max({sx[0], sx[1], sx[2]});
+  const float min_y = std::min({sy[0], sy[1], sy[2]});
+  const float max_y = std::max({sy[0], sy[1], sy[2]});
+  // ピクセル中心 (x + 0.5) が範囲に入るもの
+  out->min_x = static_cast<int>(std::max(std::ceil(min_x - 0.5f), 0.0f));
+  out->min_y = static_cast<int>(std::max(std::ceil(min_y - 0.5f), 0.0f));
+  out->max_x = static_cast<int>(std::min(std::floor(max_x - 0.5f), static_cast<float>(width) - 1.0f));
+  out->max_y = static_cast<int>(std::min(std::floor(max_y - 0.5f), static_cast<float>(height) - 1.0f));
+  if (out->min_x > out->max_x || out->min_y > out->max_y) {
+    return false;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    const float inv_w = 1.0f / v[i]->clip.w;
+    out->z[i] = v[i]->clip.z * inv_w;
+    out->inv_w[i] = inv_w;
+    for (int k = 0; k < kVaryingCount; ++k) {
+      out->varyings[i][k] = v[i]->varyings[k] * inv_w;
+    }
+
+    // 辺 i: 頂点 i+1 -> i+2. 内側で正になる
+    int a = (i + 1) % 3;
+    int b = (i + 2) % 3;
+    const float dx = sx[b] - sx[a];
+    const float dy = sy[b] - sy[a];
+    out->top_left[i] = dy > 0.0f || (dy == 0.0f && dx < 0.0f);
+    out->sign[i] = 1.0f;
+    if (sx[a] > sx[b] || (sx[a] == sx[b] && sy[a] > sy[b])) {
+      std::swap(a, b);
+      out->sign[i] = -1.0f;
+    }
+    out->ax[i] = sx[a];
+    out->ay[i] = sy[a];
+    out->dx[i] = sx[b] - sx[a];
+    out->dy[i] = sy[b] - sy[a];
+  }
+  out->inv_area = 1.0f / area;
+  out->material = material;
+  return true;
+}
+
+////////////////
+// rasterizer //
+////////////////
+
+/**
+ * @brief (x, y) から始まる横 4 ピクセルの辺関数の値と被覆マスク (bit i がピクセル x + i)
+ */
+int EvaluateEdges4(const SetupTriangle& t, int x, int y, float w[3][4]) {
+  const float py = static_cast<float>(y) + 0.5f;
+  int mask = 0xf;
+#ifdef RASTERIZER_USE_SSE
+  const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x) + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+  for (int i = 0; i < 3; ++i) {
+    const __m128 ex = _mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(t.ax[i])), _mm_set1_ps(t.dy[i]));
+    const __m128 ey = _mm_set1_ps((py - t.ay[i]) * t.dx[i]);
+    const __m128 e = _mm_mul_ps(_mm_sub_ps(ex, ey), _mm_set1_ps(t.sign[i]));
+    _mm_storeu_ps(w[i], e);
+    __m128 inside = _mm_cmpgt_ps(e, _mm_setzero_ps());
+    if (t.top_left[i]) {
+      inside = _mm_or_ps(inside, _mm_cmpeq_ps(e, _mm_setzero_ps()));
+    }
+    mask &= _mm_movemask_ps(inside);
+  }
+#else
+  for (int i = 0; i < 3; ++i) {
+    const float ey = (py - t.ay[i]) * t.dx[i];
+    int inside = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+      const float px = static_cast<float>(x + lane) + 0.5f;
+      const float e = ((px - t.ax[i]) * t.dy[i] - ey) * t.sign[i];
+      w[i][lane] = e;
+      inside |= (e > 0.0f || (e == 0.0f && t.top_left[i])) ? 1 << lane : 0;
+    }
+    mask &= inside;
+  }
+#endif
+  return mask;
+}
+
+}  // namespace
+
+SoftwareRasterizer::SoftwareRasterizer(uint32_t width, uint32_t height)
+    : width_(width), height_(height), depth_(std::size_t(width) * height, 1.0f) {
+  color_ = MakeFilledImage(width, height, 0);
+}
+
+void SoftwareRasterizer::Clear(const float color[4]) {
+  const uint8_t rgba[4] = {LinearToSrgb8(color[0]), LinearToSrgb8(color[1]), LinearToSrgb8(color[2]),
+                           LinearToUnorm8(color[3])};
+  for (std::size_t i = 0; i < color_.pixels.size(); i += 4) {
+    std::memcpy(color_.pixels.data() + i, rgba, 4);
+  }
+  std::fill(depth_.begin(), depth_.end(), 1.0f);
+  stats_ = {};
+}
+
+void SoftwareRasterizer::Draw(ThreadPool& pool, const SoftwareSceneConstants& scene, PmdSpan<PmdVertex> vertices,
+                              PmdSpan<uint16_t> indices, const std::vector<SoftwareMaterial>& materials,
+                              const std::vector<uint32_t>& material_index_counts) {
+  if (width_ == 0 || height_ == 0) {
+    return;
+  }
+
+  // 頂点処理
+  const Matrix4 wvp = scene.world * scene.view * scene.proj;
+  std::vector<ShadedVertex> shaded(vertices.size());
+  pool.ParallelFor(0, vertices.size(), 4096, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      shaded[i] = RunVertexShader(vertices[i], wvp, scene);
+    }
+  });
+
+  // 三角形ごとのマテリアル (インデックス数の累積から求める)
+  std::vector<std::size_t> material_ends;
+  std::size_t index_end = 0;
+  for (std::size_t m = 0; m < material_index_counts.size() && m < materials.size(); ++m) {
+    index_end = std::min<std::size_t>(index_end + material_index_counts[m], indices.size());
+    material_ends.push_back(index_end / 3);
+  }
+  const std::size_t triangle_count = material_ends.empty() ? 0 : material_ends.back();
+  stats_.triangles += triangle_count;
+
+  // クリップとセットアップ. ニアクリップで 2 つに分かれることがあるので 1 つにつき 2 枠用意する
+  std::vector<SetupTriangle> slots(triangle_count * 2);
+  std::vector<uint8_t> slot_counts(triangle_count, 0);
+  pool.ParallelFor(0, triangle_count, 1024, [&](std::size_t begin, std::size_t end) {
+    uint32_t material = static_cast<uint32_t>(
+        std::upper_bound(material_ends.begin(), material_ends.end(), begin) - material_ends.begin());
+    for (std::size_t t = begin; t < end; ++t) {
+      while (t >= material_ends[material]) {
+        ++material;
+      }
+      uint16_t index[3];
+      std::memcpy(index, indices.data() + t * 3, sizeof(index));
+      if (index[0] >= shaded.size() || index[1] >= shaded.size() || index[2] >= shaded.size()) {
+        continue;
+      }
+      const ShadedVertex* in[3] = {&shaded[index[0]], &shaded[index[1]], &shaded[index[2]]};
+      // 全頂点が同じ面の外側にあれば捨てる (x, y はビューポートの範囲で切り詰めるので, ここでは奥だけ見る)
+      if (in[0]->clip.z > in[0]->clip.w && in[1]->clip.z > in[1]->clip.w && in[2]->clip.z > in[2]->clip.w) {
+        continue;
+      }
+      ShadedVertex polygon[4];
+      const int n = ClipNear(in, polygon);
+      uint8_t count = 0;
+      for (int k = 1; k + 1 < n; ++k) {
+        if (SetupTriangleForRaster(polygon[0], polygon[k], polygon[k + 1], width_, height_, material,
+                                   &slots[t * 2 + count])) {
+          ++count;
+        }
+      }
+      slot_counts[t] = count;
+    }
+  });
+
+  // タイルへの振り分け (描画順を保つ)
+  const uint32_t tiles_x = (width_ + kTileSize - 1) / kTileSize;
+  const uint32_t tiles_y = (height_ + kTileSize - 1) / kTileSize;
+  std::vector<std::vector<uint32_t>> bins(std::size_t(tiles_x) * tiles_y);
+  for (std::size_t t = 0; t < triangle_count; ++t) {
+    for (uint8_t k = 0; k < slot_counts[t]; ++k) {
+      const uint32_t slot = static_cast<uint32_t>(t * 2 + k);
+      const SetupTriangle& tri = slots[slot];
+      ++stats_.rasterized;
+      for (int ty = tri.min_y / static_cast<int>(kTileSize); ty <= tri.max_y / static_cast<int>(kTileSize); ++ty) {
+        for (int tx = tri.min_x / static_cast<int>(kTileSize); tx <= tri.max_x / static_cast<int>(kTileSize); ++tx) {
+          bins[std::size_t(ty) * tiles_x + tx].push_back(slot);
+          ++stats_.tile_triangles;
+        }
+      }
+    }
+  }
+
+  // タイルごとに並列に描く
+  std::vector<std::size_t> shaded_pixels(bins.size(), 0);
+  pool.ParallelFor(0, bins.size(), 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t tile = begin; tile < end; ++tile) {
+      const int tile_x0 = static_cast<int>(tile % tiles_x * kTileSize);
+      const int tile_y0 = static_cast<int>(tile / tiles_x * kTileSize);
+      const int tile_x1 = std::min(tile_x0 + static_cast<int>(kTileSize), static_cast<int>(width_)) - 1;
+      const int tile_y1 = std::min(tile_y0 + static_cast<int>(kTileSize), static_cast<int>(height_)) - 1;
+      for (uint32_t slot : bins[tile]) {
+        const SetupTriangle& tri = slots[slot];
+        const SoftwareMaterial& material = materials[tri.material];
+        const int x0 = std::max(tri.min_x, tile_x0);
+        const int x1 = std::min(tri.max_x, tile_x1);
+        const int y0 = std::max(tri.min_y, tile_y0);
+        const int y1 = std::min(tri.max_y, tile_y1);
+        for (int y = y0; y <= y1; ++y) {
+          float* depth_row = depth_.data() + std::size_t(y) * width_;
+          uint8_t* color_row = color_.Row(static_cast<uint32_t>(y));
+          for (int x = x0; x <= x1; x += 4) {
+            float w[3][4];
+            int mask = EvaluateEdges4(tri, x, y, w);
+            mask &= (1 << std::min(4, x1 - x + 1)) - 1;
+            // 深度テストを通ったピクセルを集めてまとめてシェーディングする
+            int lanes[4];
+            float depths[4];
+            float varyings[4][kVaryingCount];
+            int count = 0;
+            for (int lane = 0; lane < 4; ++lane) {
+              if ((mask & (1 << lane)) == 0) {
+                continue;
+              }
+              const float b0 = w[0][lane] * tri.inv_area;
+              const float b1 = w[1][lane] * tri.inv_area;
+              const float b2 = w[2][lane] * tri.inv_area;
+              // 深度はスクリーン空間で線形. 範囲外は深度クリップで捨てる
+              const float z = b0 * tri.z[0] + b1 * tri.z[1] + b2 * tri.z[2];
+              if (!(z < depth_row[x + lane]) || z < 0.0f || z > 1.0f) {
+                continue;
+              }
+              const float inv_w = b0 * tri.inv_w[0] + b1 * tri.inv_w[1] + b2 * tri.inv_w[2];
+              const float persp = 1.0f / inv_w;
+              for (int k = 0; k < kVaryingCount; ++k) {
+                varyings[count][k] =
+                    (b0 * tri.varyings[0][k] + b1 * tri.varyings[1][k] + b2 * tri.varyings[2][k]) * persp;
+              }
+              lanes[count] = lane;
+              depths[count] = z;
+              ++count;
+            }
+            if (count == 0) {
+              continue;
+            }
+            Float4 colors[4];
+            RunPixelShader4(varyings, count, material, colors);
+            for (int i = 0; i < count; ++i) {
+              const int px = x + lanes[i];
+              depth_row[px] = depths[i];
+              uint8_t* p = color_row + std::size_t(px) * 4;
+              p[0] = LinearToSrgb8(colors[i].x);
+              p[1] = LinearToSrgb8(colors[i].y);
+              p[2] = LinearToSrgb8(colors[i].z);
+              p[3] = LinearToUnorm8(colors[i].w);
+            }
+            shaded_pixels[tile] += count;
+          }
+        }
+      }
+    }
+  });
+  for (auto n : shaded_pixels) {
+    stats_.pixels_shaded += n;
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_math.h"
+#include "image.h"
+#include "material.h"
+#include "pmd_file.h"
+
+class ThreadPool;
+
+/**
+ * @brief cbuff0 (SceneMatrices) と同じ内容
+ * @details 行列は DirectXMath と同じ行ベクトルの規約. BasicVS の mul(mul(mul(proj, view), world), pos) は
+ *          pos * world * view * proj に相当する.
+ */
+struct SoftwareSceneConstants {
+  Matrix4 world;
+  Matrix4 view;
+  Matrix4 proj;
+  Float3 eye;
+};
+
+/**
+ * @brief マテリアル 1 つ分の入力 (cbuffer Material と t0 - t3)
+ * @details テクスチャが nullptr のスロットは main と同じ既定のテクスチャ (白・白・黒・グラデーション) を使う.
+ *          ミップは使わず, 画像そのもの (LOD 0) だけをサンプリングする.
+ */
+struct SoftwareMaterial {
+  MaterialForHlsl constants = {};
+  const Image* tex = nullptr;
+  const Image* sph = nullptr;
+  const Image* spa = nullptr;
+  const Image* toon = nullptr;
+};
+
+/**
+ * @brief BasicVS / BasicPS を CPU で実行するリファレンスラスタライザー
+ * @details
+ *  - 頂点処理は BasicVS と同じ変換を行い, ニアクリップ面で三角形を切る
+ *  - 画面を kTileSize 四方のタイルに分け, タイルごとに並列に描く (タイル内は描画順を守るので結果は決定的)
+ *  - 被覆と深度テストは SSE で 4 ピクセルずつ求める (D3D と同じ top-left ルール, DepthFunc = LESS)
+ *  - ピクセル処理は BasicPS と同じ計算 (トゥーン, sph の乗算, spa の加算, スペキュラ). テクスチャは texture_sampler で 4 ピクセルずつ読む
+ *  - カラーバッファは R8G8B8A8_UNORM_SRGB のレンダーターゲットと同じく sRGB で保存する
+ *  パイプラインの設定 (カリングなし, ブレンドなし) は main と合わせてある.
+ */
+class SoftwareRasterizer {
+ public:
+  static constexpr uint32_t kTileSize = 64;
+
+  struct Stats {
+    std::size_t triangles = 0;       // 入力された三角形
+    std::size_t rasterized = 0;      // クリップ後に画面に残った三角形
+    std::size_t tile_triangles = 0;  // タイルに振り分けた延べ数
+    std::size_t pixels_shaded = 0;   // 深度テストを通ってピクセル処理をした数
+  };
+
+  SoftwareRasterizer(uint32_t width, uint32_t height);
+
+  /**
+   * @brief カラーを color (線形), 深度を 1.0 でクリアする
+   */
+  void Clear(const float color[4]);
+
+  /**
+   * @brief PMD のメッシュを描く
+   * @param material_index_counts マテリアルごとのインデックス数 (materials と同じ数)
+   */
+  void Draw(ThreadPool& pool, const SoftwareSceneConstants& scene, PmdSpan<PmdVertex> vertices,
+            PmdSpan<uint16_t> indices, const std::vector<SoftwareMaterial>& materials,
+            const std::vector<uint32_t>& material_index_counts);
+
+  uint32_t Width() const { return width_; }
+  uint32_t Height() const { return height_; }
+  const Image& ColorBuffer() const { return color_; }
+  const std::vector<float>& DepthBuffer() const { return depth_; }
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  uint32_t width_;
+  uint32_t height_;
+  Image color_;
+  std::vector<float> depth_;
+  Stats stats_;
+};
@@ -0,0 +1,75 @@
+#include "string_util.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+#include <cassert>
+
+std::vector<std::string> SplitString(const std::string& text_str, const char splitter) {
+  // std::getline と同じく, 末尾の区切り文字の後ろの空文字列は含めない
+  std::vector<std::string> v;
+  std::size_t begin = 0;
+  while (begin < text_str.size()) {
+    std::size_t end = text_str.find(splitter, begin);
+    if (end == std::string::npos) {
+      end = text_str.size();
+    }
+    v.emplace_back(text_str, begin, end - begin);
+    begin = end + 1;
+  }
+  return v;
+}
+
+#ifdef _WIN32
+std::wstring GetWideStringFromString(std::string_view str, unsigned int code_page) {
+  // 文字列数 (終端文字を含まない長さを渡すので, 結果にも終端文字は含まれない)
+  const int length = static_cast<int>(str.size());
+  const int num1 = MultiByteToWideChar(code_page, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.data(), length, nullptr, 0);
+  std::wstring ret_wstr(static_cast<std::size_t>(num1), L'\0');
+  if (num1 > 0) {
+    const int num2 =
+        MultiByteToWideChar(code_page, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.data(), length, ret_wstr.data(), num1);
+    assert(num1 == num2);
+  }
+  return ret_wstr;
+}
+#endif
+
+std::filesystem::path PathFromPmdString(std::string_view str) {
+#ifdef _WIN32
+  return std::filesystem::path(GetWideStringFromString(str, CP_ACP));
+#else
+  return std::filesystem::path(str.begin(), str.end());
+#endif
+}
+
+std::filesystem::path PathFromPmdString(const std::filesystem::path& directory, std::string_view str) {
+  // 絶対パスなどの結合の規則は std::filesystem に任せる
+  const bool relative = !str.empty() && str[0] != '/' && str[0] != '\\' && !(str.size() >= 2 && str[1] == ':');
+  if (directory.empty() || !relative) {
+    return directory / PathFromPmdString(str);
+  }
+  std::filesystem::path::string_type native;
+#ifdef _WIN32
+  const int length = static_cast<int>(str.size());
+  const int wide_length = MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.data(), length, nullptr, 0);
+  native.reserve(directory.native().size() + 1 + wide_length);
+#else
+  native.reserve(directory.native().size() + 1 + str.size());
+#endif
+  native = directory.native();
+  const auto last = native.back();
+  if (last != '/' && last != std::filesystem::path::preferred_separator) {
+    native += std::filesystem::path::preferred_separator;
+  }
+#ifdef _WIN32
+  const std::size_t offset = native.size();
+  native.resize(offset + wide_length);
+  MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED | MB_ERR_INVALID_CHARS, str.data(), length, native.data() + offset,
+                      wide_length);
+#else
+  native.append(str.begin(), str.end());
+#endif
+  return std::filesystem::path(std::move(native));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief split string by delimiter
+ *
+ * @param text_str
+ * @param splitter
+ * @return std::vector<std::string>
+ */
+std::vector<std::string> SplitString(const std::string& text_str, const char splitter = '*');
+
+#ifdef _WIN32
+/**
+ * @brief
+ * @param str マルチバイト文字列
+ * @param code_page 0 は CP_ACP
+ * @return 変換されたワイド文字列
+ */
+std::wstring GetWideStringFromString(std::string_view str, unsigned int code_page = 0);
+#endif
+
+/**
+ * @brief PMD 内のファイル名 (Shift-JIS) をパスに変換する
+ * @details Windows ではシステムのコードページで変換する. それ以外ではバイト列をそのまま使う.
+ */
+std::filesystem::path PathFromPmdString(std::string_view str);
+
+/**
+ * @brief directory / PathFromPmdString(str) と同じパスを作る (文字列の確保は 1 回だけ)
+ */
+std::filesystem::path PathFromPmdString(const std::filesystem::path& directory, std::string_view str);
@@ -0,0 +1,212 @@
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <cwctype>
+
+#include "hash.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "texture_content_store.h"
+
+namespace fs = std::filesystem;
+
+TextureCache::TextureCache(Decoder decoder, std::size_t budget_bytes, TextureContentStore* content_store)
+    : decoder_(std::move(decoder)), budget_bytes_(budget_bytes), content_store_(content_store) {}
+
+fs::path TextureCache::CanonicalizePath(const fs::path& path) {
+  std::error_code ec;
+  fs::path canonical = fs::weakly_canonical(path, ec);
+  if (ec) {
+    canonical = fs::absolute(path, ec).lexically_normal();
+  }
+#ifdef _WIN32
+  // NTFS は大文字小文字を区別しないのでキーは小文字に揃える
+  std::wstring wstr = canonical.wstring();
+  std::transform(wstr.begin(), wstr.end(), wstr.begin(), [](wchar_t c) { return std::towlower(c); });
+  canonical = fs::path(wstr);
+#endif
+  return canonical;
+}
+
+std::shared_ptr<const Image> TextureCache::Get(const fs::path& path) {
+  if (path.empty()) {
+    return nullptr;
+  }
+  const fs::path key = CanonicalizePath(path);
+
+  std::promise<EntryPtr> pending_promise;
+  uint64_t clear_count = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = by_path_.find(key);
+    if (it != by_path_.end()) {
+      EntryPtr entry = it->second;
+      if (entry->ready) {
+        ++stats_.hits;
+        Touch(*entry);
+      } else {
+        ++stats_.coalesced;
+      }
+      auto image = entry->image;
+      lock.unlock();
+      return image.get();
+    }
+    auto pending = pending_.find(key);
+    if (pending != pending_.end()) {
+      // 同じパスを別スレッドが読み込み中なので相乗りする
+      ++stats_.coalesced;
+      auto entry_future = pending->second;
+      lock.unlock();
+      EntryPtr entry = entry_future.get();
+      return entry ? entry->image.get() : nullptr;
+    }
+    pending_.emplace(key, pending_promise.get_future().share());
+    clear_count = clear_count_;
+  }
+
+  // ファイルの読み込みとハッシュ計算はロックの外で行う
+  MappedFile file;
+  if (!file.Open(key)) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (clear_count == clear_count_) {
+        pending_.erase(key);
+      }
+      ++stats_.failures;
+    }
+    pending_promise.set_value(nullptr);
+    return nullptr;
+  }
+  const uint64_t content_hash = HashBytes(file.data(), file.size());
+
+  EntryPtr entry;
+  std::promise<std::shared_ptr<const Image>> image_promise;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stats_.bytes_read += file.size();
+    if (clear_count == clear_count_) {  // Clear() 後は同じキーで別の読み込みが始まっているかもしれない
+      pending_.erase(key);
+    }
+    auto it = by_content_.find(content_hash);
+    if (it != by_content_.end()) {
+      // 別のパスで中身が同じものが既にある
+      entry = it->second;
+      ++stats_.content_hits;
+      entry->paths.push_back(key);
+      by_path_[key] = entry;
+      if (entry->ready) {
+        Touch(*entry);
+        stats_.bytes_deduplicated += entry->bytes;
+      } else {
+        ++entry->pending_aliases;
+      }
+      auto image = entry->image;
+      lock.unlock();
+      pending_promise.set_value(entry);
+      return image.get();
+    }
+    entry = std::make_shared<Entry>();
+    entry->content_hash = content_hash;
+    entry->image = image_promise.get_future().share();
+    entry->paths.push_back(key);
+    // 読み込み中に Clear() されていたら, 待っている呼び出しにだけ結果を返してキャッシュには載せない
+    if (clear_count == clear_count_) {
+      by_content_[content_hash] = entry;
+      by_path_[key] = entry;
+    }
+    ++stats_.misses;
+  }
+  pending_promise.set_value(entry);
+
+  std::shared_ptr<const Image> image;
+  try {
+    ProfileScope profile("texture decode");
+    image = decoder_(path, file.data(), file.size());
+    if (content_store_ != nullptr) {
+      image = content_store_->Intern(std::move(image));
+    }
+  } catch (...) {
+    image = nullptr;
+  }
+  image_promise.set_value(image);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry->ready = true;
+    entry->bytes = image ? image->SizeInBytes() : 0;
+    if (image) {
+      stats_.bytes_decoded += entry->bytes;
+      stats_.bytes_deduplicated += entry->bytes * entry->pending_aliases;
+    } else {
+      ++stats_.failures;
+    }
+    // 途中で Clear() されていたらキャッシュには載せない
+    auto it = by_content_.find(content_hash);
+    const bool registered = it != by_content_.end() && it->second == entry;
+    if (registered && !image) {
+      // 失敗は覚えずに, 次のリクエストで読み直す
+      for (const auto& entry_path : entry->paths) {
+        auto path_it = by_path_.find(entry_path);
+        if (path_it != by_path_.end() && path_it->second == entry) {
+          by_path_.erase(path_it);
+        }
+      }
+      by_content_.erase(it);
+    } else if (registered) {
+      stats_.resident_bytes += entry->bytes;
+      stats_.peak_resident_bytes = std::max(stats_.peak_resident_bytes, stats_.resident_bytes);
+      lru_.push_front(entry.get());
+      entry->lru_it = lru_.begin();
+      EvictIfNeeded();
+    }
+  }
+  return image;
+}
+
+void TextureCache::SetBudget(std::size_t budget_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_bytes_ = budget_bytes;
+  EvictIfNeeded();
+}
+
+void TextureCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!lru_.empty()) {
+    Remove(by_content_.at(lru_.back()->content_hash));
+  }
+  // 残りはデコード中のエントリ. 表から外しておけば, 完了時に自分が表に無いことを見てキャッシュに載せない
+  // 読み込み中 (pending_) のものも同じで, 以降のリクエストは新しく読み込む
+  by_path_.clear();
+  by_content_.clear();
+  pending_.clear();
+  ++clear_count_;
+}
+
+TextureCache::Stats TextureCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats = stats_;
+  stats.entry_count = lru_.size();
+  return stats;
+}
+
+void TextureCache::Touch(Entry& entry) { lru_.splice(lru_.begin(), lru_, entry.lru_it); }
+
+void TextureCache::EvictIfNeeded() {
+  while (stats_.resident_bytes > budget_bytes_ && !lru_.empty()) {
+    Remove(by_content_.at(lru_.back()->content_hash));
+    ++stats_.evictions;
+  }
+}
+
+void TextureCache::Remove(const EntryPtr& entry) {
+  EntryPtr keep = entry;  // 下の erase で最後の参照が消えないように
+  for (auto& path : keep->paths) {
+    auto it = by_path_.find(path);
+    if (it != by_path_.end() && it->second == keep) {
+      by_path_.erase(it);
+    }
+  }
+  by_content_.erase(keep->content_hash);
+  lru_.erase(keep->lru_it);
+  stats_.resident_bytes -= keep->bytes;
+}
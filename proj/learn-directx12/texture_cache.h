@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "image.h"
+
+class TextureContentStore;
+
+/**
+ * @brief スレッドセーフなデコード済みテクスチャのキャッシュ
+ * @details
+ *  - キーは正規化したパス (".." の解決, Windows では大文字小文字を無視)
+ *  - ファイル内容のハッシュも持ち, 別パスでも中身が同じならデコード結果を共有する
+ *  - 同じテクスチャへの同時リクエストはまとめられ, デコードは 1 回だけ行われる
+ *  - TextureContentStore を渡すと, ファイルは違ってもデコード後のピクセルが同じ画像を共有する
+ *  - メモリ予算を超えたら最も古く使われたものから捨てる (LRU)
+ *  - 読み込み・デコードの失敗はキャッシュしない (次の Get() でやり直す)
+ *  GPU には依存しないので, GPU 無しでも単体で動かせる.
+ */
+class TextureCache {
+ public:
+  /**
+   * @brief ファイルの中身をデコードする関数. 失敗したら nullptr を返す. 複数スレッドから同時に呼ばれる.
+   */
+  using Decoder = std::function<std::shared_ptr<const Image>(const std::filesystem::path& path, const uint8_t* data,
+                                                             std::size_t size)>;
+
+  struct Stats {
+    uint64_t hits = 0;                    // パスで見つかった
+    uint64_t content_hits = 0;            // パスは初見だが中身が同じものが見つかった
+    uint64_t coalesced = 0;               // デコード中のリクエストに相乗りした
+    uint64_t misses = 0;                  // デコードした
+    uint64_t failures = 0;                // 読み込み・デコードに失敗した
+    uint64_t evictions = 0;               // 予算超過で捨てた
+    uint64_t bytes_read = 0;              // 読み込んだファイルの合計サイズ
+    uint64_t bytes_decoded = 0;           // デコードした画像の合計サイズ
+    uint64_t bytes_deduplicated = 0;      // 中身が同じファイルを共有したことで節約できたサイズ
+    std::size_t resident_bytes = 0;       // 現在キャッシュしている画像の合計サイズ
+    std::size_t peak_resident_bytes = 0;  // resident_bytes の最大値
+    std::size_t entry_count = 0;
+  };
+
+  /**
+   * @param decoder デコード関数
+   * @param budget_bytes キャッシュしておく画像の合計サイズの上限
+   * @param content_store デコード結果をピクセル単位で共有する場合に指定する (nullptr 可, 呼び出し側が所有)
+   */
+  explicit TextureCache(Decoder decoder, std::size_t budget_bytes = std::size_t(512) << 20,
+                        TextureContentStore* content_store = nullptr);
+  TextureCache(const TextureCache&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+
+  /**
+   * @brief テクスチャを取得する. キャッシュに無ければ呼び出しスレッドでデコードする.
+   * @return 空パス・読み込み失敗・デコード失敗の場合は nullptr
+   */
+  std::shared_ptr<const Image> Get(const std::filesystem::path& path);
+
+  /**
+   * @brief 予算を変更する (超過していれば直ちに追い出す)
+   */
+  void SetBudget(std::size_t budget_bytes);
+
+  /**
+   * @brief 全エントリを破棄する
+   * @details 読み込み・デコード中のものも以降のリクエストからは見えなくなり, 完了してもキャッシュには載せない
+   *          (既に待っている呼び出しには結果を返す).
+   */
+  void Clear();
+
+  Stats GetStats() const;
+
+  /**
+   * @brief キャッシュのキーに使う正規化したパス
+   */
+  static std::filesystem::path CanonicalizePath(const std::filesystem::path& path);
+
+ private:
+  struct Entry {
+    uint64_t content_hash = 0;
+    std::shared_future<std::shared_ptr<const Image>> image;
+    std::size_t bytes = 0;
+    bool ready = false;
+    std::vector<std::filesystem::path> paths;  // このエントリを指しているパス
+    uint64_t pending_aliases = 0;              // デコード完了前に相乗りした別パスの数
+    std::list<Entry*>::iterator lru_it;
+  };
+  using EntryPtr = std::shared_ptr<Entry>;
+
+  struct PathHash {
+    std::size_t operator()(const std::filesystem::path& p) const { return std::filesystem::hash_value(p); }
+  };
+
+  void Touch(Entry& entry);
+  void EvictIfNeeded();
+  void Remove(const EntryPtr& entry);
+
+  Decoder decoder_;
+  std::size_t budget_bytes_;
+  TextureContentStore* content_store_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::filesystem::path, EntryPtr, PathHash> by_path_;
+  std::unordered_map<uint64_t, EntryPtr> by_content_;
+  // パスの読み込み中 (まだハッシュが分からない) のリクエストをまとめる
+  std::unordered_map<std::filesystem::path, std::shared_future<EntryPtr>, PathHash> pending_;
+  std::list<Entry*> lru_;     // 先頭が最近使ったもの
+  uint64_t clear_count_ = 0;  // Clear() の回数. 読み込み中に変わったら結果をキャッシュに載せない
+  Stats stats_;
+};
@@ -0,0 +1,67 @@
+#include "texture_content_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "hash.h"
+
+namespace {
+
+bool SamePixels(const Image& a, const Image& b) {
+  const std::size_t row_bytes = RowBytes(a.format, a.width);
+  for (uint32_t y = 0; y < RowCount(a.format, a.height); ++y) {
+    if (std::memcmp(a.Row(y), b.Row(y), row_bytes) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+uint64_t HashImagePixels(const Image& image) {
+  const std::size_t row_bytes = RowBytes(image.format, image.width);
+  const uint32_t rows = RowCount(image.format, image.height);
+  if (row_bytes == image.row_pitch) {
+    return HashBytes(image.pixels.data(), row_bytes * rows);
+  }
+  uint64_t hash = 0;
+  for (uint32_t y = 0; y < rows; ++y) {
+    hash = HashBytes(image.Row(y), row_bytes, hash);
+  }
+  return hash;
+}
+
+std::shared_ptr<const Image> TextureContentStore::Intern(std::shared_ptr<const Image> image) {
+  if (image == nullptr) {
+    return nullptr;
+  }
+  // ハッシュ計算はロックの外で行う
+  const Key key = {HashImagePixels(*image), image->width, image->height, image->format};
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& candidates = images_[key];
+  // 破棄済みの画像を掃除しつつ同じ内容のものを探す
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [](auto& w) { return w.expired(); }),
+                   candidates.end());
+  for (auto& weak : candidates) {
+    auto existing = weak.lock();
+    if (existing == image) {
+      return existing;
+    }
+    if (existing && SamePixels(*existing, *image)) {
+      ++stats_.duplicate_images;
+      stats_.bytes_saved += image->SizeInBytes();
+      return existing;
+    }
+  }
+  candidates.push_back(image);
+  ++stats_.unique_images;
+  stats_.unique_bytes += image->SizeInBytes();
+  return image;
+}
+
+TextureContentStore::Stats TextureContentStore::GetStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "image.h"
+
+/**
+ * @brief 画像のピクセルデータのハッシュ (行末のパディングは含めない)
+ */
+uint64_t HashImagePixels(const Image& image);
+
+/**
+ * @brief デコード済みピクセルの内容で画像を共有する (content-addressed)
+ * @details MMD モデルは同じ toon01.bmp ... toon10.bmp や sph/spa を別ディレクトリに同梱していることが多い.
+ *          Intern() に渡した画像と同じサイズ・フォーマット・ピクセルの画像が既にあればそちらを返すので,
+ *          呼び出し側は返ってきた Image 単位で GPU リソースを作れば中身が同じテクスチャは 1 つにまとまる.
+ *          保持は weak_ptr なので, ストア自体は画像の寿命を延ばさない.
+ */
+class TextureContentStore {
+ public:
+  struct Stats {
+    uint64_t unique_images = 0;     // 新規に登録された画像数
+    uint64_t unique_bytes = 0;      // 新規に登録された画像の合計サイズ
+    uint64_t duplicate_images = 0;  // 既存の画像と同じだった数
+    uint64_t bytes_saved = 0;       // 共有によって節約できたサイズ
+  };
+
+  TextureContentStore() = default;
+  TextureContentStore(const TextureContentStore&) = delete;
+  TextureContentStore& operator=(const TextureContentStore&) = delete;
+
+  /**
+   * @brief 同じ内容の画像があればそれを, 無ければ image 自身を登録して返す. スレッドセーフ.
+   */
+  std::shared_ptr<const Image> Intern(std::shared_ptr<const Image> image);
+
+  Stats GetStats() const;
+
+ private:
+  struct Key {
+    uint64_t hash;
+    uint32_t width;
+    uint32_t height;
+    PixelFormat format;
+    bool operator==(const Key& other) const {
+      return hash == other.hash && width == other.width && height == other.height && format == other.format;
+    }
+  };
+  struct KeyHash {
+    std::size_t operator()(const Key& key) const { return static_cast<std::size_t>(key.hash); }
+  };
+
+  mutable std::mutex mutex_;
+  // ハッシュが衝突しても正しく動くように, 同じキーに複数の画像をぶら下げる
+  std::unordered_map<Key, std::vector<std::weak_ptr<const Image>>, KeyHash> images_;
+  Stats stats_;
+};
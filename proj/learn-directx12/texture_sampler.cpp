@@ -0,0 +1,445 @@
+#include "texture_sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SAMPLER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(TEXTURE_SAMPLER_USE_SSE) && defined(__AVX2__)
+#define TEXTURE_SAMPLER_USE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// SIMD 実装はスカラー実装と同じ順序で同じ演算をする. 式を変えるときは両方を合わせること.
+
+namespace {
+
+constexpr float kByteToFloat = 1.0f / 255.0f;
+constexpr float kMaxFloat = 3.402823466e+38f;
+constexpr float kIntegerOnly = 8388608.0f;  // 2^23 以上の float は全て整数
+
+/**
+ * @brief 点ごとのミップの選び方
+ */
+struct LevelSelection {
+  uint32_t level0;
+  uint32_t level1;
+  float t;  // level0 と level1 の間の補間係数
+};
+
+LevelSelection SelectLevels(const TextureView& texture, const SamplerDesc& sampler, float lod) {
+  const float max_level = std::min(static_cast<float>(texture.level_count - 1), std::max(sampler.max_lod, 0.0f));
+  const float l = std::isnan(lod) ? 0.0f : std::clamp(lod, 0.0f, max_level);
+  const uint32_t level0 = static_cast<uint32_t>(l);
+  return {level0, std::min(level0 + 1, texture.level_count - 1), l - static_cast<float>(level0)};
+}
+
+/**
+ * @brief 1 軸分のテクセル番号と補間係数
+ */
+struct AxisSample {
+  uint32_t i0;
+  uint32_t i1;
+  float f;
+};
+
+AxisSample AddressAxis(float c, uint32_t size, TextureAddressMode mode) {
+  if (!(std::fabs(c) <= kMaxFloat)) {
+    c = 0.0f;  // NaN / Inf
+  }
+  const float s = static_cast<float>(size);
+  if (mode == TextureAddressMode::kWrap) {
+    if (std::fabs(c) >= kIntegerOnly) {
+      c = 0.0f;
+    }
+    c = c - std::floor(c);
+  }
+  // テクセルの中心が (i + 0.5) / size にある
+  float x = c * s - 0.5f;
+  if (mode == TextureAddressMode::kClamp) {
+    x = std::min(std::max(x, -1.0f), s);
+  }
+  const float fl = std::floor(x);
+  AxisSample axis;
+  axis.f = x - fl;
+  if (mode == TextureAddressMode::kWrap) {
+    // fl は -1 から size - 1 の間にある
+    const int i0 = static_cast<int>(fl);
+    axis.i0 = static_cast<uint32_t>(i0 < 0 ? i0 + static_cast<int>(size) : i0);
+    axis.i1 = static_cast<uint32_t>(i0 + 1 >= static_cast<int>(size) ? 0 : i0 + 1);
+  } else {
+    axis.i0 = static_cast<uint32_t>(std::min(std::max(fl, 0.0f), s - 1.0f));
+    axis.i1 = static_cast<uint32_t>(std::min(std::max(fl + 1.0f, 0.0f), s - 1.0f));
+  }
+  return axis;
+}
+
+uint32_t LoadTexel(const Image& image, uint32_t x, uint32_t y) {
+  uint32_t texel = 0;
+  std::memcpy(&texel, image.Row(y) + std::size_t(x) * 4, sizeof(texel));
+  return texel;
+}
+
+float Lerp(float a, float b, float t) { return a + (b - a) * t; }
+
+/**
+ * @brief 1 つのミップでのバイリニア補間 (チャンネルはメモリ上の順)
+ */
+void SampleLevel(const Image& image, const SamplerDesc& sampler, float u, float v, float out[4]) {
+  const AxisSample ax = AddressAxis(u, image.width, sampler.address_u);
+  const AxisSample ay = AddressAxis(v, image.height, sampler.address_v);
+  const uint32_t t00 = LoadTexel(image, ax.i0, ay.i0);
+  const uint32_t t10 = LoadTexel(image, ax.i1, ay.i0);
+  const uint32_t t01 = LoadTexel(image, ax.i0, ay.i1);
+  const uint32_t t11 = LoadTexel(image, ax.i1, ay.i1);
+  for (int c = 0; c < 4; ++c) {
+    const int shift = c * 8;
+    const float c00 = static_cast<float>((t00 >> shift) & 0xff) * kByteToFloat;
+    const float c10 = static_cast<float>((t10 >> shift) & 0xff) * kByteToFloat;
+    const float c01 = static_cast<float>((t01 >> shift) & 0xff) * kByteToFloat;
+    const float c11 = static_cast<float>((t11 >> shift) & 0xff) * kByteToFloat;
+    out[c] = Lerp(Lerp(c00, c10, ax.f), Lerp(c01, c11, ax.f), ay.f);
+  }
+}
+
+Float4 ToRgba(const float c[4], PixelFormat format) {
+  if (format == PixelFormat::kBGRA8) {
+    return {c[2], c[1], c[0], c[3]};
+  }
+  return {c[0], c[1], c[2], c[3]};
+}
+
+#ifdef TEXTURE_SAMPLER_USE_SSE
+
+////////////////////
+// SSE2 (4 lanes) //
+////////////////////
+
+/**
+ * @brief floor (SSE2 には丸め命令がないので, |x| < 2^31 の範囲で切り捨てから求める)
+ */
+__m128 Floor4(__m128 x) {
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+__m128 Abs4(__m128 x) { return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))); }
+
+__m128 Lerp4(__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)); }
+
+/**
+ * @brief AddressAxis の 4 点版. size はレーンごとに違ってよい
+ */
+__m128 AddressAxis4(__m128 c, __m128 s, TextureAddressMode mode, __m128i* i0, __m128i* i1) {
+  c = _mm_and_ps(c, _mm_cmple_ps(Abs4(c), _mm_set1_ps(kMaxFloat)));
+  if (mode == TextureAddressMode::kWrap) {
+    c = _mm_andnot_ps(_mm_cmpge_ps(Abs4(c), _mm_set1_ps(kIntegerOnly)), c);
+    c = _mm_sub_ps(c, Floor4(c));
+  }
+  __m128 x = _mm_sub_ps(_mm_mul_ps(c, s), _mm_set1_ps(0.5f));
+  if (mode == TextureAddressMode::kClamp) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), s);
+  }
+  const __m128 fl = Floor4(x);
+  if (mode == TextureAddressMode::kWrap) {
+    const __m128i size = _mm_cvttps_epi32(s);
+    const __m128i a = _mm_cvttps_epi32(fl);
+    const __m128i b = _mm_add_epi32(a, _mm_set1_epi32(1));
+    *i0 = _mm_add_epi32(a, _mm_and_si128(_mm_cmplt_epi32(a, _mm_setzero_si128()), size));
+    *i1 = _mm_andnot_si128(_mm_cmpeq_epi32(b, size), b);
+  } else {
+    const __m128 last = _mm_sub_ps(s, _mm_set1_ps(1.0f));
+    *i0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fl, _mm_setzero_ps()), last));
+    *i1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(fl, _mm_set1_ps(1.0f)), _mm_setzero_ps()), last));
+  }
+  return _mm_sub_ps(x, fl);
+}
+
+__m128 Channel4(__m128i texels, int c) {
+  const __m128i bytes = _mm_and_si128(_mm_srli_epi32(texels, c * 8), _mm_set1_epi32(0xff));
+  return _mm_mul_ps(_mm_cvtepi32_ps(bytes), _mm_set1_ps(kByteToFloat));
+}
+
+/**
+ * @brief 4 点をそれぞれのミップ (levels[lane]) でバイリニア補間する
+ */
+void SampleLevel4(const Image* const levels[4], const SamplerDesc& sampler, __m128 u, __m128 v, __m128 out[4]) {
+  const __m128 w = _mm_setr_ps(static_cast<float>(levels[0]->width), static_cast<float>(levels[1]->width),
+                               static_cast<float>(levels[2]->width), static_cast<float>(levels[3]->width));
+  const __m128 h = _mm_setr_ps(static_cast<float>(levels[0]->height), static_cast<float>(levels[1]->height),
+                               static_cast<float>(levels[2]->height), static_cast<float>(levels[3]->height));
+  __m128i x0, x1, y0, y1;
+  const __m128 fx = AddressAxis4(u, w, sampler.address_u, &x0, &x1);
+  const __m128 fy = AddressAxis4(v, h, sampler.address_v, &y0, &y1);
+
+  alignas(16) uint32_t ix[2][4];
+  alignas(16) uint32_t iy[2][4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(ix[0]), x0);
+  _mm_store_si128(reinterpret_cast<__m128i*>(ix[1]), x1);
+  _mm_store_si128(reinterpret_cast<__m128i*>(iy[0]), y0);
+  _mm_store_si128(reinterpret_cast<__m128i*>(iy[1]), y1);
+  // SSE2 には gather がないのでテクセルはレーンごとに読む
+  alignas(16) uint32_t texels[4][4];  // [00, 10, 01, 11][lane]
+  for (int lane = 0; lane < 4; ++lane) {
+    const Image& image = *levels[lane];
+    texels[0][lane] = LoadTexel(image, ix[0][lane], iy[0][lane]);
+    texels[1][lane] = LoadTexel(image, ix[1][lane], iy[0][lane]);
+    texels[2][lane] = LoadTexel(image, ix[0][lane], iy[1][lane]);
+    texels[3][lane] = LoadTexel(image, ix[1][lane], iy[1][lane]);
+  }
+  const __m128i t00 = _mm_load_si128(reinterpret_cast<const __m128i*>(texels[0]));
+  const __m128i t10 = _mm_load_si128(reinterpret_cast<const __m128i*>(texels[1]));
+  const __m128i t01 = _mm_load_si128(reinterpret_cast<const __m128i*>(texels[2]));
+  const __m128i t11 = _mm_load_si128(reinterpret_cast<const __m128i*>(texels[3]));
+  for (int c = 0; c < 4; ++c) {
+    out[c] = Lerp4(Lerp4(Channel4(t00, c), Channel4(t10, c), fx), Lerp4(Channel4(t01, c), Channel4(t11, c), fx), fy);
+  }
+}
+
+/**
+ * @brief 4 点をサンプリングして out[0..3] に RGBA で書く
+ */
+void Sample4(const TextureView& texture, const SamplerDesc& sampler, const float* u, const float* v, const float* lod,
+             Float4* out) {
+  const Image* level0[4];
+  const Image* level1[4];
+  alignas(16) float t[4];
+  bool blend = false;
+  for (int lane = 0; lane < 4; ++lane) {
+    const LevelSelection s = SelectLevels(texture, sampler, lod != nullptr ? lod[lane] : 0.0f);
+    level0[lane] = &texture.levels[s.level0];
+    level1[lane] = &texture.levels[s.level1];
+    t[lane] = s.t;
+    blend |= s.t != 0.0f;
+  }
+  const __m128 u4 = _mm_loadu_ps(u);
+  const __m128 v4 = _mm_loadu_ps(v);
+  __m128 c[4];
+  SampleLevel4(level0, sampler, u4, v4, c);
+  if (blend) {
+    // t が 0 のレーンは c0 + (c1 - c0) * 0 = c0 なので, スカラー実装と同じ値のまま
+    __m128 c1[4];
+    SampleLevel4(level1, sampler, u4, v4, c1);
+    const __m128 t4 = _mm_load_ps(t);
+    for (int k = 0; k < 4; ++k) {
+      c[k] = Lerp4(c[k], c1[k], t4);
+    }
+  }
+  if (texture.levels[0].format == PixelFormat::kBGRA8) {
+    std::swap(c[0], c[2]);
+  }
+  _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+  float* dst = reinterpret_cast<float*>(out);
+  for (int lane = 0; lane < 4; ++lane) {
+    _mm_storeu_ps(dst + lane * 4, c[lane]);
+  }
+}
+
+#endif  // TEXTURE_SAMPLER_USE_SSE
+
+#ifdef TEXTURE_SAMPLER_USE_AVX2
+
+////////////////////
+// AVX2 (8 lanes) //
+////////////////////
+
+__m256 Floor8(__m256 x) { return _mm256_floor_ps(x); }
+
+__m256 Abs8(__m256 x) { return _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff))); }
+
+__m256 Lerp8(__m256 a, __m256 b, __m256 t) { return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t)); }
+
+/**
+ * @brief AddressAxis の 8 点版 (全レーンが同じミップ)
+ */
+__m256 AddressAxis8(__m256 c, uint32_t size, TextureAddressMode mode, __m256i* i0, __m256i* i1) {
+  const __m256 s = _mm256_set1_ps(static_cast<float>(size));
+  c = _mm256_and_ps(c, _mm256_cmp_ps(Abs8(c), _mm256_set1_ps(kMaxFloat), _CMP_LE_OQ));
+  if (mode == TextureAddressMode::kWrap) {
+    c = _mm256_andnot_ps(_mm256_cmp_ps(Abs8(c), _mm256_set1_ps(kIntegerOnly), _CMP_GE_OQ), c);
+    c = _mm256_sub_ps(c, Floor8(c));
+  }
+  __m256 x = _mm256_sub_ps(_mm256_mul_ps(c, s), _mm256_set1_ps(0.5f));
+  if (mode == TextureAddressMode::kClamp) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.0f)), s);
+  }
+  const __m256 fl = Floor8(x);
+  if (mode == TextureAddressMode::kWrap) {
+    const __m256i n = _mm256_set1_epi32(static_cast<int>(size));
+    const __m256i a = _mm256_cvttps_epi32(fl);
+    const __m256i b = _mm256_add_epi32(a, _mm256_set1_epi32(1));
+    *i0 = _mm256_add_epi32(a, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), a), n));
+    *i1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(b, n), b);
+  } else {
+    const __m256 last = _mm256_sub_ps(s, _mm256_set1_ps(1.0f));
+    *i0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(fl, _mm256_setzero_ps()), last));
+    *i1 = _mm256_cvttps_epi32(
+        _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(fl, _mm256_set1_ps(1.0f)), _mm256_setzero_ps()), last));
+  }
+  return _mm256_sub_ps(x, fl);
+}
+
+__m256 Channel8(__m256i texels, int c) {
+  const __m256i bytes = _mm256_and_si256(_mm256_srli_epi32(texels, c * 8), _mm256_set1_epi32(0xff));
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(bytes), _mm256_set1_ps(kByteToFloat));
+}
+
+void SampleLevel8(const Image& image, const SamplerDesc& sampler, __m256 u, __m256 v, __m256 out[4]) {
+  __m256i x0, x1, y0, y1;
+  const __m256 fx = AddressAxis8(u, image.width, sampler.address_u, &x0, &x1);
+  const __m256 fy = AddressAxis8(v, image.height, sampler.address_v, &y0, &y1);
+  // バイトオフセットで gather する (画像は 2 GiB 未満であること)
+  const __m256i pitch = _mm256_set1_epi32(static_cast<int>(image.row_pitch));
+  const __m256i row0 = _mm256_mullo_epi32(y0, pitch);
+  const __m256i row1 = _mm256_mullo_epi32(y1, pitch);
+  const __m256i col0 = _mm256_slli_epi32(x0, 2);
+  const __m256i col1 = _mm256_slli_epi32(x1, 2);
+  const int* base = reinterpret_cast<const int*>(image.pixels.data());
+  const __m256i t00 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, col0), 1);
+  const __m256i t10 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, col1), 1);
+  const __m256i t01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, col0), 1);
+  const __m256i t11 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, col1), 1);
+  for (int c = 0; c < 4; ++c) {
+    out[c] = Lerp8(Lerp8(Channel8(t00, c), Channel8(t10, c), fx), Lerp8(Channel8(t01, c), Channel8(t11, c), fx), fy);
+  }
+}
+
+/**
+ * @brief 8 点をサンプリングする. レーンごとにミップが違う場合は false を返す (呼び出し側で 4 点ずつ処理する)
+ */
+bool Sample8(const TextureView& texture, const SamplerDesc& sampler, const float* u, const float* v, const float* lod,
+             Float4* out) {
+  alignas(32) float t[8];
+  LevelSelection first = SelectLevels(texture, sampler, lod != nullptr ? lod[0] : 0.0f);
+  t[0] = first.t;
+  for (int lane = 1; lane < 8; ++lane) {
+    const LevelSelection s = SelectLevels(texture, sampler, lod != nullptr ? lod[lane] : 0.0f);
+    if (s.level0 != first.level0 || s.level1 != first.level1) {
+      return false;
+    }
+    t[lane] = s.t;
+  }
+  const Image& image0 = texture.levels[first.level0];
+  const Image& image1 = texture.levels[first.level1];
+  if (image0.row_pitch * image0.height > 0x7fffffff || image1.row_pitch * image1.height > 0x7fffffff) {
+    return false;
+  }
+  const __m256 u8 = _mm256_loadu_ps(u);
+  const __m256 v8 = _mm256_loadu_ps(v);
+  const __m256 t8 = _mm256_load_ps(t);
+  __m256 c[4];
+  SampleLevel8(image0, sampler, u8, v8, c);
+  if (_mm256_movemask_ps(_mm256_cmp_ps(t8, _mm256_setzero_ps(), _CMP_NEQ_UQ)) != 0) {
+    __m256 c1[4];
+    SampleLevel8(image1, sampler, u8, v8, c1);
+    for (int k = 0; k < 4; ++k) {
+      c[k] = Lerp8(c[k], c1[k], t8);
+    }
+  }
+  if (image0.format == PixelFormat::kBGRA8) {
+    std::swap(c[0], c[2]);
+  }
+  // SoA -> AoS: 128 bit の半分ずつ転置する
+  for (int half = 0; half < 2; ++half) {
+    __m128 r = half == 0 ? _mm256_castps256_ps128(c[0]) : _mm256_extractf128_ps(c[0], 1);
+    __m128 g = half == 0 ? _mm256_castps256_ps128(c[1]) : _mm256_extractf128_ps(c[1], 1);
+    __m128 b = half == 0 ? _mm256_castps256_ps128(c[2]) : _mm256_extractf128_ps(c[2], 1);
+    __m128 a = half == 0 ? _mm256_castps256_ps128(c[3]) : _mm256_extractf128_ps(c[3], 1);
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+    float* dst = reinterpret_cast<float*>(out + half * 4);
+    _mm_storeu_ps(dst + 0, r);
+    _mm_storeu_ps(dst + 4, g);
+    _mm_storeu_ps(dst + 8, b);
+    _mm_storeu_ps(dst + 12, a);
+  }
+  return true;
+}
+
+#endif  // TEXTURE_SAMPLER_USE_AVX2
+
+}  // namespace
+
+bool TextureView::IsValid() const {
+  if (levels == nullptr || level_count == 0) {
+    return false;
+  }
+  const PixelFormat format = levels[0].format;
+  if (format != PixelFormat::kRGBA8 && format != PixelFormat::kBGRA8) {
+    return false;
+  }
+  for (uint32_t i = 0; i < level_count; ++i) {
+    const Image& image = levels[i];
+    if (image.format != format || image.width == 0 || image.height == 0 ||
+        image.row_pitch < std::size_t(image.width) * 4 || image.pixels.size() < image.row_pitch * image.height) {
+      return false;
+    }
+  }
+  return true;
+}
+
+float ComputeTextureLod(const TextureView& texture, float du_dx, float dv_dx, float du_dy, float dv_dy) {
+  if (texture.levels == nullptr || texture.level_count == 0) {
+    return 0.0f;
+  }
+  const float w = static_cast<float>(texture.levels[0].width);
+  const float h = static_cast<float>(texture.levels[0].height);
+  const float lx = std::hypot(du_dx * w, dv_dx * h);
+  const float ly = std::hypot(du_dy * w, dv_dy * h);
+  const float rho = std::max(lx, ly);
+  return rho > 0.0f ? std::log2(rho) : 0.0f;
+}
+
+Float4 SampleTexture(const TextureView& texture, const SamplerDesc& sampler, float u, float v, float lod) {
+  if (!texture.IsValid()) {
+    return {};
+  }
+  const LevelSelection s = SelectLevels(texture, sampler, lod);
+  float c[4];
+  SampleLevel(texture.levels[s.level0], sampler, u, v, c);
+  if (s.t != 0.0f) {
+    float c1[4];
+    SampleLevel(texture.levels[s.level1], sampler, u, v, c1);
+    for (int k = 0; k < 4; ++k) {
+      c[k] = Lerp(c[k], c1[k], s.t);
+    }
+  }
+  return ToRgba(c, texture.levels[0].format);
+}
+
+void SampleTextureBatch(const TextureView& texture, const SamplerDesc& sampler, const float* u, const float* v,
+                        const float* lod, std::size_t count, Float4* out) {
+  if (!texture.IsValid()) {
+    std::fill(out, out + count, Float4{});
+    return;
+  }
+  std::size_t i = 0;
+#ifdef TEXTURE_SAMPLER_USE_SSE
+  while (i + 4 <= count) {
+    const float* lod_i = lod != nullptr ? lod + i : nullptr;
+#ifdef TEXTURE_SAMPLER_USE_AVX2
+    if (i + 8 <= count && Sample8(texture, sampler, u + i, v + i, lod_i, out + i)) {
+      i += 8;
+      continue;
+    }
+#endif
+    Sample4(texture, sampler, u + i, v + i, lod_i, out + i);
+    i += 4;
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = SampleTexture(texture, sampler, u[i], v[i], lod != nullptr ? lod[i] : 0.0f);
+  }
+}
+
+std::size_t TextureSamplerBatchWidth() {
+#if defined(TEXTURE_SAMPLER_USE_AVX2)
+  return 8;
+#elif defined(TEXTURE_SAMPLER_USE_SSE)
+  return 4;
+#else
+  return 1;
+#endif
+}
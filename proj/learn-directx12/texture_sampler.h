@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_math.h"
+#include "image.h"
+
+/////////////
+// sampler //
+/////////////
+
+enum class TextureAddressMode {
+  kWrap,   // D3D12_TEXTURE_ADDRESS_MODE_WRAP
+  kClamp,  // D3D12_TEXTURE_ADDRESS_MODE_CLAMP
+};
+
+/**
+ * @brief D3D12_STATIC_SAMPLER_DESC のうち CPU のサンプラーが扱う部分
+ * @details フィルタは常に D3D12_FILTER_MIN_MAG_MIP_LINEAR (バイリニア + ミップ間の線形補間).
+ */
+struct SamplerDesc {
+  TextureAddressMode address_u = TextureAddressMode::kWrap;
+  TextureAddressMode address_v = TextureAddressMode::kWrap;
+  float max_lod = 3.402823466e+38f;  // D3D12_FLOAT32_MAX
+};
+
+// BasicShaderHeader.hlsli の smp (s0) と smpToon (s1) と同じ設定
+constexpr SamplerDesc kSamplerSmp = {TextureAddressMode::kWrap, TextureAddressMode::kWrap};
+constexpr SamplerDesc kSamplerSmpToon = {TextureAddressMode::kClamp, TextureAddressMode::kClamp};
+
+/**
+ * @brief サンプリングするテクスチャ (ミップマップの列への参照)
+ * @details levels[0] が最も大きいミップ. 全てのミップは同じフォーマット (kRGBA8 か kBGRA8) であること.
+ */
+struct TextureView {
+  const Image* levels = nullptr;
+  uint32_t level_count = 0;
+
+  TextureView() = default;
+  TextureView(const Image* levels, uint32_t level_count) : levels(levels), level_count(level_count) {}
+  TextureView(const Image& image) : levels(&image), level_count(1) {}  // ミップ 1 段のテクスチャ
+
+  bool IsValid() const;
+};
+
+/**
+ * @brief UV の微分から LOD を求める (D3D と同じく, 長い方の軸のテクセル数の log2)
+ */
+float ComputeTextureLod(const TextureView& texture, float du_dx, float dv_dx, float du_dy, float dv_dy);
+
+//////////////
+// sampling //
+//////////////
+
+/**
+ * @brief 1 点をサンプリングする (スカラー実装. SIMD 実装の検証用のリファレンス)
+ * @details 結果は RGBA の順 (kBGRA8 のテクスチャも並べ替える) で 0.0 - 1.0.
+ *          UV が NaN / Inf なら 0 として扱う. 無効なテクスチャは (0, 0, 0, 0) を返す.
+ */
+Float4 SampleTexture(const TextureView& texture, const SamplerDesc& sampler, float u, float v, float lod = 0.0f);
+
+/**
+ * @brief count 点をまとめてサンプリングする
+ * @details AVX2 が使えるビルドでは 8 点, SSE2 では 4 点ずつ処理する. 端数と SIMD が使えない環境はスカラー実装で処理する.
+ *          結果は SampleTexture と誤差 1e-6 以内で一致する.
+ * @param lod nullptr なら全て 0 (最も大きいミップ)
+ */
+void SampleTextureBatch(const TextureView& texture, const SamplerDesc& sampler, const float* u, const float* v,
+                        const float* lod, std::size_t count, Float4* out);
+
+/**
+ * @brief SampleTextureBatch が 1 回に処理する点の数 (SIMD が使えなければ 1)
+ */
+std::size_t TextureSamplerBatchWidth();
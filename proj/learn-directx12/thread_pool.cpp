@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(std::size_t thread_count, std::function<void()> on_thread_start,
+                       std::function<void()> on_thread_exit)
+    : on_thread_start_(std::move(on_thread_start)), on_thread_exit_(std::move(on_thread_exit)) {
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  workers_.reserve(thread_count);
+  for (std::size_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back([this]() { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::WorkerLoop() {
+  if (on_thread_start_) {
+    on_thread_start_();
+  }
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      // 停止時も残っているタスクは全て処理する
+      if (tasks_.empty()) {
+        break;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+  if (on_thread_exit_) {
+    on_thread_exit_();
+  }
+}
+
+void ThreadPool::ParallelFor(std::size_t begin, std::size_t end, std::size_t chunk,
+                             const std::function<void(std::size_t, std::size_t)>& body) {
+  if (begin >= end) {
+    return;
+  }
+  chunk = std::max<std::size_t>(chunk, 1);
+  const std::size_t chunk_count = (end - begin + chunk - 1) / chunk;
+
+  // 状態は共有ポインタで持つ (呼び出し元が先に抜けてもワーカーが触れるように)
+  struct State {
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+
+  auto run = [state, begin, end, chunk, chunk_count, &body]() {
+    while (true) {
+      const std::size_t c = state->next.fetch_add(1);
+      if (c >= chunk_count) {
+        return;
+      }
+      const std::size_t b = begin + c * chunk;
+      try {
+        body(b, std::min(end, b + chunk));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      if (state->done.fetch_add(1) + 1 == chunk_count) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cv.notify_all();
+      }
+    }
+  };
+
+  const std::size_t helpers = std::min(workers_.size(), chunk_count - 1);
+  for (std::size_t i = 0; i < helpers; ++i) {
+    Post(run);
+  }
+  run();  // 呼び出しスレッドも参加する
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&]() { return state->done.load() == chunk_count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief 固定サイズのスレッドプール
+ * @details タスクは FIFO で実行される. タスクの中で同じプールの別タスクの完了を待つとデッドロックするので,
+ *          依存関係はタスクの末尾で次のタスクを Submit して表現すること.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @param thread_count 0 の場合は std::thread::hardware_concurrency()
+   * @param on_thread_start 各ワーカースレッドの開始時に呼ばれる (COM の初期化など)
+   * @param on_thread_exit 各ワーカースレッドの終了時に呼ばれる
+   */
+  explicit ThreadPool(std::size_t thread_count = 0, std::function<void()> on_thread_start = {},
+                      std::function<void()> on_thread_exit = {});
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief タスクを投入し, 結果を受け取る future を返す
+   */
+  template <typename F>
+  auto Submit(F&& f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+    using R = std::invoke_result_t<std::decay_t<F>>;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    auto future = task->get_future();
+    Post([task]() { (*task)(); });
+    return future;
+  }
+
+  /**
+   * @brief 結果の不要なタスクを投入する
+   */
+  void Post(std::function<void()> task);
+
+  /**
+   * @brief [begin, end) を chunk 単位に分けて並列実行し, 全て終わるまで待つ
+   * @details 呼び出しスレッドも処理に参加する. ワーカースレッドから呼んでもデッドロックしない.
+   */
+  void ParallelFor(std::size_t begin, std::size_t end, std::size_t chunk,
+                   const std::function<void(std::size_t, std::size_t)>& body);
+
+  std::size_t ThreadCount() const { return workers_.size(); }
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::function<void()> on_thread_start_;
+  std::function<void()> on_thread_exit_;
+};
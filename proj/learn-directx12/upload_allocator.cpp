@@ -0,0 +1,101 @@
+#include "upload_allocator.h"
+
+#include <algorithm>
+#include <utility>
+
+LinearUploadAllocator::LinearUploadAllocator(const Options& options, CreatePage create_page, DestroyPage destroy_page)
+    : options_(options), create_page_(std::move(create_page)), destroy_page_(std::move(destroy_page)) {
+  options_.alignment = std::max<std::size_t>(options_.alignment, 1);
+  options_.page_size = std::max(options_.page_size, options_.alignment);
+}
+
+LinearUploadAllocator::~LinearUploadAllocator() {
+  for (const auto& page : frame_pages_) {
+    Destroy(page);
+  }
+  for (const auto& retired : retired_) {
+    Destroy(retired.page);
+  }
+  ReleaseFreePages();
+}
+
+void LinearUploadAllocator::BeginFrame(uint64_t completed_value) {
+  while (!retired_.empty() && retired_.front().fence_value <= completed_value) {
+    const UploadPage& page = retired_.front().page;
+    if (page.size == options_.page_size) {
+      free_pages_.push_back(page);
+    } else {
+      Destroy(page);  // 専用のページは使い回さない
+    }
+    retired_.pop_front();
+  }
+  stats_.frame_bytes = 0;
+}
+
+UploadAllocation LinearUploadAllocator::Allocate(std::size_t size, std::size_t alignment) {
+  if (alignment == 0) {
+    alignment = options_.alignment;
+  }
+  std::size_t aligned = (offset_ + alignment - 1) & ~(alignment - 1);
+  if (frame_pages_.empty() || aligned + size > frame_pages_.back().size) {
+    // ページの先頭はどのアライメントにも揃っているものとする
+    if (!NextPage(size)) {
+      return {};
+    }
+    aligned = 0;
+  }
+  const UploadPage& page = frame_pages_.back();
+  stats_.frame_bytes += aligned + size - offset_;
+  stats_.peak_frame_bytes = std::max(stats_.peak_frame_bytes, stats_.frame_bytes);
+  ++stats_.allocations;
+  offset_ = aligned + size;
+  return {page.cpu + aligned, page.gpu_address + aligned, size};
+}
+
+void LinearUploadAllocator::EndFrame(uint64_t fence_value) {
+  for (const auto& page : frame_pages_) {
+    retired_.push_back({fence_value, page});
+  }
+  frame_pages_.clear();
+  offset_ = 0;
+}
+
+void LinearUploadAllocator::ReleaseFreePages() {
+  for (const auto& page : free_pages_) {
+    Destroy(page);
+  }
+  free_pages_.clear();
+}
+
+bool LinearUploadAllocator::NextPage(std::size_t size) {
+  UploadPage page;
+  if (size <= options_.page_size && !free_pages_.empty()) {
+    page = free_pages_.back();
+    free_pages_.pop_back();
+    ++stats_.page_reuses;
+  } else {
+    const std::size_t page_size = size <= options_.page_size
+                                      ? options_.page_size
+                                      : (size + options_.alignment - 1) / options_.alignment * options_.alignment;
+    if (!create_page_(page_size, &page) || page.cpu == nullptr) {
+      return false;
+    }
+    page.size = page_size;  // 大きめに作られても, 使い回すかどうかの判定のため要求したサイズとして扱う
+    ++stats_.page_creations;
+    ++stats_.pages;
+    stats_.reserved_bytes += page.size;
+  }
+  // 切り出し中だったページの残りは使ったものとして数える
+  if (!frame_pages_.empty()) {
+    stats_.frame_bytes += frame_pages_.back().size - offset_;
+  }
+  frame_pages_.push_back(page);
+  offset_ = 0;
+  return true;
+}
+
+void LinearUploadAllocator::Destroy(const UploadPage& page) {
+  destroy_page_(page);
+  --stats_.pages;
+  stats_.reserved_bytes -= page.size;
+}
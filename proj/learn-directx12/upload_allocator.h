@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief CPU から書き込めて GPU から読めるメモリの塊 (D3D12 なら Map したままのアップロードヒープのバッファ)
+ */
+struct UploadPage {
+  uint8_t* cpu = nullptr;    // 先頭 (書き込み用)
+  uint64_t gpu_address = 0;  // GPU から見た先頭のアドレス
+  std::size_t size = 0;
+  void* handle = nullptr;    // バックエンドのリソース (ID3D12Resource* など)
+};
+
+/**
+ * @brief UploadPage から切り出した領域
+ */
+struct UploadAllocation {
+  uint8_t* cpu = nullptr;  // 失敗したら nullptr
+  uint64_t gpu_address = 0;
+  std::size_t size = 0;
+
+  explicit operator bool() const { return cpu != nullptr; }
+};
+
+/**
+ * @brief フレームごとの定数などを大きなページから前詰めで切り出す (GPU の API には依存しない)
+ * @details
+ *  - Allocate() はページ内のオフセットを進めるだけ. ページが尽きたら空いているページを使うか, 新しく作る
+ *  - ページ 1 枚より大きい要求にはその大きさの専用のページを作る (再利用せず, GPU が使い終わったら破棄する)
+ *  - EndFrame() でそのフレームに使ったページにフェンス値を付け, BeginFrame() に渡された完了済みの値に達したら再利用する
+ *  ページの作成と破棄は呼び出し側の関数で行う. スレッドセーフではない.
+ *
+ *   LinearUploadAllocator upload({}, create_page, destroy_page);
+ *   // フレームごと
+ *   upload.BeginFrame(completed_fence_value);
+ *   auto constants = upload.Upload(scene);  // constants.gpu_address を CBV として使う
+ *   ...
+ *   upload.EndFrame(fence_value_of_this_frame);
+ */
+class LinearUploadAllocator {
+ public:
+  struct Options {
+    std::size_t page_size = std::size_t(1) << 20;
+    std::size_t alignment = 256;  // 既定のアライメント (D3D12 の CBV は 256 バイト境界)
+  };
+
+  struct Stats {
+    uint64_t allocations = 0;         // Allocate() の回数 (作ってから)
+    uint64_t page_creations = 0;      // ページを作った回数 (専用のページを含む)
+    uint64_t page_reuses = 0;         // 空いたページを使い回した回数
+    std::size_t pages = 0;            // 持っているページの数 (使用中 + GPU 待ち + 空き)
+    std::size_t reserved_bytes = 0;   // 持っているページの合計
+    std::size_t frame_bytes = 0;      // 今のフレームで切り出したバイト数 (アライメントの詰め物を含む)
+    std::size_t peak_frame_bytes = 0; // frame_bytes の最大値
+  };
+
+  // size バイト以上のページを作る. 失敗したら false
+  using CreatePage = std::function<bool(std::size_t size, UploadPage* page)>;
+  using DestroyPage = std::function<void(const UploadPage& page)>;
+
+  LinearUploadAllocator(const Options& options, CreatePage create_page, DestroyPage destroy_page);
+  /**
+   * @brief 全てのページを破棄する. GPU が使い終わってから破棄すること
+   */
+  ~LinearUploadAllocator();
+  LinearUploadAllocator(const LinearUploadAllocator&) = delete;
+  LinearUploadAllocator& operator=(const LinearUploadAllocator&) = delete;
+
+  /**
+   * @brief フレームを始める. completed_value までのフレームで使ったページを空きに戻す
+   */
+  void BeginFrame(uint64_t completed_value);
+
+  /**
+   * @param alignment 0 なら Options::alignment (2 のべき乗)
+   */
+  UploadAllocation Allocate(std::size_t size, std::size_t alignment = 0);
+
+  /**
+   * @brief value を切り出した領域に書く
+   */
+  template <typename T>
+  UploadAllocation Upload(const T& value, std::size_t alignment = 0) {
+    UploadAllocation allocation = Allocate(sizeof(T), alignment);
+    if (allocation) {
+      std::memcpy(allocation.cpu, &value, sizeof(T));
+    }
+    return allocation;
+  }
+
+  /**
+   * @brief フレームを終える. このフレームで使ったページは GPU のフェンスが fence_value に達するまで使わない
+   */
+  void EndFrame(uint64_t fence_value);
+
+  /**
+   * @brief 空いているページを破棄する (使用中と GPU 待ちのページは残す)
+   */
+  void ReleaseFreePages();
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct RetiredPage {
+    uint64_t fence_value;
+    UploadPage page;
+  };
+
+  bool NextPage(std::size_t size);
+  void Destroy(const UploadPage& page);
+
+  Options options_;
+  CreatePage create_page_;
+  DestroyPage destroy_page_;
+  std::vector<UploadPage> frame_pages_;  // 今のフレームで使っているページ (末尾が切り出し中)
+  std::size_t offset_ = 0;               // frame_pages_.back() の使用済みバイト数
+  std::deque<RetiredPage> retired_;      // GPU が使い終わるのを待っているページ (フェンス値の順)
+  std::vector<UploadPage> free_pages_;
+  Stats stats_;
+};
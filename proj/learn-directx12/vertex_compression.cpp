@@ -0,0 +1,225 @@
+#include "vertex_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+namespace {
+
+constexpr float kSnorm16Max = 32767.0f;
+
+float SignNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+/**
+ * @brief SNORM の値を float にする (D3D の変換規則: -32768 は -1.0 になる)
+ */
+float Snorm16ToFloat(int16_t v) { return std::max(static_cast<float>(v) / kSnorm16Max, -1.0f); }
+
+int16_t FloatToSnorm16(float v) {
+  return static_cast<int16_t>(std::clamp(v, -kSnorm16Max, kSnorm16Max));
+}
+
+template <typename Vertex>
+void CompressInto(PmdSpan<PmdVertex> vertices, Vertex* dst) {
+  using BoneIndex = std::remove_extent_t<decltype(Vertex::bone_no)>;
+  for (std::size_t i = 0; i < vertices.size(); ++i) {
+    const PmdVertex& v = vertices[i];
+    Vertex& c = dst[i];
+    c.pos = v.pos;
+    EncodeOctahedral({v.normal.x, v.normal.y, v.normal.z}, c.normal);
+    c.uv[0] = FloatToHalf(v.uv.x);
+    c.uv[1] = FloatToHalf(v.uv.y);
+    c.bone_no[0] = static_cast<BoneIndex>(v.bone_no[0]);
+    c.bone_no[1] = static_cast<BoneIndex>(v.bone_no[1]);
+    c.weight = v.weight;
+    c.edge_flag = v.EdgeFlag;
+  }
+}
+
+template <typename Vertex>
+PmdVertex Decompress(const Vertex& c) {
+  PmdVertex v = {};
+  v.pos = c.pos;
+  const Float3 n = DecodeOctahedral(c.normal);
+  v.normal = {n.x, n.y, n.z};
+  v.uv = {HalfToFloat(c.uv[0]), HalfToFloat(c.uv[1])};
+  v.bone_no[0] = c.bone_no[0];
+  v.bone_no[1] = c.bone_no[1];
+  v.weight = c.weight;
+  v.EdgeFlag = c.edge_flag;
+  return v;
+}
+
+}  // namespace
+
+////////////////////
+// scalar helpers //
+////////////////////
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t abs = bits & 0x7fffffff;
+
+  if (abs >= 0x7f800000) {
+    // Inf / NaN (NaN は quiet NaN にする)
+    return sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00);
+  }
+  if (abs >= 0x477ff000) {
+    // 65520 以上は丸めると half の最大値を超える
+    return sign | 0x7c00;
+  }
+
+  // 切り捨てる下位ビットを見て最近接偶数に丸める
+  auto round = [](uint32_t mantissa, uint32_t shift) {
+    const uint32_t result = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t half = 1u << (shift - 1);
+    return result + ((rest > half || (rest == half && (result & 1))) ? 1 : 0);
+  };
+  if (abs < 0x38800000) {
+    // half では非正規化数 (2^-14 未満)
+    const uint32_t shift = 126 - (abs >> 23);
+    if (shift > 24) {
+      return sign;
+    }
+    return sign | static_cast<uint16_t>(round((abs & 0x7fffff) | 0x800000, shift));
+  }
+  // 指数のバイアスを 127 から 15 に付け替える. 仮数の繰り上がりはそのまま指数に入る
+  return sign | static_cast<uint16_t>(round(abs - 0x38000000, 13));
+}
+
+float HalfToFloat(uint16_t value) {
+  const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  const uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+  uint32_t bits = 0;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa != 0) {
+    // 非正規化数: 仮数の先頭の 1 が 10 bit 目に来るまでずらす
+    uint32_t e = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --e;
+    }
+    bits = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+  } else {
+    bits = sign;
+  }
+  float result = 0.0f;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+void EncodeOctahedral(const Float3& normal, int16_t out[2]) {
+  const float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+  if (!(l1 > 0.0f)) {
+    out[0] = 0;
+    out[1] = 0;
+    return;
+  }
+  // 八面体に射影し, 下半分は外側の三角形に折り返す
+  float x = normal.x / l1;
+  float y = normal.y / l1;
+  if (normal.z < 0.0f) {
+    const float fx = (1.0f - std::fabs(y)) * SignNotZero(x);
+    const float fy = (1.0f - std::fabs(x)) * SignNotZero(y);
+    x = fx;
+    y = fy;
+  }
+
+  const Float3 target = Normalize(normal);
+  const float sx = x * kSnorm16Max;
+  const float sy = y * kSnorm16Max;
+  float best_dot = -2.0f;
+  for (float cx : {std::floor(sx), std::ceil(sx)}) {
+    for (float cy : {std::floor(sy), std::ceil(sy)}) {
+      const int16_t candidate[2] = {FloatToSnorm16(cx), FloatToSnorm16(cy)};
+      const float d = Dot(DecodeOctahedral(candidate), target);
+      if (d > best_dot) {
+        best_dot = d;
+        out[0] = candidate[0];
+        out[1] = candidate[1];
+      }
+    }
+  }
+}
+
+Float3 DecodeOctahedral(const int16_t encoded[2]) {
+  Float3 n = {Snorm16ToFloat(encoded[0]), Snorm16ToFloat(encoded[1]), 0.0f};
+  n.z = 1.0f - std::fabs(n.x) - std::fabs(n.y);
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return Normalize(n);
+}
+
+////////////////////////////
+// conversion and metrics //
+////////////////////////////
+
+CompactVertexFormat SelectCompactVertexFormat(PmdSpan<PmdVertex> vertices) {
+  const bool narrow = std::all_of(vertices.begin(), vertices.end(),
+                                  [](const PmdVertex& v) { return v.bone_no[0] < 256 && v.bone_no[1] < 256; });
+  return narrow ? CompactVertexFormat::kNarrowBones : CompactVertexFormat::kWideBones;
+}
+
+CompactVertexBuffer CompressVertices(PmdSpan<PmdVertex> vertices) {
+  CompactVertexBuffer buffer;
+  buffer.format = SelectCompactVertexFormat(vertices);
+  buffer.stride =
+      buffer.format == CompactVertexFormat::kNarrowBones ? sizeof(CompactVertex) : sizeof(CompactVertexWide);
+  buffer.vertex_count = vertices.size();
+  buffer.data.resize(buffer.stride * buffer.vertex_count);
+  if (buffer.format == CompactVertexFormat::kNarrowBones) {
+    CompressInto(vertices, reinterpret_cast<CompactVertex*>(buffer.data.data()));
+  } else {
+    CompressInto(vertices, reinterpret_cast<CompactVertexWide*>(buffer.data.data()));
+  }
+  return buffer;
+}
+
+PmdVertex DecompressVertex(const CompactVertexBuffer& buffer, std::size_t index) {
+  const uint8_t* p = buffer.data.data() + buffer.stride * index;
+  if (buffer.format == CompactVertexFormat::kNarrowBones) {
+    return Decompress(*reinterpret_cast<const CompactVertex*>(p));
+  }
+  return Decompress(*reinterpret_cast<const CompactVertexWide*>(p));
+}
+
+VertexCompressionError MeasureCompressionError(PmdSpan<PmdVertex> vertices, const CompactVertexBuffer& buffer) {
+  VertexCompressionError error;
+  const std::size_t n = std::min(vertices.size(), buffer.vertex_count);
+  error.mismatched = std::max(vertices.size(), buffer.vertex_count) - n;
+  double angle_sum = 0.0;
+  std::size_t angle_count = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    const PmdVertex& a = vertices[i];
+    const PmdVertex b = DecompressVertex(buffer, i);
+    if (std::memcmp(&a.pos, &b.pos, sizeof(a.pos)) != 0 || a.bone_no[0] != b.bone_no[0] ||
+        a.bone_no[1] != b.bone_no[1] || a.weight != b.weight || a.EdgeFlag != b.EdgeFlag) {
+      ++error.mismatched;
+    }
+    error.max_uv_error = std::max({error.max_uv_error, std::fabs(a.uv.x - b.uv.x), std::fabs(a.uv.y - b.uv.y)});
+
+    const Float3 original = {a.normal.x, a.normal.y, a.normal.z};
+    if (!(Length(original) > 0.0f)) {
+      ++error.zero_normals;
+      continue;
+    }
+    // 小さい角度では acos の精度が落ちるので atan2(|a x b|, a . b) で求める
+    const Float3 decoded = {b.normal.x, b.normal.y, b.normal.z};
+    const float degrees =
+        std::atan2(Length(Cross(original, decoded)), Dot(original, decoded)) * (180.0f / 3.14159265358979f);
+    error.max_normal_degrees = std::max(error.max_normal_degrees, degrees);
+    angle_sum += degrees;
+    ++angle_count;
+  }
+  error.mean_normal_degrees = angle_count == 0 ? 0.0f : static_cast<float>(angle_sum / angle_count);
+  return error;
+}
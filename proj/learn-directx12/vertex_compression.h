@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu_math.h"
+#include "pmd_file.h"
+
+//////////////////////////
+// compact vertex types //
+//////////////////////////
+
+// PmdVertex (38 bytes) を GPU にそのまま渡す代わりに使う圧縮した頂点レイアウト
+// 位置はそのまま, 法線は octahedral 表現の 16 bit SNORM x 2, UV は half x 2 にする.
+// D3D12 の入力レイアウトでは次のフォーマットで読めば, シェーダー側で必要なのは OctDecode (BasicShaderHeader.hlsli) だけ.
+//   pos: R32G32B32_FLOAT, normal: R16G16_SNORM, uv: R16G16_FLOAT, bone_no: R8G8_UINT (Wide は R16G16_UINT),
+//   weight: R8_UINT, edge_flag: R8_UINT
+#pragma pack(push, 1)
+/**
+ * @brief ボーン番号が 8 bit に収まるモデル用 (24 bytes)
+ */
+struct CompactVertex {
+  PmdFloat3 pos;
+  int16_t normal[2];  // octahedral 表現 (SNORM)
+  uint16_t uv[2];     // half
+  uint8_t bone_no[2];
+  uint8_t weight;  // bone_no[0] の影響度 (0 - 100)
+  uint8_t edge_flag;
+};
+
+/**
+ * @brief ボーン番号が 256 以上のモデル用 (26 bytes)
+ */
+struct CompactVertexWide {
+  PmdFloat3 pos;
+  int16_t normal[2];
+  uint16_t uv[2];
+  uint16_t bone_no[2];
+  uint8_t weight;
+  uint8_t edge_flag;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CompactVertex) == 24, "compact vertex must be 24 bytes");
+static_assert(sizeof(CompactVertexWide) == 26, "compact wide vertex must be 26 bytes");
+
+enum class CompactVertexFormat {
+  kNarrowBones,  // CompactVertex
+  kWideBones,    // CompactVertexWide
+};
+
+/**
+ * @brief 圧縮した頂点列 (GPU にそのまま転送できるバイト列)
+ */
+struct CompactVertexBuffer {
+  CompactVertexFormat format = CompactVertexFormat::kNarrowBones;
+  std::size_t stride = sizeof(CompactVertex);
+  std::size_t vertex_count = 0;
+  std::vector<uint8_t> data;
+};
+
+////////////////////
+// scalar helpers //
+////////////////////
+
+/**
+ * @brief float を half (IEEE 754 binary16) に変換する (最近接偶数丸め)
+ */
+uint16_t FloatToHalf(float value);
+
+/**
+ * @brief half を float に変換する (R16_FLOAT を読んだときと同じ値になる)
+ */
+float HalfToFloat(uint16_t value);
+
+/**
+ * @brief 法線を octahedral 表現の SNORM 16 bit x 2 にする
+ * @details 丸め方向の 4 通りから, デコードしたときに元の向きに最も近いものを選ぶ. 長さ 0 のベクトルは +Z になる.
+ */
+void EncodeOctahedral(const Float3& normal, int16_t out[2]);
+
+/**
+ * @brief octahedral 表現から単位法線に戻す (BasicShaderHeader.hlsli の OctDecode と同じ計算)
+ */
+Float3 DecodeOctahedral(const int16_t encoded[2]);
+
+////////////////////////////
+// conversion and metrics //
+////////////////////////////
+
+/**
+ * @brief 全頂点のボーン番号が 8 bit に収まれば kNarrowBones を選ぶ
+ */
+CompactVertexFormat SelectCompactVertexFormat(PmdSpan<PmdVertex> vertices);
+
+/**
+ * @brief PmdVertex の列を圧縮する
+ * @details ボーン番号・影響度・輪郭線フラグ・位置はそのまま保存する.
+ */
+CompactVertexBuffer CompressVertices(PmdSpan<PmdVertex> vertices);
+
+/**
+ * @brief 圧縮した頂点を PmdVertex に戻す (頂点シェーダーが受け取る値と同じもの)
+ */
+PmdVertex DecompressVertex(const CompactVertexBuffer& buffer, std::size_t index);
+
+/**
+ * @brief 圧縮による誤差
+ */
+struct VertexCompressionError {
+  float max_normal_degrees = 0.0f;   // 法線の角度の誤差の最大値 (度)
+  float mean_normal_degrees = 0.0f;  // 法線の角度の誤差の平均 (度)
+  float max_uv_error = 0.0f;         // UV の絶対誤差の最大値
+  std::size_t mismatched = 0;        // 位置・ボーン番号・影響度・輪郭線フラグが一致しない頂点の数 (0 であること)
+  std::size_t zero_normals = 0;      // 長さ 0 の法線の数 (角度の誤差から除外する)
+};
+
+/**
+ * @brief 元の頂点列と圧縮した頂点列を比べる
+ */
+VertexCompressionError MeasureCompressionError(PmdSpan<PmdVertex> vertices, const CompactVertexBuffer& buffer);
@@ -0,0 +1,306 @@
+#include "vmd_motion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+/////////////
+// VmdFile //
+/////////////
+
+namespace {
+
+/**
+ * @brief 件数 (uint32_t) に続く固定長レコードの配列を読む
+ * @return 範囲外にはみ出すなら false
+ */
+template <typename T>
+bool ReadSection(const uint8_t* bytes, std::size_t size, std::size_t* offset, PmdSpan<T>* out) {
+  uint32_t count = 0;
+  if (size - *offset < sizeof(count)) {
+    return false;
+  }
+  std::memcpy(&count, bytes + *offset, sizeof(count));
+  *offset += sizeof(count);
+  if (count > (size - *offset) / sizeof(T)) {
+    return false;
+  }
+  *out = PmdSpan<T>(reinterpret_cast<const T*>(bytes + *offset), count);
+  *offset += count * sizeof(T);
+  return true;
+}
+
+}  // namespace
+
+bool VmdFile::Open(const fs::path& path) {
+  if (!file_.Open(path)) {
+    error_ = file_.Error();
+    return false;
+  }
+  return Parse(file_.data(), file_.size());
+}
+
+bool VmdFile::Parse(const void* data, std::size_t size) {
+  motions_ = {};
+  morphs_ = {};
+  error_.clear();
+
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  std::size_t offset = 0;
+  constexpr char kSignature[] = "Vocaloid Motion Data ";
+  constexpr char kOldSignature[] = "Vocaloid Motion Data file";
+  if (bytes == nullptr || size < sizeof(VmdHeader) - 10 ||
+      std::memcmp(bytes, kSignature, sizeof(kSignature) - 1) != 0) {
+    error_ = "Not a VMD file (bad signature)";
+    return false;
+  }
+  // 旧形式はモデル名が 10 bytes
+  const bool old_format = std::memcmp(bytes, kOldSignature, sizeof(kOldSignature) - 1) == 0;
+  offset = old_format ? sizeof(VmdHeader) - 10 : sizeof(VmdHeader);
+  if (offset > size || !ReadSection(bytes, size, &offset, &motions_)) {
+    error_ = "VMD file is truncated in motion section";
+    return false;
+  }
+  // 表情以降 (カメラ・照明など) は古いツールの出力では欠けていることがある. 使わないので読み飛ばす
+  if (offset != size && !ReadSection(bytes, size, &offset, &morphs_)) {
+    error_ = "VMD file is truncated in morph section";
+    return false;
+  }
+  return true;
+}
+
+/////////////////
+// BezierCurve //
+/////////////////
+
+float BezierCurve::Evaluate(float x) const {
+  if (IsLinear() || x <= 0.0f || x >= 1.0f) {
+    return std::min(std::max(x, 0.0f), 1.0f);
+  }
+  // x(t) = x を満たす t をニュートン法で求める. 区間から出たら二分法に切り替える
+  float lo = 0.0f;
+  float hi = 1.0f;
+  float t = x;
+  for (int i = 0; i < 16; ++i) {
+    const float s = 1.0f - t;
+    const float ft = 3.0f * s * s * t * x1 + 3.0f * s * t * t * x2 + t * t * t - x;
+    if (std::fabs(ft) < 1e-6f) {
+      break;
+    }
+    (ft > 0.0f ? hi : lo) = t;
+    const float dt = 3.0f * s * s * x1 + 6.0f * s * t * (x2 - x1) + 3.0f * t * t * (1.0f - x2);
+    float next = dt > 1e-6f ? t - ft / dt : lo;
+    if (next <= lo || next >= hi) {
+      next = (lo + hi) * 0.5f;
+    }
+    t = next;
+  }
+  const float s = 1.0f - t;
+  return 3.0f * s * s * t * y1 + 3.0f * s * t * t * y2 + t * t * t;
+}
+
+/////////////////
+// BezierTable //
+/////////////////
+
+BezierTable::BezierTable(const BezierCurve& source) : curve(source) {
+  for (int i = 0; i <= kSegments; ++i) {
+    const float t = static_cast<float>(i) / kSegments;
+    const float s = 1.0f - t;
+    x[i] = 3.0f * s * s * t * curve.x1 + 3.0f * s * t * t * curve.x2 + t * t * t;
+  }
+  // 制御点が 0 - 1 なので x(t) は単調増加だが, 丸めで前の点を下回らないようにしておく
+  for (int i = 1; i <= kSegments; ++i) {
+    x[i] = std::max(x[i], x[i - 1]);
+  }
+}
+
+float BezierTable::Evaluate(float value) const {
+  if (value <= 0.0f) {
+    return 0.0f;
+  }
+  if (value >= 1.0f) {
+    return 1.0f;
+  }
+  // x[i] <= value < x[i + 1] となる区間で t を線形補間し, ニュートン法で 1 回詰める (区間からは出さない)
+  const int i = static_cast<int>(std::upper_bound(x + 1, x + kSegments, value) - x) - 1;
+  const float width = x[i + 1] - x[i];
+  const float t0 = static_cast<float>(i) / kSegments;
+  const float t1 = static_cast<float>(i + 1) / kSegments;
+  float t = t0 + (width > 0.0f ? (value - x[i]) / width : 0.0f) * (t1 - t0);
+  float s = 1.0f - t;
+  const float ft = 3.0f * s * s * t * curve.x1 + 3.0f * s * t * t * curve.x2 + t * t * t - value;
+  const float dt = 3.0f * s * s * curve.x1 + 6.0f * s * t * (curve.x2 - curve.x1) + 3.0f * t * t * (1.0f - curve.x2);
+  if (dt > 1e-6f) {
+    t = std::min(std::max(t - ft / dt, t0), t1);
+    s = 1.0f - t;
+  }
+  return 3.0f * s * s * t * curve.y1 + 3.0f * s * t * t * curve.y2 + t * t * t;
+}
+
+////////////////
+// MotionClip //
+////////////////
+
+namespace {
+
+/**
+ * @brief VMD の補間パラメータ (0 - 127) からカーブを作る
+ * @param index 0: X 移動, 1: Y 移動, 2: Z 移動, 3: 回転
+ */
+BezierCurve MakeCurve(const uint8_t* interpolation, int index) {
+  BezierCurve curve;
+  curve.x1 = interpolation[index] / 127.0f;
+  curve.y1 = interpolation[index + 4] / 127.0f;
+  curve.x2 = interpolation[index + 8] / 127.0f;
+  curve.y2 = interpolation[index + 12] / 127.0f;
+  return curve;
+}
+
+float EvaluateCurve(const BezierTable* tables, uint32_t curve, float t) {
+  return curve == BoneKeyframe::kLinearCurve ? t : tables[curve].Evaluate(t);
+}
+
+/**
+ * @brief cursor と cursor + 1 のキーの間を補間する (cursor が最後のキーならその値)
+ */
+BonePose Interpolate(PmdSpan<BoneKeyframe> keys, const BezierTable* tables, std::size_t cursor, float frame) {
+  BonePose pose;
+  if (keys.empty()) {
+    return pose;
+  }
+  const BoneKeyframe& k0 = keys[cursor];
+  if (cursor + 1 >= keys.size() || frame <= k0.frame) {
+    pose.rotation = k0.rotation;
+    pose.translation = k0.translation;
+    return pose;
+  }
+  const BoneKeyframe& k1 = keys[cursor + 1];
+  const float t = std::min((frame - k0.frame) / static_cast<float>(k1.frame - k0.frame), 1.0f);
+  pose.rotation = Slerp(k0.rotation, k1.rotation, EvaluateCurve(tables, k1.curves[3], t));
+  // 回転しかしないボーンが大半なので, 移動量が変わらない軸はカーブを評価しない
+  auto lerp = [tables, t](float a, float b, uint32_t curve) {
+    return a == b ? a : a + (b - a) * EvaluateCurve(tables, curve, t);
+  };
+  pose.translation.x = lerp(k0.translation.x, k1.translation.x, k1.curves[0]);
+  pose.translation.y = lerp(k0.translation.y, k1.translation.y, k1.curves[1]);
+  pose.translation.z = lerp(k0.translation.z, k1.translation.z, k1.curves[2]);
+  return pose;
+}
+
+/**
+ * @brief frame 以下で最後のキーの位置 (全て frame より後なら 0)
+ */
+uint32_t FindKey(PmdSpan<BoneKeyframe> keys, float frame) {
+  auto it = std::upper_bound(keys.begin(), keys.end(), frame,
+                             [](float f, const BoneKeyframe& key) { return f < static_cast<float>(key.frame); });
+  return it == keys.begin() ? 0 : static_cast<uint32_t>(it - keys.begin() - 1);
+}
+
+}  // namespace
+
+void MotionClip::Build(const VmdFile& vmd, const Skeleton& skeleton) {
+  keys_.clear();
+  tracks_.assign(skeleton.BoneCount(), TrackRange());
+  curve_tables_.clear();
+  frame_count_ = 0;
+
+  // VMD のボーン名は 15 bytes で切られているので, PMD の名前も同じ長さで切って引く.
+  // 先頭 15 bytes が同じボーンが複数あれば前のものに対応付ける
+  std::unordered_map<std::string, int> bone_indices;
+  for (std::size_t i = 0; i < skeleton.BoneCount(); ++i) {
+    bone_indices.emplace(skeleton.Name(i).substr(0, sizeof(VmdMotion::bone_name)), static_cast<int>(i));
+  }
+  // 制御点 (4 bytes) -> curve_tables_ の番号
+  std::unordered_map<uint32_t, uint32_t> curve_indices;
+  auto curve_index = [&](const uint8_t* interpolation, int index) {
+    const BezierCurve curve = MakeCurve(interpolation, index);
+    if (curve.IsLinear()) {
+      return BoneKeyframe::kLinearCurve;
+    }
+    const uint32_t key = uint32_t(interpolation[index]) | uint32_t(interpolation[index + 4]) << 8 |
+                         uint32_t(interpolation[index + 8]) << 16 | uint32_t(interpolation[index + 12]) << 24;
+    auto [it, inserted] = curve_indices.emplace(key, static_cast<uint32_t>(curve_tables_.size()));
+    if (inserted) {
+      curve_tables_.emplace_back(curve);
+    }
+    return it->second;
+  };
+
+  // ボーンごとに数えてから詰める (キーは 1 本の配列にまとめる)
+  auto motions = vmd.Motions();
+  std::vector<int> motion_bones(motions.size(), -1);
+  for (std::size_t i = 0; i < motions.size(); ++i) {
+    const VmdMotion& m = motions[i];
+    auto it = bone_indices.find(std::string(m.bone_name, strnlen(m.bone_name, sizeof(m.bone_name))));
+    if (it != bone_indices.end()) {
+      motion_bones[i] = it->second;
+      ++tracks_[it->second].count;
+    }
+  }
+  std::size_t begin = 0;
+  for (auto& track : tracks_) {
+    track.begin = begin;
+    begin += track.count;
+    track.count = 0;
+  }
+  keys_.resize(begin);
+  for (std::size_t i = 0; i < motions.size(); ++i) {
+    if (motion_bones[i] < 0) {
+      continue;
+    }
+    const VmdMotion& m = motions[i];
+    auto& track = tracks_[motion_bones[i]];
+    BoneKeyframe& key = keys_[track.begin + track.count++];
+    key.frame = m.frame_no;
+    key.rotation = Normalize(Quaternion{m.quaternion[0], m.quaternion[1], m.quaternion[2], m.quaternion[3]});
+    key.translation = {m.location.x, m.location.y, m.location.z};
+    for (int axis = 0; axis < 4; ++axis) {
+      key.curves[axis] = curve_index(m.interpolation, axis);
+    }
+    frame_count_ = std::max(frame_count_, key.frame);
+  }
+  for (auto& track : tracks_) {
+    std::stable_sort(keys_.begin() + track.begin, keys_.begin() + track.begin + track.count,
+                     [](const BoneKeyframe& a, const BoneKeyframe& b) { return a.frame < b.frame; });
+  }
+}
+
+BonePose MotionClip::SampleBone(std::size_t bone, float frame) const {
+  auto keys = Track(bone);
+  return Interpolate(keys, curve_tables_.data(), FindKey(keys, frame), frame);
+}
+
+void MotionClip::Sample(float frame, std::vector<BonePose>* pose) const {
+  pose->resize(BoneCount());
+  for (std::size_t bone = 0; bone < BoneCount(); ++bone) {
+    (*pose)[bone] = SampleBone(bone, frame);
+  }
+}
+
+//////////////////
+// MotionPlayer //
+//////////////////
+
+MotionPlayer::MotionPlayer(const MotionClip& clip) : clip_(clip), cursors_(clip.BoneCount(), 0) {}
+
+void MotionPlayer::Sample(float frame, std::vector<BonePose>* pose) {
+  pose->resize(clip_.BoneCount());
+  const bool rewound = frame < last_frame_;
+  last_frame_ = frame;
+  for (std::size_t bone = 0; bone < clip_.BoneCount(); ++bone) {
+    auto keys = clip_.Track(bone);
+    uint32_t& cursor = cursors_[bone];
+    if (rewound) {
+      cursor = FindKey(keys, frame);
+    } else {
+      while (cursor + 1 < keys.size() && static_cast<float>(keys[cursor + 1].frame) <= frame) {
+        ++cursor;
+      }
+    }
+    (*pose)[bone] = Interpolate(keys, clip_.CurveTables().data(), cursor, frame);
+  }
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "cpu_math.h"
+#include "mapped_file.h"
+#include "pmd_file.h"
+#include "skinning.h"
+
+////////////////////////////
+// VMD on-disk structures //
+////////////////////////////
+
+#pragma pack(push, 1)
+/**
+ * @brief VMD ヘッダー
+ * @details "Vocaloid Motion Data file" (旧形式) ではモデル名が 10 bytes になる.
+ */
+struct VmdHeader {
+  char signature[30];   // "Vocaloid Motion Data 0002"
+  char model_name[20];  // モデル名
+};
+
+/**
+ * @brief ボーンのキーフレーム
+ *
+ */
+struct VmdMotion {
+  char bone_name[15];         // ボーン名
+  uint32_t frame_no;          // フレーム番号
+  PmdFloat3 location;         // 基準点からの移動量
+  float quaternion[4];        // 回転 (x, y, z, w)
+  uint8_t interpolation[64];  // 補間パラメータ (ベジェ曲線の制御点. 0 - 127)
+};
+
+/**
+ * @brief 表情のキーフレーム
+ *
+ */
+struct VmdMorph {
+  char name[15];      // 表情名
+  uint32_t frame_no;  // フレーム番号
+  float weight;       // 0.0 - 1.0
+};
+#pragma pack(pop)
+
+static_assert(sizeof(VmdMotion) == 111, "VMD motion must be 111 bytes");
+static_assert(sizeof(VmdMorph) == 23, "VMD morph must be 23 bytes");
+
+/**
+ * @brief VMD ファイルのゼロコピーリーダー
+ * @details PmdFile と同じく, 返したビューは VmdFile が生きている間だけ有効.
+ */
+class VmdFile {
+ public:
+  VmdFile() = default;
+  VmdFile(const VmdFile&) = delete;
+  VmdFile& operator=(const VmdFile&) = delete;
+  VmdFile(VmdFile&&) noexcept = default;
+  VmdFile& operator=(VmdFile&&) noexcept = default;
+
+  /**
+   * @brief ファイルをマップしてパースする
+   * @return 失敗したら false. 理由は Error() で取得できる
+   */
+  bool Open(const std::filesystem::path& path);
+
+  /**
+   * @brief メモリ上の VMD データをパースする (データは呼び出し側が保持し続けること)
+   */
+  bool Parse(const void* data, std::size_t size);
+
+  // ファイル上の順序のまま (フレーム順とは限らない)
+  PmdSpan<VmdMotion> Motions() const { return motions_; }
+  PmdSpan<VmdMorph> Morphs() const { return morphs_; }
+
+  const std::string& Error() const { return error_; }
+
+ private:
+  MappedFile file_;
+  PmdSpan<VmdMotion> motions_;
+  PmdSpan<VmdMorph> morphs_;
+  std::string error_;
+};
+
+/**
+ * @brief 3 次ベジェ曲線 (始点 (0, 0), 終点 (1, 1)) による補間カーブ
+ */
+struct BezierCurve {
+  float x1 = 0.25f;
+  float y1 = 0.25f;
+  float x2 = 0.75f;
+  float y2 = 0.75f;
+
+  bool IsLinear() const { return x1 == y1 && x2 == y2; }
+
+  /**
+   * @brief x (時間の割合) から y (補間の割合) を求める (ニュートン法で x(t) = x を解く)
+   */
+  float Evaluate(float x) const;
+};
+
+/**
+ * @brief BezierCurve の x(t) を t の等間隔で表にしたもの
+ * @details x の二分探索と線形補間で t の初期値を求め, ニュートン法を 1 回だけ行う.
+ *          サンプリングのたびに BezierCurve::Evaluate() の反復を解かずに済む. 誤差は y で 2e-4 程度.
+ */
+struct BezierTable {
+  static constexpr int kSegments = 32;
+
+  BezierTable() = default;
+  explicit BezierTable(const BezierCurve& curve);
+
+  float Evaluate(float x) const;
+
+  BezierCurve curve;  // 元の曲線
+  float x[kSegments + 1] = {};
+};
+
+/**
+ * @brief ボーン 1 本のキーフレーム (補間パラメータは 1 つ前のキーからこのキーまでの区間に使う)
+ */
+struct BoneKeyframe {
+  static constexpr uint32_t kLinearCurve = 0xffffffff;
+
+  uint32_t frame = 0;
+  Quaternion rotation;
+  Float3 translation;
+  // MotionClip::CurveTables() の番号 (X 移動, Y 移動, Z 移動, 回転). kLinearCurve なら直線で補間する
+  uint32_t curves[4] = {kLinearCurve, kLinearCurve, kLinearCurve, kLinearCurve};
+};
+
+/**
+ * @brief スケルトンに対応付けたモーション
+ * @details キーフレームはボーンごとにフレーム順に並べ, 1 本の配列にまとめて持つ.
+ *          スケルトンに無いボーンのキーは捨てる. VMD のボーン名は 15 bytes で切られているので,
+ *          PMD のボーン名も先頭 15 bytes で対応付ける.
+ *          補間カーブは同じ制御点のものを 1 つの BezierTable にまとめる (実際のモーションでは種類は少ない).
+ */
+class MotionClip {
+ public:
+  /**
+   * @brief VMD のキーフレームをボーンごとに振り分けて並べ替える
+   */
+  void Build(const VmdFile& vmd, const Skeleton& skeleton);
+
+  std::size_t BoneCount() const { return tracks_.size(); }
+  // 最後のキーフレームの番号
+  uint32_t FrameCount() const { return frame_count_; }
+
+  PmdSpan<BoneKeyframe> Track(std::size_t bone) const {
+    return PmdSpan<BoneKeyframe>(keys_.data() + tracks_[bone].begin, tracks_[bone].count);
+  }
+  const std::vector<BezierTable>& CurveTables() const { return curve_tables_; }
+
+  /**
+   * @brief 1 本のボーンの姿勢を二分探索で求める (状態を持たない)
+   */
+  BonePose SampleBone(std::size_t bone, float frame) const;
+
+  /**
+   * @brief 全ボーンの姿勢を二分探索で求める
+   */
+  void Sample(float frame, std::vector<BonePose>* pose) const;
+
+ private:
+  struct TrackRange {
+    std::size_t begin = 0;
+    std::size_t count = 0;
+  };
+
+  std::vector<BoneKeyframe> keys_;
+  std::vector<TrackRange> tracks_;
+  std::vector<BezierTable> curve_tables_;
+  uint32_t frame_count_ = 0;
+};
+
+/**
+ * @brief キャラクター 1 体分の再生状態
+ * @details ボーンごとに前回使ったキーの位置を覚えておき, 時間が進んだときは前方へ数個進めるだけで済ませる.
+ *          連続再生なら 1 ボーンあたり償却 O(1). 巻き戻しやループで戻ったときだけ二分探索する.
+ */
+class MotionPlayer {
+ public:
+  explicit MotionPlayer(const MotionClip& clip);
+
+  /**
+   * @brief 指定フレームの姿勢を求める
+   * @param frame フレーム番号 (小数可, 30 fps)
+   * @param pose ボーンごとの姿勢. clip のボーン数に合わせて確保し直す
+   */
+  void Sample(float frame, std::vector<BonePose>* pose);
+
+ private:
+  const MotionClip& clip_;
+  std::vector<uint32_t> cursors_;  // ボーンごと. Track() 内で frame 以下の最後のキー
+  float last_frame_ = -1.0f;
+};